@@ -0,0 +1,169 @@
+#include "ActorFuture.h"
+#include "Factory.h"
+
+ActorState::ActorState() : refs(1), done(false), result(0), continuation(NULL), continuation_arg(NULL), group(NULL){
+    INIT_MUTEX_LOCK(lock);
+    pthread_cond_init(&done_condition, NULL);
+}
+
+ActorState::~ActorState(){
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&done_condition);
+}
+
+void ActorState::ref(){
+    refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ActorState::unref(){
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete this;
+    }
+}
+
+void ActorState::complete(int result){
+    pthread_mutex_lock(&lock);
+    this->result = result;
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&done_condition);
+    //nobody changes them once the actor is done
+    ActorContinuation done_continuation = continuation;
+    void* done_continuation_arg = continuation_arg;
+    ActorGroup* done_group = group;
+    pthread_mutex_unlock(&lock);
+
+    if(done_continuation != NULL){
+        done_continuation(result, done_continuation_arg);
+    }
+    if(done_group != NULL){
+        done_group->actorDone(this);
+    }
+}
+
+ActorFuture::ActorFuture(ActorState* state) : state(state){
+    state->ref();
+}
+
+ActorFuture::ActorFuture(const ActorFuture& other) : state(other.state){
+    if(state != NULL){
+        state->ref();
+    }
+}
+
+ActorFuture& ActorFuture::operator=(const ActorFuture& other){
+    //take the new reference first, in case both share the state
+    if(other.state != NULL){
+        other.state->ref();
+    }
+    if(state != NULL){
+        state->unref();
+    }
+    state = other.state;
+    return *this;
+}
+
+ActorFuture::~ActorFuture(){
+    if(state != NULL){
+        state->unref();
+    }
+}
+
+bool ActorFuture::poll() const{
+    return __atomic_load_n(&state->done, __ATOMIC_ACQUIRE);
+}
+
+int ActorFuture::wait() const{
+    //the result never changes once it is published
+    if(poll()){
+        return state->result;
+    }
+
+    pthread_mutex_lock(&state->lock);
+    while(!state->done){
+        pthread_cond_wait(&state->done_condition, &state->lock);
+    }
+    int result = state->result;
+    pthread_mutex_unlock(&state->lock);
+    return result;
+}
+
+void ActorFuture::then(ActorContinuation continuation, void* arg) const{
+    pthread_mutex_lock(&state->lock);
+    bool done = state->done;
+    if(!done){
+        state->continuation = continuation;
+        state->continuation_arg = arg;
+    }
+    pthread_mutex_unlock(&state->lock);
+
+    if(done){
+        continuation(state->result, arg);
+    }
+}
+
+ActorGroup::ActorGroup() : num_pending(0){
+    INIT_MUTEX_LOCK(lock);
+    pthread_cond_init(&condition, NULL);
+}
+
+ActorGroup::~ActorGroup(){
+    //the actors tell the group when they finish, so it must outlive them
+    waitAll();
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&condition);
+}
+
+void ActorGroup::add(const ActorFuture& future){
+    ActorState* state = future.state;
+
+    //the state's lock is taken before the group's, the same order as an actor that finishes
+    pthread_mutex_lock(&state->lock);
+    pthread_mutex_lock(&lock);
+    if(state->done){
+        finished.push_back(future);
+        pthread_cond_broadcast(&condition);
+    } else{
+        state->group = this;
+        ++num_pending;
+    }
+    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&state->lock);
+}
+
+void ActorGroup::actorDone(ActorState* state){
+    pthread_mutex_lock(&lock);
+    finished.push_back(ActorFuture(state));
+    --num_pending;
+    //both waitAll and waitAny may be waiting
+    pthread_cond_broadcast(&condition);
+    pthread_mutex_unlock(&lock);
+}
+
+size_t ActorGroup::numPending(){
+    pthread_mutex_lock(&lock);
+    size_t pending = num_pending;
+    pthread_mutex_unlock(&lock);
+    return pending;
+}
+
+void ActorGroup::waitAll(){
+    pthread_mutex_lock(&lock);
+    while(num_pending > 0){
+        pthread_cond_wait(&condition, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+ActorFuture ActorGroup::waitAny(){
+    pthread_mutex_lock(&lock);
+    while(finished.empty() && num_pending > 0){
+        pthread_cond_wait(&condition, &lock);
+    }
+    ActorFuture future;
+    if(!finished.empty()){
+        future = finished.front();
+        finished.pop_front();
+    }
+    pthread_mutex_unlock(&lock);
+    return future;
+}
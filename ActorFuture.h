@@ -0,0 +1,128 @@
+#ifndef ACTOR_FUTURE_H_
+#define ACTOR_FUTURE_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include "ObjectPool.h"
+
+class ActorGroup;
+
+//called with the result of an actor once it finished
+typedef void (*ActorContinuation)(int result, void* arg);
+
+//the state an actor shares with its futures, freed with the last reference (to a pool, there is one per actor)
+class ActorState : public PooledObject<ActorState>{
+    friend class ActorFuture;
+    friend class ActorGroup;
+
+    std::atomic<int> refs;
+
+    pthread_mutex_t lock;
+    //waiters of the actor wait on it
+    pthread_cond_t done_condition;
+
+    //true when the actor finished - under lock, written with __atomic_store_n so poll can read it without the lock
+    bool done;
+    //the actor's result, written once before done
+    int result;
+
+    //runs when the actor finishes, NULL if there is none - under lock
+    ActorContinuation continuation;
+    void* continuation_arg;
+
+    //the group the actor belongs to, NULL if there is none - under lock
+    ActorGroup* group;
+
+    //copying is not allowed
+    ActorState(const ActorState&);
+    ActorState& operator=(const ActorState&);
+
+public:
+    //a new state has one reference, the actor's
+    ActorState();
+    ~ActorState();
+
+    void ref();
+    void unref();
+
+    //publishes result, wakes the waiters, then runs the continuation and tells the group.
+    //called once, by the actor
+    void complete(int result);
+};
+
+/**
+ * A handle to the result of an actor (a producer, buyer, company or thief the factory started).
+ * Copies share the same result, which is stored inline in the shared state and freed with the last handle.
+ * A default constructed future is not valid and must not be used.
+ */
+class ActorFuture{
+    friend class ActorGroup;
+    friend class ActorSlotMap;
+
+    ActorState* state;
+
+public:
+    ActorFuture() : state(NULL){}
+    //a new reference to state
+    explicit ActorFuture(ActorState* state);
+    ActorFuture(const ActorFuture& other);
+    ActorFuture& operator=(const ActorFuture& other);
+    ~ActorFuture();
+
+    bool valid() const{
+        return state != NULL;
+    }
+
+    //true when the actor finished, never blocks
+    bool poll() const;
+    //waits until the actor finishes and returns its result
+    int wait() const;
+    /*runs continuation(result, arg) once the actor finishes, on the actor's thread. if it already finished
+    the continuation runs now, on the calling thread. a future gets at most one continuation*/
+    void then(ActorContinuation continuation, void* arg) const;
+};
+
+/**
+ * Waits for many actors at once: every actor tells its group when it finishes, so a controller
+ * sleeps on one condition var no matter how many actors it waits for, and is woken once per
+ * finished actor at most.
+ * The group must live until all of its actors finished (the destructor waits for them).
+ */
+class ActorGroup{
+    friend class ActorState;
+
+    pthread_mutex_t lock;
+    //waitAll and waitAny wait on it
+    pthread_cond_t condition;
+
+    //number of actors added that did not finish yet - under lock
+    size_t num_pending;
+    //actors that finished and were not returned by waitAny yet, in the order they finished - under lock
+    std::deque<ActorFuture> finished;
+
+    //called by an actor of the group after it finished
+    void actorDone(ActorState* state);
+
+    //copying is not allowed
+    ActorGroup(const ActorGroup&);
+    ActorGroup& operator=(const ActorGroup&);
+
+public:
+    ActorGroup();
+    ~ActorGroup();
+
+    //adds the actor of future to the group, an actor belongs to at most one group
+    void add(const ActorFuture& future);
+
+    //the number of actors that did not finish yet
+    size_t numPending();
+
+    //waits until every actor of the group finished
+    void waitAll();
+    /*waits until an actor that waitAny did not return yet finishes and returns it (the actors are returned
+    in the order they finished). returns an invalid future if every actor of the group was returned already*/
+    ActorFuture waitAny();
+};
+
+#endif // ACTOR_FUTURE_H_
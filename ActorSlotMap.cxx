@@ -0,0 +1,119 @@
+#include "ActorSlotMap.h"
+
+ActorSlotMap::Leaf::Leaf(){
+    for(auto& slot : slots){
+        slot.store(0, std::memory_order_relaxed);
+    }
+}
+
+ActorSlotMap::Middle::Middle(){
+    for(auto& leaf : leaves){
+        leaf.store(NULL, std::memory_order_relaxed);
+    }
+}
+
+ActorSlotMap::ActorSlotMap() : top(new std::atomic<Middle*>[1 << ACTOR_SLOT_TOP_BITS]){
+    for(int i=0; i<(1 << ACTOR_SLOT_TOP_BITS); i++){
+        top[i].store(NULL, std::memory_order_relaxed);
+    }
+}
+
+ActorSlotMap::~ActorSlotMap(){
+    for(int i=0; i<(1 << ACTOR_SLOT_TOP_BITS); i++){
+        Middle* middle = top[i].load(std::memory_order_relaxed);
+        if(middle == NULL){
+            continue;
+        }
+        for(auto& leaf_pointer : middle->leaves){
+            Leaf* leaf = leaf_pointer.load(std::memory_order_relaxed);
+            if(leaf == NULL){
+                continue;
+            }
+            for(auto& slot : leaf->slots){
+                ActorState* state = stateOf(slot.load(std::memory_order_relaxed));
+                if(state != NULL){
+                    state->unref();
+                }
+            }
+            delete leaf;
+        }
+        delete middle;
+    }
+    delete[] top;
+}
+
+ActorSlotMap::Slot& ActorSlotMap::slotForWrite(unsigned int id){
+    std::atomic<Middle*>& middle_pointer = top[id >> (ACTOR_SLOT_LEAF_BITS + ACTOR_SLOT_MIDDLE_BITS)];
+    Middle* middle = middle_pointer.load(std::memory_order_acquire);
+    if(middle == NULL){
+        //the first id in the range, whoever installs its table first wins
+        Middle* new_middle = new Middle();
+        if(middle_pointer.compare_exchange_strong(middle, new_middle, std::memory_order_acq_rel)){
+            middle = new_middle;
+        } else{
+            delete new_middle;
+        }
+    }
+
+    std::atomic<Leaf*>& leaf_pointer = middle->leaves[(id >> ACTOR_SLOT_LEAF_BITS) & ((1 << ACTOR_SLOT_MIDDLE_BITS) - 1)];
+    Leaf* leaf = leaf_pointer.load(std::memory_order_acquire);
+    if(leaf == NULL){
+        Leaf* new_leaf = new Leaf();
+        if(leaf_pointer.compare_exchange_strong(leaf, new_leaf, std::memory_order_acq_rel)){
+            leaf = new_leaf;
+        } else{
+            delete new_leaf;
+        }
+    }
+
+    return leaf->slots[id & ((1 << ACTOR_SLOT_LEAF_BITS) - 1)];
+}
+
+ActorSlotMap::Slot* ActorSlotMap::slotForRead(unsigned int id) const{
+    Middle* middle = top[id >> (ACTOR_SLOT_LEAF_BITS + ACTOR_SLOT_MIDDLE_BITS)].load(std::memory_order_acquire);
+    if(middle == NULL){
+        return NULL;
+    }
+    Leaf* leaf = middle->leaves[(id >> ACTOR_SLOT_LEAF_BITS) & ((1 << ACTOR_SLOT_MIDDLE_BITS) - 1)].load(std::memory_order_acquire);
+    if(leaf == NULL){
+        return NULL;
+    }
+    return &leaf->slots[id & ((1 << ACTOR_SLOT_LEAF_BITS) - 1)];
+}
+
+void ActorSlotMap::put(unsigned int id, const ActorFuture& future){
+    Slot& slot = slotForWrite(id);
+
+    //the slot gets a reference of its own
+    ActorState* state = future.state;
+    state->ref();
+
+    uint64_t word = slot.load(std::memory_order_acquire);
+    while(!slot.compare_exchange_weak(word, nextWord(word, state), std::memory_order_acq_rel)){
+    }
+
+    //an id that is started again before it was finished replaces the old actor
+    ActorState* replaced = stateOf(word);
+    if(replaced != NULL){
+        replaced->unref();
+    }
+}
+
+ActorFuture ActorSlotMap::take(unsigned int id){
+    Slot* slot = slotForRead(id);
+    if(slot == NULL){
+        return ActorFuture();
+    }
+
+    uint64_t word = slot->load(std::memory_order_acquire);
+    do{
+        if(stateOf(word) == NULL){
+            return ActorFuture();
+        }
+    } while(!slot->compare_exchange_weak(word, nextWord(word, NULL), std::memory_order_acq_rel));
+
+    //the slot's reference moves to the returned future
+    ActorFuture future(stateOf(word));
+    stateOf(word)->unref();
+    return future;
+}
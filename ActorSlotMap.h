@@ -0,0 +1,75 @@
+#ifndef ACTOR_SLOT_MAP_H_
+#define ACTOR_SLOT_MAP_H_
+
+#include <atomic>
+#include <cstdint>
+#include "ActorFuture.h"
+
+//bits of an actor id that index a leaf of an ActorSlotMap, and the bits that index a middle table
+#define ACTOR_SLOT_LEAF_BITS 10
+#define ACTOR_SLOT_MIDDLE_BITS 10
+//the rest of the 32 bits of an id index the top table
+#define ACTOR_SLOT_TOP_BITS (32 - ACTOR_SLOT_LEAF_BITS - ACTOR_SLOT_MIDDLE_BITS)
+
+/**
+ * The futures of the actors that were started with an id, by id. Safe to use from many threads at once,
+ * and neither put nor take takes a lock or waits for another thread.
+ *
+ * The id itself is the index of its slot in a three level table (like a page table), so there is no
+ * hashing and no rehashing: the tables of a range of ids are allocated (with a CAS) the first time an id
+ * in the range is used, and live as long as the map.
+ *
+ * Every slot is a single word with the slot's actor and a generation. The generation grows with every
+ * put and take, so a CAS that is based on an old value of the slot fails even if the same ActorState
+ * address was allocated again for a new actor with the same id (ids are reused all the time).
+ */
+class ActorSlotMap{
+    //the generation is kept in the bits above the pointer (user space addresses fit in 48 bits)
+    static const int GENERATION_SHIFT = 48;
+    static const uint64_t STATE_MASK = (uint64_t(1) << GENERATION_SHIFT) - 1;
+
+    typedef std::atomic<uint64_t> Slot;
+
+    struct Leaf{
+        Slot slots[1 << ACTOR_SLOT_LEAF_BITS];
+
+        Leaf();
+    };
+
+    struct Middle{
+        std::atomic<Leaf*> leaves[1 << ACTOR_SLOT_MIDDLE_BITS];
+
+        Middle();
+    };
+
+    std::atomic<Middle*>* top;
+
+    static ActorState* stateOf(uint64_t word){
+        return reinterpret_cast<ActorState*>(static_cast<uintptr_t>(word & STATE_MASK));
+    }
+    //the word that follows word in a slot, with state as its actor
+    static uint64_t nextWord(uint64_t word, ActorState* state){
+        return (((word >> GENERATION_SHIFT) + 1) << GENERATION_SHIFT) | reinterpret_cast<uintptr_t>(state);
+    }
+
+    //the slot of id, allocates its tables if needed
+    Slot& slotForWrite(unsigned int id);
+    //the slot of id, or NULL if no id in its range was ever put
+    Slot* slotForRead(unsigned int id) const;
+
+    //copying is not allowed
+    ActorSlotMap(const ActorSlotMap&);
+    ActorSlotMap& operator=(const ActorSlotMap&);
+
+public:
+    ActorSlotMap();
+    //drops the futures that were never taken
+    ~ActorSlotMap();
+
+    //saves future under id. if another actor is saved under id it is replaced (and its future dropped)
+    void put(unsigned int id, const ActorFuture& future);
+    //removes the future saved under id and returns it, or returns an invalid future if there is none
+    ActorFuture take(unsigned int id);
+};
+
+#endif // ACTOR_SLOT_MAP_H_
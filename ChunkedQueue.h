@@ -0,0 +1,605 @@
+#ifndef CHUNKED_QUEUE_H_
+#define CHUNKED_QUEUE_H_
+
+#include <cstddef>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <sched.h>
+#include "ObjectPool.h"
+
+//number of items stored in a single chunk of a ChunkedQueue
+#define CHUNK_CAPACITY 256
+
+//number of empty chunks a queue keeps around for reuse instead of freeing them
+#define MAX_SPARE_CHUNKS 4
+
+//number of times lockExclusive spins on the concurrent poppers before yielding the cpu
+#define EXCLUSIVE_SPINS 64
+
+/**
+ * A FIFO queue stored as a singly linked list of fixed size chunks (a segmented deque).
+ * Items are consumed from the front of the head chunk and appended to the back of the tail chunk,
+ * and drained chunks are kept as spares for the tail, so in steady state the chunks form a ring
+ * and no memory is allocated per item.
+ * Moving items between queues is done by relinking whole chunks, so only the chunk on the boundary
+ * of a take is ever copied.
+ *
+ * The queue is not thread safe, the owner is responsible for locking, with one exception:
+ * after setConcurrentPop(true), tryPopFrontConcurrent() may be called by any number of threads
+ * without the owner's lock. Such a pop is a single CAS on the begin index of the head chunk.
+ * Every other operation that moves the front of the queue (or reads it) first closes the queue
+ * to concurrent poppers and waits for the ones already inside to leave, so the owner always sees
+ * a queue that only it can change. Appending does not need to close the queue.
+ *
+ * A Snapshot shares the chunks of the queue instead of copying them. Items before the end of a chunk
+ * never change, and a chunk that a snapshot still references is never reused, so the snapshot stays
+ * a valid point in time view while the queue keeps changing.
+ */
+template <typename T>
+class ChunkedQueue{
+public:
+    //chunks come from a pool, a queue that is filled and drained (a company's purchase) takes one every time
+    struct Chunk : public PooledObject<Chunk>{
+        T items[CHUNK_CAPACITY];
+        //index of the first item still in the chunk, concurrent poppers advance it with a CAS
+        std::atomic<int> begin;
+        //index one past the last item in the chunk, items before it are never changed
+        std::atomic<int> end;
+        Chunk* next;
+        //number of owners: the queue that holds the chunk and every snapshot that shares it
+        std::atomic<int> refs;
+
+        Chunk() : begin(0), end(0), next(NULL), refs(1){}
+
+        int size() const{
+            return end.load(std::memory_order_acquire) - begin.load(std::memory_order_acquire);
+        }
+    };
+
+private:
+    //oldest chunk, items are taken from its begin
+    std::atomic<Chunk*> head;
+    //newest chunk, items are added at its end
+    Chunk* tail;
+    //total number of items in the queue
+    std::atomic<size_t> count;
+
+    //stack of empty chunks kept for reuse
+    Chunk* spare_chunks;
+    int spare_count;
+
+    //true when tryPopFrontConcurrent may be called without the owner's lock
+    bool concurrent_pop;
+    //true while the owner changes the front of the queue, concurrent poppers back off
+    mutable std::atomic<bool> exclusive;
+    //number of threads inside tryPopFrontConcurrent
+    mutable std::atomic<int> concurrent_poppers;
+
+    //closes the queue to concurrent poppers for the lifetime of the guard
+    class ExclusiveGuard{
+        const ChunkedQueue& queue;
+    public:
+        explicit ExclusiveGuard(const ChunkedQueue& queue) : queue(queue){
+            queue.lockExclusive();
+        }
+        ~ExclusiveGuard(){
+            queue.unlockExclusive();
+        }
+    };
+
+    void lockExclusive() const{
+        if(!concurrent_pop){
+            return;
+        }
+        exclusive.store(true, std::memory_order_seq_cst);
+        //a popper that got in before the flag was set may still be about to CAS, wait for it
+        int spins = 0;
+        while(concurrent_poppers.load(std::memory_order_seq_cst) != 0){
+            if(++spins == EXCLUSIVE_SPINS){
+                spins = 0;
+                sched_yield();
+            }
+        }
+    }
+
+    void unlockExclusive() const{
+        if(concurrent_pop){
+            exclusive.store(false, std::memory_order_release);
+        }
+    }
+
+    //returns an empty chunk, reusing a spare one if there is any
+    Chunk* newChunk(){
+        if(spare_chunks == NULL){
+            return new Chunk();
+        }
+        Chunk* chunk = spare_chunks;
+        spare_chunks = chunk->next;
+        --spare_count;
+        chunk->begin.store(0, std::memory_order_relaxed);
+        chunk->end.store(0, std::memory_order_relaxed);
+        chunk->next = NULL;
+        return chunk;
+    }
+
+    //drops one owner of the chunk, the last owner frees it
+    static void unrefChunk(Chunk* chunk){
+        if(chunk->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+            delete chunk;
+        }
+    }
+
+    //gives back a chunk that is no longer linked to the queue
+    void releaseChunk(Chunk* chunk){
+        //a chunk that is still shared by a snapshot is freed by the snapshot instead of reused
+        if(chunk->refs.fetch_sub(1, std::memory_order_acq_rel) != 1){
+            return;
+        }
+        chunk->refs.store(1, std::memory_order_relaxed);
+        if(spare_count >= MAX_SPARE_CHUNKS){
+            delete chunk;
+            return;
+        }
+        chunk->next = spare_chunks;
+        spare_chunks = chunk;
+        ++spare_count;
+    }
+
+    //links a chunk (or a chain of chunks ending at last) to the back of the queue
+    void linkBack(Chunk* first, Chunk* last, size_t num_items){
+        last->next = NULL;
+        count.fetch_add(num_items, std::memory_order_relaxed);
+        if(tail == NULL){
+            //publishes the items of the chain to concurrent poppers
+            head.store(first, std::memory_order_release);
+        } else{
+            tail->next = first;
+        }
+        tail = last;
+    }
+
+    //removes the head chunk from the queue and returns it, the items in it are still counted
+    //the queue must be exclusive
+    Chunk* unlinkHead(){
+        Chunk* chunk = head.load(std::memory_order_relaxed);
+        head.store(chunk->next, std::memory_order_relaxed);
+        if(chunk->next == NULL){
+            tail = NULL;
+        }
+        chunk->next = NULL;
+        return chunk;
+    }
+
+    //releases head chunks that concurrent poppers drained, the queue must be exclusive
+    void dropDrainedHead(){
+        Chunk* chunk = head.load(std::memory_order_relaxed);
+        while(chunk != NULL && chunk->size() == 0 &&
+              (chunk->next != NULL || chunk->end.load(std::memory_order_relaxed) == CHUNK_CAPACITY)){
+            releaseChunk(unlinkHead());
+            chunk = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    //returns the tail chunk if it has room, otherwise links a new chunk and returns it
+    Chunk* writableTail(){
+        if(tail == NULL || tail->end.load(std::memory_order_relaxed) == CHUNK_CAPACITY){
+            Chunk* chunk = newChunk();
+            linkBack(chunk, chunk, 0);
+        }
+        return tail;
+    }
+
+    //moves up to num_items of the oldest items to out, the queue must be exclusive
+    size_t takeFrontExclusive(size_t num_items, ChunkedQueue& out){
+        dropDrainedHead();
+        num_items = std::min(num_items, count.load(std::memory_order_relaxed));
+        size_t taken = num_items;
+        while(num_items > 0){
+            Chunk* chunk = head.load(std::memory_order_relaxed);
+            size_t in_head = static_cast<size_t>(chunk->size());
+            if(in_head == 0){
+                //a chunk drained by concurrent poppers
+                releaseChunk(unlinkHead());
+            } else if(in_head <= num_items){
+                //take the entire chunk
+                count.fetch_sub(in_head, std::memory_order_relaxed);
+                num_items -= in_head;
+                unlinkHead();
+                out.linkBack(chunk, chunk, in_head);
+            } else{
+                //take only part of the chunk, copy it
+                int begin = chunk->begin.load(std::memory_order_relaxed);
+                out.pushBack(static_cast<int>(num_items), chunk->items + begin);
+                chunk->begin.store(begin + static_cast<int>(num_items), std::memory_order_relaxed);
+                count.fetch_sub(num_items, std::memory_order_relaxed);
+                num_items = 0;
+            }
+        }
+        return taken;
+    }
+
+    //moves all the items of other to the front of this queue in O(1), the queue must be exclusive
+    void spliceFrontExclusive(ChunkedQueue& other){
+        Chunk* first = other.head.load(std::memory_order_relaxed);
+        if(first == NULL){
+            return;
+        }
+        other.tail->next = head.load(std::memory_order_relaxed);
+        if(tail == NULL){
+            tail = other.tail;
+        }
+        count.fetch_add(other.count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        head.store(first, std::memory_order_release);
+        other.head = NULL;
+        other.tail = NULL;
+        other.count = 0;
+    }
+
+    void freeChunks(Chunk* chunk){
+        while(chunk != NULL){
+            Chunk* next = chunk->next;
+            unrefChunk(chunk);
+            chunk = next;
+        }
+    }
+
+    //copy is not allowed, ownership of chunks must be unique
+    ChunkedQueue(const ChunkedQueue&);
+    ChunkedQueue& operator=(const ChunkedQueue&);
+
+public:
+    /**
+     * A point in time view of the items of a queue that shares the queue's chunks instead of copying them.
+     * Taking it costs one reference per chunk, reading it does not touch the queue at all, so it may be
+     * read (and destroyed) without the owner's lock.
+     */
+    class Snapshot{
+        friend class ChunkedQueue;
+
+        struct Segment{
+            Chunk* chunk;
+            int begin;
+            int end;
+        };
+
+        std::vector<Segment> segments;
+        size_t count;
+
+        void release(){
+            for(auto& segment : segments){
+                unrefChunk(segment.chunk);
+            }
+            segments.clear();
+            count = 0;
+        }
+
+        //copying is not allowed, every segment holds a reference
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+
+    public:
+        //walks the items of a snapshot from oldest to newest
+        class Cursor{
+            const Snapshot* snapshot;
+            size_t segment;
+            int index;
+
+        public:
+            explicit Cursor(const Snapshot& snapshot) : snapshot(&snapshot), segment(0),
+                                                        index(snapshot.segments.empty() ? 0 :
+                                                              snapshot.segments[0].begin){}
+
+            bool done() const{
+                return segment == snapshot->segments.size();
+            }
+
+            const T& item() const{
+                return snapshot->segments[segment].chunk->items[index];
+            }
+
+            void next(){
+                if(++index == snapshot->segments[segment].end && ++segment < snapshot->segments.size()){
+                    index = snapshot->segments[segment].begin;
+                }
+            }
+        };
+
+        Snapshot() : count(0){}
+
+        Snapshot(Snapshot&& other) : segments(std::move(other.segments)), count(other.count){
+            other.segments.clear();
+            other.count = 0;
+        }
+
+        Snapshot& operator=(Snapshot&& other){
+            if(this != &other){
+                release();
+                segments = std::move(other.segments);
+                count = other.count;
+                other.segments.clear();
+                other.count = 0;
+            }
+            return *this;
+        }
+
+        ~Snapshot(){
+            release();
+        }
+
+        size_t size() const{
+            return count;
+        }
+
+        //calls func on every item from oldest to newest
+        template <typename Func>
+        void forEach(Func func) const{
+            for(auto& segment : segments){
+                for(int i = segment.begin; i < segment.end; ++i){
+                    func(segment.chunk->items[i]);
+                }
+            }
+        }
+
+        //calls func(items, num_items) on every run of items that are contiguous in memory, from oldest to newest
+        template <typename Func>
+        void forEachRange(Func func) const{
+            for(auto& segment : segments){
+                func(segment.chunk->items + segment.begin, static_cast<size_t>(segment.end - segment.begin));
+            }
+        }
+
+        //returns the items as a list, from oldest to newest
+        std::list<T> toList() const{
+            std::list<T> items_list;
+            forEach([&items_list](const T& item){ items_list.push_back(item); });
+            return items_list;
+        }
+    };
+
+    ChunkedQueue() : head(NULL), tail(NULL), count(0), spare_chunks(NULL), spare_count(0), concurrent_pop(false),
+                     exclusive(false), concurrent_poppers(0){}
+
+    //moving is only allowed for queues that are not used concurrently
+    ChunkedQueue(ChunkedQueue&& other) : head(other.head.load()), tail(other.tail), count(other.count.load()),
+                                         spare_chunks(other.spare_chunks), spare_count(other.spare_count),
+                                         concurrent_pop(false), exclusive(false), concurrent_poppers(0){
+        other.head = NULL;
+        other.tail = NULL;
+        other.count = 0;
+        other.spare_chunks = NULL;
+        other.spare_count = 0;
+    }
+
+    ChunkedQueue& operator=(ChunkedQueue&& other){
+        if(this != &other){
+            clear();
+            freeChunks(spare_chunks);
+            head = other.head.load();
+            tail = other.tail;
+            count = other.count.load();
+            spare_chunks = other.spare_chunks;
+            spare_count = other.spare_count;
+            other.head = NULL;
+            other.tail = NULL;
+            other.count = 0;
+            other.spare_chunks = NULL;
+            other.spare_count = 0;
+        }
+        return *this;
+    }
+
+    ~ChunkedQueue(){
+        freeChunks(head.load());
+        freeChunks(spare_chunks);
+    }
+
+    //allows tryPopFrontConcurrent, must be set before the queue is shared
+    void setConcurrentPop(bool enabled){
+        concurrent_pop = enabled;
+    }
+
+    //the number of items, while concurrent pops are running it may already be out of date
+    size_t size() const{
+        return count.load(std::memory_order_acquire);
+    }
+
+    bool empty() const{
+        return size() == 0;
+    }
+
+    //removes all items, the chunks are kept as spares when possible
+    void clear(){
+        ExclusiveGuard guard(*this);
+        while(head.load(std::memory_order_relaxed) != NULL){
+            releaseChunk(unlinkHead());
+        }
+        count = 0;
+    }
+
+    void pushBack(const T& item){
+        Chunk* chunk = writableTail();
+        int end = chunk->end.load(std::memory_order_relaxed);
+        chunk->items[end] = item;
+        //count before publishing, so concurrent poppers never make the count go below zero
+        count.fetch_add(1, std::memory_order_relaxed);
+        //publish the item to concurrent poppers
+        chunk->end.store(end + 1, std::memory_order_release);
+    }
+
+    //appends num_items items from an array, filling whole chunks at a time
+    void pushBack(int num_items, const T* items){
+        while(num_items > 0){
+            Chunk* chunk = writableTail();
+            int end = chunk->end.load(std::memory_order_relaxed);
+            int to_copy = std::min(num_items, CHUNK_CAPACITY - end);
+            std::copy(items, items + to_copy, chunk->items + end);
+            count.fetch_add(to_copy, std::memory_order_relaxed);
+            chunk->end.store(end + to_copy, std::memory_order_release);
+            items += to_copy;
+            num_items -= to_copy;
+        }
+    }
+
+    //removes the oldest item and writes it to item, returns false if the queue is empty
+    bool popFront(T& item){
+        ExclusiveGuard guard(*this);
+        dropDrainedHead();
+        if(count.load(std::memory_order_relaxed) == 0){
+            return false;
+        }
+        Chunk* chunk = head.load(std::memory_order_relaxed);
+        int begin = chunk->begin.load(std::memory_order_relaxed);
+        item = chunk->items[begin];
+        chunk->begin.store(begin + 1, std::memory_order_relaxed);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        if(begin + 1 == chunk->end.load(std::memory_order_relaxed)){
+            releaseChunk(unlinkHead());
+        }
+        return true;
+    }
+
+    /*removes the oldest item without the owner's lock (only after setConcurrentPop(true)).
+    returns false if the item could not be taken without the owner: the queue is empty, the owner
+    is changing the front of the queue, or the head chunk was drained and has to be unlinked.*/
+    bool tryPopFrontConcurrent(T& item){
+        bool popped = false;
+
+        //do not touch the counter at all while the owner waits for it to drop, so it can't starve
+        if(exclusive.load(std::memory_order_acquire)){
+            return false;
+        }
+
+        //announce this popper before looking at the flag again, lockExclusive does the opposite
+        concurrent_poppers.fetch_add(1, std::memory_order_seq_cst);
+        if(!exclusive.load(std::memory_order_seq_cst)){
+            Chunk* chunk = head.load(std::memory_order_acquire);
+            if(chunk != NULL){
+                int begin = chunk->begin.load(std::memory_order_acquire);
+                while(begin < chunk->end.load(std::memory_order_acquire)){
+                    //the items before end never change while this popper is counted
+                    item = chunk->items[begin];
+                    if(chunk->begin.compare_exchange_weak(begin, begin + 1, std::memory_order_acq_rel)){
+                        count.fetch_sub(1, std::memory_order_release);
+                        popped = true;
+                        break;
+                    }
+                    //another popper won, begin was reloaded
+                }
+            }
+        }
+        concurrent_poppers.fetch_sub(1, std::memory_order_release);
+
+        return popped;
+    }
+
+    //moves all the items of other to the back of this queue in O(1), other is left empty
+    void spliceBack(ChunkedQueue& other){
+        if(other.head.load(std::memory_order_relaxed) == NULL){
+            return;
+        }
+        linkBack(other.head.load(std::memory_order_relaxed), other.tail, other.count.load(std::memory_order_relaxed));
+        other.head = NULL;
+        other.tail = NULL;
+        other.count = 0;
+    }
+
+    //moves all the items of other to the front of this queue in O(1) (same order), other is left empty
+    void spliceFront(ChunkedQueue& other){
+        ExclusiveGuard guard(*this);
+        spliceFrontExclusive(other);
+    }
+
+    /*moves up to num_items of the oldest items to the back of out (same order), returns how many were moved.
+    whole chunks are relinked, only the last partially taken chunk is copied.*/
+    size_t takeFront(size_t num_items, ChunkedQueue& out){
+        ExclusiveGuard guard(*this);
+        return takeFrontExclusive(num_items, out);
+    }
+
+    //moves exactly num_items of the oldest items to the back of out, or nothing if there are less items
+    bool tryTakeFront(size_t num_items, ChunkedQueue& out){
+        ExclusiveGuard guard(*this);
+        if(count.load(std::memory_order_relaxed) < num_items){
+            return false;
+        }
+        takeFrontExclusive(num_items, out);
+        return true;
+    }
+
+    /*takes exactly num_items of the oldest items, or nothing if there are less items. the taken items that
+    keep returns true for are moved to the back of kept, the others stay in the queue in their place.
+    returns false if nothing was taken, otherwise writes the number of items that stayed to num_rejected.*/
+    template <typename Pred>
+    bool tryTakeFrontIf(size_t num_items, Pred keep, ChunkedQueue& kept, size_t& num_rejected){
+        ExclusiveGuard guard(*this);
+        if(count.load(std::memory_order_relaxed) < num_items){
+            return false;
+        }
+        ChunkedQueue oldest;
+        ChunkedQueue rejected;
+        takeFrontExclusive(num_items, oldest);
+        oldest.forEach([&](const T& item){
+            if(keep(item)){
+                kept.pushBack(item);
+            } else{
+                rejected.pushBack(item);
+            }
+        });
+        num_rejected = rejected.size();
+        spliceFrontExclusive(rejected);
+        return true;
+    }
+
+    //calls func on every item from oldest to newest
+    template <typename Func>
+    void forEach(Func func) const{
+        ExclusiveGuard guard(*this);
+        for(Chunk* chunk = head.load(std::memory_order_relaxed); chunk != NULL; chunk = chunk->next){
+            int end = chunk->end.load(std::memory_order_relaxed);
+            for(int i = chunk->begin.load(std::memory_order_relaxed); i < end; ++i){
+                func(chunk->items[i]);
+            }
+        }
+    }
+
+    //copies the items of the queue to the back of out, from oldest to newest
+    void copyTo(ChunkedQueue& out) const{
+        ExclusiveGuard guard(*this);
+        for(Chunk* chunk = head.load(std::memory_order_relaxed); chunk != NULL; chunk = chunk->next){
+            int begin = chunk->begin.load(std::memory_order_relaxed);
+            out.pushBack(chunk->end.load(std::memory_order_relaxed) - begin, chunk->items + begin);
+        }
+    }
+
+    //returns the items as a list, from oldest to newest
+    std::list<T> toList() const{
+        std::list<T> items_list;
+        forEach([&items_list](const T& item){ items_list.push_back(item); });
+        return items_list;
+    }
+
+    //replaces out with a view of the current items that shares their chunks, no item is copied
+    void snapshot(Snapshot& out) const{
+        Snapshot taken;
+        {
+            ExclusiveGuard guard(*this);
+            for(Chunk* chunk = head.load(std::memory_order_relaxed); chunk != NULL; chunk = chunk->next){
+                typename Snapshot::Segment segment;
+                segment.chunk = chunk;
+                segment.begin = chunk->begin.load(std::memory_order_relaxed);
+                segment.end = chunk->end.load(std::memory_order_relaxed);
+                if(segment.begin == segment.end){
+                    continue;
+                }
+                chunk->refs.fetch_add(1, std::memory_order_relaxed);
+                taken.segments.push_back(segment);
+                taken.count += static_cast<size_t>(segment.end - segment.begin);
+            }
+        }
+        out = std::move(taken);
+    }
+};
+
+#endif // CHUNKED_QUEUE_H_
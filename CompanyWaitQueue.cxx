@@ -0,0 +1,135 @@
+#include "CompanyWaitQueue.h"
+
+CompanyWaitQueue::CompanyWaitQueue(bool broadcast, bool fifo) : pending_demand(0), broadcast(broadcast), wakeups(0),
+                                                                 handoffs(0),
+                                                                 fifo(fifo), next_ticket(1), serving_ticket(1){}
+
+CompanyWaitQueue::~CompanyWaitQueue(){
+    //only asynchronous waiters can be left, nobody sleeps on a destroyed queue
+    for(auto& waiter : waiters){
+        delete waiter.second;
+    }
+}
+
+unsigned long long CompanyWaitQueue::waiterKey(int num_products, unsigned long long ticket) const{
+    return fifo ? ticket : static_cast<unsigned long long>(num_products);
+}
+
+bool CompanyWaitQueue::wait(pthread_mutex_t* lock, int num_products, unsigned long long ticket, void* order){
+    Waiter waiter;
+    waiter.num_products = num_products;
+    waiter.woken = false;
+    waiter.wake = NULL;
+    waiter.wake_arg = NULL;
+    waiter.order = order;
+    waiter.filled = false;
+    pthread_cond_init(&waiter.condition, NULL);
+
+    //an equal key is inserted after the existing ones, so equal requests are woken in arrival order
+    waiters.insert(std::make_pair(waiterKey(num_products, ticket), &waiter));
+    while(!waiter.woken){
+        pthread_cond_wait(&waiter.condition, lock);
+    }
+    pthread_cond_destroy(&waiter.condition);
+
+    //nothing was promised to a filled waiter, any other waiter is about to look at the inventory
+    if(!waiter.filled){
+        wokenLooked(num_products);
+    }
+    return waiter.filled;
+}
+
+void CompanyWaitQueue::waitAsync(int num_products, WakeFunc wake, void* arg, unsigned long long ticket){
+    //lives in the queue until it is woken, it has no stack to live on
+    Waiter* waiter = new Waiter();
+    waiter->num_products = num_products;
+    waiter->woken = false;
+    waiter->wake = wake;
+    waiter->wake_arg = arg;
+    waiter->order = NULL;
+    waiter->filled = false;
+    waiters.insert(std::make_pair(waiterKey(num_products, ticket), waiter));
+}
+
+void CompanyWaitQueue::wokenLooked(int num_products){
+    //its products are no longer promised
+    if(!broadcast){
+        pending_demand -= static_cast<size_t>(num_products);
+    }
+}
+
+void CompanyWaitQueue::wakeSatisfiable(size_t num_available, FillFunc fill, void* owner){
+    //products that were promised to woken waiters are not available to the others
+    num_available = (num_available > pending_demand) ? num_available - pending_demand : 0;
+
+    WaiterMap::iterator it = waiters.begin();
+    while(it != waiters.end()){
+        size_t wanted = static_cast<size_t>(it->second->num_products);
+        //a ticket that is not served yet waits, and so do all the tickets after it
+        if(fifo && !broadcast && it->first != 0 && it->first != serving_ticket){
+            break;
+        }
+        //the waiters are ordered by request (or by ticket), if this one doesn't fit none of the next ones may buy
+        if(!broadcast && wanted > num_available){
+            break;
+        }
+        Waiter* waiter = it->second;
+        unsigned long long key = it->first;
+        //a filled order takes its products now, nothing is promised to it (a broadcast also wakes the tickets
+        //that are not served, they must not buy)
+        waiter->filled = (fill != NULL && waiter->order != NULL && isServing(key) && fill(owner, waiter->order));
+        if(!broadcast){
+            num_available -= wanted;
+            if(!waiter->filled){
+                pending_demand += wanted;
+            }
+        }
+        if(waiter->filled){
+            served(key);
+            ++handoffs;
+        }
+        ++wakeups;
+        it = waiters.erase(it);
+        if(waiter->wake != NULL){
+            waiter->wake(waiter->wake_arg);
+            delete waiter;
+        } else{
+            waiter->woken = true;
+            pthread_cond_signal(&waiter->condition);
+        }
+    }
+}
+
+unsigned long long CompanyWaitQueue::takeTicket(){
+    return fifo ? next_ticket++ : 0;
+}
+
+bool CompanyWaitQueue::isServing(unsigned long long ticket) const{
+    return !fifo || ticket == serving_ticket;
+}
+
+void CompanyWaitQueue::served(unsigned long long ticket){
+    if(fifo && ticket == serving_ticket){
+        ++serving_ticket;
+    }
+}
+
+bool CompanyWaitQueue::isFifo() const{
+    return fifo;
+}
+
+bool CompanyWaitQueue::isBroadcast() const{
+    return broadcast;
+}
+
+size_t CompanyWaitQueue::numWaiting() const{
+    return waiters.size();
+}
+
+unsigned long long CompanyWaitQueue::numWakeups() const{
+    return wakeups;
+}
+
+unsigned long long CompanyWaitQueue::numHandoffs() const{
+    return handoffs;
+}
@@ -0,0 +1,116 @@
+#ifndef COMPANY_WAIT_QUEUE_H_
+#define COMPANY_WAIT_QUEUE_H_
+
+#include <pthread.h>
+#include <cstddef>
+#include <map>
+#include "ObjectPool.h"
+
+//called to wake a waiter that has no thread of its own
+typedef void (*WakeFunc)(void* arg);
+//fills the order of a waiter with its products before it is woken, returns false if it can't
+typedef bool (*FillFunc)(void* owner, void* order);
+
+/**
+ * The companies that wait for products, ordered by the number of products they want (and by arrival
+ * among companies that want the same number). Every waiter sleeps on a condition var of its own, so
+ * when products become available only the waiters whose requests fit are woken, smallest first,
+ * instead of broadcasting to all of them.
+ * A woken waiter that has not looked at the inventory yet still counts against the available products,
+ * so two waiters are never woken for the same products.
+ *
+ * Smallest first lets a company that wants many products starve behind a stream of small orders. In fifo mode
+ * the companies are served strictly in arrival order instead: a company takes a ticket when it arrives and may
+ * only buy when its ticket is served (isServing), the waiters are ordered by ticket, and only the waiter whose
+ * ticket is served is ever woken. Waiters without a ticket (0, returning companies that wait for the thieves to
+ * leave) are first and always woken.
+ *
+ * A sleeping waiter may leave an order (a backorder) that the waking thread fills on its behalf with a FillFunc,
+ * in the same critical section that made the products available. Such a waiter wakes up already holding its
+ * products, instead of waking up to take the lock again and look for them.
+ *
+ * A waiter may also be asynchronous (waitAsync): instead of sleeping it leaves a function that is called when
+ * it is woken, and it looks at the inventory later, on its own (for actors that are not threads).
+ *
+ * Not thread safe, every call must be made under the lock that is passed to wait().
+ */
+class CompanyWaitQueue{
+    struct Waiter : public PooledObject<Waiter>{
+        int num_products;
+        pthread_cond_t condition;
+        //set by the thread that wakes the waiter, so spurious wakeups are ignored
+        bool woken;
+        //called instead of signaling condition for an asynchronous waiter, NULL for a sleeping one
+        WakeFunc wake;
+        void* wake_arg;
+        //the order a wake may fill, NULL if there is none
+        void* order;
+        //set with woken when the order was filled
+        bool filled;
+    };
+
+    //a node is allocated for every wait, from a pool. the key is the request, or the ticket in fifo mode
+    typedef std::multimap<unsigned long long, Waiter*, std::less<unsigned long long>,
+                          PoolAllocator<std::pair<const unsigned long long, Waiter*>>> WaiterMap;
+    WaiterMap waiters;
+
+    //products wanted by waiters that were woken and did not look at the inventory yet
+    size_t pending_demand;
+
+    //when true every wake wakes all the waiters, like a broadcast
+    bool broadcast;
+
+    //total number of times a waiter was woken
+    unsigned long long wakeups;
+    //the number of those wakes that filled the waiter's order
+    unsigned long long handoffs;
+
+    //serve the companies in arrival order
+    bool fifo;
+    //the ticket the next company gets, and the ticket that may buy now (fifo mode only)
+    unsigned long long next_ticket;
+    unsigned long long serving_ticket;
+
+    //the key of a waiter in waiters
+    unsigned long long waiterKey(int num_products, unsigned long long ticket) const;
+
+    //copying is not allowed
+    CompanyWaitQueue(const CompanyWaitQueue&);
+    CompanyWaitQueue& operator=(const CompanyWaitQueue&);
+
+public:
+    //broadcast keeps the old behaviour of waking every waiter, for comparison
+    CompanyWaitQueue(bool broadcast, bool fifo);
+    ~CompanyWaitQueue();
+
+    /*releases lock and sleeps until a wake decides that num_products products are there for this waiter
+    (and in fifo mode that its ticket is served). returns true if the wake filled order, false if the waiter
+    has to look at the inventory itself*/
+    bool wait(pthread_mutex_t* lock, int num_products, unsigned long long ticket = 0, void* order = NULL);
+    /*adds a waiter that does not sleep: when a wake decides that num_products products are there for it,
+    wake(arg) is called (under the lock, so it must not call back into the owner) and the waiter is removed.
+    the woken waiter must call wokenLooked once it looked at the inventory*/
+    void waitAsync(int num_products, WakeFunc wake, void* arg, unsigned long long ticket = 0);
+    //a woken waiter looked at the inventory, the products it was woken for are no longer promised to it
+    void wokenLooked(int num_products);
+
+    /*wakes the waiters, smallest request first, as long as their requests fit in num_available products.
+    in fifo mode only the waiter of the served ticket is woken, if its request fits (a filled order serves the
+    ticket). when fill is not NULL the orders of the woken waiters are filled with fill(owner, order) first*/
+    void wakeSatisfiable(size_t num_available, FillFunc fill = NULL, void* owner = NULL);
+
+    //a ticket for a company that arrived, 0 (always served) when not in fifo mode
+    unsigned long long takeTicket();
+    //true if the company with ticket may buy now
+    bool isServing(unsigned long long ticket) const;
+    //the company with ticket bought its products, the next ticket is served
+    void served(unsigned long long ticket);
+
+    bool isBroadcast() const;
+    bool isFifo() const;
+    size_t numWaiting() const;
+    unsigned long long numWakeups() const;
+    unsigned long long numHandoffs() const;
+};
+
+#endif // COMPANY_WAIT_QUEUE_H_
@@ -1,87 +1,156 @@
 #include "Factory.h"
 
-struct wrapper_struct{
+//allocated by every actor launch and freed by the actor, so it comes from a pool
+struct wrapper_struct : public PooledObject<wrapper_struct>{
     Factory* factory;
     int num_products;
     Product* products;
     int min_value;
     unsigned int fake_id;
+    //where the actor publishes its result, one reference is the actor's
+    ActorState* state;
 
     wrapper_struct(Factory* factory, int num_products, Product* products, int min_value = 0, unsigned int fake_id = 0):
-            factory(factory), num_products(num_products), products(products), min_value(min_value), fake_id(fake_id){}
+            factory(factory), num_products(num_products), products(products), min_value(min_value), fake_id(fake_id),
+            state(NULL){}
     wrapper_struct(Factory* factory, int num_products = 0, int min_value = 0, unsigned int fake_id = 0):
-            factory(factory), num_products(num_products), products(NULL), min_value(min_value), fake_id(fake_id){}
+            factory(factory), num_products(num_products), products(NULL), min_value(min_value), fake_id(fake_id),
+            state(NULL){}
     wrapper_struct(Factory* factory, int num_products, unsigned int fake_id):
-            factory(factory), num_products(num_products), products(NULL), min_value(0), fake_id(fake_id){}
+            factory(factory), num_products(num_products), products(NULL), min_value(0), fake_id(fake_id),
+            state(NULL){}
 
     ~wrapper_struct(){
         factory = NULL;
         products = NULL;
+        state = NULL;
     }
 
 };
 
 void *prodWrapper(void* s_struct);
 void *simpleWrapper(void* s_struct);
+void *bulkBuyerWrapper(void* s_struct);
 void *companyWrapper(void* s_struct);
+void *filteringCompanyWrapper(void* s_struct);
 void *thiefWrapper(void* s_struct);
 
+//the backorder of a waiting company, filled by the thread that makes its products available
+struct CompanyOrder{
+    int num_products;
+    int min_value;
+    int* num_rejected;
+    ProductQueue* products;
+
+    CompanyOrder(int num_products, int min_value, int* num_rejected, ProductQueue* products) :
+            num_products(num_products), min_value(min_value), num_rejected(num_rejected), products(products){}
+};
+
 class isAboveMinValueFunctor{
     int min_value;
 public:
     isAboveMinValueFunctor(int min_value) : min_value(min_value){}
-    bool operator()(Product& prod) { return (prod.getValue() >= min_value); }
+    bool operator()(const Product& prod) { return (prod.getValue() >= min_value); }
 };
 
 
-Factory::Factory() : is_returning_open(true), is_factory_open(true), thieves_counter(0), waiting_for_return_counter(0),
-                     waiting_thieves_counter(0), waiting_companies_counter(0),
-                     threads_map(new std::unordered_map<unsigned int, pthread_t>),
-                     available_products(new std::list<Product>), thefts(new std::list<std::pair<Product, int>>){
+Factory::Factory() : Factory(FactoryOptions()){}
+
+Factory::Factory(const FactoryOptions& options) : actor_slots(new ActorSlotMap),
+                     actor_pool(options.pool_threads > 0 ? new ThreadPool(options.pool_threads) : NULL),
+                     available_products(new ProductQueue),
+                     sharded_products(options.inventory_shards != 0 && options.store_path == NULL ?
+                                      new ShardedInventory(options.inventory_shards) : NULL),
+                     thefts(new TheftLog),
+                     waiting_companies(new CompanyWaitQueue(options.broadcast_company_wakeups,
+                                                                             options.fifo_company_orders)),
+                     company_handoff(options.company_handoff), stock_listener(NULL), stock_listener_arg(NULL),
+                     factory_lock_profile(options.profile_locks ? new MutexProfile("factory_lock") : NULL),
+                     thieves_counter_lock_profile(options.profile_locks ? new MutexProfile("thieves_counter_lock") : NULL),
+                     returning_service_lock_profile(options.profile_locks ? new MutexProfile("returning_service_lock") : NULL),
+                     operation_profile(options.profile_operations ? new OperationProfile : NULL),
+                     operation_trace(options.trace_path != NULL ? OperationTrace::create(options.trace_path) : NULL),
+                     store(options.store_path != NULL ? PersistentStore::open(options.store_path) : NULL),
+                     wal(options.wal_path != NULL ? WriteAheadLog::open(options.wal_path, options.wal_sync) : NULL),
+                     wal_wait_durable(options.wal_wait_durable),
+                     thieves_counter(0), waiting_thieves_counter(0), waiting_companies_counter(0),
+                     waiting_for_return_counter(0),
+                     factory_open_waiters(new std::vector<AsyncWait*>), returning_open_waiters(new std::vector<AsyncWait*>),
+                     is_returning_open(true), is_factory_open(true),
+                     lock_free_buy(options.lock_free_buy && options.inventory_shards == 0 && options.store_path == NULL),
+                     filter_company_purchases(options.filter_company_purchases){
+    //let simple buyers take products without the factory lock
+    available_products->setConcurrentPop(lock_free_buy);
+
     //init mutex lock
     INIT_MUTEX_LOCK(factory_lock);
-    INIT_MUTEX_LOCK(stolen_lock);
     INIT_MUTEX_LOCK(thieves_counter_lock);
     INIT_MUTEX_LOCK(returning_service_lock);
 
 //    pthread_mutex_init(&factory_lock, NULL);
-//    pthread_mutex_init(&stolen_lock, NULL);
 //    pthread_mutex_init(&thieves_counter_lock, NULL);
 //    pthread_mutex_init(&returning_service_lock, NULL);
 
     //init condition vars
     pthread_cond_init(&returning_open_condition, NULL);
     pthread_cond_init(&factory_open_condition, NULL);
-    pthread_cond_init(&companies_condition, NULL);
+
+    //a restarted factory goes on with the products and thefts of the store
+    if(store != NULL){
+        std::vector<Product> products;
+        std::vector<TheftLog::Entry> stolen;
+        store->recover(products, stolen);
+        available_products->pushBack(static_cast<int>(products.size()), products.data());
+        if(!stolen.empty()){
+            size_t log_position = thefts->reserve(stolen.size());
+            for(auto& entry : stolen){
+                thefts->write(log_position++, entry.first, entry.second);
+            }
+        }
+    }
 }
 
 Factory::~Factory(){
+    //stop the pool's workers before anything they may use is destroyed
+    delete actor_pool;
+
     //destroy mutex lock
     pthread_mutex_destroy(&factory_lock);
-    pthread_mutex_destroy(&stolen_lock);
     pthread_mutex_destroy(&thieves_counter_lock);
     pthread_mutex_destroy(&returning_service_lock);
 
     //destroy condition vars
     pthread_cond_destroy(&returning_open_condition);
     pthread_cond_destroy(&factory_open_condition);
-    pthread_cond_destroy(&companies_condition);
 
     //delete lists and map
-    delete threads_map;
+    delete actor_slots;
     delete available_products;
+    delete sharded_products;
     delete thefts;
+    delete waiting_companies;
+    delete factory_open_waiters;
+    delete returning_open_waiters;
+    delete factory_lock_profile;
+    delete thieves_counter_lock_profile;
+    delete returning_service_lock_profile;
+    delete operation_profile;
+    delete operation_trace;
+    delete store;
+    delete wal;
 }
 
 void Factory::startProduction(int num_products, Product* products,unsigned int id){
-    //insert the new thread to the map;
-    pthread_t& new_thread = (*threads_map)[id];
+    //save the actor's future under its id
+    actor_slots->put(id, launchProduction(num_products, products));
+}
 
+ActorFuture Factory::launchProduction(int num_products, Product* products){
     //make wrapper struct
     wrapper_struct* s = new wrapper_struct(this, num_products, products);
 
-    //create new thread using wrapper functions
-    pthread_create(&new_thread, NULL, prodWrapper , s);
+    //run the actor using wrapper functions
+    return launchActor(prodWrapper, s);
 }
 
 void *prodWrapper(void* s_struct){
@@ -89,45 +158,100 @@ void *prodWrapper(void* s_struct){
     delete static_cast<wrapper_struct*>(s_struct);
 
     s.factory->produce(s.num_products, s.products);
-    pthread_exit(NULL);
+
+    //a producer has no result
+    s.state->complete(0);
+    s.state->unref();
+    return NULL;
 }
 
 void Factory::produce(int num_products, Product* products){
+    TraceCall trace_call(operation_trace, OP_PRODUCE, num_products);
+    trace_call.addProducts(num_products, products);
+    OperationTimer timer(operation_profile, OP_PRODUCE);
+
+    //a sharded inventory only locks the shard the products go to
+    if(sharded_products != NULL){
+        sharded_products->add(num_products, products);
+        productsAddedSignal(OP_PRODUCE);
+        stockAddedSignal();
+        return;
+    }
+
+    //big batches are copied to chunks before locking, so only linking them is done under the lock
+    if(num_products >= BULK_PRODUCE_THRESHOLD){
+        ProductQueue batch;
+        batch.pushBack(num_products, products);
+        produceBatch(batch);
+        return;
+    }
+
     //lock factory
-    pthread_mutex_lock(&factory_lock);
+    profiledLock(&factory_lock, factory_lock_profile, OP_PRODUCE);
 
     //add all products to factory
-    for(int i=0; i<num_products; i++){
-        available_products->push_back(products[i]);
+    available_products->pushBack(num_products, products);
+    if(store != NULL){
+        store->add(num_products, products);
     }
 
     //signal the next thread that it can take the lock
-    factoryFreeSignal();
+    factoryFreeSignal(OP_PRODUCE);
 
     //unlock factory
-    pthread_mutex_unlock(&factory_lock);
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    stockAddedSignal();
 }
 
-void Factory::finishProduction(unsigned int id){
-    //save thread id
-    pthread_t prod_thread = (*threads_map)[id];
+void Factory::produce(ProductQueue& batch){
+    TraceCall trace_call(operation_trace, OP_PRODUCE, static_cast<int>(batch.size()));
+    trace_call.addProducts(batch);
+    OperationTimer timer(operation_profile, OP_PRODUCE);
+    produceBatch(batch);
+}
+
+void Factory::produceBatch(ProductQueue& batch){
+    //a sharded inventory only locks the shard the products go to
+    if(sharded_products != NULL){
+        sharded_products->add(batch);
+        productsAddedSignal(OP_PRODUCE);
+        stockAddedSignal();
+        return;
+    }
 
-    //remove it from the map
-    threads_map->erase(id);
+    //lock factory
+    profiledLock(&factory_lock, factory_lock_profile, OP_PRODUCE);
+
+    //link the batch's chunks to the end of the factory, no product is copied
+    if(store != NULL){
+        store->add(batch);
+    }
+    available_products->spliceBack(batch);
+
+    //signal the next thread that it can take the lock
+    factoryFreeSignal(OP_PRODUCE);
+
+    //unlock factory
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    stockAddedSignal();
+}
 
-    //join the thread
-    pthread_join(prod_thread, NULL);
+void Factory::finishProduction(unsigned int id){
+    //join the actor
+    joinActor(id);
 }
 
 void Factory::startSimpleBuyer(unsigned int id){
-    //insert the new thread to the map;
-    pthread_t &simple_thread = (*threads_map)[id];
+    //save the actor's future under its id
+    actor_slots->put(id, launchSimpleBuyer());
+}
 
+ActorFuture Factory::launchSimpleBuyer(){
     //make wrapper struct
     wrapper_struct* s = new wrapper_struct(this);
 
-    //create new thread using wrapper functions
-    pthread_create(&simple_thread, NULL, simpleWrapper , s);
+    //run the actor using wrapper functions
+    return launchActor(simpleWrapper, s);
 }
 
 //Wrapper for correct usage of pthread_create
@@ -135,65 +259,155 @@ void *simpleWrapper(void* s_struct){
     //cast wrapper to correct struct
     wrapper_struct s = *static_cast<wrapper_struct*>(s_struct);
     delete static_cast<wrapper_struct*>(s_struct);
-    //create pointer to return value (allocate with new)
-    int* retval;
-    //call try tryBuyOne
-    retval = new int(s.factory->tryBuyOne());
-    //return buy result
-    pthread_exit((void*)retval);
+    //call try tryBuyOne and publish the buy result
+    s.state->complete(s.factory->tryBuyOne());
+    s.state->unref();
+    return NULL;
 }
 
 int Factory::tryBuyOne(){
+    TraceCall trace_call(operation_trace, OP_TRY_BUY_ONE);
+    OperationTimer timer(operation_profile, OP_TRY_BUY_ONE);
+
+    Product bought = buyOne();
+    if(bought.getId() != -1){
+        logOperation(WAL_SALE, 0, bought, true);
+    }
+    trace_call.setResult(bought.getId());
+    return bought.getId();
+}
+
+Product Factory::buyOne(){
     //create a product with an id of -1 for the default return value
     Product bought = Product(-1, -1);
 
-    if(pthread_mutex_trylock(&factory_lock) == 0){
-        if(!available_products->empty() && is_factory_open) {
-            //buy and remove the oldest product
-            bought = available_products->front();
-            available_products->pop_front();
+    //a sharded inventory is never locked as a whole by simple buyers, a closed factory sells nothing
+    if(sharded_products != NULL){
+        if(__atomic_load_n(&is_factory_open, __ATOMIC_ACQUIRE)){
+            sharded_products->tryTakeOne(bought);
+        }
+        return bought;
+    }
+
+    //try to buy the oldest product without the lock, a closed factory sells nothing
+    if(lock_free_buy){
+        if(!__atomic_load_n(&is_factory_open, __ATOMIC_ACQUIRE)){
+            return bought;
+        }
+        if(available_products->tryPopFrontConcurrent(bought)){
+            return bought;
+        }
+    }
+
+    if(profiledTryLock(&factory_lock, factory_lock_profile, OP_TRY_BUY_ONE)){
+        if(is_factory_open) {
+            //buy and remove the oldest product (bought is left unchanged if there are no products)
+            if(available_products->popFront(bought) && store != NULL){
+                store->takeFront(1);
+            }
         }
 
         //signal the next thread that it can take the lock
-        factoryFreeSignal();
+        factoryFreeSignal(OP_TRY_BUY_ONE);
 
         //unlock the factory
-        pthread_mutex_unlock(&factory_lock);
+        profiledUnlock(&factory_lock, factory_lock_profile);
     }
 
-    return bought.getId();
+    return bought;
 }
 
 int Factory::finishSimpleBuyer(unsigned int id){
-    //@TODO maybe we should use threads_map->at(id) instead so we'll find errors easier
-    pthread_t simple_thread = (*threads_map)[id];
+    //join the actor and return the buy result
+    return joinActor(id);
+}
+
+void Factory::startBulkBuyer(int num_products, unsigned int id){
+    //save the actor's future under its id
+    actor_slots->put(id, launchBulkBuyer(num_products));
+}
 
-    //create pointer to result address and variable to copy to result to before freeing the memory
-    int* buy_result_address = NULL;
-    int buy_result;
+ActorFuture Factory::launchBulkBuyer(int num_products){
+    //make wrapper struct
+    wrapper_struct* s = new wrapper_struct(this, num_products);
 
-    //remove it from the map
-    threads_map->erase(id);
+    //run the actor using wrapper functions
+    return launchActor(bulkBuyerWrapper, s);
+}
 
-    //join the thread and save the result pointer in buy_result_address
-    pthread_join(simple_thread, (void**)&buy_result_address);
-    //copy the result to a local variable
-    buy_result = *buy_result_address;
-    //free the memory we allocated for the result
-    delete buy_result_address;
+void *bulkBuyerWrapper(void* s_struct){
+    wrapper_struct s = *static_cast<wrapper_struct*>(s_struct);
+    delete static_cast<wrapper_struct*>(s_struct);
 
-    return buy_result;
+    //buy what is available and publish how much that was
+    s.state->complete(static_cast<int>(s.factory->tryBuyMany(s.num_products).size()));
+    s.state->unref();
+    return NULL;
+}
+
+std::list<Product> Factory::tryBuyMany(int num_products){
+    TraceCall trace_call(operation_trace, OP_TRY_BUY_MANY, num_products);
+    OperationTimer timer(operation_profile, OP_TRY_BUY_MANY);
+    if(num_products <= 0){
+        return std::list<Product>();
+    }
+    size_t wanted = static_cast<size_t>(num_products);
+    ProductQueue bought_products;
+
+    //a sharded inventory is never locked as a whole by simple buyers, a closed factory sells nothing
+    if(sharded_products != NULL){
+        if(__atomic_load_n(&is_factory_open, __ATOMIC_ACQUIRE)){
+            sharded_products->tryTakeMany(wanted, bought_products);
+        }
+        logOperation(WAL_SALE, 0, bought_products, true);
+        trace_call.setResult(static_cast<int>(bought_products.size()));
+        return bought_products.toList();
+    }
+
+    if(profiledTryLock(&factory_lock, factory_lock_profile, OP_TRY_BUY_MANY)){
+        if(is_factory_open) {
+            //buy the oldest products, whole chunks are relinked
+            size_t num_bought = available_products->takeFront(wanted, bought_products);
+            if(store != NULL){
+                store->takeFront(num_bought);
+            }
+        }
+
+        //signal the next thread that it can take the lock
+        factoryFreeSignal(OP_TRY_BUY_MANY);
+
+        //unlock the factory
+        profiledUnlock(&factory_lock, factory_lock_profile);
+    } else if(lock_free_buy && __atomic_load_n(&is_factory_open, __ATOMIC_ACQUIRE)){
+        //the factory is busy, buy what can be bought without the lock instead of nothing
+        Product bought;
+        while(bought_products.size() < wanted && available_products->tryPopFrontConcurrent(bought)){
+            bought_products.pushBack(bought);
+        }
+    }
+
+    //build the list only after the factory is unlocked
+    logOperation(WAL_SALE, 0, bought_products, true);
+    trace_call.setResult(static_cast<int>(bought_products.size()));
+    return bought_products.toList();
+}
+
+int Factory::finishBulkBuyer(unsigned int id){
+    //join the actor and return the number of bought products
+    return joinActor(id);
 }
 
 void Factory::startCompanyBuyer(int num_products, int min_value,unsigned int id){
-    //insert the new thread to the map;
-    pthread_t &new_thread = (*threads_map)[id];
+    //save the actor's future under its id
+    actor_slots->put(id, launchCompanyBuyer(num_products, min_value));
+}
 
+ActorFuture Factory::launchCompanyBuyer(int num_products, int min_value){
     //make wrapper struct
     wrapper_struct* s = new wrapper_struct(this, num_products, min_value);
 
-    //create new thread using wrapper functions
-    pthread_create(&new_thread, NULL, companyWrapper , s);
+    //run the actor using wrapper functions
+    return launchActor(filter_company_purchases ? filteringCompanyWrapper : companyWrapper, s);
 }
 
 void *companyWrapper(void* s_struct){
@@ -201,49 +415,98 @@ void *companyWrapper(void* s_struct){
     wrapper_struct s = *static_cast<wrapper_struct*>(s_struct);
     delete static_cast<wrapper_struct*>(s_struct);
 
-    int* num_returned;
-
     //buy products
     std::list<Product> bought_products = s.factory->buyProducts(s.num_products);
 
     //remove all products that should not be returned from the list
     isAboveMinValueFunctor pred = isAboveMinValueFunctor(s.min_value);
     bought_products.remove_if(pred);
-    //save the number of products we will return, that will be our return value
-    num_returned = new int(static_cast<int>(bought_products.size()));
+    //save the number of products we will return, that will be our result
+    int num_returned = static_cast<int>(bought_products.size());
 
     //return the products (id parameter is deprecated and can be passed any value)
     s.factory->returnProducts(bought_products, 0);
 
-    pthread_exit((void*)num_returned);
+    s.state->complete(num_returned);
+    s.state->unref();
+    return NULL;
+}
+
+void *filteringCompanyWrapper(void* s_struct){
+    //cast wrapper to correct struct
+    wrapper_struct s = *static_cast<wrapper_struct*>(s_struct);
+    delete static_cast<wrapper_struct*>(s_struct);
+
+    //buy only the products worth at least min_value, the rest never leave the factory
+    int num_rejected = 0;
+    s.factory->buyProducts(s.num_products, s.min_value, &num_rejected);
+
+    //the products left in the factory count as returned
+    s.state->complete(num_rejected);
+    s.state->unref();
+    return NULL;
 }
 
 std::list<Product> Factory::buyProducts(int num_products){
+    //every product is worth at least NO_MIN_VALUE
+    int num_rejected = 0;
+    return buyProducts(num_products, NO_MIN_VALUE, &num_rejected);
+}
+
+std::list<Product> Factory::buyProducts(int num_products, int min_value, int* num_rejected){
+    TraceCall trace_call(operation_trace, OP_BUY_PRODUCTS, num_products, min_value);
+    OperationTimer timer(operation_profile, OP_BUY_PRODUCTS);
+
     //lock the factory
-    pthread_mutex_lock(&factory_lock);
-    pthread_mutex_lock(&thieves_counter_lock);
-    //wait until there are enough products and no thieves are around
-    while(available_products->size() < num_products || thieves_counter > 0 || !is_factory_open){
-        //this company is now waiting
-        ++waiting_companies_counter;
-        pthread_mutex_unlock(&thieves_counter_lock);
-        pthread_cond_wait(&companies_condition, &factory_lock);
-        pthread_mutex_lock(&thieves_counter_lock);
-        //this company is no longer waiting
-        --waiting_companies_counter;
-    }
-    pthread_mutex_unlock(&thieves_counter_lock);
-
-    //take the num_products oldest products
-    std::list<Product> bought_products = takeOldestProducts(num_products);
+    profiledLock(&factory_lock, factory_lock_profile, OP_BUY_PRODUCTS);
+    ProductQueue bought_products;
+    //the order a producer may fill while this company waits
+    CompanyOrder order(num_products, min_value, num_rejected, &bought_products);
+    //this company is waiting until it buys. it is counted before it looks at the products, so a producer
+    //of a sharded inventory that sees no waiting companies added its products before this company looks
+    __atomic_add_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+    //this company's place in line, when companies are served in arrival order
+    unsigned long long ticket = waiting_companies->takeTicket();
+    //wait until it is this company's turn, there are no thieves around and there are enough products,
+    //then take the num_products oldest products
+    while(true){
+        profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_BUY_PRODUCTS);
+        bool bought = (thieves_counter <= 0 && is_factory_open && waiting_companies->isServing(ticket) &&
+                       takeOldestProducts(num_products, bought_products, min_value, num_rejected));
+        profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+        if(bought){
+            break;
+        }
+        //the products this company was woken for may be gone, pass the wakeup on to companies that want less
+        //(a broadcast already woke all of them, and in arrival order nobody after this company may buy)
+        if(!waiting_companies->isBroadcast() && !waiting_companies->isFifo()){
+            factoryFreeSignal(OP_BUY_PRODUCTS);
+        }
+        timer.waitBegin();
+        profiledWaitBegin(factory_lock_profile);
+        bool filled = waiting_companies->wait(&factory_lock, num_products, ticket,
+                                              company_handoff ? &order : NULL);
+        profiledWaitEnd(factory_lock_profile, OP_BUY_PRODUCTS);
+        timer.waitEnd();
+        //woken holding the products, there is nothing to look at
+        if(filled){
+            break;
+        }
+    }
+    //this company is no longer waiting, the next one in line may buy
+    __atomic_sub_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+    waiting_companies->served(ticket);
 
     //signal that the factory is unlocked
-    factoryFreeSignal();
+    factoryFreeSignal(OP_BUY_PRODUCTS);
 
     //unlock the factory
-    pthread_mutex_unlock(&factory_lock);
+    profiledUnlock(&factory_lock, factory_lock_profile);
 
-    return bought_products;
+    //build the list only after the factory is unlocked
+    logOperation(WAL_SALE, 0, bought_products, true);
+    trace_call.setResult(static_cast<int>(bought_products.size()));
+    return bought_products.toList();
 }
 
 void Factory::returnProducts(std::list<Product> products,unsigned int id){
@@ -251,80 +514,236 @@ void Factory::returnProducts(std::list<Product> products,unsigned int id){
     if(products.empty()){
         return;
     }
+    TraceCall trace_call(operation_trace, OP_RETURN_PRODUCTS, static_cast<int>(products.size()));
+    trace_call.addProducts(products);
+    OperationTimer timer(operation_profile, OP_RETURN_PRODUCTS);
 
     //lock the returning service
-    pthread_mutex_lock(&returning_service_lock);
+    profiledLock(&returning_service_lock, returning_service_lock_profile, OP_RETURN_PRODUCTS);
     //if the returning service is closed, wait until it opens
     if(!is_returning_open){
         //this company is waiting, so increase the counter
         ++waiting_for_return_counter;
+        timer.waitBegin();
+        profiledWaitBegin(returning_service_lock_profile);
         pthread_cond_wait(&returning_open_condition, &returning_service_lock);
+        profiledWaitEnd(returning_service_lock_profile, OP_RETURN_PRODUCTS);
+        timer.waitEnd();
         //this company is no longer waiting, so decrease the counter
         --waiting_for_return_counter;
     }
     //unlock the returning service
-    pthread_mutex_unlock(&returning_service_lock);
+    profiledUnlock(&returning_service_lock, returning_service_lock_profile);
+
+    //copy the products to chunks before locking the factory, so they can be linked in O(1)
+    ProductQueue returned_products;
+    for(auto& product : products){
+        returned_products.pushBack(product);
+    }
 
     //lock the factory
-    pthread_mutex_lock(&factory_lock);
-    pthread_mutex_lock(&thieves_counter_lock);
-    //wait until no thieves are around
-    while(thieves_counter > 0){
-        //this company is now waiting
-        ++waiting_companies_counter;
-        pthread_mutex_unlock(&thieves_counter_lock);
-        pthread_cond_wait(&companies_condition, &factory_lock);
-        pthread_mutex_lock(&thieves_counter_lock);
-        //this company is no longer waiting
-        --waiting_companies_counter;
+    profiledLock(&factory_lock, factory_lock_profile, OP_RETURN_PRODUCTS);
+    WriteAheadLog::Reservation return_record;
+    while(true){
+        profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_RETURN_PRODUCTS);
+        //wait until no thieves are around
+        while(thieves_counter > 0){
+            //this company is now waiting
+            __atomic_add_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+            profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+            //a returning company needs no products, it is woken as soon as the thieves leave
+            timer.waitBegin();
+            profiledWaitBegin(factory_lock_profile);
+            waiting_companies->wait(&factory_lock, 0);
+            profiledWaitEnd(factory_lock_profile, OP_RETURN_PRODUCTS);
+            timer.waitEnd();
+            profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_RETURN_PRODUCTS);
+            //this company is no longer waiting
+            __atomic_sub_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+        }
+        profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+
+        //the return is logged before the products can be bought again, so its record is reserved under the lock.
+        //the log is not waited for under it: when the log is full the factory is unlocked until it has room, and
+        //the thieves are checked again
+        if(wal == NULL || wal->tryReserve(products.size(), return_record)){
+            break;
+        }
+        profiledUnlock(&factory_lock, factory_lock_profile);
+        timer.waitBegin();
+        wal->waitForRoom(products.size());
+        timer.waitEnd();
+        profiledLock(&factory_lock, factory_lock_profile, OP_RETURN_PRODUCTS);
     }
-    pthread_mutex_unlock(&thieves_counter_lock);
 
     //return the products
-    available_products->splice(available_products->end(), products);
+    if(sharded_products != NULL){
+        sharded_products->add(returned_products);
+    } else{
+        if(store != NULL){
+            store->add(returned_products);
+        }
+        available_products->spliceBack(returned_products);
+    }
 
     //signal that the factory is unlocked
-    factoryFreeSignal();
+    factoryFreeSignal(OP_RETURN_PRODUCTS);
 
     //unlock the factory
-    pthread_mutex_unlock(&factory_lock);
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    stockAddedSignal();
+
+    if(wal != NULL){
+        wal->write(return_record, WAL_RETURN, 0, products);
+        if(wal_wait_durable){
+            wal->waitDurable(return_record.end());
+        }
+    }
 }
 
-int Factory::finishCompanyBuyer(unsigned int id){
-    //save the thread
-    pthread_t company_thread = (*threads_map)[id];
+bool Factory::buyProductsAsync(int num_products, int min_value, int* num_rejected, std::list<Product>& bought,
+                               AsyncWait& wait){
+    if(wait.waiting_for == ASYNC_WAITING_FOR_LOG){
+        //bought on an earlier call, only the record is left
+        return logOperationAsync(WAL_SALE, 0, wait);
+    }
+
+    profiledLock(&factory_lock, factory_lock_profile, OP_BUY_PRODUCTS);
+    if(wait.waiting_for == ASYNC_WAITING_FOR_PRODUCTS){
+        //woken, this company is about to look at the products it was woken for
+        waiting_companies->wokenLooked(num_products);
+    } else{
+        //the first call, this company is waiting until it buys (the same as the loop of buyProducts)
+        __atomic_add_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+        wait.ticket = waiting_companies->takeTicket();
+    }
+
+    ProductQueue bought_products;
+    profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_BUY_PRODUCTS);
+    bool done = (thieves_counter <= 0 && is_factory_open && waiting_companies->isServing(wait.ticket) &&
+                 takeOldestProducts(num_products, bought_products, min_value, num_rejected));
+    profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+
+    if(!done){
+        //pass the wakeup on like buyProducts does, then wait without a thread
+        if(!waiting_companies->isBroadcast() && !waiting_companies->isFifo()){
+            factoryFreeSignal(OP_BUY_PRODUCTS);
+        }
+        waiting_companies->waitAsync(num_products, wait.wake, wait.arg, wait.ticket);
+        wait.waiting_for = ASYNC_WAITING_FOR_PRODUCTS;
+        profiledUnlock(&factory_lock, factory_lock_profile);
+        return false;
+    }
+
+    //this company is no longer waiting
+    __atomic_sub_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+    waiting_companies->served(wait.ticket);
+    wait.waiting_for = ASYNC_NOT_WAITING;
+
+    //signal that the factory is unlocked
+    factoryFreeSignal(OP_BUY_PRODUCTS);
+    profiledUnlock(&factory_lock, factory_lock_profile);
+
+    //build the list only after the factory is unlocked, and before the record: once a wake is left with the log
+    //the call may be repeated (and finish) on another thread
+    bought = bought_products.toList();
+    wait.unlogged.spliceBack(bought_products);
+    return logOperationAsync(WAL_SALE, 0, wait);
+}
+
+bool Factory::returnProductsAsync(const std::list<Product>& products, AsyncWait& wait){
+    if(products.empty()){
+        return true;
+    }
+
+    //wait for the returning service, it is checked again after every wake
+    profiledLock(&returning_service_lock, returning_service_lock_profile, OP_RETURN_PRODUCTS);
+    if(!is_returning_open){
+        returning_open_waiters->push_back(&wait);
+        wait.waiting_for = ASYNC_WAITING_FOR_RETURNING_SERVICE;
+        profiledUnlock(&returning_service_lock, returning_service_lock_profile);
+        return false;
+    }
+    profiledUnlock(&returning_service_lock, returning_service_lock_profile);
+
+    profiledLock(&factory_lock, factory_lock_profile, OP_RETURN_PRODUCTS);
+    if(wait.waiting_for == ASYNC_WAITING_FOR_PRODUCTS){
+        //woken after the thieves left, this company is no longer waiting
+        waiting_companies->wokenLooked(0);
+        __atomic_sub_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+    }
+
+    //wait until no thieves are around
+    profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_RETURN_PRODUCTS);
+    bool thieves_around = (thieves_counter > 0);
+    profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+    if(thieves_around){
+        __atomic_add_fetch(&waiting_companies_counter, 1, __ATOMIC_SEQ_CST);
+        waiting_companies->waitAsync(0, wait.wake, wait.arg);
+        wait.waiting_for = ASYNC_WAITING_FOR_PRODUCTS;
+        profiledUnlock(&factory_lock, factory_lock_profile);
+        return false;
+    }
+    wait.waiting_for = ASYNC_NOT_WAITING;
 
-    //create pointer to result address and variable to copy to result to before freeing the memory
-    int* num_returned_address = NULL;
-    int num_returned = 0;
+    //return the products
+    //the record is reserved before the products can be bought again, like returnProducts does.
+    //when the log is full nothing is returned, the call is woken by the log once it has room and starts over
+    WriteAheadLog::Reservation return_record;
+    if(wal != NULL && !wal->tryReserve(products.size(), return_record)){
+        wait.waiting_for = ASYNC_WAITING_FOR_LOG;
+        profiledUnlock(&factory_lock, factory_lock_profile);
+        wal->wakeOnRoom(products.size(), wait.wake, wait.arg);
+        return false;
+    }
+    ProductQueue returned_products;
+    for(auto& product : products){
+        returned_products.pushBack(product);
+    }
+    if(sharded_products != NULL){
+        sharded_products->add(returned_products);
+    } else{
+        if(store != NULL){
+            store->add(returned_products);
+        }
+        available_products->spliceBack(returned_products);
+    }
 
-    //remove it from the map
-    threads_map->erase(id);
+    //signal that the factory is unlocked
+    factoryFreeSignal(OP_RETURN_PRODUCTS);
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    stockAddedSignal();
 
-    //join the thread and save the result pointer in num_returned_address
-    pthread_join(company_thread, (void**)&num_returned_address);
-    //copy the result to a local variable
-    num_returned = *num_returned_address;
-    //free the memory we allocated for the result
-    delete num_returned_address;
+    if(wal != NULL){
+        wal->write(return_record, WAL_RETURN, 0, products);
+    }
+    return true;
+}
 
-    return num_returned;
+int Factory::finishCompanyBuyer(unsigned int id){
+    //join the actor and return the number of returned products
+    return joinActor(id);
 }
 
 void Factory::startThief(int num_products,unsigned int fake_id){
-    //make new thread in the map
-    pthread_t &new_thread = (*threads_map)[fake_id];
+    //save the actor's future under its fake id
+    actor_slots->put(fake_id, launchThief(num_products, fake_id));
+}
+
+ActorFuture Factory::launchThief(int num_products,unsigned int fake_id){
+    //a replay starts its own thief, so the thief's stealProducts call is not replayed
+    TraceCall trace_call(operation_trace, OP_START_THIEF, num_products, static_cast<int>(fake_id));
 
     //make wrapper struct
     wrapper_struct* s = new wrapper_struct(this, num_products, fake_id);
 
     //update companies counter
-    pthread_mutex_lock(&thieves_counter_lock);
+    profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_START_THIEF);
     ++thieves_counter;
-    pthread_mutex_unlock(&thieves_counter_lock);
+    profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
 
-    //create new thread using wrapper functions
-    pthread_create(&new_thread, NULL, thiefWrapper , s);
+    //run the actor using wrapper functions
+    return launchActor(thiefWrapper, s);
 }
 
 void *thiefWrapper(void* s_struct){
@@ -332,174 +751,467 @@ void *thiefWrapper(void* s_struct){
     wrapper_struct s = *static_cast<wrapper_struct*>(s_struct);
     delete static_cast<wrapper_struct*>(s_struct);
 
-    //create pointer to return value (allocate with new)
-    int* retval;
+    //call stealProducts and publish the theft value
+    s.state->complete(s.factory->stealProducts(s.num_products, s.fake_id));
+    s.state->unref();
+    return NULL;
+}
+
+int Factory::stealAsThief(int num_products, unsigned int fake_id){
+    //recorded like launchThief, a replay starts a thief for it and skips the stealProducts call
+    TraceCall trace_call(operation_trace, OP_START_THIEF, num_products, static_cast<int>(fake_id));
 
-    //call stealProducts
-    retval = new int(s.factory->stealProducts(s.num_products, s.fake_id));
+    //companies wait for the thief from now on, stealProducts counts it out
+    profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_START_THIEF);
+    ++thieves_counter;
+    profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+    return stealProducts(num_products, fake_id);
+}
+
+void Factory::setStockListener(WakeFunc listener, void* arg){
+    stock_listener = listener;
+    stock_listener_arg = arg;
+}
 
-    //return the theft value
-    pthread_exit((void*)retval);
+size_t Factory::beginClusterOrder(){
+    profiledLock(&factory_lock, factory_lock_profile, OP_BUY_PRODUCTS);
+    //held until endClusterOrder, so no thief comes in between looking at the products and taking them
+    profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_BUY_PRODUCTS);
+    if(!is_factory_open || thieves_counter > 0){
+        return 0;
+    }
+    return numAvailableProducts();
+}
+
+void Factory::takeClusterOrder(int num_products, ProductQueue& taken){
+    //recorded while the factory is locked, so a replay makes it in the same order with the other calls
+    TraceCall trace_call(operation_trace, OP_TRY_BUY_MANY, num_products);
+    int num_rejected = 0;
+    takeOldestProducts(num_products, taken, NO_MIN_VALUE, &num_rejected);
+    trace_call.setResult(static_cast<int>(taken.size()));
+}
+
+void Factory::endClusterOrder(const ProductQueue& taken){
+    profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+    factoryFreeSignal(OP_BUY_PRODUCTS);
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    logOperation(WAL_SALE, 0, taken, true);
 }
 
 int Factory::stealProducts(int num_products,unsigned int fake_id){
-    //lock factory
-    pthread_mutex_lock(&factory_lock);
+    TraceCall trace_call(operation_trace, OP_STEAL_PRODUCTS, num_products, static_cast<int>(fake_id));
+    OperationTimer timer(operation_profile, OP_STEAL_PRODUCTS);
 
-    //take the reported thefts' lock
-    pthread_mutex_lock(&stolen_lock);
+    //lock factory
+    profiledLock(&factory_lock, factory_lock_profile, OP_STEAL_PRODUCTS);
 
     if(!is_factory_open){
         //thief is now waiting
         ++waiting_thieves_counter;
         //wait until the factory opens
-        pthread_mutex_unlock(&stolen_lock);
+        timer.waitBegin();
+        profiledWaitBegin(factory_lock_profile);
         pthread_cond_wait(&factory_open_condition, &factory_lock);
-        pthread_mutex_lock(&stolen_lock);
+        profiledWaitEnd(factory_lock_profile, OP_STEAL_PRODUCTS);
+        timer.waitEnd();
         //thief is no longer waiting
         --waiting_thieves_counter;
     }
 
-    //calculate how many products will be stolen
-    int num_stolen = std::min(num_products, static_cast<int>(available_products->size()));
-    //steal the products
-    std::list<Product> stolen = takeOldestProducts(num_stolen);
+    ProductQueue stolen;
+    int num_stolen = stealLocked(num_products, fake_id, stolen);
+    logOperation(WAL_THEFT, static_cast<int>(fake_id), stolen, true);
+    trace_call.setResult(num_stolen);
+    return num_stolen;
+}
+
+int Factory::stealLocked(int num_products, unsigned int fake_id, ProductQueue& stolen){
+    //steal up to num_products products and count how many were stolen
+    int num_stolen;
+    if(sharded_products != NULL){
+        num_stolen = static_cast<int>(sharded_products->takeOldest(static_cast<size_t>(num_products), stolen));
+    } else{
+        num_stolen = static_cast<int>(available_products->takeFront(static_cast<size_t>(num_products), stolen));
+        //the products leave the store and enter its thefts in one commit
+        if(store != NULL){
+            store->steal(stolen, static_cast<int>(fake_id));
+        }
+    }
+
+    //reserve the log positions while the factory is locked, so the thefts are logged in the order they happened
+    size_t log_position = thefts->reserve(static_cast<size_t>(num_stolen));
 
     //the thief is no longer in the factory so we should decrease the counter
-    pthread_mutex_lock(&thieves_counter_lock);
+    profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_STEAL_PRODUCTS);
     --thieves_counter;
-    pthread_mutex_unlock(&thieves_counter_lock);
+    profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
 
     //signal the next thread that it can take the lock
-    factoryFreeSignal();
+    factoryFreeSignal(OP_STEAL_PRODUCTS);
 
     //free the factory lock
-    pthread_mutex_unlock(&factory_lock);
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    stockAddedSignal();
 
     //report the thefts
-    for (auto& product : stolen){
-        thefts->emplace_back(product, static_cast<int>(fake_id));
-    }
-
-    //unlock reported thefts' lock
-    pthread_mutex_unlock(&stolen_lock);
+    stolen.forEach([this, fake_id, &log_position](const Product& product){
+        thefts->write(log_position++, product, static_cast<int>(fake_id));
+    });
 
     return num_stolen;
 }
 
-int Factory::finishThief(unsigned int fake_id){
-    //save the thread
-    pthread_t thief_thread = (*threads_map)[fake_id];
-
-    //create pointer to result address and variable to copy to result to before freeing the memory
-    int* num_stolen_address = NULL;
-    int num_stolen = 0;
+bool Factory::stealProductsAsync(int num_products, unsigned int fake_id, int* num_stolen, AsyncWait& wait){
+    if(wait.waiting_for == ASYNC_WAITING_FOR_LOG){
+        //stolen on an earlier call, only the record is left
+        return logOperationAsync(WAL_THEFT, static_cast<int>(fake_id), wait);
+    }
+    if(wait.waiting_for != ASYNC_WAITING_FOR_FACTORY_OPEN){
+        //the first call, the thief is in the factory from now on (like startThief)
+        profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, OP_START_THIEF);
+        ++thieves_counter;
+        profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
+    }
 
-    //remove it from the map
-    threads_map->erase(fake_id);
+    profiledLock(&factory_lock, factory_lock_profile, OP_STEAL_PRODUCTS);
+    if(!is_factory_open){
+        //wait until the factory opens
+        factory_open_waiters->push_back(&wait);
+        wait.waiting_for = ASYNC_WAITING_FOR_FACTORY_OPEN;
+        profiledUnlock(&factory_lock, factory_lock_profile);
+        return false;
+    }
+    wait.waiting_for = ASYNC_NOT_WAITING;
 
-    //join the thread and save the result pointer in buy_result_address
-    pthread_join(thief_thread, (void**)&num_stolen_address);
-    //copy the result to a local variable
-    num_stolen = *num_stolen_address;
-    //free the memory we allocated for the result
-    delete num_stolen_address;
+    //the rest is the same as stealProducts, but the record is logged without waiting
+    *num_stolen = stealLocked(num_products, fake_id, wait.unlogged);
+    return logOperationAsync(WAL_THEFT, static_cast<int>(fake_id), wait);
+}
 
-    return num_stolen;
+int Factory::finishThief(unsigned int fake_id){
+    //join the actor and return the number of stolen products
+    return joinActor(fake_id);
 }
 
 void Factory::closeFactory(){
+    TraceCall trace_call(operation_trace, OP_CLOSE_FACTORY);
     if(is_factory_open){
-        pthread_mutex_lock(&factory_lock);
-        is_factory_open = false;
-        pthread_mutex_unlock(&factory_lock);
+        profiledLock(&factory_lock, factory_lock_profile, OP_CLOSE_FACTORY);
+        __atomic_store_n(&is_factory_open, false, __ATOMIC_RELEASE);
+        profiledUnlock(&factory_lock, factory_lock_profile);
     }
 }
 
 void Factory::openFactory(){
+    TraceCall trace_call(operation_trace, OP_OPEN_FACTORY);
     if(!is_factory_open){
-        pthread_mutex_lock(&factory_lock);
-        is_factory_open = true;
+        profiledLock(&factory_lock, factory_lock_profile, OP_OPEN_FACTORY);
+        __atomic_store_n(&is_factory_open, true, __ATOMIC_RELEASE);
         if(waiting_thieves_counter > 0){
             pthread_cond_broadcast(&factory_open_condition);
         }
-        factoryFreeSignal();
-        pthread_mutex_unlock(&factory_lock);
+        for(auto waiter : *factory_open_waiters){
+            waiter->wake(waiter->arg);
+        }
+        factory_open_waiters->clear();
+        factoryFreeSignal(OP_OPEN_FACTORY);
+        profiledUnlock(&factory_lock, factory_lock_profile);
+        stockAddedSignal();
     }
 }
 
 void Factory::closeReturningService(){
+    TraceCall trace_call(operation_trace, OP_CLOSE_RETURNING_SERVICE);
     if(is_returning_open){
-        pthread_mutex_lock(&returning_service_lock);
+        profiledLock(&returning_service_lock, returning_service_lock_profile, OP_CLOSE_RETURNING_SERVICE);
         is_returning_open = false;
-        pthread_mutex_unlock(&returning_service_lock);
+        profiledUnlock(&returning_service_lock, returning_service_lock_profile);
     }
 }
 
 void Factory::openReturningService(){
+    TraceCall trace_call(operation_trace, OP_OPEN_RETURNING_SERVICE);
     if(!is_returning_open){
-        pthread_mutex_lock(&returning_service_lock);
+        profiledLock(&returning_service_lock, returning_service_lock_profile, OP_OPEN_RETURNING_SERVICE);
         is_returning_open = true;
         if(waiting_for_return_counter > 0){
             pthread_cond_broadcast(&returning_open_condition);
         }
-        pthread_mutex_unlock(&returning_service_lock);
+        for(auto waiter : *returning_open_waiters){
+            waiter->wake(waiter->arg);
+        }
+        returning_open_waiters->clear();
+        profiledUnlock(&returning_service_lock, returning_service_lock_profile);
     }
 }
 
 std::list<std::pair<Product, int>> Factory::listStolenProducts(){
-    //take the reported thefts' lock
-    pthread_mutex_lock(&stolen_lock);
-
-    //copy the thefts' list
-    std::list<std::pair<Product, int>> thefts_copy = *thefts;
+    size_t cursor = 0;
+    return listStolenProductsSince(cursor);
+}
 
-    //unlock the reported thefts' lock
-    pthread_mutex_unlock(&stolen_lock);
+size_t Factory::copyStolenProductsSince(size_t cursor, std::vector<std::pair<Product, int>>& thefts_copy){
+    //the vector keeps its capacity, so a reader that copies again and again stops allocating
+    thefts_copy.clear();
+    return thefts->forEachSince(cursor, [&thefts_copy](const TheftLog::Entry& entry){
+        thefts_copy.push_back(entry);
+    });
+}
 
-    //return the copy
+std::list<std::pair<Product, int>> Factory::listStolenProductsSince(size_t& cursor){
+    //copy only the thefts after the cursor, no lock is needed
+    std::list<std::pair<Product, int>> thefts_copy;
+    cursor = thefts->forEachSince(cursor, [&thefts_copy](const TheftLog::Entry& entry){
+        thefts_copy.push_back(entry);
+    });
     return thefts_copy;
 }
 
 std::list<Product> Factory::listAvailableProducts(){
+    TraceCall trace_call(operation_trace, OP_LIST_AVAILABLE_PRODUCTS);
+    //the list is built from a snapshot, after the factory is unlocked
+    std::list<Product> products = snapshotAvailableProducts().toList();
+    trace_call.setResult(static_cast<int>(products.size()));
+    return products;
+}
+
+size_t Factory::numAvailableProducts(){
+    return (sharded_products != NULL) ? sharded_products->size() : available_products->size();
+}
+
+unsigned long long Factory::numCompanyWakeups(){
+    profiledLock(&factory_lock, factory_lock_profile, OP_READ_STATS);
+    unsigned long long wakeups = waiting_companies->numWakeups();
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    return wakeups;
+}
+
+unsigned long long Factory::numCompanyHandoffs(){
+    profiledLock(&factory_lock, factory_lock_profile, OP_READ_STATS);
+    unsigned long long handoffs = waiting_companies->numHandoffs();
+    profiledUnlock(&factory_lock, factory_lock_profile);
+    return handoffs;
+}
+
+std::vector<MutexStats> Factory::lockStats(){
+    std::vector<MutexStats> stats;
+    std::pair<pthread_mutex_t*, MutexProfile*> profiled_locks[] = {
+        {&factory_lock, factory_lock_profile},
+        {&thieves_counter_lock, thieves_counter_lock_profile},
+        {&returning_service_lock, returning_service_lock_profile}
+    };
+    for(auto& profiled_lock : profiled_locks){
+        if(profiled_lock.second == NULL){
+            continue;
+        }
+        //the statistics are under the mutex they describe, reading them is not recorded
+        stats.push_back(MutexStats());
+        pthread_mutex_lock(profiled_lock.first);
+        profiled_lock.second->copyTo(stats.back());
+        pthread_mutex_unlock(profiled_lock.first);
+    }
+    return stats;
+}
+
+std::vector<OperationStats> Factory::operationStats(){
+    if(operation_profile == NULL){
+        return std::vector<OperationStats>();
+    }
+    return operation_profile->read();
+}
+
+void Factory::waitDurable(){
+    if(wal != NULL){
+        wal->waitDurable(wal->reservedPosition());
+    }
+}
+
+void Factory::logOperation(WalRecordType type, int fake_id, const ProductQueue& products, bool may_wait){
+    if(wal == NULL || products.empty()){
+        return;
+    }
+    WriteAheadLog::Reservation record = wal->reserve(products.size());
+    wal->write(record, type, fake_id, products);
+    if(may_wait && wal_wait_durable){
+        wal->waitDurable(record.end());
+    }
+}
+
+void Factory::logOperation(WalRecordType type, int fake_id, const Product& product, bool may_wait){
+    if(wal == NULL){
+        return;
+    }
+    WriteAheadLog::Reservation record = wal->reserve(1);
+    wal->write(record, type, fake_id, product);
+    if(may_wait && wal_wait_durable){
+        wal->waitDurable(record.end());
+    }
+}
+
+bool Factory::logOperationAsync(WalRecordType type, int fake_id, AsyncWait& wait){
+    if(wal == NULL || wait.unlogged.empty()){
+        wait.unlogged.clear();
+        wait.waiting_for = ASYNC_NOT_WAITING;
+        return true;
+    }
+    WriteAheadLog::Reservation record;
+    if(!wal->tryReserve(wait.unlogged.size(), record)){
+        //the products stay in wait.unlogged until the repeated call, the log wakes it once it has room
+        wait.waiting_for = ASYNC_WAITING_FOR_LOG;
+        wal->wakeOnRoom(wait.unlogged.size(), wait.wake, wait.arg);
+        return false;
+    }
+    wal->write(record, type, fake_id, wait.unlogged);
+    wait.unlogged.clear();
+    wait.waiting_for = ASYNC_NOT_WAITING;
+    return true;
+}
+
+void Factory::syncStore(){
+    if(store == NULL){
+        return;
+    }
+    profiledLock(&factory_lock, factory_lock_profile, OP_READ_STATS);
+    store->sync();
+    profiledUnlock(&factory_lock, factory_lock_profile);
+}
+
+void Factory::flushTrace(){
+    if(operation_trace != NULL){
+        operation_trace->flush();
+    }
+}
+
+InventorySnapshot Factory::snapshotAvailableProducts(){
+    InventorySnapshot snapshot;
+
+    //a sharded inventory makes its consistent snapshot by locking all its shards
+    if(sharded_products != NULL){
+        sharded_products->snapshot(snapshot);
+        return snapshot;
+    }
+
     //lock the factory lock
-    pthread_mutex_lock(&factory_lock);
+    profiledLock(&factory_lock, factory_lock_profile, OP_LIST_AVAILABLE_PRODUCTS);
+
+    //share the chunks of the available products, nothing is copied
+    snapshot.addPart(*available_products, NULL);
+
+    //unlock the factory lock
+    profiledUnlock(&factory_lock, factory_lock_profile);
+
+    return snapshot;
+}
+
+ValueSummary Factory::summarizeAvailableProducts(int num_threads){
+    InventorySnapshot snapshot = snapshotAvailableProducts();
+    return summarizeValues(snapshot, num_threads, bestFilterKernel(), actor_pool);
+}
 
-    //copy the available products list
-    std::list<Product> available_products_copy = *available_products;
+size_t Factory::countAvailableProductsInRange(int min_value, int max_value, int num_threads){
+    InventorySnapshot snapshot = snapshotAvailableProducts();
+    return countValuesInRange(snapshot, min_value, max_value, num_threads, bestFilterKernel(), actor_pool);
+}
 
-    //unlock the reported thefts' lock
-    pthread_mutex_unlock(&factory_lock);
+ValueHistogram Factory::histogramAvailableProducts(int low, int bucket_width, int num_buckets, int num_threads){
+    InventorySnapshot snapshot = snapshotAvailableProducts();
+    return histogramValues(snapshot, low, bucket_width, num_buckets, num_threads, actor_pool);
+}
+
+ActorFuture Factory::launchActor(ThreadPool::JobFunc actor, wrapper_struct* arg){
+    //the actor holds one reference and the future another, so the state lives until both are done with it
+    arg->state = new ActorState();
+    ActorFuture future(arg->state);
+
+    if(actor_pool != NULL){
+        //hand the actor to one of the pool's workers, nobody joins it
+        actor_pool->submitDetached(actor, arg);
+    } else{
+        //create a new thread for the actor, it is detached since its result is published through the future
+        //(detaching after creating it could race with a short actor that already exited)
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        pthread_t thread;
+        pthread_create(&thread, &attr, actor, arg);
+        pthread_attr_destroy(&attr);
+    }
+    return future;
+}
+
+int Factory::joinActor(unsigned int id){
+    //remove the actor from the map
+    ActorFuture future = actor_slots->take(id);
+
+    //an id that was never started has no result
+    if(!future.valid()){
+        return 0;
+    }
 
-    //return the copy
-    return available_products_copy;
+    //wait for it and return its result
+    return future.wait();
 }
 
-void Factory::factoryFreeSignal(){
+bool Factory::fillCompanyOrder(void* factory, void* order){
+    //called under factory_lock and thieves_counter_lock with no thieves around, like a company that buys
+    Factory* owner = static_cast<Factory*>(factory);
+    CompanyOrder* company_order = static_cast<CompanyOrder*>(order);
+    return owner->takeOldestProducts(company_order->num_products, *company_order->products, company_order->min_value,
+                                     company_order->num_rejected);
+}
+
+void Factory::factoryFreeSignal(FactoryOperation operation){
     //lock thieves_counter_lock so we can look at thieves_counter,
     //waiting_companies_counter is under factory_lock which is always locked before calling this function
-    pthread_mutex_lock(&thieves_counter_lock);
+    profiledLock(&thieves_counter_lock, thieves_counter_lock_profile, operation);
     //if there are now thieves waiting for the factory lock, and there are companies waiting for it
-    //and the factory is open broadcast to them
+    //and the factory is open wake the companies that the available products can satisfy
     if(is_factory_open && thieves_counter == 0 && waiting_companies_counter > 0){
-        pthread_cond_broadcast(&companies_condition);
+        size_t num_available = (sharded_products != NULL) ? sharded_products->size() : available_products->size();
+        waiting_companies->wakeSatisfiable(num_available, fillCompanyOrder, this);
     }
-    pthread_mutex_unlock(&thieves_counter_lock);
+    profiledUnlock(&thieves_counter_lock, thieves_counter_lock_profile);
 }
-//factory is always locked when this function is called
-std::list<Product> Factory::takeOldestProducts(int num_products){
-    if(num_products == 0){
-        return std::list<Product>();
+void Factory::productsAddedSignal(FactoryOperation operation){
+    //companies count themselves as waiting before they look at the products, so if no company is counted
+    //now, every company that comes later will see the products that were just added
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&waiting_companies_counter, __ATOMIC_SEQ_CST) > 0){
+        profiledLock(&factory_lock, factory_lock_profile, operation);
+        factoryFreeSignal(operation);
+        profiledUnlock(&factory_lock, factory_lock_profile);
     }
+}
 
-    std::list<Product> new_list;
-
-    //create an iterator pointing to the last product we want to take
-    auto last_to_take = available_products->begin();
-    std::advance(last_to_take, num_products);
-
-    //take all of the elements from the beginning of available_products to the num_products element
-    new_list.splice(new_list.begin(), *available_products, available_products->begin(), last_to_take);
+void Factory::stockAddedSignal(){
+    if(stock_listener != NULL){
+        stock_listener(stock_listener_arg);
+    }
+}
 
-    return new_list;
-}
\ No newline at end of file
+//factory is always locked when this function is called
+bool Factory::takeOldestProducts(int num_products, ProductQueue& taken, int min_value, int* num_rejected){
+    bool enough;
+    size_t rejected = 0;
+    if(min_value == NO_MIN_VALUE && sharded_products != NULL){
+        //a sharded inventory merges its shards by stamp
+        enough = sharded_products->tryTakeOldest(static_cast<size_t>(num_products), taken);
+    } else if(min_value == NO_MIN_VALUE){
+        //whole chunks are relinked to taken, so there is no walk over the products
+        enough = available_products->tryTakeFront(static_cast<size_t>(num_products), taken);
+    } else if(sharded_products != NULL){
+        enough = sharded_products->tryTakeOldestFiltered(static_cast<size_t>(num_products), min_value, taken, rejected);
+    } else{
+        isAboveMinValueFunctor pred = isAboveMinValueFunctor(min_value);
+        enough = available_products->tryTakeFrontIf(static_cast<size_t>(num_products), pred, taken, rejected);
+    }
+    *num_rejected = static_cast<int>(rejected);
+    if(enough && store != NULL){
+        if(min_value == NO_MIN_VALUE){
+            store->takeFront(static_cast<size_t>(num_products));
+        } else{
+            store->takeFrontIf(static_cast<size_t>(num_products), min_value);
+        }
+    }
+    return enough;
+}
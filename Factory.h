@@ -20,33 +20,189 @@
 }while(false)
 
 #include <pthread.h>
+#include <climits>
 #include <list>
-#include <unordered_map>
+#include <vector>
+#include "ActorFuture.h"
+#include "ActorSlotMap.h"
 #include "Product.h"
+#include "ProductQueue.h"
+#include "CompanyWaitQueue.h"
+#include "FactoryOperation.h"
+#include "MutexProfile.h"
+#include "OperationProfile.h"
+#include "OperationTrace.h"
+#include "PersistentStore.h"
+#include "InventorySnapshot.h"
+#include "InventoryAnalytics.h"
+#include "ShardedInventory.h"
+#include "TheftLog.h"
+#include "ThreadPool.h"
+#include "WriteAheadLog.h"
+
+//min_value that keeps every product, buyProducts without a min_value uses it
+#define NO_MIN_VALUE INT_MIN
+
+//produce calls with at least this many products build their chunks before locking the factory
+#define BULK_PRODUCE_THRESHOLD CHUNK_CAPACITY
+
+//construction options of a Factory, the defaults give the original behaviour
+struct FactoryOptions{
+    //number of pooled worker threads that run the actors (producers, buyers and thieves).
+    //0 means every actor gets a thread of its own that is created on start and joined on finish
+    int pool_threads;
+
+    //when true tryBuyOne first tries to take the oldest product with a single CAS, without factory_lock,
+    //and only falls back to trying factory_lock when that fails
+    bool lock_free_buy;
+
+    //number of shards the inventory is split into (see ShardedInventory for the ordering policy).
+    //0 keeps a single inventory under factory_lock, a negative number gives one shard per online cpu.
+    //producers and simple buyers of a sharded inventory never take factory_lock, lock_free_buy is ignored
+    int inventory_shards;
+
+    //when true company buyers filter their purchase inside the factory (buyProducts with a min_value),
+    //so the products they don't want never leave the inventory and are not returned through the returning service
+    bool filter_company_purchases;
+
+    //when true every unlock wakes all the waiting companies, instead of only the ones the available
+    //products can satisfy (see CompanyWaitQueue). kept for comparison
+    bool broadcast_company_wakeups;
+
+    //when true companies (buyProducts) are served strictly in arrival order: a company that arrived later
+    //never buys before one that arrived earlier, even when there are enough products for it and not for the
+    //first one. without it a company that wants many products may wait forever behind smaller orders
+    bool fifo_company_orders;
+
+    //when true the thread that makes products available (a producer, a return, the last thief to leave) hands
+    //them straight to the waiting companies they satisfy, in the same critical section, so a company wakes up
+    //holding its products instead of taking factory_lock again to look for them. false keeps the old behaviour
+    //of waking the companies to look
+    bool company_handoff;
+
+    //when true the factory's mutexes record their contention (wait and hold times, contended acquisitions
+    //and which operation took them), read it with Factory::lockStats. when false locking costs one more branch
+    bool profile_locks;
+
+    //when true produce, tryBuyOne, buyProducts, returnProducts and stealProducts record how long every call took,
+    //split to waiting on condition vars and the rest. read it with Factory::operationStats
+    bool profile_operations;
+
+    //when not NULL every call of produce, tryBuyOne, tryBuyMany, buyProducts, returnProducts, stealProducts,
+    //startThief (and launchThief), listAvailableProducts and the open and close functions is recorded to a trace
+    //file at this path (see OperationTrace), that replay_trace can run again. the asynchronous calls are not recorded
+    const char* trace_path;
+
+    //when not NULL the inventory and the theft log are kept in a memory-mapped file at this path too (see
+    //PersistentStore), and a factory that opens an existing file starts with its products and thefts.
+    //a stored factory keeps a single inventory under factory_lock: inventory_shards and lock_free_buy are ignored
+    const char* store_path;
+
+    //when not NULL every sale (tryBuyOne, tryBuyMany, buyProducts), return and theft is appended to a write-ahead
+    //log at this path (see WriteAheadLog). the log is written by a thread of its own. sales and thefts are logged
+    //after the factory is unlocked, a return reserves its record under factory_lock (so it comes before the sales of
+    //the returned products) but never waits for the log under it, it unlocks the factory until the log has room.
+    //an asynchronous call never waits for the log at all, see ASYNC_WAITING_FOR_LOG
+    const char* wal_path;
+    //sync the log after every batch of records, without it the records only reach the page cache
+    bool wal_sync;
+    //when true the calls that sell, return or steal return only once their record is on the disk
+    //(the asynchronous calls never wait). Factory::waitDurable waits for all the records so far instead
+    bool wal_wait_durable;
+
+    FactoryOptions() : pool_threads(0), lock_free_buy(false), inventory_shards(0), filter_company_purchases(false),
+                       broadcast_company_wakeups(false), fifo_company_orders(false), company_handoff(false),
+                       profile_locks(false),
+                       profile_operations(false),
+                       trace_path(NULL), store_path(NULL), wal_path(NULL), wal_sync(true), wal_wait_durable(false){}
+};
+
+//the arguments of an actor
+struct wrapper_struct;
+
+//what an asynchronous call (see AsyncWait) is registered to wait for
+enum AsyncWaitFor{
+    ASYNC_NOT_WAITING,
+    //products, or for the thieves to leave
+    ASYNC_WAITING_FOR_PRODUCTS,
+    ASYNC_WAITING_FOR_FACTORY_OPEN,
+    ASYNC_WAITING_FOR_RETURNING_SERVICE,
+    //room in the full log: for the record of a sale or theft that is done (the repeated call only logs it), or
+    //for the record of a return before it is done (the repeated call starts over)
+    ASYNC_WAITING_FOR_LOG
+};
+
+/*a caller of the asynchronous calls (buyProductsAsync, returnProductsAsync and stealProductsAsync), for actors
+that are not threads (see the coroutine engine of sim_factory). a call that can't finish now registers the caller
+and returns false, and wake(arg) is called once it may finish - under a lock of the factory or of its log, so wake
+must not call the factory. the caller then repeats the same call with the same AsyncWait until it returns true*/
+struct AsyncWait{
+    WakeFunc wake;
+    void* arg;
+    //kept by the factory between the calls of one operation
+    AsyncWaitFor waiting_for;
+    //the company's place in line when the factory serves companies in arrival order
+    unsigned long long ticket;
+    //the products of a sale or theft whose record the full log had no room for yet
+    ProductQueue unlogged;
+
+    AsyncWait(WakeFunc wake, void* arg) : wake(wake), arg(arg), waiting_for(ASYNC_NOT_WAITING), ticket(0){}
+};
 
 class Factory{
 private:
-    //map of threads by id
-    std::unordered_map<unsigned int, pthread_t>* threads_map;
+    //the futures of the actors that were started with an id, by id - can be used without a lock
+    ActorSlotMap* actor_slots;
+
+    //pool that runs the actors, NULL when every actor gets a new thread
+    ThreadPool* actor_pool;
+
+    //queue of all available products from oldest produced to newest - under factory_lock
+    ProductQueue* available_products;
 
-    //list of all available products from oldest produced to newest - under factory_lock
-    std::list<Product>* available_products;
+    //the inventory when it is sharded, NULL otherwise (and then available_products is used)
+    //has locks of its own, multi-product takes are still done under factory_lock
+    ShardedInventory* sharded_products;
 
-    /*list of all the filed thefts in the order they happened, each element in the list is a pair of
-    stolen Product and the fake_id of the thief who stole it.*/
-    //under stolen_lock
-    std::list<std::pair<Product, int>>* thefts;
+    /*log of all the filed thefts in the order they happened, each entry is a pair of stolen Product
+    and the fake_id of the thief who stole it. appends and reads do not need a lock.*/
+    TheftLog* thefts;
 
     //lock for the factory
     pthread_mutex_t factory_lock;
-    pthread_mutex_t stolen_lock;
     pthread_mutex_t thieves_counter_lock;
     pthread_mutex_t returning_service_lock;
 
     //condition vars for the different thread types, used by the factory lock
     pthread_cond_t returning_open_condition;
     pthread_cond_t factory_open_condition;
-    pthread_cond_t companies_condition;
+
+    //companies waiting for products or for the thieves to leave - under factory_lock
+    CompanyWaitQueue* waiting_companies;
+    //hand the products to the waiting companies (FactoryOptions::company_handoff)
+    bool company_handoff;
+
+    //called when more products may be bought (see setStockListener), NULL when nobody listens
+    WakeFunc stock_listener;
+    void* stock_listener_arg;
+
+    //contention of every mutex, NULL when profile_locks is off - every profile is under its mutex
+    MutexProfile* factory_lock_profile;
+    MutexProfile* thieves_counter_lock_profile;
+    MutexProfile* returning_service_lock_profile;
+
+    //latencies of the operations, NULL when profile_operations is off - has locks of its own
+    OperationProfile* operation_profile;
+
+    //the trace the calls are recorded to, NULL when trace_path is not set - has locks of its own
+    OperationTrace* operation_trace;
+
+    //the file copy of available_products and thefts, NULL when store_path is not set - under factory_lock
+    PersistentStore* store;
+
+    //the log of sales, returns and thefts, NULL when wal_path is not set - can be used without a lock
+    WriteAheadLog* wal;
+    bool wal_wait_durable;
 
     //counters for thread types that need them - under thieves_counter_lock
     int thieves_counter;
@@ -54,42 +210,131 @@ private:
     //counter for the number of thieves waiting for the factory to open - under factory_lock
     int waiting_thieves_counter;
 
-    //counter for the number of companies waiting for the factory lock (while buying or returning) - under factory_lock
+    //counter for the number of companies waiting for the factory lock (while buying or returning) - under factory_lock,
+    //changed with __atomic builtins because producers of a sharded inventory read it without the lock
     int waiting_companies_counter;
 
     //counter for companies waiting for the returning service - under returning_service_lock
     int waiting_for_return_counter;
 
+    //asynchronous thieves waiting for the factory to open - under factory_lock
+    std::vector<AsyncWait*>* factory_open_waiters;
+    //asynchronous companies waiting for the returning service to open - under returning_service_lock
+    std::vector<AsyncWait*>* returning_open_waiters;
+
     //flag that is true when the returning service is open - under returning_service_lock
     bool is_returning_open;
 
-    //flag that is true when the factory is open - under factory_lock
+    //flag that is true when the factory is open - under factory_lock,
+    //written with __atomic_store_n so that lock free buyers can read it without the lock
     bool is_factory_open;
 
-    //calls the correct condition vars when factory is free
-    void factoryFreeSignal();
-    //takes the num_products oldest products from available_products and returns them as a list (same order)
-    std::list<Product> takeOldestProducts(int num_products);
+    //true when tryBuyOne may buy without factory_lock (the inventory allows concurrent pops)
+    bool lock_free_buy;
+
+    //runs actor(arg) on a new (detached) thread or on the pool, the actor publishes its result to the returned future
+    ActorFuture launchActor(ThreadPool::JobFunc actor, wrapper_struct* arg);
+    //removes the actor saved under id from actor_slots, waits for it to finish and returns its result
+    int joinActor(unsigned int id);
+
+    /*the part of stealProducts after the factory is open, factory_lock must be locked and is unlocked.
+    the stolen products are moved to stolen, for the caller to log*/
+    int stealLocked(int num_products, unsigned int fake_id, ProductQueue& stolen);
+    //calls the correct condition vars when factory is free, operation is the caller
+    void factoryFreeSignal(FactoryOperation operation);
+    //wakes waiting companies after products were added without factory_lock (sharded inventory)
+    void productsAddedSignal(FactoryOperation operation);
+    //calls the stock listener, the factory must not be locked
+    void stockAddedSignal();
+    //produce(batch) without timing it, for produce calls that are already timed
+    void produceBatch(ProductQueue& batch);
+    //tryBuyOne without timing or logging it, returns a product with an id of -1 if none was bought
+    Product buyOne();
+    /*appends an operation that is done to the log (nothing without a log or products), and waits until it is on
+    the disk if may_wait and wal_wait_durable. must be called without the factory's locks*/
+    void logOperation(WalRecordType type, int fake_id, const ProductQueue& products, bool may_wait);
+    void logOperation(WalRecordType type, int fake_id, const Product& product, bool may_wait);
+    /*logs the operation of an asynchronous call whose products are in wait.unlogged, without waiting.
+    returns false when the log is full, after it left wait.wake with the log (the call then must not touch wait)*/
+    bool logOperationAsync(WalRecordType type, int fake_id, AsyncWait& wait);
+    /*moves the num_products oldest products from available_products to the back of taken (same order).
+    returns false and takes nothing if there are less than num_products products (lock free buyers
+    may take products between checking the size and taking).
+    only products with a value of at least min_value are taken, the others stay in their place and
+    their number is written to num_rejected*/
+    bool takeOldestProducts(int num_products, ProductQueue& taken, int min_value, int* num_rejected);
+    //the FillFunc of waiting_companies: fills a CompanyOrder of a waiting company with takeOldestProducts
+    static bool fillCompanyOrder(void* factory, void* order);
+
+    //true when company buyers use the filtering buyProducts
+    bool filter_company_purchases;
 
 public:
     Factory();
+    explicit Factory(const FactoryOptions& options);
     ~Factory();
     
     void startProduction(int num_products, Product* products, unsigned int id);
+    /*like startProduction, but the actor is not saved under an id: its result is read through the returned future
+    (wait, poll, then or an ActorGroup), and it needs no finish call. the same goes for the other launch functions*/
+    ActorFuture launchProduction(int num_products, Product* products);
     void produce(int num_products, Product* products);
+    //adds all the products of batch (in order) by linking its chunks in O(1), batch is left empty
+    void produce(ProductQueue& batch);
     void finishProduction(unsigned int id);
     
     void startSimpleBuyer(unsigned int id);
+    //the future's result is the id of the bought product, or -1
+    ActorFuture launchSimpleBuyer();
     int tryBuyOne();
     int finishSimpleBuyer(unsigned int id);
 
+    //a simple buyer that buys up to num_products products at once with tryBuyMany
+    void startBulkBuyer(int num_products, unsigned int id);
+    //the future's result is the number of bought products
+    ActorFuture launchBulkBuyer(int num_products);
+    /*like tryBuyOne for up to num_products products: buys the oldest available ones in one critical section
+    and returns them (oldest first), never waits. may return less products than asked for, or none*/
+    std::list<Product> tryBuyMany(int num_products);
+    //returns the number of products the buyer bought
+    int finishBulkBuyer(unsigned int id);
+
     void startCompanyBuyer(int num_products, int min_value,unsigned int id);
+    //the future's result is the number of returned products
+    ActorFuture launchCompanyBuyer(int num_products, int min_value);
     std::list<Product> buyProducts(int num_products);
+    /*buys the num_products oldest products like buyProducts(num_products), but in the same critical section
+    only the ones with a value of at least min_value are bought. the others stay in the inventory in their
+    place, and their number is written to num_rejected*/
+    std::list<Product> buyProducts(int num_products, int min_value, int* num_rejected);
     void returnProducts(std::list<Product> products,unsigned int id);
     int finishCompanyBuyer(unsigned int id);
 
+    //the non-blocking forms of buyProducts, returnProducts and stealProducts, see AsyncWait
+    bool buyProductsAsync(int num_products, int min_value, int* num_rejected, std::list<Product>& bought,
+                          AsyncWait& wait);
+    bool returnProductsAsync(const std::list<Product>& products, AsyncWait& wait);
+    //counts the thief in (like startThief) on its first call
+    bool stealProductsAsync(int num_products, unsigned int fake_id, int* num_stolen, AsyncWait& wait);
+
     void startThief(int num_products,unsigned int fake_id);
+    //the future's result is the number of stolen products
+    ActorFuture launchThief(int num_products,unsigned int fake_id);
     int stealProducts(int num_products,unsigned int fake_id);
+    //counts the calling thread in as a thief (like startThief) and steals on it, the same as a thief actor
+    int stealAsThief(int num_products, unsigned int fake_id);
+
+    /*for a FactoryCluster: listener(arg) is called without a factory lock after products were added (produced or
+    returned), the factory opened or the last thief left. set it before the factory is used*/
+    void setStockListener(WakeFunc listener, void* arg);
+    /*for a FactoryCluster order that buys from several factories and takes nothing unless it gets every product.
+    beginClusterOrder locks the factory and returns the number of products a company could buy now (0 while the
+    factory is closed or thieves are around), takeClusterOrder takes the num_products oldest of them (recorded like
+    a tryBuyMany that bought them) and endClusterOrder unlocks the factory and logs the sale.
+    the factories of an order are locked in the same order by every caller, so two orders can't deadlock*/
+    size_t beginClusterOrder();
+    void takeClusterOrder(int num_products, ProductQueue& taken);
+    void endClusterOrder(const ProductQueue& taken);
     int finishThief(unsigned int fake_id);
 
     void closeFactory();
@@ -99,7 +344,38 @@ public:
     void openReturningService();
     
     std::list<std::pair<Product, int>> listStolenProducts();
+    /*returns the thefts that were filed since cursor and moves cursor past them, so the thefts can be
+    followed without copying the whole history every time. a new reader starts with cursor 0.*/
+    std::list<std::pair<Product, int>> listStolenProductsSince(size_t& cursor);
+    //the same as listStolenProductsSince, but copies to a vector the caller reuses, returns the new cursor
+    size_t copyStolenProductsSince(size_t cursor, std::vector<std::pair<Product, int>>& thefts_copy);
     std::list<Product> listAvailableProducts();
+    //the number of available products, read without a lock so it may be out of date as soon as it returns
+    size_t numAvailableProducts();
+    //the number of times a waiting company was woken so far
+    unsigned long long numCompanyWakeups();
+    //the number of those wakes that handed the company its products (FactoryOptions::company_handoff)
+    unsigned long long numCompanyHandoffs();
+    //the contention statistics of every mutex of the factory, empty unless profile_locks was set
+    std::vector<MutexStats> lockStats();
+    //the latencies of every operation (indexed by FactoryOperation), empty unless profile_operations was set
+    std::vector<OperationStats> operationStats();
+    //writes the recorded calls to the trace file, they are written anyway when the factory is destroyed
+    void flushTrace();
+    //waits until every sale, return and theft that was logged so far is on the disk
+    void waitDurable();
+    //waits until the store is on the disk, so it survives a crash of the machine (not only of the process)
+    void syncStore();
+    /*returns a point in time view of the available products that shares the inventory's storage instead
+    of copying it. only taking it holds the lock (one reference per chunk), reading it blocks nobody.*/
+    InventorySnapshot snapshotAvailableProducts();
+    /*aggregates over the values of the available products, computed in place over a snapshot of them (see
+    InventoryAnalytics.h), so the factory is locked only while the snapshot is taken. num_threads threads
+    (at least one, the caller's) share the products, the others are the pool's workers when pool_threads is set.*/
+    ValueSummary summarizeAvailableProducts(int num_threads);
+    //the number of available products worth at least min_value and at most max_value
+    size_t countAvailableProductsInRange(int min_value, int max_value, int num_threads);
+    ValueHistogram histogramAvailableProducts(int low, int bucket_width, int num_buckets, int num_threads);
 
 };
 #endif // FACTORY_H_
@@ -0,0 +1,272 @@
+#include "FactoryCluster.h"
+#include <algorithm>
+
+size_t routeRoundRobin(FactoryCluster& cluster, FactoryOperation /*operation*/, int /*num_products*/, void* /*arg*/){
+    return static_cast<size_t>(cluster.nextRoundRobin() % cluster.numInstances());
+}
+
+size_t routeLeastLoaded(FactoryCluster& cluster, FactoryOperation /*operation*/, int /*num_products*/, void* /*arg*/){
+    size_t best = 0;
+    int best_load = cluster.load(0);
+    for(size_t i=1; i<cluster.numInstances(); i++){
+        int load = cluster.load(i);
+        if(load < best_load){
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+size_t routeStockAware(FactoryCluster& cluster, FactoryOperation operation, int /*num_products*/, void* /*arg*/){
+    //new stock evens the instances out, buyers and thieves go where they are most likely to find products
+    bool adds_stock = (operation == OP_PRODUCE || operation == OP_RETURN_PRODUCTS);
+    size_t best = 0;
+    size_t best_stock = cluster.stock(0);
+    for(size_t i=1; i<cluster.numInstances(); i++){
+        size_t stock = cluster.stock(i);
+        if(adds_stock ? (stock < best_stock) : (stock > best_stock)){
+            best = i;
+            best_stock = stock;
+        }
+    }
+    return best;
+}
+
+FactoryCluster::FactoryCluster(int num_instances, const FactoryOptions& options, RoutingPolicy policy,
+                               void* policy_arg) :
+        loads(new std::atomic<int>[num_instances > 0 ? num_instances : 1]),
+        demands(new std::atomic<long long>[num_instances > 0 ? num_instances : 1]), next_round_robin(0),
+        stock_changes(0), split_waiters(0), policy(policy), policy_arg(policy_arg){
+    INIT_MUTEX_LOCK(stock_lock);
+    pthread_cond_init(&stock_added, NULL);
+    if(num_instances < 1){
+        num_instances = 1;
+    }
+    //the options point into paths, so it must not grow after they are taken
+    paths.reserve(3 * static_cast<size_t>(num_instances));
+    for(int i=0; i<num_instances; i++){
+        FactoryOptions instance_options = options;
+        const char** instance_paths[] = {&instance_options.trace_path, &instance_options.store_path,
+                                         &instance_options.wal_path};
+        for(auto path : instance_paths){
+            if(*path != NULL){
+                paths.push_back(std::string(*path) + "." + std::to_string(i));
+                *path = paths.back().c_str();
+            }
+        }
+        instances.push_back(new Factory(instance_options));
+        instances.back()->setStockListener(stockAdded, this);
+        loads[i].store(0);
+        demands[i].store(0);
+    }
+}
+
+FactoryCluster::~FactoryCluster(){
+    for(auto factory : instances){
+        delete factory;
+    }
+    delete[] loads;
+    delete[] demands;
+    pthread_cond_destroy(&stock_added);
+    pthread_mutex_destroy(&stock_lock);
+}
+
+size_t FactoryCluster::begin(FactoryOperation operation, int num_products){
+    size_t index = policy(*this, operation, num_products, policy_arg);
+    loads[index].fetch_add(1, std::memory_order_relaxed);
+    return index;
+}
+
+void FactoryCluster::done(size_t index){
+    loads[index].fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::list<Product> FactoryCluster::buyAt(size_t index, int num_products, int min_value, int* num_rejected){
+    demands[index].fetch_add(num_products);
+    std::list<Product> bought = instances[index]->buyProducts(num_products, min_value, num_rejected);
+    demands[index].fetch_sub(num_products);
+    return bought;
+}
+
+bool FactoryCluster::tryBuyAcross(size_t routed, int num_products, std::list<Product>& bought){
+    //every instance stays locked until the order is taken, so it gets all of its products or none
+    std::vector<size_t> buyable(instances.size());
+    size_t num_buyable = 0;
+    for(size_t index=0; index<instances.size(); index++){
+        buyable[index] = instances[index]->beginClusterOrder();
+        num_buyable += buyable[index];
+    }
+    bool enough = (num_buyable >= static_cast<size_t>(num_products));
+    std::vector<ProductQueue> parts(instances.size());
+    if(enough){
+        size_t num_left = static_cast<size_t>(num_products);
+        for(size_t i=0; i<instances.size() && num_left > 0; i++){
+            size_t index = (routed + i) % instances.size();
+            size_t num_taken = std::min(num_left, buyable[index]);
+            if(num_taken > 0){
+                instances[index]->takeClusterOrder(static_cast<int>(num_taken), parts[index]);
+                num_left -= num_taken;
+            }
+        }
+    }
+    for(size_t index=instances.size(); index-- > 0;){
+        instances[index]->endClusterOrder(parts[index]);
+    }
+
+    if(enough){
+        for(size_t i=0; i<instances.size(); i++){
+            std::list<Product> part = parts[(routed + i) % instances.size()].toList();
+            bought.splice(bought.end(), part);
+        }
+    }
+    return enough;
+}
+
+void FactoryCluster::stockAdded(void* cluster){
+    FactoryCluster* owner = static_cast<FactoryCluster*>(cluster);
+    //a split order counts itself before it looks at the stock, so if none is counted now, every split order
+    //that comes later sees the change
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(owner->split_waiters.load() > 0){
+        pthread_mutex_lock(&owner->stock_lock);
+        ++owner->stock_changes;
+        pthread_cond_broadcast(&owner->stock_added);
+        pthread_mutex_unlock(&owner->stock_lock);
+    }
+}
+
+size_t FactoryCluster::numInstances() const{
+    return instances.size();
+}
+
+Factory& FactoryCluster::instance(size_t index){
+    return *instances[index];
+}
+
+int FactoryCluster::load(size_t index) const{
+    return loads[index].load(std::memory_order_relaxed);
+}
+
+size_t FactoryCluster::stock(size_t index){
+    return instances[index]->numAvailableProducts();
+}
+
+unsigned long long FactoryCluster::nextRoundRobin(){
+    return next_round_robin.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FactoryCluster::produce(int num_products, Product* products){
+    size_t index = begin(OP_PRODUCE, num_products);
+    //waiting companies come first, whatever the policy
+    size_t target = index;
+    long long most_demand = 0;
+    for(size_t i=0; i<instances.size(); i++){
+        long long demand = demands[i].load();
+        if(demand > most_demand){
+            target = i;
+            most_demand = demand;
+        }
+    }
+    instances[target]->produce(num_products, products);
+    done(index);
+}
+
+int FactoryCluster::tryBuyOne(){
+    size_t routed = begin(OP_TRY_BUY_ONE, 1);
+    int id = -1;
+    //the routed instance first, then the others in turn
+    for(size_t i=0; i<instances.size() && id == -1; i++){
+        id = instances[(routed + i) % instances.size()]->tryBuyOne();
+    }
+    done(routed);
+    return id;
+}
+
+std::list<Product> FactoryCluster::buyProducts(int num_products){
+    size_t routed = begin(OP_BUY_PRODUCTS, num_products);
+    std::list<Product> bought;
+    if(stock(routed) >= static_cast<size_t>(num_products)){
+        //the usual case, the whole order from one instance
+        int num_rejected = 0;
+        bought = buyAt(routed, num_products, NO_MIN_VALUE, &num_rejected);
+        done(routed);
+        return bought;
+    }
+
+    //an order bigger than the routed instance's stock takes its products from every instance at once, and
+    //waits holding nothing until the stock of an instance changes when they are not there
+    split_waiters.fetch_add(1);
+    pthread_mutex_lock(&stock_lock);
+    while(true){
+        //a change after this is seen below, even if it comes before the order looks at the instances
+        unsigned long long changes = stock_changes;
+        pthread_mutex_unlock(&stock_lock);
+        bool done_buying = tryBuyAcross(routed, num_products, bought);
+        pthread_mutex_lock(&stock_lock);
+        if(done_buying){
+            break;
+        }
+        while(stock_changes == changes){
+            pthread_cond_wait(&stock_added, &stock_lock);
+        }
+    }
+    pthread_mutex_unlock(&stock_lock);
+    split_waiters.fetch_sub(1);
+    done(routed);
+    return bought;
+}
+
+std::list<Product> FactoryCluster::buyProducts(int num_products, int min_value, int* num_rejected){
+    size_t index = begin(OP_BUY_PRODUCTS, num_products);
+    std::list<Product> bought = buyAt(index, num_products, min_value, num_rejected);
+    done(index);
+    return bought;
+}
+
+void FactoryCluster::returnProducts(std::list<Product> products, unsigned int id){
+    size_t index = begin(OP_RETURN_PRODUCTS, static_cast<int>(products.size()));
+    instances[index]->returnProducts(products, id);
+    done(index);
+}
+
+int FactoryCluster::stealProducts(int num_products, unsigned int fake_id){
+    size_t routed = begin(OP_STEAL_PRODUCTS, num_products);
+    int num_stolen = 0;
+    for(size_t i=0; i<instances.size() && num_stolen < num_products; i++){
+        size_t index = (routed + i) % instances.size();
+        //the other instances are only visited when they have something to steal
+        if(i > 0 && stock(index) == 0){
+            continue;
+        }
+        num_stolen += instances[index]->stealAsThief(num_products - num_stolen, fake_id);
+    }
+    done(routed);
+    return num_stolen;
+}
+
+size_t FactoryCluster::numAvailableProducts(){
+    size_t num_products = 0;
+    for(auto factory : instances){
+        num_products += factory->numAvailableProducts();
+    }
+    return num_products;
+}
+
+std::list<Product> FactoryCluster::listAvailableProducts(){
+    std::list<Product> products;
+    for(auto factory : instances){
+        std::list<Product> instance_products = factory->listAvailableProducts();
+        products.splice(products.end(), instance_products);
+    }
+    return products;
+}
+
+std::list<std::pair<Product, int>> FactoryCluster::listStolenProducts(){
+    std::list<std::pair<Product, int>> thefts;
+    for(auto factory : instances){
+        std::list<std::pair<Product, int>> instance_thefts = factory->listStolenProducts();
+        thefts.splice(thefts.end(), instance_thefts);
+    }
+    return thefts;
+}
@@ -0,0 +1,110 @@
+#ifndef FACTORY_CLUSTER_H_
+#define FACTORY_CLUSTER_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <vector>
+#include "Factory.h"
+
+class FactoryCluster;
+
+//picks the instance a call of operation for num_products products goes to, an index below numInstances()
+typedef size_t (*RoutingPolicy)(FactoryCluster& cluster, FactoryOperation operation, int num_products, void* arg);
+
+//every call goes to the next instance in turn
+size_t routeRoundRobin(FactoryCluster& cluster, FactoryOperation operation, int num_products, void* arg);
+//every call goes to the instance with the fewest calls in progress (the first of them on a tie)
+size_t routeLeastLoaded(FactoryCluster& cluster, FactoryOperation operation, int num_products, void* arg);
+//products go to the instance with the least stock, buyers and thieves go to the one with the most
+size_t routeStockAware(FactoryCluster& cluster, FactoryOperation operation, int num_products, void* arg);
+
+/**
+ * A front end to N Factory instances, so the calls are spread over N lock domains instead of one.
+ * Every call is routed to one instance by a RoutingPolicy, and made there with the instance's own semantics:
+ * - produce adds all the products to the routed instance, so products produced together stay in order. While
+ *   companies wait at an instance, produce goes to the one with the most waiting demand instead of the routed
+ *   one, so a policy that routes away from the waiting companies can't starve them.
+ * - tryBuyOne tries the routed instance first and then the others, so it fails only if every instance
+ *   looked empty.
+ * - buyProducts buys the whole order from the routed instance when it has the stock. Otherwise the order is
+ *   split across the instances: it locks every instance (in index order) and, if the open instances without
+ *   thieves have the stock between them, takes the parts (routed instance first) before unlocking any of them.
+ *   Otherwise it takes nothing and waits until an instance gets products, opens or sees its last thief leave,
+ *   and tries again. A split order never holds products while it waits, so two split orders can't each hold part
+ *   of the stock that only one of them needs. The products are the oldest of every instance, not of the whole
+ *   cluster, and a split order does not wait for its turn behind the companies that wait at an instance.
+ *   The filtering buyProducts (min_value) is never split, it waits at the routed instance.
+ * - stealProducts steals from the routed instance, and the rest from the others in turn. Every instance the
+ *   thief steals from counts it in like a thief actor, so the companies there wait for it as usual.
+ * The instances are independent factories (closing one does not close the others). The trace, store and
+ * log paths of the options get the instance's index as a suffix (".0", ".1", ...).
+ */
+class FactoryCluster{
+    std::vector<Factory*> instances;
+    //the per-instance paths, the options of an instance point into them
+    std::vector<std::string> paths;
+    //calls in progress per instance, for routeLeastLoaded
+    std::atomic<int>* loads;
+    //products that companies wait for (in buyProducts) per instance
+    std::atomic<long long>* demands;
+    std::atomic<unsigned long long> next_round_robin;
+
+    //split orders wait on stock_added for the instances' stock to change
+    pthread_mutex_t stock_lock;
+    pthread_cond_t stock_added;
+    //the number of times the instances' stock changed while split orders waited - under stock_lock
+    unsigned long long stock_changes;
+    //split orders that wait or are about to, the instances only wake them when there are any
+    std::atomic<int> split_waiters;
+
+    RoutingPolicy policy;
+    void* policy_arg;
+
+    //routes a call and counts it in at the instance, the caller must call done(index)
+    size_t begin(FactoryOperation operation, int num_products);
+    void done(size_t index);
+    //buyProducts at the instance, with the products counted as waiting demand
+    std::list<Product> buyAt(size_t index, int num_products, int min_value, int* num_rejected);
+    //buys the whole order across the instances (routed instance first) or nothing
+    bool tryBuyAcross(size_t routed, int num_products, std::list<Product>& bought);
+    //the stock listener of every instance, wakes the split orders
+    static void stockAdded(void* cluster);
+
+    //copying is not allowed
+    FactoryCluster(const FactoryCluster&);
+    FactoryCluster& operator=(const FactoryCluster&);
+
+public:
+    //num_instances factories with the same options (at least one)
+    FactoryCluster(int num_instances, const FactoryOptions& options, RoutingPolicy policy = routeRoundRobin,
+                   void* policy_arg = NULL);
+    ~FactoryCluster();
+
+    size_t numInstances() const;
+    Factory& instance(size_t index);
+    //calls in progress at the instance
+    int load(size_t index) const;
+    //the number of available products at the instance, may be out of date as soon as it returns
+    size_t stock(size_t index);
+    //the next turn of routeRoundRobin, a counter that every call of it advances
+    unsigned long long nextRoundRobin();
+
+    void produce(int num_products, Product* products);
+    int tryBuyOne();
+    std::list<Product> buyProducts(int num_products);
+    std::list<Product> buyProducts(int num_products, int min_value, int* num_rejected);
+    //returns the products to the routed instance
+    void returnProducts(std::list<Product> products, unsigned int id);
+    //returns the number of stolen products
+    int stealProducts(int num_products, unsigned int fake_id);
+
+    //the sum over the instances
+    size_t numAvailableProducts();
+    //the products of every instance, instance after instance
+    std::list<Product> listAvailableProducts();
+    std::list<std::pair<Product, int>> listStolenProducts();
+};
+
+#endif // FACTORY_CLUSTER_H_
@@ -0,0 +1,9 @@
+#include "FactoryOperation.h"
+
+const char* factoryOperationName(FactoryOperation operation){
+    static const char* names[NUM_FACTORY_OPERATIONS] = {
+        "produce", "tryBuyOne", "tryBuyMany", "buyProducts", "returnProducts", "stealProducts", "startThief", "openFactory",
+        "closeFactory", "openReturningService", "closeReturningService", "listAvailableProducts", "readStats"
+    };
+    return (operation >= 0 && operation < NUM_FACTORY_OPERATIONS) ? names[operation] : "unknown";
+}
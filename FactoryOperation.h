@@ -0,0 +1,25 @@
+#ifndef FACTORY_OPERATION_H_
+#define FACTORY_OPERATION_H_
+
+//the operations of a Factory, used to tell apart the statistics of different callers
+enum FactoryOperation{
+    OP_PRODUCE,
+    OP_TRY_BUY_ONE,
+    OP_TRY_BUY_MANY,
+    OP_BUY_PRODUCTS,
+    OP_RETURN_PRODUCTS,
+    OP_STEAL_PRODUCTS,
+    OP_START_THIEF,
+    OP_OPEN_FACTORY,
+    OP_CLOSE_FACTORY,
+    OP_OPEN_RETURNING_SERVICE,
+    OP_CLOSE_RETURNING_SERVICE,
+    OP_LIST_AVAILABLE_PRODUCTS,
+    OP_READ_STATS,
+    NUM_FACTORY_OPERATIONS
+};
+
+//the name of the Factory method that does the operation
+const char* factoryOperationName(FactoryOperation operation);
+
+#endif // FACTORY_OPERATION_H_
@@ -0,0 +1,345 @@
+#include "InventoryAnalytics.h"
+#include <pthread.h>
+#include <climits>
+#include <algorithm>
+#include "SimdSupport.h"
+
+//the kernels read a product as two ints, the id and then the value
+static_assert(sizeof(Product) == 2 * sizeof(int), "a Product must be an {id, value} pair of ints");
+
+//a run of products that are contiguous in memory
+struct ProductRange{
+    const Product* products;
+    size_t num_products;
+};
+
+//adds the values of the products to sum, min and max, which start at 0, INT_MAX and INT_MIN
+typedef void (*SummarizeFunc)(const Product* products, size_t num_products, long long& sum, int& min, int& max);
+//the number of products whose value is in [min_value, max_value]
+typedef size_t (*CountInRangeFunc)(const Product* products, size_t num_products, int min_value, int max_value);
+
+static void summarizeScalar(const Product* products, size_t num_products, long long& sum, int& min, int& max){
+    for(size_t i=0; i<num_products; i++){
+        int value = products[i].getValue();
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+}
+
+static size_t countInRangeScalar(const Product* products, size_t num_products, int min_value, int max_value){
+    size_t count = 0;
+    for(size_t i=0; i<num_products; i++){
+        int value = products[i].getValue();
+        count += (value >= min_value && value <= max_value);
+    }
+    return count;
+}
+
+#ifdef VALUE_FILTER_X86
+
+/*
+ * Both vector kernels load two vectors of products and shuffle their odd (value) lanes into one vector of values.
+ * The values of a vector are out of order after the shuffle, which no aggregate here cares about.
+ * Called per range (a chunk at most), so the int lanes of a count never overflow.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i loadValuesSse2(const Product* products){
+    const float* words = reinterpret_cast<const float*>(products);
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_loadu_ps(words), _mm_loadu_ps(words + 4), _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+__attribute__((target("sse2")))
+static void summarizeSse2(const Product* products, size_t num_products, long long& sum, int& min, int& max){
+    //sse2 has no 32 bit min, max or sign extension, they are made of a compare and masks
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = zero;
+    __m128i mins = _mm_set1_epi32(min);
+    __m128i maxs = _mm_set1_epi32(max);
+    size_t i = 0;
+    for(; i + 4 <= num_products; i += 4){
+        __m128i values = loadValuesSse2(products + i);
+        __m128i sign = _mm_cmpgt_epi32(zero, values);
+        sums = _mm_add_epi64(sums, _mm_unpacklo_epi32(values, sign));
+        sums = _mm_add_epi64(sums, _mm_unpackhi_epi32(values, sign));
+        __m128i below = _mm_cmpgt_epi32(mins, values);
+        mins = _mm_or_si128(_mm_and_si128(below, values), _mm_andnot_si128(below, mins));
+        __m128i above = _mm_cmpgt_epi32(values, maxs);
+        maxs = _mm_or_si128(_mm_and_si128(above, values), _mm_andnot_si128(above, maxs));
+    }
+    long long lane_sums[2];
+    int lane_mins[4];
+    int lane_maxs[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lane_sums), sums);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lane_mins), mins);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lane_maxs), maxs);
+    sum += lane_sums[0] + lane_sums[1];
+    for(int lane=0; lane<4; lane++){
+        min = std::min(min, lane_mins[lane]);
+        max = std::max(max, lane_maxs[lane]);
+    }
+    summarizeScalar(products + i, num_products - i, sum, min, max);
+}
+
+__attribute__((target("sse2")))
+static size_t countInRangeSse2(const Product* products, size_t num_products, int min_value, int max_value){
+    //a lane is all ones (-1) for a value out of the range, subtracting the lanes counts those values
+    const __m128i low = _mm_set1_epi32(min_value);
+    const __m128i high = _mm_set1_epi32(max_value);
+    __m128i lane_counts = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 4 <= num_products; i += 4){
+        __m128i values = loadValuesSse2(products + i);
+        __m128i outside = _mm_or_si128(_mm_cmpgt_epi32(low, values), _mm_cmpgt_epi32(values, high));
+        lane_counts = _mm_sub_epi32(lane_counts, outside);
+    }
+    int lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lane_counts);
+    size_t num_outside = 0;
+    for(int lane : lanes){
+        num_outside += static_cast<size_t>(lane);
+    }
+    return (i - num_outside) + countInRangeScalar(products + i, num_products - i, min_value, max_value);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i loadValuesAvx2(const Product* products){
+    const float* words = reinterpret_cast<const float*>(products);
+    return _mm256_castps_si256(_mm256_shuffle_ps(_mm256_loadu_ps(words), _mm256_loadu_ps(words + 8),
+                                                 _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+__attribute__((target("avx2")))
+static void summarizeAvx2(const Product* products, size_t num_products, long long& sum, int& min, int& max){
+    __m256i sums = _mm256_setzero_si256();
+    __m256i mins = _mm256_set1_epi32(min);
+    __m256i maxs = _mm256_set1_epi32(max);
+    size_t i = 0;
+    for(; i + 8 <= num_products; i += 8){
+        __m256i values = loadValuesAvx2(products + i);
+        sums = _mm256_add_epi64(sums, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(values)));
+        sums = _mm256_add_epi64(sums, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(values, 1)));
+        mins = _mm256_min_epi32(mins, values);
+        maxs = _mm256_max_epi32(maxs, values);
+    }
+    long long lane_sums[4];
+    int lane_mins[8];
+    int lane_maxs[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lane_sums), sums);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lane_mins), mins);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lane_maxs), maxs);
+    sum += lane_sums[0] + lane_sums[1] + lane_sums[2] + lane_sums[3];
+    for(int lane=0; lane<8; lane++){
+        min = std::min(min, lane_mins[lane]);
+        max = std::max(max, lane_maxs[lane]);
+    }
+    summarizeScalar(products + i, num_products - i, sum, min, max);
+}
+
+__attribute__((target("avx2")))
+static size_t countInRangeAvx2(const Product* products, size_t num_products, int min_value, int max_value){
+    const __m256i low = _mm256_set1_epi32(min_value);
+    const __m256i high = _mm256_set1_epi32(max_value);
+    __m256i lane_counts = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 8 <= num_products; i += 8){
+        __m256i values = loadValuesAvx2(products + i);
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(low, values), _mm256_cmpgt_epi32(values, high));
+        lane_counts = _mm256_sub_epi32(lane_counts, outside);
+    }
+    int lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), lane_counts);
+    size_t num_outside = 0;
+    for(int lane : lanes){
+        num_outside += static_cast<size_t>(lane);
+    }
+    return (i - num_outside) + countInRangeScalar(products + i, num_products - i, min_value, max_value);
+}
+
+#endif // VALUE_FILTER_X86
+
+static SummarizeFunc summarizeFunc(FilterKernel kernel){
+    switch(filterKernelSupported(kernel) ? kernel : FILTER_SCALAR){
+#ifdef VALUE_FILTER_X86
+        case FILTER_SSE2: return summarizeSse2;
+        case FILTER_AVX2: return summarizeAvx2;
+#endif
+        default: return summarizeScalar;
+    }
+}
+
+static CountInRangeFunc countInRangeFunc(FilterKernel kernel){
+    switch(filterKernelSupported(kernel) ? kernel : FILTER_SCALAR){
+#ifdef VALUE_FILTER_X86
+        case FILTER_SSE2: return countInRangeSse2;
+        case FILTER_AVX2: return countInRangeAvx2;
+#endif
+        default: return countInRangeScalar;
+    }
+}
+
+//splits the ranges of the snapshot to num_shares shares of about the same number of products
+static void splitRanges(const InventorySnapshot& snapshot, int num_shares,
+                        std::vector<std::vector<ProductRange>>& shares){
+    size_t num_products = snapshot.size();
+    size_t share_size = std::max(static_cast<size_t>(1), (num_products + num_shares - 1) / num_shares);
+    shares.assign(1, std::vector<ProductRange>());
+    size_t in_share = 0;
+    snapshot.forEachRange([&](const Product* products, size_t num_range_products){
+        //a range on the border of two shares is cut in two
+        while(num_range_products > 0){
+            if(in_share == share_size){
+                shares.push_back(std::vector<ProductRange>());
+                in_share = 0;
+            }
+            size_t num_taken = std::min(num_range_products, share_size - in_share);
+            ProductRange range = {products, num_taken};
+            shares.back().push_back(range);
+            in_share += num_taken;
+            products += num_taken;
+            num_range_products -= num_taken;
+        }
+    });
+}
+
+template <typename Func>
+struct ShareThread{
+    Func* func;
+    size_t share;
+};
+
+template <typename Func>
+static void* runShare(void* arg){
+    ShareThread<Func>* thread = static_cast<ShareThread<Func>*>(arg);
+    (*thread->func)(thread->share);
+    return NULL;
+}
+
+//calls func(share) for every share: share 0 on the calling thread and the others on the pool's workers, or on threads
+//of their own without a pool
+template <typename Func>
+static void forEachShare(size_t num_shares, Func func, ThreadPool* pool){
+    std::vector<ShareThread<Func>> threads(num_shares);
+    std::vector<ThreadPool::Job*> jobs(num_shares, NULL);
+    std::vector<pthread_t> thread_ids(num_shares);
+    std::vector<bool> started(num_shares, false);
+    for(size_t share=1; share<num_shares; share++){
+        threads[share].func = &func;
+        threads[share].share = share;
+        if(pool != NULL){
+            jobs[share] = pool->submit(runShare<Func>, &threads[share]);
+            continue;
+        }
+        started[share] = (pthread_create(&thread_ids[share], NULL, runShare<Func>, &threads[share]) == 0);
+        if(!started[share]){
+            //no thread left, the share runs here instead
+            func(share);
+        }
+    }
+    if(num_shares > 0){
+        func(0);
+    }
+    for(size_t share=1; share<num_shares; share++){
+        if(jobs[share] != NULL){
+            pool->wait(jobs[share]);
+        } else if(started[share]){
+            pthread_join(thread_ids[share], NULL);
+        }
+    }
+}
+
+ValueSummary summarizeValues(const InventorySnapshot& snapshot, int num_threads, FilterKernel kernel,
+                             ThreadPool* pool){
+    std::vector<std::vector<ProductRange>> shares;
+    splitRanges(snapshot, std::max(num_threads, 1), shares);
+    SummarizeFunc summarize = summarizeFunc(kernel);
+    std::vector<long long> sums(shares.size(), 0);
+    std::vector<int> mins(shares.size(), INT_MAX);
+    std::vector<int> maxs(shares.size(), INT_MIN);
+    forEachShare(shares.size(), [&](size_t share){
+        //every share has its own results, they are merged after the threads are joined
+        long long sum = 0;
+        int min = INT_MAX;
+        int max = INT_MIN;
+        for(auto& range : shares[share]){
+            summarize(range.products, range.num_products, sum, min, max);
+        }
+        sums[share] = sum;
+        mins[share] = min;
+        maxs[share] = max;
+    }, pool);
+
+    ValueSummary summary;
+    summary.count = snapshot.size();
+    if(summary.count > 0){
+        summary.min = INT_MAX;
+        summary.max = INT_MIN;
+        for(size_t share=0; share<shares.size(); share++){
+            summary.sum += sums[share];
+            summary.min = std::min(summary.min, mins[share]);
+            summary.max = std::max(summary.max, maxs[share]);
+        }
+    }
+    return summary;
+}
+
+size_t countValuesInRange(const InventorySnapshot& snapshot, int min_value, int max_value, int num_threads,
+                          FilterKernel kernel, ThreadPool* pool){
+    std::vector<std::vector<ProductRange>> shares;
+    splitRanges(snapshot, std::max(num_threads, 1), shares);
+    CountInRangeFunc count_in_range = countInRangeFunc(kernel);
+    std::vector<size_t> counts(shares.size(), 0);
+    forEachShare(shares.size(), [&](size_t share){
+        size_t count = 0;
+        for(auto& range : shares[share]){
+            count += count_in_range(range.products, range.num_products, min_value, max_value);
+        }
+        counts[share] = count;
+    }, pool);
+
+    size_t count = 0;
+    for(auto share_count : counts){
+        count += share_count;
+    }
+    return count;
+}
+
+ValueHistogram histogramValues(const InventorySnapshot& snapshot, int low, int bucket_width, int num_buckets,
+                               int num_threads, ThreadPool* pool){
+    ValueHistogram histogram;
+    histogram.low = low;
+    histogram.bucket_width = std::max(bucket_width, 1);
+    histogram.counts.assign(static_cast<size_t>(std::max(num_buckets, 1)), 0);
+
+    std::vector<std::vector<ProductRange>> shares;
+    splitRanges(snapshot, std::max(num_threads, 1), shares);
+    std::vector<ValueHistogram> partials(shares.size(), histogram);
+    forEachShare(shares.size(), [&](size_t share){
+        ValueHistogram& partial = partials[share];
+        long long num_partial_buckets = static_cast<long long>(partial.counts.size());
+        for(auto& range : shares[share]){
+            for(size_t i=0; i<range.num_products; i++){
+                //in 64 bits, a value minus low may not fit an int
+                long long offset = static_cast<long long>(range.products[i].getValue()) - low;
+                long long bucket = (offset < 0) ? -1 : offset / partial.bucket_width;
+                if(bucket < 0){
+                    ++partial.below;
+                } else if(bucket >= num_partial_buckets){
+                    ++partial.above;
+                } else{
+                    ++partial.counts[static_cast<size_t>(bucket)];
+                }
+            }
+        }
+    }, pool);
+
+    for(auto& partial : partials){
+        histogram.below += partial.below;
+        histogram.above += partial.above;
+        for(size_t bucket=0; bucket<histogram.counts.size(); bucket++){
+            histogram.counts[bucket] += partial.counts[bucket];
+        }
+    }
+    return histogram;
+}
@@ -0,0 +1,51 @@
+#ifndef INVENTORY_ANALYTICS_H_
+#define INVENTORY_ANALYTICS_H_
+
+#include <cstddef>
+#include <vector>
+#include "InventorySnapshot.h"
+#include "ThreadPool.h"
+#include "ValueFilter.h"
+
+//the number of products and the total, smallest and biggest of their values (min and max are 0 without products)
+struct ValueSummary{
+    size_t count;
+    long long sum;
+    int min;
+    int max;
+
+    ValueSummary() : count(0), sum(0), min(0), max(0){}
+};
+
+//bucket i counts the values from low + i * bucket_width up to (not including) low + (i + 1) * bucket_width
+struct ValueHistogram{
+    int low;
+    int bucket_width;
+    std::vector<size_t> counts;
+    //the values below the first bucket and past the last one
+    size_t below;
+    size_t above;
+
+    ValueHistogram() : low(0), bucket_width(1), below(0), above(0){}
+};
+
+/*
+ * Aggregates over the values of the products of a snapshot, computed in place over the chunks the snapshot shares
+ * with the inventory: no product is copied, and the factory is not locked while they run.
+ * A chunk holds {id, value} pairs, so the vector kernels load a block of products and keep only the value lanes.
+ * The histogram has no vector kernel (every value goes to a bucket of its own), it is always scalar.
+ * With num_threads above 1 the products are split evenly between that many threads (the calling thread is one of
+ * them), which pays off only for inventories of millions of products. The other threads are the workers of pool,
+ * or threads created for the call when pool is NULL.
+ */
+
+ValueSummary summarizeValues(const InventorySnapshot& snapshot, int num_threads,
+                             FilterKernel kernel = bestFilterKernel(), ThreadPool* pool = NULL);
+//the number of products worth at least min_value and at most max_value
+size_t countValuesInRange(const InventorySnapshot& snapshot, int min_value, int max_value, int num_threads,
+                          FilterKernel kernel = bestFilterKernel(), ThreadPool* pool = NULL);
+//num_buckets buckets (at least one) of bucket_width values (at least one) from low
+ValueHistogram histogramValues(const InventorySnapshot& snapshot, int low, int bucket_width, int num_buckets,
+                               int num_threads, ThreadPool* pool = NULL);
+
+#endif // INVENTORY_ANALYTICS_H_
@@ -0,0 +1,35 @@
+#include "InventorySnapshot.h"
+
+InventorySnapshot::InventorySnapshot() : num_products(0){}
+
+InventorySnapshot::InventorySnapshot(InventorySnapshot&& other) : parts(std::move(other.parts)),
+                                                                  num_products(other.num_products){
+    other.parts.clear();
+    other.num_products = 0;
+}
+
+InventorySnapshot::~InventorySnapshot(){
+    for(auto part : parts){
+        delete part;
+    }
+}
+
+void InventorySnapshot::addPart(const ProductQueue& queue, const std::deque<StampRun>* stamps){
+    Part* part = new Part();
+    queue.snapshot(part->products);
+    if(stamps != NULL){
+        part->stamps = *stamps;
+    }
+    num_products += part->products.size();
+    parts.push_back(part);
+}
+
+size_t InventorySnapshot::size() const{
+    return num_products;
+}
+
+std::list<Product> InventorySnapshot::toList() const{
+    std::list<Product> products_list;
+    forEach([&products_list](const Product& product){ products_list.push_back(product); });
+    return products_list;
+}
@@ -0,0 +1,88 @@
+#ifndef INVENTORY_SNAPSHOT_H_
+#define INVENTORY_SNAPSHOT_H_
+
+#include <deque>
+#include <list>
+#include <vector>
+#include "Product.h"
+#include "ProductQueue.h"
+#include "StampMerge.h"
+
+/**
+ * A point in time view of the available products that shares the chunks of the inventory instead of
+ * copying them. Taking it only adds a reference to every chunk, and the chunks it shares are neither
+ * changed nor reused until it is destroyed, so reading it never blocks the factory.
+ * A sharded inventory gives one part per shard together with its stamps, the parts are merged by stamp
+ * while reading, so the products are always seen in global order.
+ */
+class InventorySnapshot{
+    struct Part{
+        ProductQueue::Snapshot products;
+        //empty when the snapshot has a single part
+        std::deque<StampRun> stamps;
+    };
+
+    std::vector<Part*> parts;
+    size_t num_products;
+
+    //copying is not allowed, the parts hold references to chunks
+    InventorySnapshot(const InventorySnapshot&);
+    InventorySnapshot& operator=(const InventorySnapshot&);
+
+public:
+    InventorySnapshot();
+    InventorySnapshot(InventorySnapshot&& other);
+    ~InventorySnapshot();
+
+    /*adds a view of the current products of queue, the caller must hold the queue's lock.
+    stamps are the stamps of the products of queue, NULL if the snapshot has a single part.*/
+    void addPart(const ProductQueue& queue, const std::deque<StampRun>* stamps);
+
+    size_t size() const;
+
+    //calls func on every product from oldest to newest
+    template <typename Func>
+    void forEach(Func func) const;
+
+    //calls func(products, num_products) on every run of products that are contiguous in memory. the runs of a
+    //single part are from oldest to newest, with more parts they come part after part (not by age)
+    template <typename Func>
+    void forEachRange(Func func) const;
+
+    //returns the products as a list, from oldest to newest
+    std::list<Product> toList() const;
+};
+
+template <typename Func>
+void InventorySnapshot::forEachRange(Func func) const{
+    for(auto part : parts){
+        part->products.forEachRange(func);
+    }
+}
+
+template <typename Func>
+void InventorySnapshot::forEach(Func func) const{
+    if(parts.size() == 1){
+        parts[0]->products.forEach(func);
+        return;
+    }
+
+    std::vector<const std::deque<StampRun>*> stamps;
+    std::vector<ProductQueue::Snapshot::Cursor> cursors;
+    for(auto part : parts){
+        stamps.push_back(&part->stamps);
+        cursors.push_back(ProductQueue::Snapshot::Cursor(part->products));
+    }
+    std::vector<MergeStep> steps;
+    planMerge(stamps, num_products, steps);
+
+    for(auto& step : steps){
+        ProductQueue::Snapshot::Cursor& cursor = cursors[step.queue];
+        for(size_t i=0; i<step.count; i++){
+            func(cursor.item());
+            cursor.next();
+        }
+    }
+}
+
+#endif // INVENTORY_SNAPSHOT_H_
@@ -0,0 +1,95 @@
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <time.h>
+
+LatencyHistogram::LatencyHistogram(){
+    reset();
+}
+
+size_t LatencyHistogram::bucketOf(unsigned long long value){
+    //values below LATENCY_SUB_BUCKETS get a bucket each
+    if(value < LATENCY_SUB_BUCKETS){
+        return static_cast<size_t>(value);
+    }
+    //otherwise the top bit picks the power of two and the next bits pick the bucket inside it
+    int top_bit = 63 - __builtin_clzll(value);
+    int shift = top_bit - LATENCY_SUB_BUCKET_BITS;
+    size_t sub_bucket = static_cast<size_t>(value >> shift) - LATENCY_SUB_BUCKETS;
+    return static_cast<size_t>(shift + 1) * LATENCY_SUB_BUCKETS + sub_bucket;
+}
+
+unsigned long long LatencyHistogram::bucketTop(size_t bucket){
+    if(bucket < LATENCY_SUB_BUCKETS){
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket / LATENCY_SUB_BUCKETS) - 1;
+    unsigned long long sub_bucket = bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(unsigned long long value){
+    ++counts[bucketOf(value)];
+    ++total_count;
+    total_value += value;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other){
+    for(size_t i=0; i<LATENCY_BUCKETS; i++){
+        counts[i] += other.counts[i];
+    }
+    total_count += other.total_count;
+    total_value += other.total_value;
+    min_value = std::min(min_value, other.min_value);
+    max_value = std::max(max_value, other.max_value);
+}
+
+void LatencyHistogram::reset(){
+    std::fill(counts, counts + LATENCY_BUCKETS, 0ULL);
+    total_count = 0;
+    total_value = 0;
+    min_value = ~0ULL;
+    max_value = 0;
+}
+
+unsigned long long LatencyHistogram::count() const{
+    return total_count;
+}
+
+unsigned long long LatencyHistogram::min() const{
+    return (total_count == 0) ? 0 : min_value;
+}
+
+unsigned long long LatencyHistogram::max() const{
+    return max_value;
+}
+
+double LatencyHistogram::mean() const{
+    return (total_count == 0) ? 0 : static_cast<double>(total_value) / total_count;
+}
+
+unsigned long long LatencyHistogram::percentile(double percentile) const{
+    if(total_count == 0){
+        return 0;
+    }
+    //the rank of the wanted value, at least the first one
+    unsigned long long rank = static_cast<unsigned long long>(percentile / 100.0 * total_count + 0.5);
+    rank = std::max(rank, 1ULL);
+
+    unsigned long long seen = 0;
+    for(size_t i=0; i<LATENCY_BUCKETS; i++){
+        seen += counts[i];
+        if(seen >= rank){
+            //the top of the bucket, but never above the biggest recorded value
+            return std::min(bucketTop(i), max_value);
+        }
+    }
+    return max_value;
+}
+
+unsigned long long nowNanoseconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long long>(ts.tv_sec) * 1000000000ULL + static_cast<unsigned long long>(ts.tv_nsec);
+}
@@ -0,0 +1,48 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <cstddef>
+
+//every power of two is split into 2^LATENCY_SUB_BUCKET_BITS buckets, so a value is recorded
+//with a relative error of at most 1/2^LATENCY_SUB_BUCKET_BITS
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+
+/**
+ * A log-linear (HDR style) histogram of latencies in nanoseconds, with a fixed number of buckets
+ * that covers every 64 bit value.
+ * Recording is a few shifts and an increment, and the histogram is not thread safe: every thread
+ * records to a histogram of its own, and the histograms are merged when they are read.
+ */
+class LatencyHistogram{
+    unsigned long long counts[LATENCY_BUCKETS];
+    unsigned long long total_count;
+    unsigned long long total_value;
+    unsigned long long min_value;
+    unsigned long long max_value;
+
+    static size_t bucketOf(unsigned long long value);
+    //the biggest value that is recorded to the bucket
+    static unsigned long long bucketTop(size_t bucket);
+
+public:
+    LatencyHistogram();
+
+    void record(unsigned long long value);
+    //adds all the values recorded to other
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    unsigned long long count() const;
+    unsigned long long min() const;
+    unsigned long long max() const;
+    double mean() const;
+    //the value that percentile percent of the recorded values are at most (within the bucket error), 0 if empty
+    unsigned long long percentile(double percentile) const;
+};
+
+//nanoseconds on the monotonic clock
+unsigned long long nowNanoseconds();
+
+#endif // LATENCY_HISTOGRAM_H_
@@ -0,0 +1,81 @@
+#include "MutexProfile.h"
+
+LockOperationStats MutexStats::total() const{
+    LockOperationStats sum;
+    for(auto& operation : operations){
+        sum.acquisitions += operation.acquisitions;
+        sum.contended += operation.contended;
+        sum.failed_tries += operation.failed_tries;
+        sum.total_wait_ns += operation.total_wait_ns;
+        sum.total_hold_ns += operation.total_hold_ns;
+    }
+    return sum;
+}
+
+MutexProfile::MutexProfile(const char* name) : acquired_at(0), holder(OP_READ_STATS){
+    stats.name = name;
+    for(auto& failed : failed_tries){
+        failed.store(0);
+    }
+}
+
+void MutexProfile::acquired(FactoryOperation operation, unsigned long long wait_ns, bool contended){
+    LockOperationStats& operation_stats = stats.operations[operation];
+    ++operation_stats.acquisitions;
+    if(contended){
+        ++operation_stats.contended;
+    }
+    operation_stats.total_wait_ns += wait_ns;
+    stats.wait_time.record(wait_ns);
+
+    holder = operation;
+    acquired_at = nowNanoseconds();
+}
+
+void MutexProfile::lock(pthread_mutex_t* mutex, FactoryOperation operation){
+    //a free mutex is taken without reading the clock
+    if(pthread_mutex_trylock(mutex) == 0){
+        acquired(operation, 0, false);
+        return;
+    }
+    unsigned long long start = nowNanoseconds();
+    pthread_mutex_lock(mutex);
+    acquired(operation, nowNanoseconds() - start, true);
+}
+
+bool MutexProfile::tryLock(pthread_mutex_t* mutex, FactoryOperation operation){
+    if(pthread_mutex_trylock(mutex) == 0){
+        acquired(operation, 0, false);
+        return true;
+    }
+    //the mutex is not held by this thread, so only an atomic counter may be changed
+    failed_tries[operation].fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void MutexProfile::released(){
+    unsigned long long hold_ns = nowNanoseconds() - acquired_at;
+    stats.operations[holder].total_hold_ns += hold_ns;
+    stats.hold_time.record(hold_ns);
+}
+
+void MutexProfile::waitBegin(){
+    released();
+}
+
+void MutexProfile::waitEnd(FactoryOperation operation){
+    holder = operation;
+    acquired_at = nowNanoseconds();
+}
+
+void MutexProfile::unlock(pthread_mutex_t* mutex){
+    released();
+    pthread_mutex_unlock(mutex);
+}
+
+void MutexProfile::copyTo(MutexStats& out) const{
+    out = stats;
+    for(int operation=0; operation<NUM_FACTORY_OPERATIONS; operation++){
+        out.operations[operation].failed_tries = failed_tries[operation].load(std::memory_order_relaxed);
+    }
+}
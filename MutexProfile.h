@@ -0,0 +1,110 @@
+#ifndef MUTEX_PROFILE_H_
+#define MUTEX_PROFILE_H_
+
+#include <pthread.h>
+#include <atomic>
+#include "FactoryOperation.h"
+#include "LatencyHistogram.h"
+
+//contention of a mutex caused by a single operation
+struct LockOperationStats{
+    unsigned long long acquisitions;
+    //acquisitions that had to wait for another holder
+    unsigned long long contended;
+    //try locks that failed because the mutex was held
+    unsigned long long failed_tries;
+    unsigned long long total_wait_ns;
+    unsigned long long total_hold_ns;
+
+    LockOperationStats() : acquisitions(0), contended(0), failed_tries(0), total_wait_ns(0), total_hold_ns(0){}
+};
+
+//contention statistics of a mutex
+struct MutexStats{
+    const char* name;
+    //time from asking for the mutex to getting it, 0 when it was free
+    LatencyHistogram wait_time;
+    //time from getting the mutex to releasing it, a condition wait ends a hold and starts a new one
+    LatencyHistogram hold_time;
+    LockOperationStats operations[NUM_FACTORY_OPERATIONS];
+
+    MutexStats() : name(""){}
+
+    //the sum over all the operations
+    LockOperationStats total() const;
+};
+
+/**
+ * Records the contention of one mutex. Everything is recorded while the mutex is held, so the
+ * statistics are protected by the mutex they describe and recording adds no synchronization,
+ * except for failed try locks, which are counted atomically.
+ * A mutex without a profile is locked through the same helpers with a NULL profile, which then
+ * cost a single branch.
+ */
+class MutexProfile{
+    //under the mutex
+    MutexStats stats;
+    //when the current holder got the mutex and what it is doing - under the mutex
+    unsigned long long acquired_at;
+    FactoryOperation holder;
+
+    std::atomic<unsigned long long> failed_tries[NUM_FACTORY_OPERATIONS];
+
+    void acquired(FactoryOperation operation, unsigned long long wait_ns, bool contended);
+    void released();
+
+    //copying is not allowed
+    MutexProfile(const MutexProfile&);
+    MutexProfile& operator=(const MutexProfile&);
+
+public:
+    explicit MutexProfile(const char* name);
+
+    void lock(pthread_mutex_t* mutex, FactoryOperation operation);
+    bool tryLock(pthread_mutex_t* mutex, FactoryOperation operation);
+    void unlock(pthread_mutex_t* mutex);
+
+    //called before a condition wait releases the mutex and after it takes it back
+    void waitBegin();
+    void waitEnd(FactoryOperation operation);
+
+    //copies the statistics to out, the caller must hold the mutex
+    void copyTo(MutexStats& out) const;
+};
+
+inline void profiledLock(pthread_mutex_t* mutex, MutexProfile* profile, FactoryOperation operation){
+    if(profile == NULL){
+        pthread_mutex_lock(mutex);
+        return;
+    }
+    profile->lock(mutex, operation);
+}
+
+inline bool profiledTryLock(pthread_mutex_t* mutex, MutexProfile* profile, FactoryOperation operation){
+    if(profile == NULL){
+        return pthread_mutex_trylock(mutex) == 0;
+    }
+    return profile->tryLock(mutex, operation);
+}
+
+inline void profiledUnlock(pthread_mutex_t* mutex, MutexProfile* profile){
+    if(profile == NULL){
+        pthread_mutex_unlock(mutex);
+        return;
+    }
+    profile->unlock(mutex);
+}
+
+inline void profiledWaitBegin(MutexProfile* profile){
+    if(profile != NULL){
+        profile->waitBegin();
+    }
+}
+
+inline void profiledWaitEnd(MutexProfile* profile, FactoryOperation operation){
+    if(profile != NULL){
+        profile->waitEnd(operation);
+    }
+}
+
+#endif // MUTEX_PROFILE_H_
@@ -0,0 +1,26 @@
+#include "ObjectPool.h"
+#include <atomic>
+
+static std::atomic<unsigned long long> total_allocations(0);
+static std::atomic<unsigned long long> total_heap_allocations(0);
+static std::atomic<unsigned long long> total_heap_frees(0);
+
+void PoolStats::add(unsigned long long allocations, unsigned long long heap_allocations, unsigned long long heap_frees){
+    if(allocations != 0){
+        total_allocations.fetch_add(allocations, std::memory_order_relaxed);
+    }
+    if(heap_allocations != 0){
+        total_heap_allocations.fetch_add(heap_allocations, std::memory_order_relaxed);
+    }
+    if(heap_frees != 0){
+        total_heap_frees.fetch_add(heap_frees, std::memory_order_relaxed);
+    }
+}
+
+PoolCounters PoolStats::read(){
+    PoolCounters counters;
+    counters.allocations = total_allocations.load(std::memory_order_relaxed);
+    counters.heap_allocations = total_heap_allocations.load(std::memory_order_relaxed);
+    counters.heap_frees = total_heap_frees.load(std::memory_order_relaxed);
+    return counters;
+}
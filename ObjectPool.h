@@ -0,0 +1,241 @@
+#ifndef OBJECT_POOL_H_
+#define OBJECT_POOL_H_
+
+#include <pthread.h>
+#include <cstddef>
+#include <new>
+
+//blocks a thread moves to or from the shared list of its pool at once
+#define POOL_BATCH 32
+//blocks the shared list of a pool keeps, beyond them freed blocks go back to the heap
+#define POOL_MAX_SHARED_BLOCKS 2048
+
+struct PoolCounters{
+    //blocks the pools handed out, including the ones from the heap
+    unsigned long long allocations;
+    //blocks that had to come from the heap, because the thread's cache and the shared list were empty
+    unsigned long long heap_allocations;
+    //blocks that went back to the heap, because the shared list was full
+    unsigned long long heap_frees;
+};
+
+//the counters of every pool together. a thread adds its counts when it moves a batch or exits,
+//so the allocations of threads that are still running may be missing (the heap counts never are)
+class PoolStats{
+public:
+    static void add(unsigned long long allocations, unsigned long long heap_allocations, unsigned long long heap_frees);
+    static PoolCounters read();
+};
+
+/**
+ * A pool of memory blocks of SIZE bytes, shared by everything of that size.
+ * Every thread keeps freed blocks in a cache of its own, so allocating and freeing take no lock and no atomic.
+ * Blocks are often freed by another thread than the one that allocated them (an actor frees the arguments its
+ * launcher allocated), so a cache that grows to twice POOL_BATCH moves a batch to a shared list, an empty cache
+ * takes a batch from it, and a thread that exits gives its whole cache back. Only when the shared list is empty
+ * too is a block allocated from the heap, so a steady workload stops using the heap once the pool is warm.
+ */
+template <size_t SIZE>
+class FixedPool{
+    struct Block{
+        Block* next;
+        //the next batch of the shared list, set in the first block of a batch
+        Block* next_batch;
+    };
+    static const size_t BLOCK_SIZE = (SIZE < sizeof(Block)) ? sizeof(Block) : SIZE;
+
+    //a plain struct, so it is never destroyed while threads still exit
+    struct Shared{
+        pthread_mutex_t lock;
+        //the batches are of POOL_BATCH blocks, except the rest of the caches of threads that exited
+        Block* batches;
+        int num_blocks;
+    };
+
+    struct Cache{
+        Block* blocks;
+        int num_blocks;
+        unsigned long long allocations;
+        unsigned long long heap_allocations;
+        unsigned long long heap_frees;
+
+        Cache() : blocks(NULL), num_blocks(0), allocations(0), heap_allocations(0), heap_frees(0){}
+        ~Cache(){
+            //the thread exits, its blocks go to the other threads
+            while(num_blocks > 0){
+                giveBatch(*this);
+            }
+            flushCounters(*this);
+            destroyed() = true;
+        }
+    };
+
+    static Shared& shared(){
+        static Shared pool_shared = {PTHREAD_MUTEX_INITIALIZER, NULL, 0};
+        return pool_shared;
+    }
+
+    static Cache& cache(){
+        static thread_local Cache thread_cache;
+        return thread_cache;
+    }
+
+    //true once the thread's cache was destroyed, the blocks freed after it (by other thread exit code) use the heap
+    static bool& destroyed(){
+        static thread_local bool cache_destroyed = false;
+        return cache_destroyed;
+    }
+
+    static void flushCounters(Cache& thread_cache){
+        PoolStats::add(thread_cache.allocations, thread_cache.heap_allocations, thread_cache.heap_frees);
+        thread_cache.allocations = 0;
+        thread_cache.heap_allocations = 0;
+        thread_cache.heap_frees = 0;
+    }
+
+    //moves up to POOL_BATCH blocks of the cache to the shared list, or to the heap if it is full
+    static void giveBatch(Cache& thread_cache){
+        Block* first = thread_cache.blocks;
+        Block* last = first;
+        int num_moved = 1;
+        while(num_moved < POOL_BATCH && last->next != NULL){
+            last = last->next;
+            ++num_moved;
+        }
+        thread_cache.blocks = last->next;
+        thread_cache.num_blocks -= num_moved;
+        last->next = NULL;
+
+        Shared& pool_shared = shared();
+        pthread_mutex_lock(&pool_shared.lock);
+        bool kept = (pool_shared.num_blocks + num_moved <= POOL_MAX_SHARED_BLOCKS);
+        if(kept){
+            first->next_batch = pool_shared.batches;
+            pool_shared.batches = first;
+            pool_shared.num_blocks += num_moved;
+        }
+        pthread_mutex_unlock(&pool_shared.lock);
+
+        if(!kept){
+            while(first != NULL){
+                Block* next = first->next;
+                ::operator delete(first);
+                first = next;
+            }
+            thread_cache.heap_frees += num_moved;
+        }
+        flushCounters(thread_cache);
+    }
+
+    //fills the empty cache with a batch of the shared list, or with a block of the heap
+    static void refill(Cache& thread_cache){
+        Shared& pool_shared = shared();
+        pthread_mutex_lock(&pool_shared.lock);
+        Block* batch = pool_shared.batches;
+        int num_taken = 0;
+        if(batch != NULL){
+            pool_shared.batches = batch->next_batch;
+            for(Block* block = batch; block != NULL; block = block->next){
+                ++num_taken;
+            }
+            pool_shared.num_blocks -= num_taken;
+        }
+        pthread_mutex_unlock(&pool_shared.lock);
+
+        if(batch == NULL){
+            batch = static_cast<Block*>(::operator new(BLOCK_SIZE));
+            batch->next = NULL;
+            num_taken = 1;
+            ++thread_cache.heap_allocations;
+        }
+        thread_cache.blocks = batch;
+        thread_cache.num_blocks = num_taken;
+        flushCounters(thread_cache);
+    }
+
+public:
+    static void* allocate(){
+        if(destroyed()){
+            return ::operator new(BLOCK_SIZE);
+        }
+        Cache& thread_cache = cache();
+        if(thread_cache.blocks == NULL){
+            refill(thread_cache);
+        }
+        Block* block = thread_cache.blocks;
+        thread_cache.blocks = block->next;
+        --thread_cache.num_blocks;
+        ++thread_cache.allocations;
+        return block;
+    }
+
+    static void deallocate(void* memory){
+        if(destroyed()){
+            ::operator delete(memory);
+            return;
+        }
+        Cache& thread_cache = cache();
+        Block* block = static_cast<Block*>(memory);
+        block->next = thread_cache.blocks;
+        thread_cache.blocks = block;
+        if(++thread_cache.num_blocks >= 2 * POOL_BATCH){
+            giveBatch(thread_cache);
+        }
+    }
+};
+
+//gives a class (T itself, CRTP) an operator new and delete that use the FixedPool of its size
+template <typename T>
+struct PooledObject{
+    static void* operator new(size_t size){
+        //a bigger derived class can't use the pool
+        if(size != sizeof(T)){
+            return ::operator new(size);
+        }
+        return FixedPool<sizeof(T)>::allocate();
+    }
+    static void operator delete(void* memory, size_t size){
+        if(size != sizeof(T)){
+            ::operator delete(memory);
+            return;
+        }
+        FixedPool<sizeof(T)>::deallocate(memory);
+    }
+};
+
+//an allocator for node based containers (std::list, std::map), single nodes come from the FixedPool of their size
+template <typename T>
+class PoolAllocator{
+public:
+    typedef T value_type;
+
+    PoolAllocator(){}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&){}
+
+    T* allocate(size_t n){
+        if(n != 1){
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(FixedPool<sizeof(T)>::allocate());
+    }
+    void deallocate(T* memory, size_t n){
+        if(n != 1){
+            ::operator delete(memory);
+            return;
+        }
+        FixedPool<sizeof(T)>::deallocate(memory);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&){
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&){
+    return false;
+}
+
+#endif // OBJECT_POOL_H_
@@ -0,0 +1,147 @@
+#include "OperationProfile.h"
+#include <algorithm>
+#include "Factory.h"
+
+//the ThreadBuffers of every thread. the key is shared by all the profiles and never deleted, so a thread always
+//releases its buffers when it exits, even the ones of profiles that are already gone
+static pthread_key_t buffers_key;
+static pthread_once_t buffers_once = PTHREAD_ONCE_INIT;
+//a thread that releases a buffer and a profile that is destroyed hold it, so the profile of a buffer is never
+//destroyed while the buffer's samples are merged to it
+static pthread_mutex_t release_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void OperationProfile::createBuffersKey(){
+    pthread_key_create(&buffers_key, releaseBuffers);
+}
+
+OperationProfile::OperationProfile(){
+    INIT_MUTEX_LOCK(buffers_lock);
+    INIT_MUTEX_LOCK(merged_lock);
+    for(int operation=0; operation<NUM_FACTORY_OPERATIONS; operation++){
+        merged[operation].operation = static_cast<FactoryOperation>(operation);
+    }
+}
+
+OperationProfile::~OperationProfile(){
+    //the buffers belong to their threads, which free them when they exit or record to a new profile
+    pthread_mutex_lock(&release_lock);
+    for(auto buffer : buffers){
+        __atomic_store_n(&buffer->profile, static_cast<OperationProfile*>(NULL), __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&release_lock);
+    pthread_mutex_destroy(&buffers_lock);
+    pthread_mutex_destroy(&merged_lock);
+}
+
+OperationProfile::ThreadBuffer* OperationProfile::localBuffer(){
+    pthread_once(&buffers_once, createBuffersKey);
+    ThreadBuffers* thread_buffers = static_cast<ThreadBuffers*>(pthread_getspecific(buffers_key));
+    if(thread_buffers == NULL){
+        thread_buffers = new ThreadBuffers();
+        pthread_setspecific(buffers_key, thread_buffers);
+    }
+    for(auto buffer : *thread_buffers){
+        if(__atomic_load_n(&buffer->profile, __ATOMIC_ACQUIRE) == this){
+            return buffer;
+        }
+    }
+
+    //the first operation of this thread on this profile, the buffers of the destroyed profiles are freed first
+    thread_buffers->erase(std::remove_if(thread_buffers->begin(), thread_buffers->end(), [](ThreadBuffer* buffer){
+        if(__atomic_load_n(&buffer->profile, __ATOMIC_ACQUIRE) != NULL){
+            return false;
+        }
+        pthread_mutex_destroy(&buffer->lock);
+        delete buffer;
+        return true;
+    }), thread_buffers->end());
+
+    ThreadBuffer* buffer = new ThreadBuffer();
+    buffer->profile = this;
+    INIT_MUTEX_LOCK(buffer->lock);
+    buffer->count = 0;
+    pthread_mutex_lock(&buffers_lock);
+    buffers.push_back(buffer);
+    pthread_mutex_unlock(&buffers_lock);
+    thread_buffers->push_back(buffer);
+    return buffer;
+}
+
+void OperationProfile::releaseBuffers(void* thread_buffers){
+    ThreadBuffers* released = static_cast<ThreadBuffers*>(thread_buffers);
+    for(auto buffer : *released){
+        pthread_mutex_lock(&release_lock);
+        OperationProfile* profile = buffer->profile;
+        if(profile != NULL){
+            //once it is out of the list no reader can flush it, so the last samples are taken without racing anyone
+            pthread_mutex_lock(&profile->buffers_lock);
+            profile->buffers.erase(std::find(profile->buffers.begin(), profile->buffers.end(), buffer));
+            pthread_mutex_unlock(&profile->buffers_lock);
+            profile->flush(buffer);
+        }
+        pthread_mutex_unlock(&release_lock);
+
+        pthread_mutex_destroy(&buffer->lock);
+        delete buffer;
+    }
+    delete released;
+}
+
+void OperationProfile::merge(const Sample* samples, int count){
+    pthread_mutex_lock(&merged_lock);
+    for(int i=0; i<count; i++){
+        OperationStats& stats = merged[samples[i].operation];
+        stats.total_time.record(samples[i].wait_ns + samples[i].work_ns);
+        stats.wait_time.record(samples[i].wait_ns);
+        stats.work_time.record(samples[i].work_ns);
+    }
+    pthread_mutex_unlock(&merged_lock);
+}
+
+void OperationProfile::flush(ThreadBuffer* buffer){
+    //copy the samples out, so the buffer's lock and merged_lock are never held together
+    Sample samples[OPERATION_BUFFER_SIZE];
+    pthread_mutex_lock(&buffer->lock);
+    int count = buffer->count;
+    std::copy(buffer->samples, buffer->samples + count, samples);
+    buffer->count = 0;
+    pthread_mutex_unlock(&buffer->lock);
+
+    merge(samples, count);
+}
+
+void OperationProfile::record(FactoryOperation operation, unsigned long long wait_ns, unsigned long long work_ns){
+    ThreadBuffer* buffer = localBuffer();
+
+    pthread_mutex_lock(&buffer->lock);
+    Sample& sample = buffer->samples[buffer->count++];
+    sample.operation = operation;
+    sample.wait_ns = wait_ns;
+    sample.work_ns = work_ns;
+    bool full = (buffer->count == OPERATION_BUFFER_SIZE);
+    pthread_mutex_unlock(&buffer->lock);
+
+    if(full){
+        flush(buffer);
+    }
+}
+
+std::vector<OperationStats> OperationProfile::read(){
+    pthread_mutex_lock(&buffers_lock);
+    for(auto buffer : buffers){
+        flush(buffer);
+    }
+    pthread_mutex_unlock(&buffers_lock);
+
+    pthread_mutex_lock(&merged_lock);
+    std::vector<OperationStats> stats(merged, merged + NUM_FACTORY_OPERATIONS);
+    pthread_mutex_unlock(&merged_lock);
+    return stats;
+}
+
+size_t OperationProfile::numThreadBuffers(){
+    pthread_mutex_lock(&buffers_lock);
+    size_t num_buffers = buffers.size();
+    pthread_mutex_unlock(&buffers_lock);
+    return num_buffers;
+}
@@ -0,0 +1,124 @@
+#ifndef OPERATION_PROFILE_H_
+#define OPERATION_PROFILE_H_
+
+#include <pthread.h>
+#include <vector>
+#include "FactoryOperation.h"
+#include "LatencyHistogram.h"
+
+//number of samples a thread collects before it merges them to the shared histograms
+#define OPERATION_BUFFER_SIZE 256
+
+//latencies of the calls of one operation
+struct OperationStats{
+    FactoryOperation operation;
+    //the whole call
+    LatencyHistogram total_time;
+    //time spent waiting on condition vars: for products, for the thieves to leave or for something to open
+    LatencyHistogram wait_time;
+    //the rest of the call: locking and doing the operation
+    LatencyHistogram work_time;
+
+    OperationStats() : operation(OP_PRODUCE){}
+};
+
+/**
+ * Latency histograms of the factory's operations.
+ * Every thread records to a buffer of its own and merges it to the shared histograms only when it is
+ * full (or when the histograms are read), so recording almost never touches anything shared.
+ * When a thread exits its samples are merged and its buffer is freed, so only the threads that are still running
+ * keep OPERATION_BUFFER_SIZE samples worth of memory. A thread that outlives the profile (a detached actor that
+ * exits after its factory) keeps its buffer until it exits or records to a new profile.
+ */
+class OperationProfile{
+    struct Sample{
+        FactoryOperation operation;
+        unsigned long long wait_ns;
+        unsigned long long work_ns;
+    };
+
+    struct ThreadBuffer{
+        //NULL once the profile is destroyed, then only the thread uses the buffer
+        OperationProfile* profile;
+        //taken by the owner to add a sample and by readers to take the samples, never held for long
+        pthread_mutex_t lock;
+        Sample samples[OPERATION_BUFFER_SIZE];
+        int count;
+    };
+
+    //the buffers of a thread, one for every profile it recorded to
+    typedef std::vector<ThreadBuffer*> ThreadBuffers;
+
+    //the buffers of the running threads - under buffers_lock
+    std::vector<ThreadBuffer*> buffers;
+    pthread_mutex_t buffers_lock;
+
+    //the merged samples - under merged_lock
+    OperationStats merged[NUM_FACTORY_OPERATIONS];
+    pthread_mutex_t merged_lock;
+
+    ThreadBuffer* localBuffer();
+    static void createBuffersKey();
+    //called when a thread exits: merges its samples to the profiles that still exist and frees its buffers
+    static void releaseBuffers(void* thread_buffers);
+    //merges samples to the shared histograms
+    void merge(const Sample* samples, int count);
+    //takes the samples out of buffer and merges them
+    void flush(ThreadBuffer* buffer);
+
+    //copying is not allowed
+    OperationProfile(const OperationProfile&);
+    OperationProfile& operator=(const OperationProfile&);
+
+public:
+    OperationProfile();
+    ~OperationProfile();
+
+    void record(FactoryOperation operation, unsigned long long wait_ns, unsigned long long work_ns);
+
+    //merges the samples of all the threads and returns the statistics of every operation
+    std::vector<OperationStats> read();
+    //the number of threads that recorded to the profile and are still running
+    size_t numThreadBuffers();
+};
+
+/**
+ * Times a call of an operation from construction to destruction, and records it to a profile.
+ * The time between waitBegin and waitEnd is counted as waiting. With a NULL profile the clock is never read.
+ */
+class OperationTimer{
+    OperationProfile* profile;
+    FactoryOperation operation;
+    unsigned long long start;
+    unsigned long long wait_start;
+    unsigned long long wait_ns;
+
+public:
+    OperationTimer(OperationProfile* profile, FactoryOperation operation) : profile(profile), operation(operation),
+                                                                           start(0), wait_start(0), wait_ns(0){
+        if(profile != NULL){
+            start = nowNanoseconds();
+        }
+    }
+
+    ~OperationTimer(){
+        if(profile != NULL){
+            unsigned long long total_ns = nowNanoseconds() - start;
+            profile->record(operation, wait_ns, total_ns - wait_ns);
+        }
+    }
+
+    void waitBegin(){
+        if(profile != NULL){
+            wait_start = nowNanoseconds();
+        }
+    }
+
+    void waitEnd(){
+        if(profile != NULL){
+            wait_ns += nowNanoseconds() - wait_start;
+        }
+    }
+};
+
+#endif // OPERATION_PROFILE_H_
@@ -0,0 +1,204 @@
+#include "OperationTrace.h"
+#include <errno.h>
+#include <string.h>
+#include <atomic>
+#include "Factory.h"
+#include "LatencyHistogram.h"
+
+//the number of every thread that made a traced call, stored as number + 1 so NULL means none yet
+static pthread_key_t thread_number_key;
+static pthread_once_t thread_number_once = PTHREAD_ONCE_INIT;
+static std::atomic<unsigned int> next_thread_number(0);
+
+static void createThreadNumberKey(){
+    pthread_key_create(&thread_number_key, NULL);
+}
+
+unsigned int OperationTrace::threadNumber(){
+    pthread_once(&thread_number_once, createThreadNumberKey);
+    void* value = pthread_getspecific(thread_number_key);
+    if(value != NULL){
+        return static_cast<unsigned int>(reinterpret_cast<size_t>(value) - 1);
+    }
+    unsigned int number = next_thread_number.fetch_add(1);
+    pthread_setspecific(thread_number_key, reinterpret_cast<void*>(static_cast<size_t>(number) + 1));
+    return number;
+}
+
+OperationTrace::OperationTrace(FILE* file) : file(file), start_ns(nowNanoseconds()){
+    INIT_MUTEX_LOCK(file_lock);
+    for(int i=0; i<TRACE_BUFFERS; i++){
+        buffers[i] = new Buffer();
+        INIT_MUTEX_LOCK(buffers[i]->lock);
+        buffers[i]->used = 0;
+    }
+}
+
+OperationTrace* OperationTrace::create(const char* path){
+    FILE* file = fopen(path, "wb");
+    if(file == NULL){
+        fprintf(stderr, "can't create the trace %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    TraceHeader header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.reserved = 0;
+    fwrite(&header, sizeof(header), 1, file);
+    return new OperationTrace(file);
+}
+
+OperationTrace::~OperationTrace(){
+    flush();
+    for(int i=0; i<TRACE_BUFFERS; i++){
+        pthread_mutex_destroy(&buffers[i]->lock);
+        delete buffers[i];
+    }
+    fclose(file);
+    pthread_mutex_destroy(&file_lock);
+}
+
+unsigned long long OperationTrace::startTime() const{
+    return start_ns;
+}
+
+void OperationTrace::flushLocked(Buffer* buffer){
+    if(buffer->used == 0){
+        return;
+    }
+    //a buffer holds whole calls, so the calls of different buffers never mix in the file
+    pthread_mutex_lock(&file_lock);
+    fwrite(buffer->data, 1, buffer->used, file);
+    pthread_mutex_unlock(&file_lock);
+    buffer->used = 0;
+}
+
+void OperationTrace::record(TraceRecord& record, const std::vector<TraceProduct>& products){
+    record.thread = threadNumber();
+    record.num_payload = static_cast<unsigned int>(products.size());
+    size_t payload_size = products.size() * sizeof(TraceProduct);
+    size_t size = sizeof(TraceRecord) + payload_size;
+
+    Buffer* buffer = buffers[record.thread % TRACE_BUFFERS];
+    pthread_mutex_lock(&buffer->lock);
+    if(buffer->used + size > TRACE_BUFFER_SIZE){
+        flushLocked(buffer);
+    }
+    if(size > TRACE_BUFFER_SIZE){
+        //too big for any buffer, written as it is. the buffer's lock is still held, so the calls of the
+        //threads that share it stay in order
+        pthread_mutex_lock(&file_lock);
+        fwrite(&record, sizeof(record), 1, file);
+        fwrite(products.data(), 1, payload_size, file);
+        pthread_mutex_unlock(&file_lock);
+    } else{
+        memcpy(buffer->data + buffer->used, &record, sizeof(record));
+        if(payload_size > 0){
+            memcpy(buffer->data + buffer->used + sizeof(record), products.data(), payload_size);
+        }
+        buffer->used += size;
+    }
+    pthread_mutex_unlock(&buffer->lock);
+}
+
+void OperationTrace::flush(){
+    for(int i=0; i<TRACE_BUFFERS; i++){
+        pthread_mutex_lock(&buffers[i]->lock);
+        flushLocked(buffers[i]);
+        pthread_mutex_unlock(&buffers[i]->lock);
+    }
+    pthread_mutex_lock(&file_lock);
+    fflush(file);
+    pthread_mutex_unlock(&file_lock);
+}
+
+bool OperationTrace::read(const char* path, std::vector<TracedCall>& calls){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        fprintf(stderr, "can't open the trace %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    TraceHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC ||
+       header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)){
+        fprintf(stderr, "%s is not a trace of this version\n", path);
+        fclose(file);
+        return false;
+    }
+
+    bool valid = true;
+    TracedCall call;
+    std::vector<TraceProduct> products;
+    while(fread(&call.record, sizeof(call.record), 1, file) == 1){
+        products.resize(call.record.num_payload);
+        if(call.record.operation >= NUM_FACTORY_OPERATIONS ||
+           fread(products.data(), sizeof(TraceProduct), products.size(), file) != products.size()){
+            //a trace of a process that died before it was flushed ends with a partial call
+            valid = false;
+            break;
+        }
+        call.products.clear();
+        for(auto& product : products){
+            call.products.push_back(Product(product.id, product.value));
+        }
+        calls.push_back(call);
+    }
+    if(!valid){
+        fprintf(stderr, "%s is cut after %zu calls, the rest is ignored\n", path, calls.size());
+    }
+    fclose(file);
+    return true;
+}
+
+TraceCall::TraceCall(OperationTrace* trace, FactoryOperation operation, int num_products, int argument) : trace(trace){
+    if(trace != NULL){
+        call.start_ns = nowNanoseconds();
+        call.duration_ns = 0;
+        call.thread = 0;
+        call.operation = static_cast<unsigned int>(operation);
+        call.num_products = num_products;
+        call.argument = argument;
+        call.result = 0;
+        call.num_payload = 0;
+    }
+}
+
+TraceCall::~TraceCall(){
+    if(trace != NULL){
+        unsigned long long end_ns = nowNanoseconds();
+        call.duration_ns = end_ns - call.start_ns;
+        call.start_ns -= trace->startTime();
+        trace->record(call, products);
+    }
+}
+
+void TraceCall::addProducts(int num_products, const Product* products){
+    if(trace == NULL){
+        return;
+    }
+    for(int i=0; i<num_products; i++){
+        TraceProduct product = {products[i].getId(), products[i].getValue()};
+        this->products.push_back(product);
+    }
+}
+
+void TraceCall::addProducts(const std::list<Product>& products){
+    if(trace == NULL){
+        return;
+    }
+    for(auto& product : products){
+        TraceProduct traced = {product.getId(), product.getValue()};
+        this->products.push_back(traced);
+    }
+}
+
+void TraceCall::addProducts(const ProductQueue& products){
+    if(trace == NULL){
+        return;
+    }
+    products.forEach([this](const Product& product){
+        TraceProduct traced = {product.getId(), product.getValue()};
+        this->products.push_back(traced);
+    });
+}
@@ -0,0 +1,137 @@
+#ifndef OPERATION_TRACE_H_
+#define OPERATION_TRACE_H_
+
+#include <pthread.h>
+#include <stdio.h>
+#include <list>
+#include <vector>
+#include "FactoryOperation.h"
+#include "Product.h"
+#include "ProductQueue.h"
+
+//the first bytes of a trace file ("FTRC")
+#define TRACE_MAGIC 0x43525446u
+#define TRACE_VERSION 1
+
+//number of buffers the recording threads share, a thread always uses the same one
+#define TRACE_BUFFERS 64
+//bytes every buffer collects before it is written to the file
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+/**
+ * The binary trace format, in the byte order of the machine that recorded it:
+ * a TraceHeader, then one TraceRecord for every call, each followed by the num_payload TraceProducts of the call.
+ * The calls of one thread are in the order they were made, the calls of different threads are interleaved in
+ * blocks, so the order between threads is given only by the timestamps.
+ */
+struct TraceHeader{
+    unsigned int magic;
+    unsigned int version;
+    //sizeof(TraceRecord) of the recording build
+    unsigned int record_size;
+    unsigned int reserved;
+};
+
+//one call of a Factory operation
+struct TraceRecord{
+    //from the start of the trace to the start of the call
+    unsigned long long start_ns;
+    unsigned long long duration_ns;
+    //the calling thread, threads are numbered in the order of their first call in the process
+    unsigned int thread;
+    //a FactoryOperation
+    unsigned int operation;
+    //the number of products to produce, buy, steal or return
+    int num_products;
+    //min_value of buyProducts and fake_id of stealProducts and startThief, 0 for the other operations
+    int argument;
+    //the id tryBuyOne bought, the number of products tryBuyMany, buyProducts, stealProducts and
+    //listAvailableProducts gave, 0 for the other operations
+    int result;
+    //the number of TraceProducts after the record: the produced and the returned products
+    unsigned int num_payload;
+};
+
+struct TraceProduct{
+    int id;
+    int value;
+};
+
+//a call that was read from a trace
+struct TracedCall{
+    TraceRecord record;
+    std::vector<Product> products;
+};
+
+/**
+ * Records every call of a Factory's operations to a trace file (see TraceHeader).
+ * A call is appended to the calling thread's buffer under that buffer's lock (threads share TRACE_BUFFERS buffers),
+ * and a full buffer is written to the file under the file's lock, so recording is a copy unless a buffer fills up.
+ */
+class OperationTrace{
+    struct Buffer{
+        pthread_mutex_t lock;
+        char data[TRACE_BUFFER_SIZE];
+        size_t used;
+    };
+
+    FILE* file;
+    //writes to the file - under file_lock
+    pthread_mutex_t file_lock;
+    Buffer* buffers[TRACE_BUFFERS];
+    //when the trace started, timestamps are from it
+    unsigned long long start_ns;
+
+    explicit OperationTrace(FILE* file);
+
+    //writes buffer's bytes to the file and empties it, the buffer must be locked
+    void flushLocked(Buffer* buffer);
+
+    //copying is not allowed
+    OperationTrace(const OperationTrace&);
+    OperationTrace& operator=(const OperationTrace&);
+
+public:
+    //creates the trace file, NULL (after printing why) if it can't be created
+    static OperationTrace* create(const char* path);
+    //writes what is left in the buffers and closes the file
+    ~OperationTrace();
+
+    unsigned long long startTime() const;
+
+    //appends a call, record.thread is filled in
+    void record(TraceRecord& record, const std::vector<TraceProduct>& products);
+    //writes all the buffers to the file, calls that are in progress are recorded when they end
+    void flush();
+
+    //the number of the calling thread in the process
+    static unsigned int threadNumber();
+
+    //reads all the calls of a trace file, returns false (after printing why) if it is not a valid trace
+    static bool read(const char* path, std::vector<TracedCall>& calls);
+};
+
+/**
+ * Records a call of an operation from construction to destruction. With a NULL trace nothing is done and the
+ * clock is never read, like OperationTimer.
+ */
+class TraceCall{
+    OperationTrace* trace;
+    TraceRecord call;
+    std::vector<TraceProduct> products;
+
+public:
+    TraceCall(OperationTrace* trace, FactoryOperation operation, int num_products = 0, int argument = 0);
+    ~TraceCall();
+
+    void setResult(int result){
+        call.result = result;
+    }
+
+    //the products of the call, that a replay passes again
+    void addProducts(int num_products, const Product* products);
+    void addProducts(const std::list<Product>& products);
+    void addProducts(const ProductQueue& products);
+};
+
+#endif // OPERATION_TRACE_H_
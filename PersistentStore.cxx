@@ -0,0 +1,348 @@
+#include "PersistentStore.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+size_t PersistentStore::fileSize(unsigned long long product_capacity, unsigned long long theft_capacity){
+    return STORE_HEADER_SIZE + product_capacity * sizeof(StoreSlot) + theft_capacity * sizeof(StoreTheft);
+}
+
+//maps size bytes of fd, NULL (after printing why) if it can't
+static char* mapFile(int fd, size_t size, const char* path){
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mapping == MAP_FAILED){
+        fprintf(stderr, "can't map the store %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    return static_cast<char*>(mapping);
+}
+
+//creates an empty store of the given capacities in fd, the magic is written last so a half made store is not valid
+static char* createStore(int fd, unsigned long long product_capacity, unsigned long long theft_capacity,
+                         const char* path){
+    size_t size = STORE_HEADER_SIZE + product_capacity * sizeof(StoreSlot) + theft_capacity * sizeof(StoreTheft);
+    if(ftruncate(fd, static_cast<off_t>(size)) != 0){
+        fprintf(stderr, "can't size the store %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    char* mapping = mapFile(fd, size, path);
+    if(mapping == NULL){
+        return NULL;
+    }
+    StoreHeader* header = reinterpret_cast<StoreHeader*>(mapping);
+    memset(header, 0, sizeof(StoreHeader));
+    header->version = STORE_VERSION;
+    header->product_capacity = product_capacity;
+    header->theft_capacity = theft_capacity;
+    __atomic_store_n(&header->magic, STORE_MAGIC, __ATOMIC_RELEASE);
+    return mapping;
+}
+
+PersistentStore::PersistentStore(const std::string& path, int fd, char* mapping, size_t mapping_size) :
+        path(path), fd(fd), mapping(mapping), mapping_size(mapping_size), failed(false){
+    state = header()->states[header()->generation % 2];
+}
+
+PersistentStore* PersistentStore::open(const char* path){
+    //a store that was being grown when the process died, the old one is still complete
+    std::string temporary = std::string(path) + ".tmp";
+    unlink(temporary.c_str());
+
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        fprintf(stderr, "can't open the store %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat file_stat;
+    fstat(fd, &file_stat);
+    size_t file_size = static_cast<size_t>(file_stat.st_size);
+
+    char* mapping = NULL;
+    StoreHeader existing;
+    memset(&existing, 0, sizeof(existing));
+    if(file_size >= sizeof(StoreHeader) && pread(fd, &existing, sizeof(existing), 0) != sizeof(existing)){
+        existing.magic = 0;
+    }
+    if(file_size == 0 || (existing.magic == 0 && existing.generation == 0)){
+        //a new store, or one that died while it was created
+        mapping = createStore(fd, STORE_INITIAL_CAPACITY, STORE_INITIAL_CAPACITY, path);
+        file_size = fileSize(STORE_INITIAL_CAPACITY, STORE_INITIAL_CAPACITY);
+    } else if(existing.magic != STORE_MAGIC || existing.version != STORE_VERSION ||
+              file_size != fileSize(existing.product_capacity, existing.theft_capacity)){
+        fprintf(stderr, "%s is not a store of this version\n", path);
+    } else{
+        mapping = mapFile(fd, file_size, path);
+    }
+    if(mapping == NULL){
+        close(fd);
+        return NULL;
+    }
+    return new PersistentStore(path, fd, mapping, file_size);
+}
+
+PersistentStore::~PersistentStore(){
+    munmap(mapping, mapping_size);
+    close(fd);
+}
+
+StoreHeader* PersistentStore::header() const{
+    return reinterpret_cast<StoreHeader*>(mapping);
+}
+
+StoreSlot& PersistentStore::slot(unsigned long long index) const{
+    StoreSlot* slots = reinterpret_cast<StoreSlot*>(mapping + STORE_HEADER_SIZE);
+    return slots[index % header()->product_capacity];
+}
+
+StoreTheft& PersistentStore::theft(unsigned long long index) const{
+    StoreTheft* thefts = reinterpret_cast<StoreTheft*>(mapping + STORE_HEADER_SIZE +
+                                                       header()->product_capacity * sizeof(StoreSlot));
+    return thefts[index];
+}
+
+bool PersistentStore::isTaken(const StoreSlot& slot, unsigned long long generation){
+    return slot.taken_generation != 0 && slot.taken_generation <= generation;
+}
+
+void PersistentStore::commit(const StoreState& next){
+    StoreHeader* store_header = header();
+    unsigned long long generation = store_header->generation + 1;
+    store_header->states[generation % 2] = next;
+    //everything written before is part of the commit, the single store makes it visible to a recovery
+    __atomic_store_n(&store_header->generation, generation, __ATOMIC_RELEASE);
+    state = next;
+}
+
+unsigned long long PersistentStore::skipProducts(unsigned long long index, size_t num_products) const{
+    unsigned long long generation = header()->generation;
+    while(num_products > 0 && index < state.tail){
+        if(!isTaken(slot(index), generation)){
+            --num_products;
+        }
+        ++index;
+    }
+    return index;
+}
+
+unsigned long long PersistentStore::skipTaken(unsigned long long index, unsigned long long generation) const{
+    while(index < state.tail && isTaken(slot(index), generation)){
+        ++index;
+    }
+    return index;
+}
+
+void PersistentStore::recover(std::vector<Product>& products, std::vector<std::pair<Product, int>>& thefts){
+    unsigned long long generation = header()->generation;
+    for(unsigned long long index = state.head; index < state.tail; ++index){
+        StoreSlot& product_slot = slot(index);
+        if(product_slot.taken_generation > generation){
+            //marked by a change that was never committed, the product was not bought
+            product_slot.taken_generation = 0;
+        }
+        if(!isTaken(product_slot, generation)){
+            products.push_back(Product(product_slot.id, product_slot.value));
+        }
+    }
+    for(unsigned long long index = 0; index < state.num_thefts; ++index){
+        StoreTheft& entry = theft(index);
+        thefts.push_back(std::make_pair(Product(entry.id, entry.value), entry.fake_id));
+    }
+}
+
+size_t PersistentStore::size() const{
+    size_t num_products = 0;
+    unsigned long long generation = header()->generation;
+    for(unsigned long long index = state.head; index < state.tail; ++index){
+        if(!isTaken(slot(index), generation)){
+            ++num_products;
+        }
+    }
+    return num_products;
+}
+
+bool PersistentStore::reserve(size_t num_products, size_t num_thefts){
+    if(failed){
+        return false;
+    }
+    unsigned long long product_capacity = header()->product_capacity;
+    unsigned long long theft_capacity = header()->theft_capacity;
+    unsigned long long needed_products = state.tail - state.head + num_products;
+    unsigned long long needed_thefts = state.num_thefts + num_thefts;
+    if(needed_products <= product_capacity && needed_thefts <= theft_capacity){
+        return true;
+    }
+    while(product_capacity < needed_products){
+        product_capacity *= 2;
+    }
+    while(theft_capacity < needed_thefts){
+        theft_capacity *= 2;
+    }
+    if(!rewrite(product_capacity, theft_capacity)){
+        fprintf(stderr, "the store %s can't grow, the factory is no longer stored\n", path.c_str());
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool PersistentStore::rewrite(unsigned long long product_capacity, unsigned long long theft_capacity){
+    std::string temporary = path + ".tmp";
+    int new_fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(new_fd < 0){
+        return false;
+    }
+    char* new_mapping = createStore(new_fd, product_capacity, theft_capacity, temporary.c_str());
+    if(new_mapping == NULL){
+        close(new_fd);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    //the products that are not taken go to the start of the new ring
+    StoreHeader* new_header = reinterpret_cast<StoreHeader*>(new_mapping);
+    StoreSlot* new_slots = reinterpret_cast<StoreSlot*>(new_mapping + STORE_HEADER_SIZE);
+    StoreTheft* new_thefts = reinterpret_cast<StoreTheft*>(new_mapping + STORE_HEADER_SIZE +
+                                                           product_capacity * sizeof(StoreSlot));
+    unsigned long long generation = header()->generation;
+    unsigned long long num_products = 0;
+    for(unsigned long long index = state.head; index < state.tail; ++index){
+        if(!isTaken(slot(index), generation)){
+            new_slots[num_products] = slot(index);
+            new_slots[num_products].taken_generation = 0;
+            ++num_products;
+        }
+    }
+    if(state.num_thefts > 0){
+        memcpy(new_thefts, &theft(0), state.num_thefts * sizeof(StoreTheft));
+    }
+    StoreState new_state;
+    new_state.head = 0;
+    new_state.tail = num_products;
+    new_state.num_thefts = state.num_thefts;
+    new_header->states[1] = new_state;
+    new_header->generation = 1;
+
+    //the new file must be complete on the disk before it replaces the old one
+    size_t new_size = fileSize(product_capacity, theft_capacity);
+    msync(new_mapping, new_size, MS_SYNC);
+    if(rename(temporary.c_str(), path.c_str()) != 0){
+        munmap(new_mapping, new_size);
+        close(new_fd);
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    munmap(mapping, mapping_size);
+    close(fd);
+    fd = new_fd;
+    mapping = new_mapping;
+    mapping_size = new_size;
+    state = new_state;
+    return true;
+}
+
+void PersistentStore::writeSlot(size_t offset, const Product& product){
+    StoreSlot& product_slot = slot(state.tail + offset);
+    product_slot.id = product.getId();
+    product_slot.value = product.getValue();
+    product_slot.taken_generation = 0;
+}
+
+void PersistentStore::add(int num_products, const Product* products){
+    if(num_products <= 0 || !reserve(static_cast<size_t>(num_products), 0)){
+        return;
+    }
+    //the slots after tail are not committed, a crash before the commit leaves them out
+    for(int i=0; i<num_products; i++){
+        writeSlot(static_cast<size_t>(i), products[i]);
+    }
+    StoreState next = state;
+    next.tail += static_cast<unsigned long long>(num_products);
+    commit(next);
+}
+
+void PersistentStore::add(const ProductQueue& products){
+    if(products.empty() || !reserve(products.size(), 0)){
+        return;
+    }
+    size_t offset = 0;
+    products.forEach([this, &offset](const Product& product){
+        writeSlot(offset++, product);
+    });
+    StoreState next = state;
+    next.tail += offset;
+    commit(next);
+}
+
+void PersistentStore::add(const std::list<Product>& products){
+    if(products.empty() || !reserve(products.size(), 0)){
+        return;
+    }
+    size_t offset = 0;
+    for(auto& product : products){
+        writeSlot(offset++, product);
+    }
+    StoreState next = state;
+    next.tail += offset;
+    commit(next);
+}
+
+void PersistentStore::takeFront(size_t num_products){
+    if(num_products == 0 || failed){
+        return;
+    }
+    StoreState next = state;
+    next.head = skipTaken(skipProducts(state.head, num_products), header()->generation);
+    commit(next);
+}
+
+void PersistentStore::takeFrontIf(size_t num_products, int min_value){
+    if(num_products == 0 || failed){
+        return;
+    }
+    //mark the wanted products with the next generation, they count as taken only once it is committed
+    unsigned long long generation = header()->generation;
+    unsigned long long next_generation = generation + 1;
+    unsigned long long index = state.head;
+    while(num_products > 0 && index < state.tail){
+        StoreSlot& product_slot = slot(index++);
+        if(isTaken(product_slot, generation)){
+            continue;
+        }
+        if(product_slot.value >= min_value){
+            product_slot.taken_generation = next_generation;
+        }
+        --num_products;
+    }
+    StoreState next = state;
+    next.head = skipTaken(state.head, next_generation);
+    commit(next);
+}
+
+void PersistentStore::steal(const ProductQueue& stolen, int fake_id){
+    if(stolen.empty() || !reserve(0, stolen.size())){
+        return;
+    }
+    //the thefts after num_thefts are not committed, like the slots after tail
+    unsigned long long position = state.num_thefts;
+    stolen.forEach([this, &position, fake_id](const Product& product){
+        StoreTheft& entry = theft(position++);
+        entry.id = product.getId();
+        entry.value = product.getValue();
+        entry.fake_id = fake_id;
+        entry.reserved = 0;
+    });
+    StoreState next = state;
+    next.head = skipTaken(skipProducts(state.head, stolen.size()), header()->generation);
+    next.num_thefts = position;
+    commit(next);
+}
+
+void PersistentStore::sync(){
+    msync(mapping, mapping_size, MS_SYNC);
+}
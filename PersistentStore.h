@@ -0,0 +1,131 @@
+#ifndef PERSISTENT_STORE_H_
+#define PERSISTENT_STORE_H_
+
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Product.h"
+#include "ProductQueue.h"
+
+//the first bytes of a store file ("FSTR")
+#define STORE_MAGIC 0x52545346u
+#define STORE_VERSION 1
+//products and thefts a new store has room for, it grows by doubling
+#define STORE_INITIAL_CAPACITY 4096
+//the header takes the first page, so the slots are page aligned
+#define STORE_HEADER_SIZE 4096
+
+//the counters of a store, a state is replaced as a whole by a commit
+struct StoreState{
+    //slot index of the oldest product and after the newest one, they only grow (a slot is index % capacity)
+    unsigned long long head;
+    unsigned long long tail;
+    unsigned long long num_thefts;
+};
+
+struct StoreHeader{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long product_capacity;
+    unsigned long long theft_capacity;
+    //the number of commits, states[generation % 2] is the committed state
+    unsigned long long generation;
+    StoreState states[2];
+};
+
+struct StoreSlot{
+    int id;
+    int value;
+    //the commit that bought the product from the middle of the inventory (a filtered buyProducts), 0 if none.
+    //a mark of a generation that was not committed is ignored, and cleared when the store is opened
+    unsigned long long taken_generation;
+};
+
+struct StoreTheft{
+    int id;
+    int value;
+    int fake_id;
+    int reserved;
+};
+
+/**
+ * A copy of a factory's inventory and theft log in a memory-mapped file, that a restarted factory opens again.
+ *
+ * Layout: a StoreHeader, then the products as a ring of StoreSlots from head to tail, then the thefts in
+ * the order they happened. Every change writes the slots and thefts it adds outside the committed range (or
+ * marks slots with the next generation), then commits: it writes the new counters to the state that is not
+ * committed and stores the next generation with a single 8 byte store. A process that dies in the middle of a
+ * change leaves the previous generation committed, so a buyProducts or stealProducts either happened completely
+ * (products gone, thefts logged) or not at all.
+ * Stores to a shared mapping survive the process; they reach the disk when the kernel writes them back, or
+ * on sync() - that is needed to survive a crash of the machine.
+ *
+ * When the ring or the thefts are full the store is written again to a new file twice as big, that replaces the
+ * old one with a rename, so growing is also atomic. The store is not thread safe, the factory changes it under
+ * factory_lock together with the inventory.
+ */
+class PersistentStore{
+    std::string path;
+    int fd;
+    char* mapping;
+    size_t mapping_size;
+    //the committed state, the same as the header's
+    StoreState state;
+    //set when the file can't grow, from then on nothing is stored
+    bool failed;
+
+    PersistentStore(const std::string& path, int fd, char* mapping, size_t mapping_size);
+
+    StoreHeader* header() const;
+    StoreSlot& slot(unsigned long long index) const;
+    StoreTheft& theft(unsigned long long index) const;
+    static size_t fileSize(unsigned long long product_capacity, unsigned long long theft_capacity);
+    //true if the slot's product was bought from the middle by a commit up to generation
+    static bool isTaken(const StoreSlot& slot, unsigned long long generation);
+
+    //makes next the committed state
+    void commit(const StoreState& next);
+    //the index after the first num_products products that are not taken from index on
+    unsigned long long skipProducts(unsigned long long index, size_t num_products) const;
+    //skips taken slots from index on
+    unsigned long long skipTaken(unsigned long long index, unsigned long long generation) const;
+    //makes room for num_products more products and num_thefts more thefts, false if the store failed
+    bool reserve(size_t num_products, size_t num_thefts);
+    //writes the store to a new file with the given capacities and replaces the old one with it
+    bool rewrite(unsigned long long product_capacity, unsigned long long theft_capacity);
+    //writes a product to the slot after the committed ones plus offset
+    void writeSlot(size_t offset, const Product& product);
+
+    //copying is not allowed
+    PersistentStore(const PersistentStore&);
+    PersistentStore& operator=(const PersistentStore&);
+
+public:
+    //opens the store at path, or creates an empty one. NULL (after printing why) if the file is not a store
+    //or can't be mapped
+    static PersistentStore* open(const char* path);
+    ~PersistentStore();
+
+    //the committed products (oldest first) and thefts (in order), read once when the store is opened
+    void recover(std::vector<Product>& products, std::vector<std::pair<Product, int>>& thefts);
+
+    //the number of products in the store
+    size_t size() const;
+
+    //adds products after the newest one
+    void add(int num_products, const Product* products);
+    void add(const ProductQueue& products);
+    void add(const std::list<Product>& products);
+    //removes the num_products oldest products
+    void takeFront(size_t num_products);
+    //of the num_products oldest products, removes the ones with a value of at least min_value
+    void takeFrontIf(size_t num_products, int min_value);
+    //removes the stolen products (the oldest ones) and logs them as stolen by fake_id, in one commit
+    void steal(const ProductQueue& stolen, int fake_id);
+
+    //waits until the mapping is written to the disk
+    void sync();
+};
+
+#endif // PERSISTENT_STORE_H_
@@ -11,10 +11,10 @@ public:
         this->id = id;
         this->value = value;
     }
-    int getId(){
+    int getId() const{
         return id;
     }
-    int getValue(){
+    int getValue() const{
         return value;
     }
 };
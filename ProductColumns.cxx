@@ -0,0 +1,103 @@
+#include "ProductColumns.h"
+#include <algorithm>
+
+ProductColumns::ProductColumns(){}
+
+size_t ProductColumns::size() const{
+    return values.size();
+}
+
+bool ProductColumns::empty() const{
+    return values.empty();
+}
+
+void ProductColumns::clear(){
+    ids.clear();
+    values.clear();
+}
+
+void ProductColumns::reserve(size_t num_products){
+    ids.reserve(num_products);
+    values.reserve(num_products);
+}
+
+void ProductColumns::pushBack(const Product& product){
+    ids.push_back(product.getId());
+    values.push_back(product.getValue());
+}
+
+void ProductColumns::pushBack(int num_products, const Product* products){
+    reserve(size() + static_cast<size_t>(num_products));
+    for(int i=0; i<num_products; i++){
+        pushBack(products[i]);
+    }
+}
+
+void ProductColumns::pushBack(const InventorySnapshot& snapshot){
+    reserve(size() + snapshot.size());
+    snapshot.forEach([this](const Product& product){ pushBack(product); });
+}
+
+Product ProductColumns::at(size_t index) const{
+    return Product(ids[index], values[index]);
+}
+
+const int* ProductColumns::idColumn() const{
+    return ids.data();
+}
+
+const int* ProductColumns::valueColumn() const{
+    return values.data();
+}
+
+size_t ProductColumns::countAtLeast(int min_value, FilterKernel kernel) const{
+    return ::countAtLeast(values.data(), values.size(), min_value, kernel);
+}
+
+size_t ProductColumns::selectAtLeast(int min_value, ProductColumns& out, FilterKernel kernel) const{
+    unsigned int indices[COLUMNS_FILTER_BLOCK];
+    size_t num_selected = 0;
+    for(size_t begin=0; begin<values.size(); begin+=COLUMNS_FILTER_BLOCK){
+        size_t num_values = std::min(values.size() - begin, static_cast<size_t>(COLUMNS_FILTER_BLOCK));
+        size_t num_matching = ::selectAtLeast(values.data() + begin, num_values, min_value, indices, kernel);
+        //only the matching products are gathered from the columns
+        for(size_t i=0; i<num_matching; i++){
+            out.ids.push_back(ids[begin + indices[i]]);
+            out.values.push_back(values[begin + indices[i]]);
+        }
+        num_selected += num_matching;
+    }
+    return num_selected;
+}
+
+size_t ProductColumns::removeAtLeast(int min_value, FilterKernel kernel){
+    //the kept products move down in place, a kept index is never below the position it moves to
+    unsigned int indices[COLUMNS_FILTER_BLOCK];
+    size_t num_kept = 0;
+    for(size_t begin=0; begin<values.size(); begin+=COLUMNS_FILTER_BLOCK){
+        size_t num_values = std::min(values.size() - begin, static_cast<size_t>(COLUMNS_FILTER_BLOCK));
+        size_t num_below = ::selectBelow(values.data() + begin, num_values, min_value, indices, kernel);
+        if(num_below == num_values && num_kept == begin){
+            //nothing was removed yet and the whole block stays, it is already in place
+            num_kept += num_values;
+            continue;
+        }
+        for(size_t i=0; i<num_below; i++){
+            ids[num_kept] = ids[begin + indices[i]];
+            values[num_kept] = values[begin + indices[i]];
+            ++num_kept;
+        }
+    }
+    size_t num_removed = values.size() - num_kept;
+    ids.resize(num_kept);
+    values.resize(num_kept);
+    return num_removed;
+}
+
+std::list<Product> ProductColumns::toList() const{
+    std::list<Product> products;
+    for(size_t i=0; i<values.size(); i++){
+        products.push_back(at(i));
+    }
+    return products;
+}
@@ -0,0 +1,58 @@
+#ifndef PRODUCT_COLUMNS_H_
+#define PRODUCT_COLUMNS_H_
+
+#include <cstddef>
+#include <list>
+#include <vector>
+#include "Product.h"
+#include "InventorySnapshot.h"
+#include "ValueFilter.h"
+
+//values a filter looks at in one kernel call, so the indices of a call fit a small buffer that stays in cache
+#define COLUMNS_FILTER_BLOCK 4096
+
+/**
+ * Products stored as columns (structure of arrays): the ids in one array and the values in another, in order.
+ * A Product is an {id, value} pair, so in a list or a chunk of products the values are interleaved with the ids
+ * and a filter by value can't load them as a vector. Here the value column is one contiguous array of ints, and
+ * the filters run the vector kernels of ValueFilter over it: a block of values is compared at once, and only the
+ * ids of the matching products are touched.
+ * The factory's own inventory stays a queue of chunks (its chunks are relinked between queues and popped
+ * concurrently), a ProductColumns is a copy of products for filtering and counting them in bulk, for example
+ * of an InventorySnapshot.
+ * Not thread safe.
+ */
+class ProductColumns{
+    std::vector<int> ids;
+    std::vector<int> values;
+
+public:
+    ProductColumns();
+
+    size_t size() const;
+    bool empty() const;
+    void clear();
+    void reserve(size_t num_products);
+
+    void pushBack(const Product& product);
+    void pushBack(int num_products, const Product* products);
+    //appends the products of the snapshot, from oldest to newest
+    void pushBack(const InventorySnapshot& snapshot);
+
+    Product at(size_t index) const;
+    const int* idColumn() const;
+    const int* valueColumn() const;
+
+    //the number of products worth at least min_value
+    size_t countAtLeast(int min_value, FilterKernel kernel = bestFilterKernel()) const;
+    //appends the products worth at least min_value to out (in order), returns how many were appended
+    size_t selectAtLeast(int min_value, ProductColumns& out, FilterKernel kernel = bestFilterKernel()) const;
+    /*removes the products worth at least min_value and keeps the others in order, returns how many were removed.
+    the same as remove_if with isAboveMinValueFunctor on a list, what a company does before it returns products.*/
+    size_t removeAtLeast(int min_value, FilterKernel kernel = bestFilterKernel());
+
+    //returns the products as a list, in order
+    std::list<Product> toList() const;
+};
+
+#endif // PRODUCT_COLUMNS_H_
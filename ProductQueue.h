@@ -0,0 +1,10 @@
+#ifndef PRODUCT_QUEUE_H_
+#define PRODUCT_QUEUE_H_
+
+#include "Product.h"
+#include "ChunkedQueue.h"
+
+//queue of products from oldest to newest, the storage of a factory's inventory
+typedef ChunkedQueue<Product> ProductQueue;
+
+#endif // PRODUCT_QUEUE_H_
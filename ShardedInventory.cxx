@@ -0,0 +1,320 @@
+#include "ShardedInventory.h"
+#include "Factory.h"
+#include <sched.h>
+#include <unistd.h>
+
+void StampedQueue::pushBack(const Product& product, unsigned long long stamp){
+    products.pushBack(product);
+    if(!stamps.empty() && stamps.back().first_stamp + stamps.back().count == stamp){
+        ++stamps.back().count;
+    } else{
+        stamps.push_back(StampRun(stamp, 1));
+    }
+}
+
+void StampedQueue::spliceFront(StampedQueue& other){
+    products.spliceFront(other.products);
+    stamps.insert(stamps.begin(), other.stamps.begin(), other.stamps.end());
+    other.stamps.clear();
+}
+
+void StampedQueue::takeFront(size_t num_products, StampedQueue& out){
+    products.takeFront(num_products, out.products);
+
+    //move the stamps of the taken products
+    while(num_products > 0){
+        StampRun& run = stamps.front();
+        if(run.count <= num_products){
+            num_products -= run.count;
+            out.stamps.push_back(run);
+            stamps.pop_front();
+        } else{
+            out.stamps.push_back(StampRun(run.first_stamp, num_products));
+            run.first_stamp += num_products;
+            run.count -= num_products;
+            num_products = 0;
+        }
+    }
+}
+
+void StampedQueue::partition(int min_value, StampedQueue& kept, StampedQueue& rejected){
+    //walk the products and the stamps together
+    std::deque<StampRun>::const_iterator run = stamps.begin();
+    size_t offset = 0;
+    products.forEach([&](const Product& product){
+        unsigned long long stamp = run->first_stamp + offset;
+        if(++offset == run->count){
+            ++run;
+            offset = 0;
+        }
+        if(product.getValue() >= min_value){
+            kept.pushBack(product, stamp);
+        } else{
+            rejected.pushBack(product, stamp);
+        }
+    });
+    products.clear();
+    stamps.clear();
+}
+
+void StampedQueue::takeFront(size_t num_products, ProductQueue& out){
+    products.takeFront(num_products, out);
+
+    //drop the stamps of the taken products
+    while(num_products > 0){
+        StampRun& run = stamps.front();
+        if(run.count <= num_products){
+            num_products -= run.count;
+            stamps.pop_front();
+        } else{
+            run.first_stamp += num_products;
+            run.count -= num_products;
+            num_products = 0;
+        }
+    }
+}
+
+ShardedInventory::ShardedInventory(int num_shards) : next_stamp(0), total_products(0){
+    if(num_shards <= 0){
+        num_shards = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    if(num_shards <= 0){
+        num_shards = 1;
+    }
+
+    for(int i=0; i<num_shards; i++){
+        Shard* shard = new Shard();
+        INIT_MUTEX_LOCK(shard->lock);
+        shards.push_back(shard);
+    }
+}
+
+ShardedInventory::~ShardedInventory(){
+    for(auto shard : shards){
+        pthread_mutex_destroy(&shard->lock);
+        delete shard;
+    }
+}
+
+int ShardedInventory::numShards() const{
+    return static_cast<int>(shards.size());
+}
+
+size_t ShardedInventory::size() const{
+    return total_products.load();
+}
+
+size_t ShardedInventory::localShardIndex(){
+    int cpu = sched_getcpu();
+    if(cpu < 0){
+        cpu = 0;
+    }
+    return static_cast<size_t>(cpu) % shards.size();
+}
+
+void ShardedInventory::addStamps(Shard* shard, size_t num_products){
+    //stamps are taken under the shard's lock, so the stamps of every shard are increasing
+    unsigned long long first_stamp = next_stamp.fetch_add(num_products);
+    std::deque<StampRun>& stamps = shard->queue.stamps;
+
+    //if nobody added products to another shard in between, the last run just gets longer
+    if(!stamps.empty() && stamps.back().first_stamp + stamps.back().count == first_stamp){
+        stamps.back().count += num_products;
+    } else{
+        stamps.push_back(StampRun(first_stamp, num_products));
+    }
+    total_products.fetch_add(num_products);
+}
+
+void ShardedInventory::add(int num_products, const Product* products){
+    if(num_products <= 0){
+        return;
+    }
+    Shard* shard = shards[localShardIndex()];
+
+    pthread_mutex_lock(&shard->lock);
+    shard->queue.products.pushBack(num_products, products);
+    addStamps(shard, static_cast<size_t>(num_products));
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void ShardedInventory::add(ProductQueue& batch){
+    size_t num_products = batch.size();
+    if(num_products == 0){
+        return;
+    }
+    Shard* shard = shards[localShardIndex()];
+
+    pthread_mutex_lock(&shard->lock);
+    shard->queue.products.spliceBack(batch);
+    addStamps(shard, num_products);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+bool ShardedInventory::tryTakeOne(Product& product){
+    size_t num_shards = shards.size();
+    size_t local = localShardIndex();
+
+    //start from the local shard, then steal from the next ones
+    for(size_t i=0; i<num_shards; i++){
+        Shard* shard = shards[(local + i) % num_shards];
+        //skip shards that look empty without locking them
+        if(shard->queue.products.empty()){
+            continue;
+        }
+        //never wait for a busy shard
+        if(pthread_mutex_trylock(&shard->lock) != 0){
+            continue;
+        }
+        bool taken = shard->queue.products.popFront(product);
+        if(taken){
+            //drop the stamp of the taken product
+            StampRun& run = shard->queue.stamps.front();
+            ++run.first_stamp;
+            if(--run.count == 0){
+                shard->queue.stamps.pop_front();
+            }
+            total_products.fetch_sub(1);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        if(taken){
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t ShardedInventory::tryTakeMany(size_t num_products, ProductQueue& out){
+    size_t num_shards = shards.size();
+    size_t local = localShardIndex();
+    size_t taken = 0;
+
+    //the same order as tryTakeOne, every shard gives what it has until there are enough products
+    for(size_t i=0; i<num_shards && taken < num_products; i++){
+        Shard* shard = shards[(local + i) % num_shards];
+        if(shard->queue.products.empty()){
+            continue;
+        }
+        if(pthread_mutex_trylock(&shard->lock) != 0){
+            continue;
+        }
+        size_t from_shard = std::min(num_products - taken, shard->queue.products.size());
+        shard->queue.takeFront(from_shard, out);
+        total_products.fetch_sub(from_shard);
+        pthread_mutex_unlock(&shard->lock);
+        taken += from_shard;
+    }
+    return taken;
+}
+
+void ShardedInventory::lockAll(){
+    //always in index order, so two threads that lock all the shards can't deadlock
+    for(auto shard : shards){
+        pthread_mutex_lock(&shard->lock);
+    }
+}
+
+void ShardedInventory::unlockAll(){
+    for(auto shard : shards){
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void ShardedInventory::takeOldestMerged(std::vector<StampedQueue*>& queues, size_t num_products, ProductQueue& out){
+    std::vector<const std::deque<StampRun>*> stamps;
+    for(auto queue : queues){
+        stamps.push_back(&queue->stamps);
+    }
+    std::vector<MergeStep> steps;
+    planMerge(stamps, num_products, steps);
+
+    //products that were added together are taken in one step, so they move as whole chunks
+    for(auto& step : steps){
+        queues[step.queue]->takeFront(step.count, out);
+    }
+}
+
+void ShardedInventory::takeOldestLocked(size_t num_products, ProductQueue& out){
+    std::vector<StampedQueue*> queues;
+    for(auto shard : shards){
+        queues.push_back(&shard->queue);
+    }
+    takeOldestMerged(queues, num_products, out);
+    total_products.fetch_sub(num_products);
+}
+
+bool ShardedInventory::tryTakeOldest(size_t num_products, ProductQueue& out){
+    lockAll();
+    //with all the shards locked the total is exact
+    bool enough = (total_products.load() >= num_products);
+    if(enough){
+        takeOldestLocked(num_products, out);
+    }
+    unlockAll();
+    return enough;
+}
+
+bool ShardedInventory::tryTakeOldestFiltered(size_t num_products, int min_value, ProductQueue& kept,
+                                             size_t& num_rejected){
+    std::vector<StampedQueue*> kept_queues;
+    size_t num_kept = 0;
+
+    lockAll();
+    bool enough = (total_products.load() >= num_products);
+    if(enough){
+        //find which shards hold the oldest products
+        std::vector<StampedQueue*> queues;
+        std::vector<const std::deque<StampRun>*> stamps;
+        for(auto shard : shards){
+            queues.push_back(&shard->queue);
+            stamps.push_back(&shard->queue.stamps);
+        }
+        std::vector<MergeStep> steps;
+        planMerge(stamps, num_products, steps);
+        std::vector<size_t> counts(queues.size(), 0);
+        for(auto& step : steps){
+            counts[step.queue] += step.count;
+        }
+
+        //in every shard, take out the wanted products and put the rejected ones back in front
+        for(size_t i=0; i<queues.size(); i++){
+            if(counts[i] == 0){
+                continue;
+            }
+            StampedQueue oldest;
+            StampedQueue rejected;
+            StampedQueue* kept_queue = new StampedQueue();
+            queues[i]->takeFront(counts[i], oldest);
+            oldest.partition(min_value, *kept_queue, rejected);
+            queues[i]->spliceFront(rejected);
+            num_kept += kept_queue->products.size();
+            kept_queues.push_back(kept_queue);
+        }
+        total_products.fetch_sub(num_kept);
+        num_rejected = num_products - num_kept;
+    }
+    unlockAll();
+
+    //order the wanted products without holding the shards
+    takeOldestMerged(kept_queues, num_kept, kept);
+    for(auto kept_queue : kept_queues){
+        delete kept_queue;
+    }
+    return enough;
+}
+
+size_t ShardedInventory::takeOldest(size_t num_products, ProductQueue& out){
+    lockAll();
+    num_products = std::min(num_products, total_products.load());
+    takeOldestLocked(num_products, out);
+    unlockAll();
+    return num_products;
+}
+
+void ShardedInventory::snapshot(InventorySnapshot& out){
+    lockAll();
+    for(auto shard : shards){
+        out.addPart(shard->queue.products, &shard->queue.stamps);
+    }
+    unlockAll();
+}
@@ -0,0 +1,118 @@
+#ifndef SHARDED_INVENTORY_H_
+#define SHARDED_INVENTORY_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "ProductQueue.h"
+#include "StampMerge.h"
+#include "InventorySnapshot.h"
+
+//products from oldest to newest with their stamps, the stamps are increasing
+struct StampedQueue{
+    ProductQueue products;
+    //one run for every group of products that was added together, in the same order as products
+    std::deque<StampRun> stamps;
+
+    //stamp of the oldest product, the queue must not be empty
+    unsigned long long headStamp() const{
+        return stamps.front().first_stamp;
+    }
+
+    //adds a product with a stamp that is bigger than all the stamps in the queue
+    void pushBack(const Product& product, unsigned long long stamp);
+    //moves all the products of other (and their stamps) to the front of the queue, other's stamps must be smaller
+    void spliceFront(StampedQueue& other);
+
+    //moves the num_products oldest products (their stamps are dropped) to the back of out
+    void takeFront(size_t num_products, ProductQueue& out);
+    //moves the num_products oldest products with their stamps to the back of out
+    void takeFront(size_t num_products, StampedQueue& out);
+
+    //moves every product with a value of at least min_value to kept and the rest to rejected (same order)
+    void partition(int min_value, StampedQueue& kept, StampedQueue& rejected);
+};
+
+/**
+ * An inventory split into shards, each with a lock of its own, so that producers and simple buyers
+ * on different cores do not contend on a single lock.
+ *
+ * Ordering policy:
+ * - every group of products that is added gets a range of stamps from one global counter,
+ *   the stamps give the exact global order in which the products were added.
+ * - producers add to the shard of the cpu they run on.
+ * - a simple buyer (tryTakeOne) takes the oldest product of its own shard, and only when that shard
+ *   is empty or busy it steals the oldest product of another shard. The order between shards is
+ *   therefore only approximate for simple buyers.
+ * - multi-product takes (companies and thieves) and snapshots lock all the shards, in index order,
+ *   and merge them by stamp, so they always get the exact globally oldest products.
+ */
+class ShardedInventory{
+    struct Shard{
+        pthread_mutex_t lock;
+        //under lock
+        StampedQueue queue;
+        //keeps the locks of different shards off the same cache line
+        char padding[64];
+    };
+
+    std::vector<Shard*> shards;
+
+    //the next stamp to give
+    std::atomic<unsigned long long> next_stamp;
+    //number of products in all the shards
+    std::atomic<size_t> total_products;
+
+    //index of the shard of the cpu the calling thread runs on
+    size_t localShardIndex();
+    //adds the products to the back of shard with new stamps, the shard must be locked
+    void addStamps(Shard* shard, size_t num_products);
+
+    void lockAll();
+    void unlockAll();
+
+    //merges the queues by stamp and moves their num_products oldest products to out
+    static void takeOldestMerged(std::vector<StampedQueue*>& queues, size_t num_products, ProductQueue& out);
+    //takeOldestMerged over all the shards, they must be locked
+    void takeOldestLocked(size_t num_products, ProductQueue& out);
+
+    //copying is not allowed
+    ShardedInventory(const ShardedInventory&);
+    ShardedInventory& operator=(const ShardedInventory&);
+
+public:
+    //num_shards <= 0 gives one shard per online cpu
+    explicit ShardedInventory(int num_shards);
+    ~ShardedInventory();
+
+    int numShards() const;
+
+    //the number of products in all shards, may be out of date as soon as it returns
+    size_t size() const;
+
+    //adds the products to the local shard
+    void add(int num_products, const Product* products);
+    //links the chunks of batch to the local shard in O(1), batch is left empty
+    void add(ProductQueue& batch);
+
+    //takes a product from the local shard, or steals one from another shard when the local one is
+    //empty or busy. never blocks, returns false if no product could be taken.
+    bool tryTakeOne(Product& product);
+    /*like tryTakeOne, but moves up to num_products products to out: the oldest ones of the local shard,
+    then of the next shards that are not busy. never blocks, returns how many were moved*/
+    size_t tryTakeMany(size_t num_products, ProductQueue& out);
+
+    //moves exactly num_products of the globally oldest products to out, or nothing if there are less
+    bool tryTakeOldest(size_t num_products, ProductQueue& out);
+    /*like tryTakeOldest, but only the taken products with a value of at least min_value are moved to kept.
+    the other ones stay in their shards in their place, and their number is written to num_rejected*/
+    bool tryTakeOldestFiltered(size_t num_products, int min_value, ProductQueue& kept, size_t& num_rejected);
+    //moves up to num_products of the globally oldest products to out, returns how many were moved
+    size_t takeOldest(size_t num_products, ProductQueue& out);
+
+    //adds a view of every shard to out, taken while all of them are locked so it is a single point in time
+    void snapshot(InventorySnapshot& out);
+};
+
+#endif // SHARDED_INVENTORY_H_
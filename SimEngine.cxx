@@ -0,0 +1,162 @@
+#include "SimEngine.h"
+
+void SimActor::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept{
+    SimEngine* engine = handle.promise().engine;
+    handle.destroy();
+    engine->actorFinished();
+}
+
+void SimEngine::AsyncCall::wake(void* call){
+    AsyncCall* async_call = static_cast<AsyncCall*>(call);
+    //the factory is locked now, the call is retried later by a worker
+    async_call->engine->post(retry, async_call);
+}
+
+void SimEngine::AsyncCall::retry(void* call){
+    AsyncCall* async_call = static_cast<AsyncCall*>(call);
+    //a call that did not finish registered itself again, and will be woken again
+    if(async_call->tryCall()){
+        async_call->handle.resume();
+    }
+}
+
+bool SimEngine::BuyProducts::tryCall(){
+    return engine->factory.buyProductsAsync(num_products, min_value, &num_rejected, bought, wait);
+}
+
+bool SimEngine::ReturnProducts::tryCall(){
+    return engine->factory.returnProductsAsync(products, wait);
+}
+
+bool SimEngine::StealProducts::tryCall(){
+    return engine->factory.stealProductsAsync(num_products, fake_id, &num_stolen, wait);
+}
+
+void SimEngine::Yield::await_suspend(std::coroutine_handle<> handle){
+    engine->post(resumeHandle, handle.address());
+}
+
+SimEngine::SimEngine(Factory& factory, int num_threads) : factory(factory), live_actors(0), stopping(false){
+    INIT_MUTEX_LOCK(lock);
+    pthread_cond_init(&work_condition, NULL);
+    pthread_cond_init(&done_condition, NULL);
+
+    for(int i=0; i<num_threads; i++){
+        pthread_t worker;
+        pthread_create(&worker, NULL, workerMain, this);
+        workers.push_back(worker);
+    }
+}
+
+SimEngine::~SimEngine(){
+    waitAll();
+
+    //tell the workers to exit once the queue is empty
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&work_condition);
+    pthread_mutex_unlock(&lock);
+
+    for(auto& worker : workers){
+        pthread_join(worker, NULL);
+    }
+
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&work_condition);
+    pthread_cond_destroy(&done_condition);
+}
+
+void* SimEngine::workerMain(void* engine){
+    static_cast<SimEngine*>(engine)->workerLoop();
+    return NULL;
+}
+
+void SimEngine::workerLoop(){
+    pthread_mutex_lock(&lock);
+    while(true){
+        //wait for work
+        while(run_queue.empty() && !stopping){
+            pthread_cond_wait(&work_condition, &lock);
+        }
+        if(run_queue.empty()){
+            //the engine is stopping and there is nothing left to do
+            break;
+        }
+
+        Runnable runnable = run_queue.front();
+        run_queue.pop_front();
+
+        //run it without holding the lock
+        pthread_mutex_unlock(&lock);
+        runnable.func(runnable.arg);
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void SimEngine::resumeHandle(void* address){
+    std::coroutine_handle<>::from_address(address).resume();
+}
+
+void SimEngine::actorFinished(){
+    pthread_mutex_lock(&lock);
+    if(--live_actors == 0){
+        pthread_cond_broadcast(&done_condition);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+Factory& SimEngine::getFactory(){
+    return factory;
+}
+
+void SimEngine::spawn(SimActor actor){
+    //the frame now belongs to the engine, it frees itself when the actor returns
+    std::coroutine_handle<SimActor::promise_type> handle = actor.handle;
+    actor.handle = NULL;
+    handle.promise().engine = this;
+
+    pthread_mutex_lock(&lock);
+    ++live_actors;
+    run_queue.push_back(Runnable{resumeHandle, handle.address()});
+    pthread_cond_signal(&work_condition);
+    pthread_mutex_unlock(&lock);
+}
+
+void SimEngine::post(RunFunc func, void* arg){
+    pthread_mutex_lock(&lock);
+    run_queue.push_back(Runnable{func, arg});
+    pthread_cond_signal(&work_condition);
+    pthread_mutex_unlock(&lock);
+}
+
+void SimEngine::waitAll(){
+    pthread_mutex_lock(&lock);
+    while(live_actors > 0){
+        pthread_cond_wait(&done_condition, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+size_t SimEngine::numLiveActors(){
+    pthread_mutex_lock(&lock);
+    size_t live = live_actors;
+    pthread_mutex_unlock(&lock);
+    return live;
+}
+
+SimEngine::BuyProducts SimEngine::buyProducts(int num_products, int min_value){
+    return BuyProducts(this, num_products, min_value);
+}
+
+SimEngine::ReturnProducts SimEngine::returnProducts(std::list<Product> products){
+    return ReturnProducts(this, std::move(products));
+}
+
+SimEngine::StealProducts SimEngine::stealProducts(int num_products, unsigned int fake_id){
+    return StealProducts(this, num_products, fake_id);
+}
+
+SimEngine::Yield SimEngine::yield(){
+    return Yield(this);
+}
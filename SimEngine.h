@@ -0,0 +1,240 @@
+#ifndef SIM_ENGINE_H_
+#define SIM_ENGINE_H_
+
+#include <pthread.h>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <list>
+#include <vector>
+#include "Factory.h"
+
+class SimEngine;
+
+/**
+ * An actor of the simulation: a coroutine that is run by the workers of a SimEngine.
+ * It starts suspended and runs once it is given to SimEngine::spawn. Its frame is freed when it returns.
+ */
+class SimActor{
+public:
+    struct promise_type{
+        SimEngine* engine;
+
+        promise_type() : engine(NULL){}
+
+        SimActor get_return_object(){
+            return SimActor(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept{
+            return std::suspend_always();
+        }
+
+        //frees the frame and tells the engine the actor is done
+        struct FinalAwaiter{
+            bool await_ready() noexcept{
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+            void await_resume() noexcept{}
+        };
+        FinalAwaiter final_suspend() noexcept{
+            return FinalAwaiter();
+        }
+
+        void return_void(){}
+        void unhandled_exception(){
+            std::terminate();
+        }
+    };
+
+    SimActor(SimActor&& other) : handle(other.handle){
+        other.handle = NULL;
+    }
+    //an actor that was never spawned is freed without running
+    ~SimActor(){
+        if(handle){
+            handle.destroy();
+        }
+    }
+
+private:
+    friend class SimEngine;
+
+    std::coroutine_handle<promise_type> handle;
+
+    explicit SimActor(std::coroutine_handle<promise_type> handle) : handle(handle){}
+
+    //copying is not allowed
+    SimActor(const SimActor&);
+    SimActor& operator=(const SimActor&);
+};
+
+/**
+ * Runs actors that are coroutines on a fixed number of worker threads, so the number of actors is limited by
+ * memory (a coroutine frame each) and not by the number of threads.
+ *
+ * Where a threaded actor of the factory blocks, a coroutine actor is suspended instead: it calls the factory's
+ * asynchronous form of the call (see AsyncWait), and if the call can't finish now the factory calls back when
+ * it may. The callback only queues a retry of the call on a worker, and when the retry finishes the call the
+ * actor is resumed on that worker. A worker never blocks in the factory except on its short lock sections.
+ *
+ * The runnable work is kept in a single queue under one lock.
+ */
+class SimEngine{
+public:
+    typedef void (*RunFunc)(void* arg);
+
+private:
+    struct Runnable{
+        RunFunc func;
+        void* arg;
+    };
+
+    //a factory call of an actor that may have to be retried after a wake
+    class AsyncCall{
+        std::coroutine_handle<> handle;
+
+        //queues a retry, called by the factory under its lock
+        static void wake(void* call);
+        //runs on a worker, resumes the actor if the call finished
+        static void retry(void* call);
+
+    protected:
+        SimEngine* engine;
+        AsyncWait wait;
+
+        explicit AsyncCall(SimEngine* engine) : handle(NULL), engine(engine), wait(wake, this){}
+        virtual ~AsyncCall(){}
+
+        //calls the asynchronous form of the factory call once, returns true when it finished
+        virtual bool tryCall() = 0;
+
+        //the factory keeps a pointer to the call while it waits, so it never moves
+        AsyncCall(const AsyncCall&);
+        AsyncCall& operator=(const AsyncCall&);
+
+    public:
+        bool await_ready(){
+            return false;
+        }
+        //the actor is resumed right away if the call finished now, otherwise it stays suspended until a retry
+        //finishes it (which may happen on another worker before this returns, so nothing is touched after the call)
+        bool await_suspend(std::coroutine_handle<> handle){
+            this->handle = handle;
+            bool finished = tryCall();
+            return !finished;
+        }
+    };
+
+    Factory& factory;
+
+    std::vector<pthread_t> workers;
+
+    //work for the workers - under lock
+    std::deque<Runnable> run_queue;
+    //number of actors that were spawned and did not return yet - under lock
+    size_t live_actors;
+    //flag that is true when the engine is destroyed - under lock
+    bool stopping;
+
+    pthread_mutex_t lock;
+    //workers wait on it for work
+    pthread_cond_t work_condition;
+    //waitAll waits on it for the actors to return
+    pthread_cond_t done_condition;
+
+    static void* workerMain(void* engine);
+    void workerLoop();
+    static void resumeHandle(void* address);
+
+    //copying is not allowed
+    SimEngine(const SimEngine&);
+    SimEngine& operator=(const SimEngine&);
+
+public:
+    class BuyProducts : public AsyncCall{
+        int num_products;
+        int min_value;
+        int num_rejected;
+        std::list<Product> bought;
+
+        bool tryCall() override;
+
+    public:
+        BuyProducts(SimEngine* engine, int num_products, int min_value) : AsyncCall(engine),
+                                                                          num_products(num_products),
+                                                                          min_value(min_value), num_rejected(0){}
+        //the bought products, the rejected ones (below min_value) stayed in the factory
+        std::list<Product> await_resume(){
+            return std::move(bought);
+        }
+    };
+
+    class ReturnProducts : public AsyncCall{
+        std::list<Product> products;
+
+        bool tryCall() override;
+
+    public:
+        ReturnProducts(SimEngine* engine, std::list<Product> products) : AsyncCall(engine), products(std::move(products)){}
+        void await_resume(){}
+    };
+
+    class StealProducts : public AsyncCall{
+        int num_products;
+        unsigned int fake_id;
+        int num_stolen;
+
+        bool tryCall() override;
+
+    public:
+        StealProducts(SimEngine* engine, int num_products, unsigned int fake_id) : AsyncCall(engine),
+                                                                                   num_products(num_products),
+                                                                                   fake_id(fake_id), num_stolen(0){}
+        //the number of stolen products
+        int await_resume(){
+            return num_stolen;
+        }
+    };
+
+    //moves the actor to the back of the run queue, so the other actors get to run
+    class Yield{
+        SimEngine* engine;
+
+    public:
+        explicit Yield(SimEngine* engine) : engine(engine){}
+        bool await_ready(){
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume(){}
+    };
+
+    //starts num_threads workers that run actors on factory
+    SimEngine(Factory& factory, int num_threads);
+    //waits for all the actors to return, then stops the workers
+    ~SimEngine();
+
+    Factory& getFactory();
+
+    //queues actor to run on a worker
+    void spawn(SimActor actor);
+    //queues func(arg) to run on a worker
+    void post(RunFunc func, void* arg);
+
+    //called by an actor that returned
+    void actorFinished();
+
+    //waits until every spawned actor returned
+    void waitAll();
+    size_t numLiveActors();
+
+    //what the actors co_await instead of the blocking factory calls
+    BuyProducts buyProducts(int num_products, int min_value = NO_MIN_VALUE);
+    ReturnProducts returnProducts(std::list<Product> products);
+    StealProducts stealProducts(int num_products, unsigned int fake_id);
+    Yield yield();
+};
+
+#endif // SIM_ENGINE_H_
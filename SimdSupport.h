@@ -0,0 +1,11 @@
+#ifndef SIMD_SUPPORT_H_
+#define SIMD_SUPPORT_H_
+
+//the vector kernels of ValueFilter and InventoryAnalytics are built with per function target attributes, so the rest
+//of the build needs no flags. VALUE_FILTER_X86 is defined where they can be built
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define VALUE_FILTER_X86
+#include <immintrin.h>
+#endif
+
+#endif // SIMD_SUPPORT_H_
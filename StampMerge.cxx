@@ -0,0 +1,47 @@
+#include "StampMerge.h"
+#include <algorithm>
+#include <climits>
+
+void planMerge(const std::vector<const std::deque<StampRun>*>& stamps, size_t num_products,
+               std::vector<MergeStep>& steps){
+    //the position of every queue is a run index and how many products of that run are already merged
+    size_t num_queues = stamps.size();
+    std::vector<size_t> run_index(num_queues, 0);
+    std::vector<size_t> run_offset(num_queues, 0);
+
+    while(num_products > 0){
+        //find the queue with the oldest unmerged product, and the oldest unmerged product of the other queues
+        size_t oldest = num_queues;
+        unsigned long long oldest_stamp = ULLONG_MAX;
+        unsigned long long next_oldest_stamp = ULLONG_MAX;
+        for(size_t i=0; i<num_queues; i++){
+            if(run_index[i] == stamps[i]->size()){
+                continue;
+            }
+            unsigned long long stamp = (*stamps[i])[run_index[i]].first_stamp + run_offset[i];
+            if(stamp < oldest_stamp){
+                next_oldest_stamp = oldest_stamp;
+                oldest_stamp = stamp;
+                oldest = i;
+            } else{
+                next_oldest_stamp = std::min(next_oldest_stamp, stamp);
+            }
+        }
+        if(oldest == num_queues){
+            return;
+        }
+
+        //take the rest of the run, up to the first product of another queue that is older
+        const StampRun& run = (*stamps[oldest])[run_index[oldest]];
+        size_t in_order = static_cast<size_t>(std::min<unsigned long long>(run.count - run_offset[oldest],
+                                                                            next_oldest_stamp - oldest_stamp));
+        size_t to_take = std::min(num_products, in_order);
+        steps.push_back(MergeStep(oldest, to_take));
+        run_offset[oldest] += to_take;
+        if(run_offset[oldest] == run.count){
+            ++run_index[oldest];
+            run_offset[oldest] = 0;
+        }
+        num_products -= to_take;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef STAMP_MERGE_H_
+#define STAMP_MERGE_H_
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+//a range of consecutive stamps given to products that were added together
+struct StampRun{
+    unsigned long long first_stamp;
+    size_t count;
+
+    StampRun(unsigned long long first_stamp, size_t count) : first_stamp(first_stamp), count(count){}
+};
+
+//a step of a merge: take the next count products of the queue with the given index
+struct MergeStep{
+    size_t queue;
+    size_t count;
+
+    MergeStep(size_t queue, size_t count) : queue(queue), count(count){}
+};
+
+/*plans the merge by stamp of the num_products oldest products of several queues, every queue is given
+by its stamps (increasing). appends to steps the order in which the products should be taken, runs of
+products that were added together are kept in a single step.*/
+void planMerge(const std::vector<const std::deque<StampRun>*>& stamps, size_t num_products,
+               std::vector<MergeStep>& steps);
+
+#endif // STAMP_MERGE_H_
@@ -0,0 +1,97 @@
+#include "TheftLog.h"
+#include "Factory.h"
+
+TheftLog::Directory::Directory(size_t capacity) : capacity(capacity), segments(new std::atomic<Segment*>[capacity]){
+    for(size_t i=0; i<capacity; i++){
+        segments[i].store(NULL, std::memory_order_relaxed);
+    }
+}
+
+TheftLog::Directory::~Directory(){
+    delete[] segments;
+}
+
+TheftLog::TheftLog() : directory(new Directory(THEFT_LOG_INITIAL_SEGMENTS)), next_position(0){
+    INIT_MUTEX_LOCK(grow_lock);
+}
+
+TheftLog::~TheftLog(){
+    Directory* current = directory.load();
+    for(size_t i=0; i<current->capacity; i++){
+        delete current->segments[i].load();
+    }
+    delete current;
+    for(auto old_directory : old_directories){
+        delete old_directory;
+    }
+    pthread_mutex_destroy(&grow_lock);
+}
+
+size_t TheftLog::size() const{
+    return next_position.load();
+}
+
+size_t TheftLog::reserve(size_t num_entries){
+    return next_position.fetch_add(num_entries, std::memory_order_relaxed);
+}
+
+TheftLog::Segment* TheftLog::segmentForRead(size_t index) const{
+    Directory* current = directory.load(std::memory_order_acquire);
+    if(index >= current->capacity){
+        return NULL;
+    }
+    return current->segments[index].load(std::memory_order_acquire);
+}
+
+TheftLog::Segment* TheftLog::segmentForWrite(size_t index){
+    //the common case, the segment is already there
+    Segment* segment = segmentForRead(index);
+    if(segment != NULL){
+        return segment;
+    }
+
+    pthread_mutex_lock(&grow_lock);
+    Directory* current = directory.load(std::memory_order_relaxed);
+    if(index >= current->capacity){
+        //double the directory until the segment fits, the old one stays for readers that still use it
+        size_t capacity = current->capacity;
+        while(index >= capacity){
+            capacity *= 2;
+        }
+        Directory* bigger = new Directory(capacity);
+        for(size_t i=0; i<current->capacity; i++){
+            bigger->segments[i].store(current->segments[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        directory.store(bigger, std::memory_order_release);
+        old_directories.push_back(current);
+        current = bigger;
+    }
+    //another writer may have allocated it while this one waited for the lock
+    segment = current->segments[index].load(std::memory_order_relaxed);
+    if(segment == NULL){
+        segment = new Segment();
+        current->segments[index].store(segment, std::memory_order_release);
+    }
+    pthread_mutex_unlock(&grow_lock);
+
+    return segment;
+}
+
+void TheftLog::write(size_t position, const Product& product, int fake_id){
+    Segment* segment = segmentForWrite(position / THEFT_LOG_SEGMENT_CAPACITY);
+    size_t offset = position % THEFT_LOG_SEGMENT_CAPACITY;
+    segment->entries[offset] = Entry(product, fake_id);
+    segment->ready[offset].store(true, std::memory_order_release);
+}
+
+const TheftLog::Entry& TheftLog::readReady(size_t position) const{
+    size_t offset = position % THEFT_LOG_SEGMENT_CAPACITY;
+    while(true){
+        Segment* segment = segmentForRead(position / THEFT_LOG_SEGMENT_CAPACITY);
+        if(segment != NULL && segment->ready[offset].load(std::memory_order_acquire)){
+            return segment->entries[offset];
+        }
+        //the position is reserved but its writer did not get to it yet
+        sched_yield();
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef THEFT_LOG_H_
+#define THEFT_LOG_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <sched.h>
+#include "Product.h"
+
+//number of entries stored in a single segment of a TheftLog
+#define THEFT_LOG_SEGMENT_CAPACITY 1024
+
+//number of segments the first directory of a TheftLog has room for
+#define THEFT_LOG_INITIAL_SEGMENTS 16
+
+/**
+ * An append-only log of thefts, stored in fixed size segments that are never moved or freed while the
+ * log exists. Every entry has a position, its index from the start of the log.
+ *
+ * Writing is done in two steps: reserve() gives a range of positions with a single atomic add (the
+ * order of the reservations is the order of the log), then write() fills every reserved position and
+ * publishes it. Neither step takes a lock, except once per segment, when the segment is allocated.
+ *
+ * Readers ask for the entries since a position (a cursor), so the history is never copied as a whole.
+ * A read waits for the positions that were already reserved when it started, writers never block
+ * between reserve() and write(), so that wait is short.
+ */
+class TheftLog{
+public:
+    //a stolen product and the fake id of the thief who stole it
+    typedef std::pair<Product, int> Entry;
+
+private:
+    struct Segment{
+        Entry entries[THEFT_LOG_SEGMENT_CAPACITY];
+        //true once the entry in the same index was written
+        std::atomic<bool> ready[THEFT_LOG_SEGMENT_CAPACITY];
+
+        Segment(){
+            for(auto& entry_ready : ready){
+                entry_ready.store(false, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    //the table of segments, replaced by a bigger one when it is full
+    struct Directory{
+        size_t capacity;
+        std::atomic<Segment*>* segments;
+
+        explicit Directory(size_t capacity);
+        ~Directory();
+    };
+
+    std::atomic<Directory*> directory;
+    //directories that were replaced, readers may still use them so they live as long as the log
+    //under grow_lock
+    std::vector<Directory*> old_directories;
+    //taken to allocate a segment or replace the directory
+    pthread_mutex_t grow_lock;
+
+    //the position the next reservation starts at
+    std::atomic<size_t> next_position;
+
+    //returns the segment with the given index, allocates it if needed
+    Segment* segmentForWrite(size_t index);
+    //returns the segment with the given index, or NULL if it was not allocated yet
+    Segment* segmentForRead(size_t index) const;
+    //returns the entry at a reserved position once it was written
+    const Entry& readReady(size_t position) const;
+
+    //copying is not allowed
+    TheftLog(const TheftLog&);
+    TheftLog& operator=(const TheftLog&);
+
+public:
+    TheftLog();
+    ~TheftLog();
+
+    //the number of reserved positions, may be out of date as soon as it returns
+    size_t size() const;
+
+    //reserves num_entries consecutive positions and returns the first one
+    size_t reserve(size_t num_entries);
+
+    //writes an entry to a reserved position and makes it visible to readers
+    void write(size_t position, const Product& product, int fake_id);
+
+    /*calls func on every entry from position cursor up to the positions reserved when the call started,
+    in order, and returns the position after the last one (the cursor of the next read).*/
+    template <typename Func>
+    size_t forEachSince(size_t cursor, Func func) const;
+};
+
+template <typename Func>
+size_t TheftLog::forEachSince(size_t cursor, Func func) const{
+    size_t end = next_position.load(std::memory_order_acquire);
+    for(size_t position = cursor; position < end; ++position){
+        func(readReady(position));
+    }
+    return cursor < end ? end : cursor;
+}
+
+#endif // THEFT_LOG_H_
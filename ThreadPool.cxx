@@ -0,0 +1,133 @@
+#include "ThreadPool.h"
+#include "Factory.h"
+
+ThreadPool::ThreadPool(int num_threads) : queue_head(NULL), queue_tail(NULL), queued_jobs(0), idle_workers(0),
+                                          stopping(false){
+    INIT_MUTEX_LOCK(pool_lock);
+    pthread_cond_init(&work_condition, NULL);
+    pthread_cond_init(&done_condition, NULL);
+
+    pthread_mutex_lock(&pool_lock);
+    for(int i=0; i<num_threads; i++){
+        addWorker();
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+ThreadPool::~ThreadPool(){
+    //tell the workers to exit once the queue is empty
+    pthread_mutex_lock(&pool_lock);
+    stopping = true;
+    pthread_cond_broadcast(&work_condition);
+    pthread_mutex_unlock(&pool_lock);
+
+    //no new workers can be added now, so the vector is safe to read without the lock
+    for(auto& worker : workers){
+        pthread_join(worker, NULL);
+    }
+
+    pthread_mutex_destroy(&pool_lock);
+    pthread_cond_destroy(&work_condition);
+    pthread_cond_destroy(&done_condition);
+}
+
+void ThreadPool::addWorker(){
+    pthread_t worker;
+    pthread_create(&worker, NULL, workerMain, this);
+    workers.push_back(worker);
+}
+
+void* ThreadPool::workerMain(void* pool){
+    static_cast<ThreadPool*>(pool)->workerLoop();
+    return NULL;
+}
+
+void ThreadPool::workerLoop(){
+    pthread_mutex_lock(&pool_lock);
+    while(true){
+        //wait for a job
+        while(queue_head == NULL && !stopping){
+            ++idle_workers;
+            pthread_cond_wait(&work_condition, &pool_lock);
+            --idle_workers;
+        }
+        if(queue_head == NULL){
+            //the pool is stopping and there is nothing left to do
+            break;
+        }
+
+        //take the oldest job
+        Job* job = queue_head;
+        queue_head = job->next;
+        if(queue_head == NULL){
+            queue_tail = NULL;
+        }
+        --queued_jobs;
+
+        //run the job without holding the pool lock
+        pthread_mutex_unlock(&pool_lock);
+        void* result = job->func(job->arg);
+        pthread_mutex_lock(&pool_lock);
+
+        if(job->detached){
+            delete job;
+            continue;
+        }
+
+        //publish the result
+        job->result = result;
+        job->done = true;
+        pthread_cond_broadcast(&done_condition);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void ThreadPool::enqueue(Job* job){
+    pthread_mutex_lock(&pool_lock);
+    //add the job to the queue
+    if(queue_tail == NULL){
+        queue_head = job;
+    } else{
+        queue_tail->next = job;
+    }
+    queue_tail = job;
+    ++queued_jobs;
+
+    //if every worker is busy (maybe blocked inside an actor) add a worker instead of waiting for one
+    if(queued_jobs > idle_workers){
+        addWorker();
+    }
+    pthread_cond_signal(&work_condition);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+ThreadPool::Job* ThreadPool::submit(JobFunc func, void* arg){
+    Job* job = new Job(func, arg);
+    enqueue(job);
+    return job;
+}
+
+void ThreadPool::submitDetached(JobFunc func, void* arg){
+    Job* job = new Job(func, arg);
+    job->detached = true;
+    enqueue(job);
+}
+
+void* ThreadPool::wait(Job* job){
+    pthread_mutex_lock(&pool_lock);
+    while(!job->done){
+        pthread_cond_wait(&done_condition, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    void* result = job->result;
+    delete job;
+    return result;
+}
+
+int ThreadPool::numWorkers(){
+    pthread_mutex_lock(&pool_lock);
+    int num_workers = static_cast<int>(workers.size());
+    pthread_mutex_unlock(&pool_lock);
+    return num_workers;
+}
@@ -0,0 +1,84 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <pthread.h>
+#include <vector>
+#include "ObjectPool.h"
+
+/**
+ * A pool of worker threads that stay alive between jobs.
+ * A job is a function with the same signature as a pthread start routine, and its return value
+ * can be collected with wait(), the same way pthread_join collects the value of a thread.
+ * Jobs may block for a long time (a company waiting for products), so when a job is submitted
+ * while every worker is occupied a new worker is added to the pool instead of queueing the job
+ * behind the blocked ones. Workers are never removed before the pool is destroyed, so in steady
+ * state no threads are created.
+ */
+class ThreadPool{
+public:
+    typedef void* (*JobFunc)(void*);
+
+    class Job : public PooledObject<Job>{
+        friend class ThreadPool;
+
+        JobFunc func;
+        void* arg;
+        void* result;
+        //true when func returned - under pool_lock
+        bool done;
+        //true when nobody waits for the job, the worker frees it
+        bool detached;
+        //next job in the queue - under pool_lock
+        Job* next;
+
+        Job(JobFunc func, void* arg) : func(func), arg(arg), result(NULL), done(false), detached(false), next(NULL){}
+    };
+
+private:
+    std::vector<pthread_t> workers;
+
+    //queue of jobs no worker took yet - under pool_lock
+    Job* queue_head;
+    Job* queue_tail;
+    int queued_jobs;
+
+    //number of workers waiting for a job - under pool_lock
+    int idle_workers;
+
+    //flag that is true when the pool is destroyed - under pool_lock
+    bool stopping;
+
+    pthread_mutex_t pool_lock;
+    //workers wait on it for jobs
+    pthread_cond_t work_condition;
+    //wait() waits on it for jobs to finish
+    pthread_cond_t done_condition;
+
+    //creates a new worker thread - pool_lock must be locked
+    void addWorker();
+    //adds job to the queue and makes sure a worker takes it
+    void enqueue(Job* job);
+    static void* workerMain(void* pool);
+    void workerLoop();
+
+    //copying a pool is not allowed
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+public:
+    //starts num_threads workers
+    explicit ThreadPool(int num_threads);
+    //stops the workers after all the queued jobs were done
+    ~ThreadPool();
+
+    //queues func(arg) to run on a worker, the returned job must be passed to wait() exactly once
+    Job* submit(JobFunc func, void* arg);
+    //queues func(arg) to run on a worker, nobody waits for it and its return value is dropped
+    void submitDetached(JobFunc func, void* arg);
+    //waits until the job is done, frees it and returns the value func returned
+    void* wait(Job* job);
+
+    int numWorkers();
+};
+
+#endif // THREAD_POOL_H_
@@ -0,0 +1,216 @@
+#include "ValueFilter.h"
+#include <algorithm>
+#include "SimdSupport.h"
+
+//values a vector kernel counts in its lanes before it adds them up, so a lane never overflows
+#define COUNT_FLUSH_VALUES (1 << 24)
+
+const char* filterKernelName(FilterKernel kernel){
+    switch(kernel){
+        case FILTER_SCALAR: return "scalar";
+        case FILTER_SSE2: return "sse2";
+        case FILTER_AVX2: return "avx2";
+        default: return "unknown";
+    }
+}
+
+bool filterKernelSupported(FilterKernel kernel){
+#ifdef VALUE_FILTER_X86
+    __builtin_cpu_init();
+    switch(kernel){
+        case FILTER_SCALAR: return true;
+        case FILTER_SSE2: return __builtin_cpu_supports("sse2");
+        case FILTER_AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+        default: return false;
+    }
+#else
+    return kernel == FILTER_SCALAR;
+#endif
+}
+
+FilterKernel bestFilterKernel(){
+    static const FilterKernel best = filterKernelSupported(FILTER_AVX2) ? FILTER_AVX2 :
+                                     filterKernelSupported(FILTER_SSE2) ? FILTER_SSE2 : FILTER_SCALAR;
+    return best;
+}
+
+static size_t countAtLeastScalar(const int* values, size_t num_values, int min_value){
+    size_t count = 0;
+    for(size_t i=0; i<num_values; i++){
+        count += (values[i] >= min_value);
+    }
+    return count;
+}
+
+static size_t selectScalar(const int* values, size_t num_values, int min_value, unsigned int* indices,
+                           bool at_least){
+    //the index is always written and only kept when the value matches, so there is no branch to mispredict
+    size_t count = 0;
+    for(size_t i=0; i<num_values; i++){
+        indices[count] = static_cast<unsigned int>(i);
+        count += ((values[i] >= min_value) == at_least);
+    }
+    return count;
+}
+
+#ifdef VALUE_FILTER_X86
+
+//for every 8 bit mask of matching lanes, the lanes in order and then zeros, for _mm256_permutevar8x32_epi32
+//(the first 16 masks are the 4 lane masks of sse2)
+struct CompressTable{
+    int lanes[256][8];
+    int num_lanes[256];
+
+    CompressTable(){
+        for(int mask=0; mask<256; mask++){
+            num_lanes[mask] = 0;
+            for(int lane=0; lane<8; lane++){
+                if(mask & (1 << lane)){
+                    lanes[mask][num_lanes[mask]++] = lane;
+                }
+            }
+            for(int lane=num_lanes[mask]; lane<8; lane++){
+                lanes[mask][lane] = 0;
+            }
+        }
+    }
+};
+
+static const CompressTable& compressTable(){
+    static const CompressTable table;
+    return table;
+}
+
+__attribute__((target("sse2")))
+static size_t countAtLeastSse2(const int* values, size_t num_values, int min_value){
+    //a lane is all ones (-1) for a value below min_value, subtracting the lanes counts those values
+    const __m128i min = _mm_set1_epi32(min_value);
+    size_t num_below = 0;
+    size_t i = 0;
+    while(num_values - i >= 4){
+        size_t block_end = i + std::min((num_values - i) & ~static_cast<size_t>(3),
+                                        static_cast<size_t>(COUNT_FLUSH_VALUES));
+        __m128i lane_counts = _mm_setzero_si128();
+        for(; i < block_end; i += 4){
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+            lane_counts = _mm_sub_epi32(lane_counts, _mm_cmpgt_epi32(min, block));
+        }
+        int lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lane_counts);
+        for(int lane : lanes){
+            num_below += static_cast<size_t>(lane);
+        }
+    }
+    return (i - num_below) + countAtLeastScalar(values + i, num_values - i, min_value);
+}
+
+__attribute__((target("sse2")))
+static size_t selectSse2(const int* values, size_t num_values, int min_value, unsigned int* indices,
+                         bool at_least){
+    //sse2 has no lane permute, but the table's lanes of a 4 bit mask plus the index of the block are the indices
+    const CompressTable& table = compressTable();
+    const __m128i min = _mm_set1_epi32(min_value);
+    const int flip = at_least ? 0xF : 0;
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 4 <= num_values; i += 4){
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(min, block))) ^ flip;
+        __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table.lanes[mask]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + count),
+                         _mm_add_epi32(lanes, _mm_set1_epi32(static_cast<int>(i))));
+        count += static_cast<size_t>(table.num_lanes[mask]);
+    }
+    size_t tail = selectScalar(values + i, num_values - i, min_value, indices + count, at_least);
+    for(size_t j=count; j<count+tail; j++){
+        indices[j] += static_cast<unsigned int>(i);
+    }
+    return count + tail;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t countAtLeastAvx2(const int* values, size_t num_values, int min_value){
+    const __m256i min = _mm256_set1_epi32(min_value);
+    size_t num_below = 0;
+    size_t i = 0;
+    while(num_values - i >= 8){
+        size_t block_end = i + std::min((num_values - i) & ~static_cast<size_t>(7),
+                                        static_cast<size_t>(COUNT_FLUSH_VALUES));
+        __m256i lane_counts = _mm256_setzero_si256();
+        for(; i < block_end; i += 8){
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+            lane_counts = _mm256_sub_epi32(lane_counts, _mm256_cmpgt_epi32(min, block));
+        }
+        int lanes[8];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), lane_counts);
+        for(int lane : lanes){
+            num_below += static_cast<size_t>(lane);
+        }
+    }
+    return (i - num_below) + countAtLeastScalar(values + i, num_values - i, min_value);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t selectAvx2(const int* values, size_t num_values, int min_value, unsigned int* indices,
+                         bool at_least){
+    //the indices of the 8 lanes are compressed to the front of a vector by a permute, and all 8 are stored.
+    //the ones past the matching lanes are overwritten by the next store, and never pass index num_values
+    const CompressTable& table = compressTable();
+    const __m256i min = _mm256_set1_epi32(min_value);
+    const __m256i step = _mm256_set1_epi32(8);
+    const int flip = at_least ? 0xFF : 0;
+    __m256i lane_indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 8 <= num_values; i += 8){
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(min, block))) ^ flip;
+        __m256i permutation = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(table.lanes[mask]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices + count),
+                            _mm256_permutevar8x32_epi32(lane_indices, permutation));
+        count += static_cast<size_t>(__builtin_popcount(mask));
+        lane_indices = _mm256_add_epi32(lane_indices, step);
+    }
+    size_t tail = selectScalar(values + i, num_values - i, min_value, indices + count, at_least);
+    for(size_t j=count; j<count+tail; j++){
+        indices[j] += static_cast<unsigned int>(i);
+    }
+    return count + tail;
+}
+
+#endif // VALUE_FILTER_X86
+
+static FilterKernel supportedKernel(FilterKernel kernel){
+    return filterKernelSupported(kernel) ? kernel : FILTER_SCALAR;
+}
+
+size_t countAtLeast(const int* values, size_t num_values, int min_value, FilterKernel kernel){
+    switch(supportedKernel(kernel)){
+#ifdef VALUE_FILTER_X86
+        case FILTER_SSE2: return countAtLeastSse2(values, num_values, min_value);
+        case FILTER_AVX2: return countAtLeastAvx2(values, num_values, min_value);
+#endif
+        default: return countAtLeastScalar(values, num_values, min_value);
+    }
+}
+
+static size_t select(const int* values, size_t num_values, int min_value, unsigned int* indices, bool at_least,
+                     FilterKernel kernel){
+    switch(supportedKernel(kernel)){
+#ifdef VALUE_FILTER_X86
+        case FILTER_SSE2: return selectSse2(values, num_values, min_value, indices, at_least);
+        case FILTER_AVX2: return selectAvx2(values, num_values, min_value, indices, at_least);
+#endif
+        default: return selectScalar(values, num_values, min_value, indices, at_least);
+    }
+}
+
+size_t selectAtLeast(const int* values, size_t num_values, int min_value, unsigned int* indices,
+                     FilterKernel kernel){
+    return select(values, num_values, min_value, indices, true, kernel);
+}
+
+size_t selectBelow(const int* values, size_t num_values, int min_value, unsigned int* indices,
+                   FilterKernel kernel){
+    return select(values, num_values, min_value, indices, false, kernel);
+}
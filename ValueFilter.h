@@ -0,0 +1,36 @@
+#ifndef VALUE_FILTER_H_
+#define VALUE_FILTER_H_
+
+#include <cstddef>
+
+//the instruction sets the filter kernels are written for
+enum FilterKernel{
+    FILTER_SCALAR,
+    FILTER_SSE2,
+    FILTER_AVX2,
+    NUM_FILTER_KERNELS
+};
+
+//a short name of the kernel ("scalar", "sse2", "avx2")
+const char* filterKernelName(FilterKernel kernel);
+//true if the cpu can run the kernel, the scalar kernel runs everywhere
+bool filterKernelSupported(FilterKernel kernel);
+//the fastest kernel the cpu supports, detected once
+FilterKernel bestFilterKernel();
+
+/*
+ * Predicates over an array of num_values values, the value column of a ProductColumns.
+ * Every kernel gives the same results, an unsupported kernel falls back to the scalar one.
+ * The select functions write the indices of the matching values to indices (in increasing order) and return
+ * how many there are, indices must have room for num_values indices (and num_values must fit an unsigned int).
+ */
+
+//the number of values that are at least min_value
+size_t countAtLeast(const int* values, size_t num_values, int min_value, FilterKernel kernel);
+size_t selectAtLeast(const int* values, size_t num_values, int min_value, unsigned int* indices,
+                     FilterKernel kernel);
+//the values below min_value, the complement of selectAtLeast
+size_t selectBelow(const int* values, size_t num_values, int min_value, unsigned int* indices,
+                   FilterKernel kernel);
+
+#endif // VALUE_FILTER_H_
@@ -0,0 +1,385 @@
+#include "WriteAheadLog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include "Factory.h"
+
+//writes all size bytes, false if the file can't take them
+static bool writeAll(int fd, const char* data, size_t size){
+    while(size > 0){
+        ssize_t written = ::write(fd, data, size);
+        if(written < 0 && errno == EINTR){
+            continue;
+        }
+        if(written <= 0){
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t size){
+    char* bytes = static_cast<char*>(data);
+    while(size > 0){
+        ssize_t read_bytes = ::read(fd, bytes, size);
+        if(read_bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(read_bytes <= 0){
+            return false;
+        }
+        bytes += read_bytes;
+        size -= static_cast<size_t>(read_bytes);
+    }
+    return true;
+}
+
+/*reads the records of a log from the current offset of fd (after the file header), to entries if it is not NULL.
+returns the offset after the last whole record: a process that died in the middle of a write leaves a part of a
+record at the end*/
+static off_t scanRecords(int fd, off_t offset, std::vector<WalEntry>* entries){
+    WalRecordHeader header;
+    std::vector<WalProduct> products;
+    while(readAll(fd, &header, sizeof(header))){
+        size_t logged = (header.size - sizeof(header)) / sizeof(WalProduct);
+        if(header.size < sizeof(header) || header.size % WAL_ALIGNMENT != 0 || header.size > WAL_BUFFER_SIZE ||
+           (header.truncated == 0 && logged < static_cast<size_t>(header.num_products))){
+            break;
+        }
+        //the padding is read with the products
+        products.resize((header.size - sizeof(header) + sizeof(WalProduct) - 1) / sizeof(WalProduct));
+        if(!readAll(fd, products.data(), header.size - sizeof(header))){
+            break;
+        }
+        if(entries != NULL){
+            WalEntry entry;
+            entry.type = static_cast<WalRecordType>(header.type);
+            entry.fake_id = header.fake_id;
+            entry.num_products = header.num_products;
+            size_t num_logged = (header.truncated != 0) ? 0 : static_cast<size_t>(header.num_products);
+            for(size_t i=0; i<num_logged; i++){
+                entry.products.push_back(Product(products[i].id, products[i].value));
+            }
+            entries->push_back(entry);
+        }
+        offset += header.size;
+    }
+    return offset;
+}
+
+WriteAheadLog::WriteAheadLog(int fd, bool sync) : fd(fd), sync(sync), buffer(new char[WAL_BUFFER_SIZE]()),
+                                                  reserved(0), flushed(0), num_batches(0), num_waiters(0),
+                                                  stopping(false){
+    INIT_MUTEX_LOCK(flush_lock);
+    pthread_cond_init(&flushed_condition, NULL);
+    pthread_cond_init(&flush_condition, NULL);
+    pthread_create(&flusher, NULL, flusherMain, this);
+}
+
+WriteAheadLog* WriteAheadLog::open(const char* path, bool sync){
+    int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        fprintf(stderr, "can't open the log %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    WalFileHeader file_header;
+    struct stat file_stat;
+    fstat(fd, &file_stat);
+    if(file_stat.st_size == 0){
+        file_header.magic = WAL_MAGIC;
+        file_header.version = WAL_VERSION;
+        if(!writeAll(fd, reinterpret_cast<const char*>(&file_header), sizeof(file_header))){
+            fprintf(stderr, "can't write the log %s: %s\n", path, strerror(errno));
+            close(fd);
+            return NULL;
+        }
+    } else{
+        if(!readAll(fd, &file_header, sizeof(file_header)) || file_header.magic != WAL_MAGIC ||
+           file_header.version != WAL_VERSION){
+            fprintf(stderr, "%s is not a log of this version\n", path);
+            close(fd);
+            return NULL;
+        }
+        //drop a record that was cut by a crash, the new records go after the last whole one
+        off_t end = scanRecords(fd, sizeof(file_header), NULL);
+        if(ftruncate(fd, end) != 0 || lseek(fd, end, SEEK_SET) != end){
+            fprintf(stderr, "can't repair the log %s: %s\n", path, strerror(errno));
+            close(fd);
+            return NULL;
+        }
+    }
+    return new WriteAheadLog(fd, sync);
+}
+
+WriteAheadLog::~WriteAheadLog(){
+    pthread_mutex_lock(&flush_lock);
+    stopping = true;
+    pthread_cond_signal(&flush_condition);
+    pthread_mutex_unlock(&flush_lock);
+    pthread_join(flusher, NULL);
+
+    close(fd);
+    delete[] buffer;
+    pthread_mutex_destroy(&flush_lock);
+    pthread_cond_destroy(&flushed_condition);
+    pthread_cond_destroy(&flush_condition);
+}
+
+void* WriteAheadLog::flusherMain(void* log){
+    static_cast<WriteAheadLog*>(log)->flushLoop();
+    return NULL;
+}
+
+void WriteAheadLog::flushLoop(){
+    while(true){
+        bool wrote = flushBatch();
+
+        pthread_mutex_lock(&flush_lock);
+        if(wrote){
+            pthread_cond_broadcast(&flushed_condition);
+            wakeRoomWaiters();
+        }
+        //the appenders are done when the log is stopped, so everything reserved is written
+        if(stopping && flushed.load() == reserved.load()){
+            pthread_mutex_unlock(&flush_lock);
+            break;
+        }
+        if(!wrote && num_waiters == 0 && room_waiters.empty() && !stopping){
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += WAL_FLUSH_INTERVAL_US * 1000L;
+            if(until.tv_nsec >= 1000000000L){
+                until.tv_sec += 1;
+                until.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&flush_condition, &flush_lock, &until);
+            pthread_mutex_unlock(&flush_lock);
+        } else{
+            pthread_mutex_unlock(&flush_lock);
+            if(!wrote){
+                //someone waits for a record that is still being written, it is only a copy away
+                sched_yield();
+            }
+        }
+        //with a batch written the next one starts at once, with what was appended during the sync
+    }
+}
+
+void WriteAheadLog::wakeRoomWaiters(){
+    unsigned long long room_until = flushed.load() + WAL_BUFFER_SIZE;
+    size_t kept = 0;
+    for(size_t i=0; i<room_waiters.size(); i++){
+        if(room_waiters[i].end <= room_until){
+            room_waiters[i].wake(room_waiters[i].arg);
+        } else{
+            room_waiters[kept++] = room_waiters[i];
+        }
+    }
+    room_waiters.resize(kept);
+}
+
+bool WriteAheadLog::flushBatch(){
+    //only the flusher changes flushed
+    unsigned long long start = flushed.load(std::memory_order_relaxed);
+    unsigned long long limit = reserved.load(std::memory_order_acquire);
+    unsigned long long end = start;
+    while(end < limit){
+        WalRecordHeader* header = reinterpret_cast<WalRecordHeader*>(buffer + end % WAL_BUFFER_SIZE);
+        unsigned int size = __atomic_load_n(&header->size, __ATOMIC_ACQUIRE);
+        if(size == 0){
+            break;
+        }
+        end += size;
+    }
+    if(end == start){
+        return false;
+    }
+
+    //one write (two when the batch wraps around the end of the buffer) and one sync for the whole batch
+    size_t offset = static_cast<size_t>(start % WAL_BUFFER_SIZE);
+    size_t size = static_cast<size_t>(end - start);
+    size_t first = std::min(size, static_cast<size_t>(WAL_BUFFER_SIZE) - offset);
+    bool written = writeAll(fd, buffer + offset, first) && writeAll(fd, buffer, size - first);
+    if(written && sync){
+        written = (fdatasync(fd) == 0);
+    }
+    if(!written){
+        //the records are dropped so the factory goes on, the log has a gap from here
+        fprintf(stderr, "can't write the log: %s\n", strerror(errno));
+    }
+
+    //the record sizes must be 0 again before the space is reserved again
+    memset(buffer + offset, 0, first);
+    memset(buffer, 0, size - first);
+    flushed.store(end, std::memory_order_release);
+    num_batches.fetch_add(1);
+    return true;
+}
+
+WriteAheadLog::Reservation WriteAheadLog::sized(size_t num_products){
+    Reservation reservation;
+    size_t size = sizeof(WalRecordHeader) + num_products * sizeof(WalProduct);
+    reservation.num_products = static_cast<int>(num_products);
+    if(size > WAL_BUFFER_SIZE / 2){
+        //must fit in the buffer with room to spare, the products are left out
+        size = sizeof(WalRecordHeader);
+        reservation.num_products = 0;
+    }
+    size = (size + WAL_ALIGNMENT - 1) / WAL_ALIGNMENT * WAL_ALIGNMENT;
+    reservation.size = static_cast<unsigned int>(size);
+    reservation.position = 0;
+    return reservation;
+}
+
+void WriteAheadLog::waitFlushed(unsigned long long end){
+    pthread_mutex_lock(&flush_lock);
+    ++num_waiters;
+    pthread_cond_signal(&flush_condition);
+    while(end > flushed.load() + WAL_BUFFER_SIZE){
+        pthread_cond_wait(&flushed_condition, &flush_lock);
+    }
+    --num_waiters;
+    pthread_mutex_unlock(&flush_lock);
+}
+
+WriteAheadLog::Reservation WriteAheadLog::reserve(size_t num_products){
+    Reservation reservation = sized(num_products);
+    reservation.position = reserved.fetch_add(reservation.size);
+
+    //wait until the flusher made room. the oldest unwritten record always fits, so this can't deadlock
+    if(reservation.end() > flushed.load(std::memory_order_acquire) + WAL_BUFFER_SIZE){
+        waitFlushed(reservation.end());
+    }
+    return reservation;
+}
+
+bool WriteAheadLog::tryReserve(size_t num_products, Reservation& reservation){
+    reservation = sized(num_products);
+    unsigned long long position = reserved.load();
+    do{
+        //nothing was taken yet, so giving up leaves no hole in the log
+        if(position + reservation.size > flushed.load(std::memory_order_acquire) + WAL_BUFFER_SIZE){
+            return false;
+        }
+    } while(!reserved.compare_exchange_weak(position, position + reservation.size));
+    reservation.position = position;
+    return true;
+}
+
+void WriteAheadLog::waitForRoom(size_t num_products){
+    unsigned long long end = reserved.load() + sized(num_products).size;
+    if(end > flushed.load(std::memory_order_acquire) + WAL_BUFFER_SIZE){
+        waitFlushed(end);
+    }
+}
+
+void WriteAheadLog::wakeOnRoom(size_t num_products, WakeFunc wake, void* arg){
+    RoomWaiter waiter = {reserved.load() + sized(num_products).size, wake, arg};
+    pthread_mutex_lock(&flush_lock);
+    //flushed is checked under the lock the flusher wakes the waiters under, so a batch can't be missed
+    if(waiter.end <= flushed.load() + WAL_BUFFER_SIZE){
+        wake(arg);
+    } else{
+        room_waiters.push_back(waiter);
+        //the flusher does not wait for the interval when someone waits
+        pthread_cond_signal(&flush_condition);
+    }
+    pthread_mutex_unlock(&flush_lock);
+}
+
+void WriteAheadLog::copyIn(unsigned long long position, const void* data, size_t size){
+    size_t offset = static_cast<size_t>(position % WAL_BUFFER_SIZE);
+    size_t first = std::min(size, static_cast<size_t>(WAL_BUFFER_SIZE) - offset);
+    memcpy(buffer + offset, data, first);
+    memcpy(buffer, static_cast<const char*>(data) + first, size - first);
+}
+
+void WriteAheadLog::writeProduct(const Reservation& reservation, int index, const Product& product){
+    if(index >= reservation.num_products){
+        return;
+    }
+    WalProduct logged = {product.getId(), product.getValue()};
+    copyIn(reservation.position + sizeof(WalRecordHeader) + index * sizeof(WalProduct), &logged, sizeof(logged));
+}
+
+void WriteAheadLog::publish(const Reservation& reservation, WalRecordType type, int fake_id, int num_products){
+    //the header is aligned, so it never wraps
+    WalRecordHeader* header = reinterpret_cast<WalRecordHeader*>(buffer + reservation.position % WAL_BUFFER_SIZE);
+    header->type = static_cast<unsigned short>(type);
+    header->truncated = (reservation.num_products < num_products) ? 1 : 0;
+    header->fake_id = fake_id;
+    header->num_products = num_products;
+    __atomic_store_n(&header->size, reservation.size, __ATOMIC_RELEASE);
+}
+
+void WriteAheadLog::write(const Reservation& reservation, WalRecordType type, int fake_id,
+                          const ProductQueue& products){
+    int index = 0;
+    products.forEach([this, &reservation, &index](const Product& product){
+        writeProduct(reservation, index++, product);
+    });
+    publish(reservation, type, fake_id, index);
+}
+
+void WriteAheadLog::write(const Reservation& reservation, WalRecordType type, int fake_id,
+                          const std::list<Product>& products){
+    int index = 0;
+    for(auto& product : products){
+        writeProduct(reservation, index++, product);
+    }
+    publish(reservation, type, fake_id, index);
+}
+
+void WriteAheadLog::write(const Reservation& reservation, WalRecordType type, int fake_id, const Product& product){
+    writeProduct(reservation, 0, product);
+    publish(reservation, type, fake_id, 1);
+}
+
+unsigned long long WriteAheadLog::reservedPosition() const{
+    return reserved.load();
+}
+
+void WriteAheadLog::waitDurable(unsigned long long position){
+    if(flushed.load(std::memory_order_acquire) >= position){
+        return;
+    }
+    pthread_mutex_lock(&flush_lock);
+    ++num_waiters;
+    //the flusher does not wait for the interval when someone waits
+    pthread_cond_signal(&flush_condition);
+    while(flushed.load() < position){
+        pthread_cond_wait(&flushed_condition, &flush_lock);
+    }
+    --num_waiters;
+    pthread_mutex_unlock(&flush_lock);
+}
+
+unsigned long long WriteAheadLog::numBatches() const{
+    return num_batches.load();
+}
+
+bool WriteAheadLog::read(const char* path, std::vector<WalEntry>& entries){
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "can't open the log %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    WalFileHeader file_header;
+    if(!readAll(fd, &file_header, sizeof(file_header)) || file_header.magic != WAL_MAGIC ||
+       file_header.version != WAL_VERSION){
+        fprintf(stderr, "%s is not a log of this version\n", path);
+        close(fd);
+        return false;
+    }
+    scanRecords(fd, sizeof(file_header), &entries);
+    close(fd);
+    return true;
+}
@@ -0,0 +1,175 @@
+#ifndef WRITE_AHEAD_LOG_H_
+#define WRITE_AHEAD_LOG_H_
+
+#include <pthread.h>
+#include <atomic>
+#include <list>
+#include <vector>
+#include "CompanyWaitQueue.h"
+#include "Product.h"
+#include "ProductQueue.h"
+
+//the first bytes of a log file ("FWAL")
+#define WAL_MAGIC 0x4c415746u
+#define WAL_VERSION 1
+//bytes of the buffer the records wait in until they are written, a power of two
+#define WAL_BUFFER_SIZE (16 * 1024 * 1024)
+//records are aligned to this, so a record header never wraps around the end of the buffer
+#define WAL_ALIGNMENT 16
+//the flusher writes what was appended at least this often, and at once when someone waits for durability
+#define WAL_FLUSH_INTERVAL_US 1000
+
+enum WalRecordType{
+    WAL_SALE = 1,
+    WAL_RETURN = 2,
+    WAL_THEFT = 3
+};
+
+struct WalFileHeader{
+    unsigned int magic;
+    unsigned int version;
+};
+
+/**
+ * A record is this header, then the products of the operation (WalProducts), padded to WAL_ALIGNMENT.
+ * In the file the records follow the WalFileHeader back to back.
+ */
+struct WalRecordHeader{
+    //bytes of the whole record. in the buffer it is written last, 0 means the record is still being written
+    unsigned int size;
+    unsigned short type;
+    //1 when the operation had too many products for the buffer and only num_products was logged
+    unsigned short truncated;
+    //the thief of a WAL_THEFT, 0 otherwise
+    int fake_id;
+    int num_products;
+};
+
+struct WalProduct{
+    int id;
+    int value;
+};
+
+//a record that was read from a log file
+struct WalEntry{
+    WalRecordType type;
+    int fake_id;
+    int num_products;
+    std::vector<Product> products;
+};
+
+/**
+ * A durable log of sales, returns and thefts, written by a background flusher with group commit.
+ *
+ * Appending is done in two steps, like TheftLog: reserve() takes the next range of the buffer with a single
+ * atomic add (the order of the reservations is the order of the log), then write() copies the record and
+ * publishes it by storing its size. Neither takes a lock, unless the buffer is full and the appender has to wait
+ * for the flusher. An appender that holds a lock it must not wait under uses tryReserve, which fails instead, and
+ * waitForRoom after it released the lock. An appender that must never wait (an asynchronous call of the factory)
+ * leaves a wake with wakeOnRoom instead, which the flusher calls once the batch it wrote made room.
+ * The flusher takes the published records that follow each other, writes them with a single write call and
+ * syncs the file once for all of them, so the cost of a sync is shared by every record of the batch. An appender
+ * that needs its record on the disk waits for it with waitDurable, which also makes the flusher start at once.
+ */
+class WriteAheadLog{
+public:
+    struct Reservation{
+        //where the record starts in the log, not counting the file header
+        unsigned long long position;
+        unsigned int size;
+        int num_products;
+
+        //the position after the record, for waitDurable
+        unsigned long long end() const{
+            return position + size;
+        }
+    };
+
+private:
+    int fd;
+    //sync every batch, without it the records only reach the page cache
+    bool sync;
+
+    char* buffer;
+    //bytes reserved so far
+    std::atomic<unsigned long long> reserved;
+    //bytes written (and synced) so far, the buffer before it may be reused
+    std::atomic<unsigned long long> flushed;
+    std::atomic<unsigned long long> num_batches;
+
+    //appenders that wait for durability or for room in the buffer, and the flusher between batches
+    pthread_mutex_t flush_lock;
+    pthread_cond_t flushed_condition;
+    pthread_cond_t flush_condition;
+    //under flush_lock
+    int num_waiters;
+    bool stopping;
+
+    //an appender without a thread of its own that waits for room in the buffer
+    struct RoomWaiter{
+        //the position the buffer must reach before the flushed position plus WAL_BUFFER_SIZE
+        unsigned long long end;
+        WakeFunc wake;
+        void* arg;
+    };
+    //under flush_lock
+    std::vector<RoomWaiter> room_waiters;
+
+    pthread_t flusher;
+
+    explicit WriteAheadLog(int fd, bool sync);
+
+    static void* flusherMain(void* log);
+    void flushLoop();
+    //calls the wakes of room_waiters that have room now, flush_lock must be locked
+    void wakeRoomWaiters();
+    //a reservation of the size of a record of num_products products, at no position yet
+    static Reservation sized(size_t num_products);
+    //waits until the flusher wrote everything up to WAL_BUFFER_SIZE bytes before end
+    void waitFlushed(unsigned long long end);
+    //writes the published records after flushed to the file, returns false if there were none
+    bool flushBatch();
+    //copies size bytes to the buffer at position, across the end of the buffer if needed
+    void copyIn(unsigned long long position, const void* data, size_t size);
+    //fills the reservation's header and publishes it, its products must already be copied
+    void publish(const Reservation& reservation, WalRecordType type, int fake_id, int num_products);
+    //copies a product to the reservation
+    void writeProduct(const Reservation& reservation, int index, const Product& product);
+
+    //copying is not allowed
+    WriteAheadLog(const WriteAheadLog&);
+    WriteAheadLog& operator=(const WriteAheadLog&);
+
+public:
+    //opens the log at path to append to it, or creates it. NULL (after printing why) if it can't be opened
+    static WriteAheadLog* open(const char* path, bool sync);
+    //writes every record and stops the flusher, all the appenders must be done
+    ~WriteAheadLog();
+
+    //reserves a record for an operation of num_products products
+    Reservation reserve(size_t num_products);
+    //the same without waiting: false, with nothing reserved, when the buffer has no room for the record
+    bool tryReserve(size_t num_products, Reservation& reservation);
+    //waits until the buffer has room for a record of num_products products after the ones reserved so far,
+    //which a tryReserve may still lose to other appenders
+    void waitForRoom(size_t num_products);
+    /*the same without waiting: wake(arg) is called once (by the flusher, or right away if there is room now).
+    it is called under the log's lock, so wake must not use the log*/
+    void wakeOnRoom(size_t num_products, WakeFunc wake, void* arg);
+    //writes a reserved record with the products of the operation
+    void write(const Reservation& reservation, WalRecordType type, int fake_id, const ProductQueue& products);
+    void write(const Reservation& reservation, WalRecordType type, int fake_id, const std::list<Product>& products);
+    void write(const Reservation& reservation, WalRecordType type, int fake_id, const Product& product);
+
+    //the position after the last reserved record
+    unsigned long long reservedPosition() const;
+    //waits until everything before position is on the disk
+    void waitDurable(unsigned long long position);
+    //the number of writes (and syncs) so far
+    unsigned long long numBatches() const;
+
+    //reads all the records of a log file, returns false (after printing why) if it is not a log
+    static bool read(const char* path, std::vector<WalEntry>& entries);
+};
+
+#endif // WRITE_AHEAD_LOG_H_
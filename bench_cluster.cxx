@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "FactoryCluster.h"
+#include "LatencyHistogram.h"
+
+/**
+ * Throughput and latency of a FactoryCluster, for comparing the number of instances and the routing policies.
+ * Producers, simple buyers (tryBuyOne), companies (buyProducts) and thieves (stealProducts) call the cluster in
+ * a loop for the duration of the run. For every operation the number of calls, ops/sec and the p50/p99/max
+ * latency are reported as CSV.
+ *
+ * usage: bench_cluster [--name=value ...]
+ *   --instances                                   number of factories (4)
+ *   --routing                                     round-robin, least-loaded or stock-aware (round-robin)
+ *   --producers --buyers --companies --thieves    number of threads of every type (2 4 2 1)
+ *   --seconds                                     length of the run (2)
+ *   --batch --company-size --theft-size           products per produce, buyProducts and theft (16 8 4)
+ *   --max-stock                                   producers pause while the cluster has more products, until the
+ *                                                 end of the run (100000)
+ *   --label                                       free text copied to the output, to tell runs apart
+ */
+
+struct ClusterBenchConfig{
+    int instances;
+    std::string routing;
+    int producers;
+    int buyers;
+    int companies;
+    int thieves;
+    double seconds;
+    int batch;
+    int company_size;
+    int theft_size;
+    size_t max_stock;
+    std::string label;
+
+    ClusterBenchConfig() : instances(4), routing("round-robin"), producers(2), buyers(4), companies(2), thieves(1),
+                           seconds(2), batch(16), company_size(8), theft_size(4), max_stock(100000){}
+};
+
+struct ClusterBenchState{
+    FactoryCluster* cluster;
+    const ClusterBenchConfig* config;
+    std::atomic<bool> stop;
+    std::atomic<bool> consumers_done;
+    std::atomic<unsigned int> next_id;
+
+    //results of every thread, merged when it finishes - under results_lock
+    pthread_mutex_t results_lock;
+    LatencyHistogram results[NUM_FACTORY_OPERATIONS];
+};
+
+struct ClusterBenchThread{
+    ClusterBenchState* state;
+    int index;
+    LatencyHistogram histograms[NUM_FACTORY_OPERATIONS];
+};
+
+static void mergeResults(ClusterBenchThread* thread){
+    pthread_mutex_lock(&thread->state->results_lock);
+    for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+        thread->state->results[op].merge(thread->histograms[op]);
+    }
+    pthread_mutex_unlock(&thread->state->results_lock);
+}
+
+static void* producer(void* arg){
+    ClusterBenchThread* thread = static_cast<ClusterBenchThread*>(arg);
+    ClusterBenchState* state = thread->state;
+    std::vector<Product> products(state->config->batch);
+    int next_id = thread->index * 100000000 + 1;
+    while(!state->consumers_done.load()){
+        //after the run the companies that still wait may need products at an instance that has none
+        if(!state->stop.load() && state->cluster->numAvailableProducts() >= state->config->max_stock){
+            sched_yield();
+            continue;
+        }
+        for(auto& product : products){
+            product = Product(next_id, next_id % 10);
+            ++next_id;
+        }
+        unsigned long long start = nowNanoseconds();
+        state->cluster->produce(state->config->batch, products.data());
+        thread->histograms[OP_PRODUCE].record(nowNanoseconds() - start);
+    }
+    mergeResults(thread);
+    return NULL;
+}
+
+static void* simpleBuyer(void* arg){
+    ClusterBenchThread* thread = static_cast<ClusterBenchThread*>(arg);
+    ClusterBenchState* state = thread->state;
+    while(!state->stop.load()){
+        unsigned long long start = nowNanoseconds();
+        state->cluster->tryBuyOne();
+        thread->histograms[OP_TRY_BUY_ONE].record(nowNanoseconds() - start);
+    }
+    mergeResults(thread);
+    return NULL;
+}
+
+static void* company(void* arg){
+    ClusterBenchThread* thread = static_cast<ClusterBenchThread*>(arg);
+    ClusterBenchState* state = thread->state;
+    while(!state->stop.load()){
+        unsigned long long start = nowNanoseconds();
+        state->cluster->buyProducts(state->config->company_size);
+        thread->histograms[OP_BUY_PRODUCTS].record(nowNanoseconds() - start);
+    }
+    mergeResults(thread);
+    return NULL;
+}
+
+static void* thief(void* arg){
+    ClusterBenchThread* thread = static_cast<ClusterBenchThread*>(arg);
+    ClusterBenchState* state = thread->state;
+    while(!state->stop.load()){
+        unsigned long long start = nowNanoseconds();
+        state->cluster->stealProducts(state->config->theft_size, state->next_id.fetch_add(1));
+        thread->histograms[OP_STEAL_PRODUCTS].record(nowNanoseconds() - start);
+    }
+    mergeResults(thread);
+    return NULL;
+}
+
+static bool parseArgument(ClusterBenchConfig& config, const char* argument){
+    const char* equals = strchr(argument, '=');
+    if(strncmp(argument, "--", 2) != 0 || equals == NULL){
+        return false;
+    }
+    std::string name(argument + 2, equals);
+    const char* value = equals + 1;
+
+    if(name == "instances") config.instances = atoi(value);
+    else if(name == "routing") config.routing = value;
+    else if(name == "producers") config.producers = atoi(value);
+    else if(name == "buyers") config.buyers = atoi(value);
+    else if(name == "companies") config.companies = atoi(value);
+    else if(name == "thieves") config.thieves = atoi(value);
+    else if(name == "seconds") config.seconds = atof(value);
+    else if(name == "batch") config.batch = atoi(value);
+    else if(name == "company-size") config.company_size = atoi(value);
+    else if(name == "theft-size") config.theft_size = atoi(value);
+    else if(name == "max-stock") config.max_stock = static_cast<size_t>(atoll(value));
+    else if(name == "label") config.label = value;
+    else return false;
+    return true;
+}
+
+int main(int argc, char** argv){
+    ClusterBenchConfig config;
+    for(int i=1; i<argc; i++){
+        if(!parseArgument(config, argv[i])){
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    RoutingPolicy policy;
+    if(config.routing == "round-robin") policy = routeRoundRobin;
+    else if(config.routing == "least-loaded") policy = routeLeastLoaded;
+    else if(config.routing == "stock-aware") policy = routeStockAware;
+    else{
+        fprintf(stderr, "unknown routing %s\n", config.routing.c_str());
+        return 1;
+    }
+    if(config.companies > 0 && config.producers <= 0){
+        fprintf(stderr, "companies wait for products forever without producers\n");
+        return 1;
+    }
+
+    FactoryCluster cluster(config.instances, FactoryOptions(), policy);
+    ClusterBenchState state;
+    state.cluster = &cluster;
+    state.config = &config;
+    state.stop = false;
+    state.consumers_done = false;
+    state.next_id = 1;
+    INIT_MUTEX_LOCK(state.results_lock);
+
+    std::vector<ClusterBenchThread> threads(config.producers + config.buyers + config.companies + config.thieves);
+    std::vector<pthread_t> producers;
+    std::vector<pthread_t> consumers;
+    struct{
+        int count;
+        void* (*func)(void*);
+    } thread_types[] = {{config.producers, producer}, {config.buyers, simpleBuyer}, {config.companies, company},
+                        {config.thieves, thief}};
+    unsigned long long start = nowNanoseconds();
+    size_t next_thread = 0;
+    for(auto& type : thread_types){
+        for(int i=0; i<type.count; i++){
+            ClusterBenchThread& thread = threads[next_thread];
+            thread.state = &state;
+            thread.index = static_cast<int>(next_thread++);
+            pthread_t thread_id;
+            pthread_create(&thread_id, NULL, type.func, &thread);
+            (type.func == producer ? producers : consumers).push_back(thread_id);
+        }
+    }
+
+    struct timespec duration;
+    duration.tv_sec = static_cast<time_t>(config.seconds);
+    duration.tv_nsec = static_cast<long>((config.seconds - duration.tv_sec) * 1e9);
+    nanosleep(&duration, NULL);
+    state.stop = true;
+
+    //companies may still wait for products, so the producers keep going until every consumer is done
+    for(auto consumer : consumers){
+        pthread_join(consumer, NULL);
+    }
+    double seconds = (nowNanoseconds() - start) / 1e9;
+    state.consumers_done = true;
+    for(auto producer_thread : producers){
+        pthread_join(producer_thread, NULL);
+    }
+
+    printf("label,instances,routing,operation,count,ops_per_sec,p50_ns,p99_ns,max_ns\n");
+    for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+        const LatencyHistogram& histogram = state.results[op];
+        if(histogram.count() == 0){
+            continue;
+        }
+        printf("%s,%d,%s,%s,%llu,%.0f,%llu,%llu,%llu\n", config.label.c_str(), config.instances, config.routing.c_str(),
+               factoryOperationName(static_cast<FactoryOperation>(op)), histogram.count(), histogram.count() / seconds,
+               histogram.percentile(50), histogram.percentile(99), histogram.max());
+    }
+    pthread_mutex_destroy(&state.results_lock);
+    return 0;
+}
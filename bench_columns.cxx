@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <list>
+#include <string>
+#include <vector>
+#include "ProductColumns.h"
+#include "LatencyHistogram.h"
+
+/**
+ * Filtering products by value: the list of products with remove_if (what a company does before it returns
+ * products), the same on a vector of products, and a ProductColumns with every filter kernel the cpu supports.
+ * For every layout, operation and kernel the fastest of the repeats is reported as CSV, with the number of
+ * matching products so the results can be checked against each other. remove_at_least removes the products worth
+ * at least min-value, count and select count and copy them.
+ * Build with optimizations (CMAKE_BUILD_TYPE=Release) for meaningful numbers.
+ *
+ * usage: bench_columns [--name=value ...]
+ *   --products     number of products (10000000)
+ *   --values       the values are spread evenly over 0 .. values-1 (100)
+ *   --min-value    the filter's minimum value (50)
+ *   --repeat       runs of every operation (5)
+ */
+
+struct ColumnsBenchConfig{
+    size_t products;
+    int values;
+    int min_value;
+    int repeat;
+
+    ColumnsBenchConfig() : products(10000000), values(100), min_value(50), repeat(5){}
+};
+
+static bool parseArgument(ColumnsBenchConfig& config, const char* argument){
+    const char* equals = strchr(argument, '=');
+    if(strncmp(argument, "--", 2) != 0 || equals == NULL){
+        return false;
+    }
+    std::string name(argument + 2, equals);
+    const char* value = equals + 1;
+
+    if(name == "products") config.products = static_cast<size_t>(atoll(value));
+    else if(name == "values") config.values = atoi(value);
+    else if(name == "min-value") config.min_value = atoi(value);
+    else if(name == "repeat") config.repeat = atoi(value);
+    else return false;
+    return true;
+}
+
+static void report(const ColumnsBenchConfig& config, const char* layout, const char* operation, const char* kernel,
+                   size_t matching, unsigned long long best_ns){
+    printf("%s,%s,%s,%zu,%zu,%.3f,%.1f\n", layout, operation, kernel, config.products, matching, best_ns / 1e6,
+           config.products / (best_ns / 1e9) / 1e6);
+}
+
+int main(int argc, char** argv){
+    ColumnsBenchConfig config;
+    for(int i=1; i<argc; i++){
+        if(!parseArgument(config, argv[i])){
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if(config.values < 1 || config.repeat < 1){
+        fprintf(stderr, "values and repeat must be at least 1\n");
+        return 1;
+    }
+
+    //the same pseudo random products for every layout
+    std::vector<Product> products(config.products);
+    unsigned int seed = 1;
+    for(size_t i=0; i<config.products; i++){
+        seed = seed * 1103515245u + 12345u;
+        products[i] = Product(static_cast<int>(i), static_cast<int>((seed >> 8) % config.values));
+    }
+    int min_value = config.min_value;
+    auto at_least = [min_value](const Product& product){ return product.getValue() >= min_value; };
+
+    printf("layout,operation,kernel,products,matching,best_ms,mproducts_per_sec\n");
+
+    //the list is rebuilt before every run, only remove_if is timed
+    unsigned long long best_ns = ~0ULL;
+    size_t matching = 0;
+    for(int run=0; run<config.repeat; run++){
+        std::list<Product> list_products(products.begin(), products.end());
+        unsigned long long start = nowNanoseconds();
+        list_products.remove_if(at_least);
+        best_ns = std::min(best_ns, nowNanoseconds() - start);
+        matching = config.products - list_products.size();
+    }
+    report(config, "list", "remove_at_least", "scalar", matching, best_ns);
+
+    best_ns = ~0ULL;
+    for(int run=0; run<config.repeat; run++){
+        std::vector<Product> vector_products(products);
+        unsigned long long start = nowNanoseconds();
+        vector_products.erase(std::remove_if(vector_products.begin(), vector_products.end(), at_least),
+                              vector_products.end());
+        best_ns = std::min(best_ns, nowNanoseconds() - start);
+        matching = config.products - vector_products.size();
+    }
+    report(config, "vector", "remove_at_least", "scalar", matching, best_ns);
+
+    best_ns = ~0ULL;
+    for(int run=0; run<config.repeat; run++){
+        unsigned long long start = nowNanoseconds();
+        matching = static_cast<size_t>(std::count_if(products.begin(), products.end(), at_least));
+        best_ns = std::min(best_ns, nowNanoseconds() - start);
+    }
+    report(config, "vector", "count", "scalar", matching, best_ns);
+
+    ProductColumns columns;
+    columns.pushBack(static_cast<int>(config.products), products.data());
+    for(int kernel_index=0; kernel_index<NUM_FILTER_KERNELS; kernel_index++){
+        FilterKernel kernel = static_cast<FilterKernel>(kernel_index);
+        if(!filterKernelSupported(kernel)){
+            continue;
+        }
+        const char* name = filterKernelName(kernel);
+
+        best_ns = ~0ULL;
+        for(int run=0; run<config.repeat; run++){
+            unsigned long long start = nowNanoseconds();
+            matching = columns.countAtLeast(min_value, kernel);
+            best_ns = std::min(best_ns, nowNanoseconds() - start);
+        }
+        report(config, "columns", "count", name, matching, best_ns);
+
+        best_ns = ~0ULL;
+        for(int run=0; run<config.repeat; run++){
+            ProductColumns selected;
+            selected.reserve(config.products);
+            unsigned long long start = nowNanoseconds();
+            matching = columns.selectAtLeast(min_value, selected, kernel);
+            best_ns = std::min(best_ns, nowNanoseconds() - start);
+        }
+        report(config, "columns", "select", name, matching, best_ns);
+
+        best_ns = ~0ULL;
+        for(int run=0; run<config.repeat; run++){
+            ProductColumns remaining(columns);
+            unsigned long long start = nowNanoseconds();
+            matching = remaining.removeAtLeast(min_value, kernel);
+            best_ns = std::min(best_ns, nowNanoseconds() - start);
+        }
+        report(config, "columns", "remove_at_least", name, matching, best_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "Factory.h"
+#include "LatencyHistogram.h"
+
+#define DEFAULT_SECONDS 2
+#define DEFAULT_COMPANIES_PER_SIZE 2
+//products a producer call adds, and the pause between the calls
+#define PRODUCE_BATCH 4
+#define PRODUCE_PAUSE_US 50
+
+/**
+ * Measures how long companies wait for their orders, per order size, when products are scarce.
+ * Companies of every size in ORDER_SIZES call buyProducts in a loop while a producer adds a few products at a
+ * time, so the small orders alone could take every product. With the waiting companies served smallest first
+ * a large order may wait until the end of the run, in arrival order (FactoryOptions::fifo_company_orders) every
+ * order waits at most for the orders that arrived before it.
+ * For both modes, every order size gets a line with the number of orders and the p50/p99/max wait.
+ * usage: bench_company_fairness [seconds] [companies per size]
+ */
+
+static const int ORDER_SIZES[] = {1, 4, 16, 64};
+#define NUM_ORDER_SIZES (sizeof(ORDER_SIZES) / sizeof(ORDER_SIZES[0]))
+
+struct FairnessRun{
+    Factory* factory;
+    std::atomic<bool> stop;
+    std::atomic<int> num_companies_running;
+};
+
+struct FairnessCompany{
+    FairnessRun* run;
+    int order_size;
+    LatencyHistogram waits;
+};
+
+static void* company(void* arg){
+    FairnessCompany* buyer = static_cast<FairnessCompany*>(arg);
+    while(!buyer->run->stop.load()){
+        unsigned long long start = nowNanoseconds();
+        buyer->run->factory->buyProducts(buyer->order_size);
+        buyer->waits.record(nowNanoseconds() - start);
+    }
+    buyer->run->num_companies_running.fetch_sub(1);
+    return NULL;
+}
+
+static void run(const char* mode, bool fifo, double seconds, int companies_per_size){
+    FactoryOptions options;
+    options.fifo_company_orders = fifo;
+    Factory factory(options);
+    FairnessRun fairness_run;
+    fairness_run.factory = &factory;
+    fairness_run.stop = false;
+    fairness_run.num_companies_running = static_cast<int>(NUM_ORDER_SIZES) * companies_per_size;
+
+    std::vector<FairnessCompany> companies(NUM_ORDER_SIZES * companies_per_size);
+    std::vector<pthread_t> threads(companies.size());
+    for(size_t i=0; i<companies.size(); i++){
+        companies[i].run = &fairness_run;
+        companies[i].order_size = ORDER_SIZES[i % NUM_ORDER_SIZES];
+        pthread_create(&threads[i], NULL, company, &companies[i]);
+    }
+
+    //a trickle of products for the length of the run, then enough for every company that still waits
+    Product products[PRODUCE_BATCH];
+    int next_id = 0;
+    unsigned long long end = nowNanoseconds() + static_cast<unsigned long long>(seconds * 1e9);
+    while(nowNanoseconds() < end){
+        for(auto& product : products){
+            product = Product(next_id++, 1);
+        }
+        factory.produce(PRODUCE_BATCH, products);
+        usleep(PRODUCE_PAUSE_US);
+    }
+    fairness_run.stop = true;
+    while(fairness_run.num_companies_running.load() > 0){
+        for(auto& product : products){
+            product = Product(next_id++, 1);
+        }
+        factory.produce(PRODUCE_BATCH, products);
+    }
+    for(auto thread : threads){
+        pthread_join(thread, NULL);
+    }
+
+    for(size_t size_index=0; size_index<NUM_ORDER_SIZES; size_index++){
+        LatencyHistogram waits;
+        for(size_t i=size_index; i<companies.size(); i+=NUM_ORDER_SIZES){
+            waits.merge(companies[i].waits);
+        }
+        printf("%s,%d,%llu,%.3f,%.3f,%.3f\n", mode, ORDER_SIZES[size_index], waits.count(),
+               waits.percentile(50) / 1e6, waits.percentile(99) / 1e6, waits.max() / 1e6);
+    }
+}
+
+int main(int argc, char** argv){
+    double seconds = (argc > 1) ? atof(argv[1]) : DEFAULT_SECONDS;
+    int companies_per_size = (argc > 2) ? atoi(argv[2]) : DEFAULT_COMPANIES_PER_SIZE;
+
+    printf("mode,order_size,orders,p50_wait_ms,p99_wait_ms,max_wait_ms\n");
+    run("smallest_first", false, seconds, companies_per_size);
+    run("fifo", true, seconds, companies_per_size);
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "Factory.h"
+
+#define DEFAULT_COMPANIES 200
+#define MAX_REQUEST 20
+
+/**
+ * Compares waking every waiting company on every unlock (broadcast) with waking only the companies
+ * the available products can satisfy (targeted), and with handing those companies their products
+ * as they are woken (handoff).
+ * The companies are started first and want 1 to MAX_REQUEST products each, then the products they want
+ * are produced one at a time, so most of the time there are many companies waiting for few products.
+ * usage: bench_company_wakeups [companies]
+ */
+
+static double nowSeconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char* mode, bool broadcast, bool handoff, int num_companies){
+    FactoryOptions options;
+    options.broadcast_company_wakeups = broadcast;
+    options.company_handoff = handoff;
+    Factory factory(options);
+
+    int num_products = 0;
+    for(int i=0; i<num_companies; i++){
+        int request = i % MAX_REQUEST + 1;
+        num_products += request;
+        //no product has a value below 0, so the companies never return anything
+        factory.startCompanyBuyer(request, 0, static_cast<unsigned int>(i));
+    }
+
+    double start = nowSeconds();
+    for(int i=0; i<num_products; i++){
+        Product product(i, 1);
+        factory.produce(1, &product);
+    }
+    for(int i=0; i<num_companies; i++){
+        factory.finishCompanyBuyer(static_cast<unsigned int>(i));
+    }
+    double seconds = nowSeconds() - start;
+
+    unsigned long long wakeups = factory.numCompanyWakeups();
+    unsigned long long handoffs = factory.numCompanyHandoffs();
+    printf("%-10s companies=%d products=%d wakeups=%llu wakeups/purchase=%.2f handoffs=%llu time=%.3fs\n", mode,
+           num_companies, num_products, wakeups, static_cast<double>(wakeups) / num_companies, handoffs, seconds);
+}
+
+int main(int argc, char** argv){
+    int num_companies = (argc > 1) ? atoi(argv[1]) : DEFAULT_COMPANIES;
+
+    run("broadcast", true, false, num_companies);
+    run("targeted", false, false, num_companies);
+    run("handoff", false, true, num_companies);
+
+    return 0;
+}
@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "Factory.h"
+#include "LatencyHistogram.h"
+
+/**
+ * Throughput and latency benchmark of a Factory under a configurable mix of actors.
+ * Every actor is a thread that calls one Factory operation in a loop for the duration of the run:
+ * - producers produce batches of products.
+ * - simple buyers call tryBuyOne (tryBuyMany with --buyer-batch above 1).
+ * - companies call buyProducts and return the products below min-value with returnProducts
+ *   (with --filter=1 they call the filtering buyProducts instead and return nothing).
+ * - thieves start a thief actor and finish it (startThief and finishThief, the only way to steal
+ *   without breaking the factory's thieves counter), so their latency includes launching the actor.
+ * For every operation the number of calls, ops/sec and the p50/p99/p999/max latency are reported
+ * as CSV (one line per operation) or JSON. With --profile-locks=1 the contention of every mutex of the
+ * factory is reported too (a second CSV table, or a "locks" array), and with --profile-operations=1 the
+ * factory's own latencies of every operation split to waiting on condition vars and working (another
+ * table, or a "factory_operations" array). With --alloc-stats=1 the blocks the object pools handed out during the
+ * run are reported too, with the ones that had to come from the heap per call (a table, or an "allocations" object).
+ * With --dashboard a thread polls the total value of the stock like a dashboard would, by copying the products
+ * (list, reported as listAvailableProducts) or in place (analytics, summarizeAvailableProducts reported as
+ * readStats), so its effect on the buyers' latencies can be compared.
+ *
+ * usage: bench_factory [--name=value ...]
+ *   --producers --buyers --companies --thieves    number of actors of every type (1 1 1 1)
+ *   --seconds                                     length of the run (2)
+ *   --batch --company-size --theft-size           products per produce, buyProducts and theft (16 8 4)
+ *   --buyer-batch                                 products per simple buyer call (1)
+ *   --min-value                                   companies return products below it (0, nothing)
+ *   --max-stock                                   producers pause while there are more products (100000)
+ *   --pool --shards --lock-free --filter          FactoryOptions (0 0 0 0)
+ *   --handoff                                     FactoryOptions::company_handoff (0)
+ *   --profile-locks                               FactoryOptions::profile_locks (0)
+ *   --profile-operations                          FactoryOptions::profile_operations (0)
+ *   --trace                                       records the run to this trace file (FactoryOptions::trace_path),
+ *                                                 for replay_trace
+ *   --wal                                         logs sales, returns and thefts to this file (FactoryOptions::wal_path)
+ *   --wal-sync --wal-durable                      FactoryOptions::wal_sync and wal_wait_durable (1 0)
+ *   --alloc-stats                                 report the allocations of the object pools (0)
+ *   --dashboard                                   none, list or analytics (none)
+ *   --dashboard-hz --dashboard-threads            polls per second, and threads of summarizeAvailableProducts (10 1)
+ *   --format                                      csv or json (csv)
+ *   --label                                       free text copied to the output, to tell runs apart
+ */
+
+struct BenchConfig{
+    int producers;
+    int buyers;
+    int companies;
+    int thieves;
+    double seconds;
+    int batch;
+    int buyer_batch;
+    int company_size;
+    int theft_size;
+    int min_value;
+    long long max_stock;
+    FactoryOptions options;
+    bool alloc_stats;
+    std::string dashboard;
+    int dashboard_hz;
+    int dashboard_threads;
+    std::string format;
+    std::string label;
+
+    BenchConfig() : producers(1), buyers(1), companies(1), thieves(1), seconds(2), batch(16), buyer_batch(1), company_size(8),
+                    theft_size(4), min_value(0), max_stock(100000), alloc_stats(false), dashboard("none"),
+                    dashboard_hz(10), dashboard_threads(1), format("csv"){}
+};
+
+struct BenchState{
+    Factory* factory;
+    const BenchConfig* config;
+    //set when the measured part of the run is over, consumers stop
+    std::atomic<bool> stop;
+    //set when every consumer stopped, producers stop
+    std::atomic<bool> consumers_done;
+    //products in the factory according to the actors' results, producers pause when there are too many
+    std::atomic<long long> stock;
+    //ids for thieves and returning companies
+    std::atomic<unsigned int> next_id;
+
+    //merged results - under results_lock
+    pthread_mutex_t results_lock;
+    LatencyHistogram results[NUM_FACTORY_OPERATIONS];
+};
+
+struct ActorArgs{
+    BenchState* state;
+    int index;
+};
+
+static void mergeResults(BenchState* state, LatencyHistogram* histograms){
+    pthread_mutex_lock(&state->results_lock);
+    for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+        state->results[op].merge(histograms[op]);
+    }
+    pthread_mutex_unlock(&state->results_lock);
+}
+
+static void* producer(void* arg){
+    ActorArgs* args = static_cast<ActorArgs*>(arg);
+    BenchState* state = args->state;
+    const BenchConfig* config = state->config;
+    LatencyHistogram histograms[NUM_FACTORY_OPERATIONS];
+
+    std::vector<Product> products(config->batch);
+    unsigned int seed = static_cast<unsigned int>(args->index) + 1;
+    int next_id = args->index * 100000000 + 1;
+
+    while(!state->consumers_done.load()){
+        if(state->stock.load() >= config->max_stock){
+            sched_yield();
+            continue;
+        }
+        for(auto& product : products){
+            product = Product(next_id++, rand_r(&seed) % 10);
+        }
+        unsigned long long start = nowNanoseconds();
+        state->factory->produce(config->batch, products.data());
+        histograms[OP_PRODUCE].record(nowNanoseconds() - start);
+        state->stock.fetch_add(config->batch);
+    }
+
+    mergeResults(state, histograms);
+    return NULL;
+}
+
+static void* simpleBuyer(void* arg){
+    BenchState* state = static_cast<ActorArgs*>(arg)->state;
+    const BenchConfig* config = state->config;
+    LatencyHistogram histograms[NUM_FACTORY_OPERATIONS];
+
+    while(!state->stop.load()){
+        unsigned long long start = nowNanoseconds();
+        if(config->buyer_batch > 1){
+            std::list<Product> bought = state->factory->tryBuyMany(config->buyer_batch);
+            histograms[OP_TRY_BUY_MANY].record(nowNanoseconds() - start);
+            state->stock.fetch_sub(static_cast<long long>(bought.size()));
+            continue;
+        }
+        int id = state->factory->tryBuyOne();
+        histograms[OP_TRY_BUY_ONE].record(nowNanoseconds() - start);
+        if(id != -1){
+            state->stock.fetch_sub(1);
+        }
+    }
+
+    mergeResults(state, histograms);
+    return NULL;
+}
+
+static void* company(void* arg){
+    BenchState* state = static_cast<ActorArgs*>(arg)->state;
+    const BenchConfig* config = state->config;
+    LatencyHistogram histograms[NUM_FACTORY_OPERATIONS];
+
+    while(!state->stop.load()){
+        //a filtering company leaves the products it doesn't want in the factory, like the company actors do
+        if(config->options.filter_company_purchases){
+            int num_rejected = 0;
+            unsigned long long start = nowNanoseconds();
+            state->factory->buyProducts(config->company_size, config->min_value, &num_rejected);
+            histograms[OP_BUY_PRODUCTS].record(nowNanoseconds() - start);
+            state->stock.fetch_sub(config->company_size - num_rejected);
+            continue;
+        }
+
+        unsigned long long start = nowNanoseconds();
+        std::list<Product> bought = state->factory->buyProducts(config->company_size);
+        histograms[OP_BUY_PRODUCTS].record(nowNanoseconds() - start);
+        state->stock.fetch_sub(config->company_size);
+
+        std::list<Product> returned;
+        for(auto& product : bought){
+            if(product.getValue() < config->min_value){
+                returned.push_back(product);
+            }
+        }
+        if(!returned.empty()){
+            long long num_returned = static_cast<long long>(returned.size());
+            start = nowNanoseconds();
+            state->factory->returnProducts(returned, state->next_id.fetch_add(1));
+            histograms[OP_RETURN_PRODUCTS].record(nowNanoseconds() - start);
+            state->stock.fetch_add(num_returned);
+        }
+    }
+
+    mergeResults(state, histograms);
+    return NULL;
+}
+
+static void* thief(void* arg){
+    BenchState* state = static_cast<ActorArgs*>(arg)->state;
+    const BenchConfig* config = state->config;
+    LatencyHistogram histograms[NUM_FACTORY_OPERATIONS];
+
+    while(!state->stop.load()){
+        unsigned int id = state->next_id.fetch_add(1);
+        unsigned long long start = nowNanoseconds();
+        state->factory->startThief(config->theft_size, id);
+        int num_stolen = state->factory->finishThief(id);
+        histograms[OP_STEAL_PRODUCTS].record(nowNanoseconds() - start);
+        state->stock.fetch_sub(num_stolen);
+    }
+
+    mergeResults(state, histograms);
+    return NULL;
+}
+
+static void* dashboard(void* arg){
+    BenchState* state = static_cast<ActorArgs*>(arg)->state;
+    const BenchConfig* config = state->config;
+    LatencyHistogram histograms[NUM_FACTORY_OPERATIONS];
+    struct timespec pause;
+    pause.tv_sec = 0;
+    pause.tv_nsec = 1000000000L / std::max(config->dashboard_hz, 1);
+
+    long long total_value = 0;
+    while(!state->stop.load()){
+        unsigned long long start = nowNanoseconds();
+        if(config->dashboard == "list"){
+            std::list<Product> available = state->factory->listAvailableProducts();
+            total_value = 0;
+            for(auto& product : available){
+                total_value += product.getValue();
+            }
+            histograms[OP_LIST_AVAILABLE_PRODUCTS].record(nowNanoseconds() - start);
+        } else{
+            total_value = state->factory->summarizeAvailableProducts(config->dashboard_threads).sum;
+            histograms[OP_READ_STATS].record(nowNanoseconds() - start);
+        }
+        nanosleep(&pause, NULL);
+    }
+    (void)total_value;
+
+    mergeResults(state, histograms);
+    return NULL;
+}
+
+static bool parseArgument(BenchConfig& config, const char* argument){
+    const char* equals = strchr(argument, '=');
+    if(strncmp(argument, "--", 2) != 0 || equals == NULL){
+        return false;
+    }
+    std::string name(argument + 2, equals);
+    const char* value = equals + 1;
+
+    if(name == "producers") config.producers = atoi(value);
+    else if(name == "buyers") config.buyers = atoi(value);
+    else if(name == "companies") config.companies = atoi(value);
+    else if(name == "thieves") config.thieves = atoi(value);
+    else if(name == "seconds") config.seconds = atof(value);
+    else if(name == "batch") config.batch = atoi(value);
+    else if(name == "buyer-batch") config.buyer_batch = atoi(value);
+    else if(name == "company-size") config.company_size = atoi(value);
+    else if(name == "theft-size") config.theft_size = atoi(value);
+    else if(name == "min-value") config.min_value = atoi(value);
+    else if(name == "max-stock") config.max_stock = atoll(value);
+    else if(name == "pool") config.options.pool_threads = atoi(value);
+    else if(name == "shards") config.options.inventory_shards = atoi(value);
+    else if(name == "lock-free") config.options.lock_free_buy = (atoi(value) != 0);
+    else if(name == "filter") config.options.filter_company_purchases = (atoi(value) != 0);
+    else if(name == "handoff") config.options.company_handoff = (atoi(value) != 0);
+    else if(name == "profile-locks") config.options.profile_locks = (atoi(value) != 0);
+    else if(name == "profile-operations") config.options.profile_operations = (atoi(value) != 0);
+    else if(name == "trace") config.options.trace_path = value;
+    else if(name == "wal") config.options.wal_path = value;
+    else if(name == "wal-sync") config.options.wal_sync = (atoi(value) != 0);
+    else if(name == "wal-durable") config.options.wal_wait_durable = (atoi(value) != 0);
+    else if(name == "alloc-stats") config.alloc_stats = (atoi(value) != 0);
+    else if(name == "dashboard") config.dashboard = value;
+    else if(name == "dashboard-hz") config.dashboard_hz = atoi(value);
+    else if(name == "dashboard-threads") config.dashboard_threads = atoi(value);
+    else if(name == "format") config.format = value;
+    else if(name == "label") config.label = value;
+    else return false;
+    return true;
+}
+
+static void printLocksCsv(const BenchConfig& config, const std::vector<MutexStats>& locks){
+    printf("\nlabel,mutex,operation,acquisitions,contended,failed_tries,total_wait_ns,total_hold_ns\n");
+    for(auto& lock : locks){
+        for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+            const LockOperationStats& stats = lock.operations[op];
+            if(stats.acquisitions == 0 && stats.failed_tries == 0){
+                continue;
+            }
+            printf("%s,%s,%s,%llu,%llu,%llu,%llu,%llu\n", config.label.c_str(), lock.name,
+                   factoryOperationName(static_cast<FactoryOperation>(op)), stats.acquisitions, stats.contended,
+                   stats.failed_tries, stats.total_wait_ns, stats.total_hold_ns);
+        }
+    }
+}
+
+static void printLocksJson(const std::vector<MutexStats>& locks){
+    printf(",\n  \"locks\": [");
+    for(size_t i=0; i<locks.size(); i++){
+        const MutexStats& lock = locks[i];
+        LockOperationStats total = lock.total();
+        printf("%s\n    {\"mutex\": \"%s\", \"acquisitions\": %llu, \"contended\": %llu, \"failed_tries\": %llu, "
+               "\"wait_p50_ns\": %llu, \"wait_p99_ns\": %llu, \"wait_p999_ns\": %llu, "
+               "\"hold_p50_ns\": %llu, \"hold_p99_ns\": %llu, \"hold_p999_ns\": %llu, \"operations\": [",
+               i == 0 ? "" : ",", lock.name, total.acquisitions, total.contended, total.failed_tries,
+               lock.wait_time.percentile(50), lock.wait_time.percentile(99), lock.wait_time.percentile(99.9),
+               lock.hold_time.percentile(50), lock.hold_time.percentile(99), lock.hold_time.percentile(99.9));
+        bool first = true;
+        for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+            const LockOperationStats& stats = lock.operations[op];
+            if(stats.acquisitions == 0 && stats.failed_tries == 0){
+                continue;
+            }
+            printf("%s{\"operation\": \"%s\", \"acquisitions\": %llu, \"contended\": %llu, \"failed_tries\": %llu, "
+                   "\"total_wait_ns\": %llu, \"total_hold_ns\": %llu}", first ? "" : ", ",
+                   factoryOperationName(static_cast<FactoryOperation>(op)), stats.acquisitions, stats.contended,
+                   stats.failed_tries, stats.total_wait_ns, stats.total_hold_ns);
+            first = false;
+        }
+        printf("]}");
+    }
+    printf("\n  ]");
+}
+
+static void printOperationsCsv(const BenchConfig& config, const std::vector<OperationStats>& operations){
+    printf("\nlabel,operation,count,wait_p50_ns,wait_p99_ns,wait_p999_ns,work_p50_ns,work_p99_ns,work_p999_ns\n");
+    for(auto& stats : operations){
+        if(stats.total_time.count() == 0){
+            continue;
+        }
+        printf("%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", config.label.c_str(), factoryOperationName(stats.operation),
+               stats.total_time.count(), stats.wait_time.percentile(50), stats.wait_time.percentile(99),
+               stats.wait_time.percentile(99.9), stats.work_time.percentile(50), stats.work_time.percentile(99),
+               stats.work_time.percentile(99.9));
+    }
+}
+
+static void printOperationsJson(const std::vector<OperationStats>& operations){
+    printf(",\n  \"factory_operations\": [");
+    bool first = true;
+    for(auto& stats : operations){
+        if(stats.total_time.count() == 0){
+            continue;
+        }
+        printf("%s\n    {\"operation\": \"%s\", \"count\": %llu, \"wait_p50_ns\": %llu, \"wait_p99_ns\": %llu, "
+               "\"wait_p999_ns\": %llu, \"work_p50_ns\": %llu, \"work_p99_ns\": %llu, \"work_p999_ns\": %llu}",
+               first ? "" : ",", factoryOperationName(stats.operation), stats.total_time.count(),
+               stats.wait_time.percentile(50), stats.wait_time.percentile(99), stats.wait_time.percentile(99.9),
+               stats.work_time.percentile(50), stats.work_time.percentile(99), stats.work_time.percentile(99.9));
+        first = false;
+    }
+    printf("\n  ]");
+}
+
+static unsigned long long totalCalls(const BenchState& state){
+    unsigned long long calls = 0;
+    for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+        calls += state.results[op].count();
+    }
+    return calls;
+}
+
+static void printAllocationsCsv(const BenchConfig& config, const BenchState& state, const PoolCounters& counters){
+    unsigned long long calls = totalCalls(state);
+    printf("\nlabel,calls,pool_allocations,heap_allocations,heap_frees,heap_allocations_per_call\n");
+    printf("%s,%llu,%llu,%llu,%llu,%.6f\n", config.label.c_str(), calls, counters.allocations, counters.heap_allocations,
+           counters.heap_frees, calls == 0 ? 0.0 : static_cast<double>(counters.heap_allocations) / calls);
+}
+
+static void printAllocationsJson(const BenchState& state, const PoolCounters& counters){
+    unsigned long long calls = totalCalls(state);
+    printf(",\n  \"allocations\": {\"calls\": %llu, \"pool_allocations\": %llu, \"heap_allocations\": %llu, "
+           "\"heap_frees\": %llu, \"heap_allocations_per_call\": %.6f}", calls, counters.allocations,
+           counters.heap_allocations, counters.heap_frees,
+           calls == 0 ? 0.0 : static_cast<double>(counters.heap_allocations) / calls);
+}
+
+static void printCsv(const BenchConfig& config, const BenchState& state, double seconds){
+    printf("label,operation,count,ops_per_sec,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+    for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+        const LatencyHistogram& histogram = state.results[op];
+        if(histogram.count() == 0){
+            continue;
+        }
+        printf("%s,%s,%llu,%.0f,%.0f,%llu,%llu,%llu,%llu\n", config.label.c_str(), factoryOperationName(static_cast<FactoryOperation>(op)),
+               histogram.count(), histogram.count() / seconds, histogram.mean(), histogram.percentile(50),
+               histogram.percentile(99), histogram.percentile(99.9), histogram.max());
+    }
+}
+
+static void printJson(const BenchConfig& config, const BenchState& state, double seconds){
+    printf("{\n");
+    printf("  \"label\": \"%s\",\n", config.label.c_str());
+    printf("  \"config\": {\"producers\": %d, \"buyers\": %d, \"companies\": %d, \"thieves\": %d, "
+           "\"seconds\": %.3f, \"batch\": %d, \"buyer_batch\": %d, \"company_size\": %d, \"theft_size\": %d, "
+           "\"min_value\": %d, \"pool\": %d, \"shards\": %d, \"lock_free\": %s, \"filter\": %s},\n",
+           config.producers, config.buyers, config.companies, config.thieves, seconds, config.batch,
+           config.buyer_batch, config.company_size, config.theft_size, config.min_value, config.options.pool_threads,
+           config.options.inventory_shards, config.options.lock_free_buy ? "true" : "false",
+           config.options.filter_company_purchases ? "true" : "false");
+    printf("  \"operations\": [");
+    bool first = true;
+    for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+        const LatencyHistogram& histogram = state.results[op];
+        if(histogram.count() == 0){
+            continue;
+        }
+        printf("%s\n    {\"operation\": \"%s\", \"count\": %llu, \"ops_per_sec\": %.0f, \"mean_ns\": %.0f, "
+               "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+               first ? "" : ",", factoryOperationName(static_cast<FactoryOperation>(op)), histogram.count(), histogram.count() / seconds,
+               histogram.mean(), histogram.percentile(50), histogram.percentile(99), histogram.percentile(99.9),
+               histogram.max());
+        first = false;
+    }
+    printf("\n  ]");
+}
+
+int main(int argc, char** argv){
+    BenchConfig config;
+    for(int i=1; i<argc; i++){
+        if(!parseArgument(config, argv[i])){
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if(config.format != "csv" && config.format != "json"){
+        fprintf(stderr, "unknown format %s\n", config.format.c_str());
+        return 1;
+    }
+    if(config.dashboard != "none" && config.dashboard != "list" && config.dashboard != "analytics"){
+        fprintf(stderr, "unknown dashboard %s\n", config.dashboard.c_str());
+        return 1;
+    }
+    if(config.companies > 0 && config.producers <= 0){
+        fprintf(stderr, "companies wait for products forever without producers\n");
+        return 1;
+    }
+
+    Factory factory(config.options);
+    BenchState state;
+    state.factory = &factory;
+    state.config = &config;
+    state.stop = false;
+    state.consumers_done = false;
+    state.stock = 0;
+    state.next_id = 1;
+    INIT_MUTEX_LOCK(state.results_lock);
+
+    std::vector<pthread_t> producers(config.producers);
+    std::vector<pthread_t> consumers;
+    int num_dashboards = (config.dashboard != "none") ? 1 : 0;
+    std::vector<ActorArgs> args(config.producers + config.buyers + config.companies + config.thieves + num_dashboards);
+    for(size_t i=0; i<args.size(); i++){
+        args[i].state = &state;
+        args[i].index = static_cast<int>(i);
+    }
+
+    PoolCounters counters_before = PoolStats::read();
+    unsigned long long start = nowNanoseconds();
+    size_t next_args = 0;
+    for(int i=0; i<config.producers; i++){
+        pthread_create(&producers[i], NULL, producer, &args[next_args++]);
+    }
+    struct{
+        int count;
+        void* (*actor)(void*);
+    } consumer_types[] = {{config.buyers, simpleBuyer}, {config.companies, company}, {config.thieves, thief},
+                          {num_dashboards, dashboard}};
+    for(auto& type : consumer_types){
+        for(int i=0; i<type.count; i++){
+            pthread_t consumer;
+            pthread_create(&consumer, NULL, type.actor, &args[next_args++]);
+            consumers.push_back(consumer);
+        }
+    }
+
+    struct timespec duration;
+    duration.tv_sec = static_cast<time_t>(config.seconds);
+    duration.tv_nsec = static_cast<long>((config.seconds - duration.tv_sec) * 1e9);
+    nanosleep(&duration, NULL);
+    state.stop = true;
+
+    //companies may still wait for products, so the producers keep going until every consumer is done
+    for(auto consumer : consumers){
+        pthread_join(consumer, NULL);
+    }
+    double seconds = (nowNanoseconds() - start) / 1e9;
+    state.consumers_done = true;
+    for(auto producer_thread : producers){
+        pthread_join(producer_thread, NULL);
+    }
+
+    //the bench threads exited, so their pool counters are all in
+    PoolCounters counters = PoolStats::read();
+    counters.allocations -= counters_before.allocations;
+    counters.heap_allocations -= counters_before.heap_allocations;
+    counters.heap_frees -= counters_before.heap_frees;
+
+    std::vector<MutexStats> locks = factory.lockStats();
+    std::vector<OperationStats> operations = factory.operationStats();
+    if(config.format == "csv"){
+        printCsv(config, state, seconds);
+        if(!locks.empty()){
+            printLocksCsv(config, locks);
+        }
+        if(!operations.empty()){
+            printOperationsCsv(config, operations);
+        }
+        if(config.alloc_stats){
+            printAllocationsCsv(config, state, counters);
+        }
+    } else{
+        printJson(config, state, seconds);
+        if(!locks.empty()){
+            printLocksJson(locks);
+        }
+        if(!operations.empty()){
+            printOperationsJson(operations);
+        }
+        if(config.alloc_stats){
+            printAllocationsJson(state, counters);
+        }
+        printf("\n}\n");
+    }
+
+    pthread_mutex_destroy(&state.results_lock);
+    return 0;
+}
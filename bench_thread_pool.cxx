@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "Factory.h"
+
+#define DEFAULT_ROUNDS 2000
+#define ACTORS_PER_TYPE 16
+#define POOL_THREADS 8
+
+/**
+ * Compares running the actors on a new thread each (the default) with running them on a pool.
+ * Every round starts ACTORS_PER_TYPE producers, simple buyers and thieves and then finishes all
+ * of them, so the time is dominated by starting and finishing actors.
+ * usage: bench_thread_pool [rounds]
+ */
+
+static double nowSeconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double runRounds(Factory& factory, int rounds){
+    Product products[ACTORS_PER_TYPE];
+    for(int i=0; i<ACTORS_PER_TYPE; i++){
+        products[i] = Product(i, i);
+    }
+
+    double start = nowSeconds();
+    for(int round=0; round<rounds; round++){
+        for(unsigned int i=0; i<ACTORS_PER_TYPE; i++){
+            factory.startProduction(1, products + i, i);
+            factory.startSimpleBuyer(ACTORS_PER_TYPE + i);
+            factory.startThief(1, 2*ACTORS_PER_TYPE + i);
+        }
+        for(unsigned int i=0; i<ACTORS_PER_TYPE; i++){
+            factory.finishProduction(i);
+            factory.finishSimpleBuyer(ACTORS_PER_TYPE + i);
+            factory.finishThief(2*ACTORS_PER_TYPE + i);
+        }
+    }
+    return nowSeconds() - start;
+}
+
+static void report(const char* mode, int rounds, double seconds){
+    double actors = 3.0 * ACTORS_PER_TYPE * rounds;
+    printf("%-8s actors=%.0f time=%.3fs actors/sec=%.0f\n", mode, actors, seconds, actors / seconds);
+}
+
+int main(int argc, char** argv){
+    int rounds = (argc > 1) ? atoi(argv[1]) : DEFAULT_ROUNDS;
+
+    Factory spawn_factory;
+    report("spawn", rounds, runRounds(spawn_factory, rounds));
+
+    FactoryOptions options;
+    options.pool_threads = POOL_THREADS;
+    Factory pooled_factory(options);
+    report("pooled", rounds, runRounds(pooled_factory, rounds));
+
+    return 0;
+}
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "Factory.h"
+#include "LatencyHistogram.h"
+
+/**
+ * Replays a trace that a Factory recorded (FactoryOptions::trace_path, or bench_factory --trace) against a new
+ * Factory of this build, as a benchmark that is the same traffic every time.
+ * Every thread of the trace gets a replay thread that makes its calls in the recorded order, with the recorded
+ * arguments and products:
+ * - with --timing=full the calls are made back to back, so the threads may run ahead of each other.
+ * - with --timing=recorded every call is made at its recorded time (divided by --speed).
+ * startThief calls start a thief like they did, and the thief's own stealProducts call is not replayed.
+ * A result that is different from the recorded one (another product id, or another number of products) counts as
+ * diverged. When all the replay threads wait inside the factory and nothing happens for a while (a call that woke
+ * them ran in another order than it was recorded), the factory and the returning service are opened and filler
+ * products are produced until they go on, and the number of filler products is reported.
+ * Every run is reported as one CSV line, followed by the latencies of every operation over all the runs.
+ *
+ * usage: replay_trace --trace=path [--name=value ...]
+ *   --timing                            full or recorded (full)
+ *   --speed                             recorded timing runs this many times faster (1)
+ *   --runs                              replays the trace this many times, every time against a new factory (1)
+ *   --pool --shards --lock-free         FactoryOptions (0 0 0)
+ *   --broadcast                         FactoryOptions::broadcast_company_wakeups (0)
+ *   --label                             free text copied to the output, to tell runs apart
+ */
+
+//how often the replay is checked for threads that are stuck, it is stuck after a check without progress
+#define STALL_CHECK_US 10000
+//products a stuck replay gets at first, and at most
+#define FILLER_BATCH 64
+#define MAX_FILLER_BATCH 65536
+
+struct ReplayConfig{
+    std::string trace_path;
+    bool recorded_timing;
+    double speed;
+    int runs;
+    FactoryOptions options;
+    std::string label;
+
+    ReplayConfig() : recorded_timing(false), speed(1), runs(1){}
+};
+
+struct ReplayRun{
+    const ReplayConfig* config;
+    Factory* factory;
+    unsigned long long start_ns;
+
+    //the replay threads wait for the start - under start_lock
+    bool started;
+    pthread_mutex_t start_lock;
+    pthread_cond_t start_condition;
+
+    //calls that were made so far
+    std::atomic<unsigned long long> num_calls_done;
+    //threads that did not finish, and the ones of them that are inside the factory (or wait for their thieves)
+    std::atomic<int> num_running;
+    std::atomic<int> num_in_factory;
+};
+
+struct ReplayThread{
+    std::vector<TracedCall*> calls;
+    ReplayRun* run;
+    //latencies of every operation over all the runs
+    LatencyHistogram latencies[NUM_FACTORY_OPERATIONS];
+    long long num_diverged;
+};
+
+static void sleepUntil(unsigned long long time_ns){
+    //most calls of a busy trace are already due, reading the clock is much cheaper than a sleep call
+    if(nowNanoseconds() >= time_ns){
+        return;
+    }
+    struct timespec time;
+    time.tv_sec = static_cast<time_t>(time_ns / 1000000000ULL);
+    time.tv_nsec = static_cast<long>(time_ns % 1000000000ULL);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, NULL) != 0){
+    }
+}
+
+//makes the call, returns false if its result can't be compared to the recorded one
+static bool replayCall(Factory& factory, TracedCall& call, ActorGroup& thieves, int& result){
+    const TraceRecord& record = call.record;
+    int num_rejected = 0;
+    switch(static_cast<FactoryOperation>(record.operation)){
+        case OP_PRODUCE:
+            factory.produce(static_cast<int>(call.products.size()), call.products.data());
+            return false;
+        case OP_TRY_BUY_ONE:
+            result = factory.tryBuyOne();
+            return true;
+        case OP_TRY_BUY_MANY:
+            result = static_cast<int>(factory.tryBuyMany(record.num_products).size());
+            return true;
+        case OP_BUY_PRODUCTS:
+            result = static_cast<int>(factory.buyProducts(record.num_products, record.argument, &num_rejected).size());
+            return true;
+        case OP_RETURN_PRODUCTS:
+            factory.returnProducts(std::list<Product>(call.products.begin(), call.products.end()), 0);
+            return false;
+        case OP_START_THIEF:
+            thieves.add(factory.launchThief(record.num_products, static_cast<unsigned int>(record.argument)));
+            return false;
+        case OP_OPEN_FACTORY:
+            factory.openFactory();
+            return false;
+        case OP_CLOSE_FACTORY:
+            factory.closeFactory();
+            return false;
+        case OP_OPEN_RETURNING_SERVICE:
+            factory.openReturningService();
+            return false;
+        case OP_CLOSE_RETURNING_SERVICE:
+            factory.closeReturningService();
+            return false;
+        case OP_LIST_AVAILABLE_PRODUCTS:
+            result = static_cast<int>(factory.listAvailableProducts().size());
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void* replayThread(void* arg){
+    ReplayThread* replay = static_cast<ReplayThread*>(arg);
+    ReplayRun* run = replay->run;
+    const ReplayConfig* config = run->config;
+    ActorGroup thieves;
+
+    pthread_mutex_lock(&run->start_lock);
+    while(!run->started){
+        pthread_cond_wait(&run->start_condition, &run->start_lock);
+    }
+    pthread_mutex_unlock(&run->start_lock);
+
+    for(auto call : replay->calls){
+        const TraceRecord& record = call->record;
+        if(config->recorded_timing){
+            sleepUntil(run->start_ns + static_cast<unsigned long long>(record.start_ns / config->speed));
+        }
+
+        int result = 0;
+        run->num_in_factory.fetch_add(1);
+        unsigned long long start = nowNanoseconds();
+        bool compared = replayCall(*run->factory, *call, thieves, result);
+        replay->latencies[record.operation].record(nowNanoseconds() - start);
+        run->num_in_factory.fetch_sub(1);
+
+        if(compared && result != record.result){
+            ++replay->num_diverged;
+        }
+        run->num_calls_done.fetch_add(1);
+    }
+
+    //the thieves this thread started count as its calls
+    run->num_in_factory.fetch_add(1);
+    thieves.waitAll();
+    run->num_in_factory.fetch_sub(1);
+    run->num_running.fetch_sub(1);
+    return NULL;
+}
+
+static bool parseArgument(ReplayConfig& config, const char* argument){
+    const char* equals = strchr(argument, '=');
+    if(strncmp(argument, "--", 2) != 0 || equals == NULL){
+        return false;
+    }
+    std::string name(argument + 2, equals);
+    const char* value = equals + 1;
+
+    if(name == "trace") config.trace_path = value;
+    else if(name == "timing" && strcmp(value, "full") == 0) config.recorded_timing = false;
+    else if(name == "timing" && strcmp(value, "recorded") == 0) config.recorded_timing = true;
+    else if(name == "speed") config.speed = atof(value);
+    else if(name == "runs") config.runs = atoi(value);
+    else if(name == "pool") config.options.pool_threads = atoi(value);
+    else if(name == "shards") config.options.inventory_shards = atoi(value);
+    else if(name == "lock-free") config.options.lock_free_buy = (atoi(value) != 0);
+    else if(name == "broadcast") config.options.broadcast_company_wakeups = (atoi(value) != 0);
+    else if(name == "label") config.label = value;
+    else return false;
+    return true;
+}
+
+int main(int argc, char** argv){
+    ReplayConfig config;
+    for(int i=1; i<argc; i++){
+        if(!parseArgument(config, argv[i])){
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if(config.trace_path.empty() || config.speed <= 0 || config.runs <= 0){
+        fprintf(stderr, "usage: replay_trace --trace=path [--timing=full|recorded] [--speed=x] [--runs=n]\n");
+        return 1;
+    }
+
+    std::vector<TracedCall> calls;
+    if(!OperationTrace::read(config.trace_path.c_str(), calls)){
+        return 1;
+    }
+
+    //the calls of every recorded thread in their order, the thieves' steals are made by the thieves the replay starts
+    std::map<unsigned int, ReplayThread*> threads_by_number;
+    size_t num_replayed = 0;
+    for(auto& call : calls){
+        if(call.record.operation == OP_STEAL_PRODUCTS){
+            continue;
+        }
+        ReplayThread*& replay = threads_by_number[call.record.thread];
+        if(replay == NULL){
+            replay = new ReplayThread();
+            replay->num_diverged = 0;
+        }
+        replay->calls.push_back(&call);
+        ++num_replayed;
+    }
+    std::vector<ReplayThread*> threads;
+    for(auto& entry : threads_by_number){
+        threads.push_back(entry.second);
+    }
+
+    printf("label,run,calls,threads,seconds,calls_per_sec,diverged,filler_products\n");
+    int next_filler_id = INT_MAX;
+    for(int run_index=0; run_index<config.runs; run_index++){
+        Factory factory(config.options);
+        ReplayRun run;
+        run.config = &config;
+        run.factory = &factory;
+        run.start_ns = 0;
+        run.started = false;
+        INIT_MUTEX_LOCK(run.start_lock);
+        pthread_cond_init(&run.start_condition, NULL);
+        run.num_calls_done = 0;
+        run.num_running = static_cast<int>(threads.size());
+        run.num_in_factory = 0;
+
+        long long diverged_before = 0;
+        std::vector<pthread_t> thread_ids(threads.size());
+        for(size_t i=0; i<threads.size(); i++){
+            diverged_before += threads[i]->num_diverged;
+            threads[i]->run = &run;
+            pthread_create(&thread_ids[i], NULL, replayThread, threads[i]);
+        }
+
+        pthread_mutex_lock(&run.start_lock);
+        run.start_ns = nowNanoseconds();
+        run.started = true;
+        pthread_cond_broadcast(&run.start_condition);
+        pthread_mutex_unlock(&run.start_lock);
+
+        //help the replay threads when all of them wait inside the factory for a call that already happened
+        long long num_filler = 0;
+        int filler_batch = FILLER_BATCH;
+        unsigned long long last_calls_done = 0;
+        while(run.num_running.load() > 0){
+            usleep(STALL_CHECK_US);
+            unsigned long long calls_done = run.num_calls_done.load();
+            if(run.num_in_factory.load() < run.num_running.load()){
+                //a thread is between calls, so the replay is not stuck
+                filler_batch = FILLER_BATCH;
+                last_calls_done = calls_done;
+                continue;
+            }
+            if(calls_done != last_calls_done){
+                last_calls_done = calls_done;
+                continue;
+            }
+            factory.openFactory();
+            factory.openReturningService();
+            std::vector<Product> filler(filler_batch);
+            for(auto& product : filler){
+                //worth more than any min_value, with ids from the top down so they don't mix with the recorded ones
+                product = Product(next_filler_id--, INT_MAX);
+            }
+            factory.produce(filler_batch, filler.data());
+            num_filler += filler_batch;
+            //threads that stay stuck get more every time
+            filler_batch = std::min(filler_batch * 2, MAX_FILLER_BATCH);
+        }
+        double seconds = (nowNanoseconds() - run.start_ns) / 1e9;
+
+        long long diverged = -diverged_before;
+        for(size_t i=0; i<threads.size(); i++){
+            pthread_join(thread_ids[i], NULL);
+            diverged += threads[i]->num_diverged;
+        }
+        printf("%s,%d,%zu,%zu,%.3f,%.0f,%lld,%lld\n", config.label.c_str(), run_index, num_replayed, threads.size(),
+               seconds, num_replayed / seconds, diverged, num_filler);
+
+        pthread_mutex_destroy(&run.start_lock);
+        pthread_cond_destroy(&run.start_condition);
+    }
+
+    printf("\nlabel,operation,count,mean_ns,p50_ns,p99_ns,p999_ns,max_ns\n");
+    for(int op=0; op<NUM_FACTORY_OPERATIONS; op++){
+        LatencyHistogram latency;
+        for(auto replay : threads){
+            latency.merge(replay->latencies[op]);
+        }
+        if(latency.count() == 0){
+            continue;
+        }
+        printf("%s,%s,%llu,%.0f,%llu,%llu,%llu,%llu\n", config.label.c_str(), factoryOperationName(static_cast<FactoryOperation>(op)),
+               latency.count(), latency.mean(), latency.percentile(50), latency.percentile(99), latency.percentile(99.9),
+               latency.max());
+    }
+
+    for(auto replay : threads){
+        delete replay;
+    }
+    return 0;
+}
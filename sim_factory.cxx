@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <vector>
+#include "Factory.h"
+#include "LatencyHistogram.h"
+#include "SimEngine.h"
+
+/**
+ * Capacity simulation of a Factory with actors that are coroutines instead of threads (see SimEngine),
+ * so millions of buyers, companies and thieves can be alive at once on a few worker threads.
+ *
+ * - producers produce batches while there are consumers left, and pause while the stock is high.
+ * - simple buyers call tryBuyOne once.
+ * - companies buy company-size products, and return the ones below min-value.
+ * - thieves steal theft-size products.
+ * With --start-closed=1 the factory and the returning service are closed until every actor was spawned, so all
+ * the companies and thieves are suspended at the same time before anything is sold.
+ * The run is reported as one CSV line: how long spawning and running took and the peak memory of the process.
+ *
+ * usage: sim_factory [--name=value ...]
+ *   --producers --buyers --companies --thieves    number of actors of every type (4 100000 100000 10000)
+ *   --threads                                     worker threads that run the actors (4)
+ *   --batch --company-size --theft-size           products per produce, buyProducts and theft (64 4 2)
+ *   --min-value                                   companies return products below it (0, nothing)
+ *   --max-stock                                   producers pause while there are more products (100000)
+ *   --shards                                      FactoryOptions::inventory_shards (0)
+ *   --start-closed                                keep the factory closed while spawning (0)
+ *   --label                                       free text copied to the output, to tell runs apart
+ */
+
+struct SimConfig{
+    int producers;
+    long long buyers;
+    long long companies;
+    long long thieves;
+    int threads;
+    int batch;
+    int company_size;
+    int theft_size;
+    int min_value;
+    long long max_stock;
+    bool start_closed;
+    FactoryOptions options;
+    std::string label;
+
+    SimConfig() : producers(4), buyers(100000), companies(100000), thieves(10000), threads(4), batch(64),
+                  company_size(4), theft_size(2), min_value(0), max_stock(100000), start_closed(false){}
+};
+
+struct SimState{
+    const SimConfig* config;
+    //products in the factory according to the actors' results, producers pause when there are too many
+    std::atomic<long long> stock;
+    //buyers, companies and thieves that did not finish yet, producers stop when there are none
+    std::atomic<long long> remaining_consumers;
+
+    std::atomic<long long> num_bought;
+    std::atomic<long long> num_returned;
+    std::atomic<long long> num_stolen;
+};
+
+static SimActor producer(SimEngine& engine, SimState& state, int index){
+    const SimConfig* config = state.config;
+    std::vector<Product> products(config->batch);
+    unsigned int seed = static_cast<unsigned int>(index) + 1;
+    int next_id = index * 100000000 + 1;
+
+    while(state.remaining_consumers.load() > 0){
+        if(state.stock.load() < config->max_stock){
+            for(auto& product : products){
+                product = Product(next_id++, rand_r(&seed) % 10);
+            }
+            engine.getFactory().produce(config->batch, products.data());
+            state.stock.fetch_add(config->batch);
+        }
+        //let the consumers run
+        co_await engine.yield();
+    }
+}
+
+static SimActor simpleBuyer(SimEngine& engine, SimState& state){
+    //tryBuyOne never blocks, so it is called as it is
+    if(engine.getFactory().tryBuyOne() != -1){
+        state.stock.fetch_sub(1);
+        state.num_bought.fetch_add(1);
+    }
+    state.remaining_consumers.fetch_sub(1);
+    co_return;
+}
+
+static SimActor company(SimEngine& engine, SimState& state){
+    const SimConfig* config = state.config;
+
+    //suspended (not blocked) until there are enough products and no thieves
+    std::list<Product> bought = co_await engine.buyProducts(config->company_size);
+    state.stock.fetch_sub(config->company_size);
+    state.num_bought.fetch_add(config->company_size);
+
+    std::list<Product> returned;
+    for(auto& product : bought){
+        if(product.getValue() < config->min_value){
+            returned.push_back(product);
+        }
+    }
+    if(!returned.empty()){
+        long long num_returned = static_cast<long long>(returned.size());
+        //suspended until the returning service is open and the thieves left
+        co_await engine.returnProducts(std::move(returned));
+        state.stock.fetch_add(num_returned);
+        state.num_returned.fetch_add(num_returned);
+    }
+    state.remaining_consumers.fetch_sub(1);
+}
+
+static SimActor thief(SimEngine& engine, SimState& state, unsigned int fake_id){
+    //suspended until the factory is open
+    int num_stolen = co_await engine.stealProducts(state.config->theft_size, fake_id);
+    state.stock.fetch_sub(num_stolen);
+    state.num_stolen.fetch_add(num_stolen);
+    state.remaining_consumers.fetch_sub(1);
+}
+
+static bool parseArgument(SimConfig& config, const char* argument){
+    const char* equals = strchr(argument, '=');
+    if(strncmp(argument, "--", 2) != 0 || equals == NULL){
+        return false;
+    }
+    std::string name(argument + 2, equals);
+    const char* value = equals + 1;
+
+    if(name == "producers") config.producers = atoi(value);
+    else if(name == "buyers") config.buyers = atoll(value);
+    else if(name == "companies") config.companies = atoll(value);
+    else if(name == "thieves") config.thieves = atoll(value);
+    else if(name == "threads") config.threads = atoi(value);
+    else if(name == "batch") config.batch = atoi(value);
+    else if(name == "company-size") config.company_size = atoi(value);
+    else if(name == "theft-size") config.theft_size = atoi(value);
+    else if(name == "min-value") config.min_value = atoi(value);
+    else if(name == "max-stock") config.max_stock = atoll(value);
+    else if(name == "shards") config.options.inventory_shards = atoi(value);
+    else if(name == "start-closed") config.start_closed = (atoi(value) != 0);
+    else if(name == "label") config.label = value;
+    else return false;
+    return true;
+}
+
+//the peak resident memory of the process, in kB (0 if it is unknown)
+static long long peakMemoryKb(){
+    FILE* status = fopen("/proc/self/status", "r");
+    if(status == NULL){
+        return 0;
+    }
+    long long peak = 0;
+    char line[256];
+    while(fgets(line, sizeof(line), status) != NULL){
+        if(strncmp(line, "VmHWM:", 6) == 0){
+            peak = atoll(line + 6);
+            break;
+        }
+    }
+    fclose(status);
+    return peak;
+}
+
+int main(int argc, char** argv){
+    SimConfig config;
+    for(int i=1; i<argc; i++){
+        if(!parseArgument(config, argv[i])){
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if(config.threads <= 0 || config.batch <= 0){
+        fprintf(stderr, "threads and batch must be positive\n");
+        return 1;
+    }
+    if(config.companies > 0 && config.producers <= 0){
+        fprintf(stderr, "companies wait for products forever without producers\n");
+        return 1;
+    }
+
+    Factory factory(config.options);
+    SimState state;
+    state.config = &config;
+    state.stock = 0;
+    state.remaining_consumers = config.buyers + config.companies + config.thieves;
+    state.num_bought = 0;
+    state.num_returned = 0;
+    state.num_stolen = 0;
+
+    if(config.start_closed){
+        factory.closeFactory();
+        factory.closeReturningService();
+    }
+
+    unsigned long long start = nowNanoseconds();
+    {
+        SimEngine engine(factory, config.threads);
+
+        //interleave the types, so every type is alive from the start
+        long long most = std::max(config.buyers, std::max(config.companies, config.thieves));
+        for(long long i=0; i<most; i++){
+            if(i < config.thieves){
+                engine.spawn(thief(engine, state, static_cast<unsigned int>(i)));
+            }
+            if(i < config.companies){
+                engine.spawn(company(engine, state));
+            }
+            if(i < config.buyers){
+                engine.spawn(simpleBuyer(engine, state));
+            }
+        }
+        for(int i=0; i<config.producers; i++){
+            engine.spawn(producer(engine, state, i));
+        }
+        unsigned long long spawned = nowNanoseconds();
+
+        if(config.start_closed){
+            factory.openFactory();
+            factory.openReturningService();
+        }
+        engine.waitAll();
+        unsigned long long finished = nowNanoseconds();
+
+        long long actors = config.producers + config.buyers + config.companies + config.thieves;
+        double spawn_seconds = (spawned - start) / 1e9;
+        double seconds = (finished - start) / 1e9;
+        printf("label,actors,threads,spawn_s,total_s,actors_per_sec,peak_rss_kb,bought,returned,stolen\n");
+        printf("%s,%lld,%d,%.3f,%.3f,%.0f,%lld,%lld,%lld,%lld\n", config.label.c_str(), actors, config.threads,
+               spawn_seconds, seconds, actors / seconds, peakMemoryKb(), state.num_bought.load(),
+               state.num_returned.load(), state.num_stolen.load());
+    }
+    return 0;
+}
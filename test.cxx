@@ -1,7 +1,14 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <set>
+#include <algorithm>
 #include <iostream>
 #include "Factory.h"
+#include "FactoryCluster.h"
+#include "ProductColumns.h"
+#include "LatencyHistogram.h"
 #include "test_utilities.h"
 
 #define TEST_SYNC_SIZE 100 // this is not recommended to increase this parameter.
@@ -341,6 +348,819 @@ bool testReusingIds() {
 }
 
 
+bool testManyChunks() {
+	const int num_products = 1000;
+	Product products[num_products];
+	for(int i=0; i<num_products; i++){
+		products[i]=Product(i+1,i);
+	}
+	
+	Factory factory=Factory();
+	factory.produce(num_products/2, products);
+	factory.produce(num_products/2, products+num_products/2);
+	
+	list<Product> bought_products = factory.buyProducts(300);
+	ASSERT_TEST(bought_products.size() == 300);
+	int i=1;
+	for (list<Product>::iterator iterator = bought_products.begin(), end = bought_products.end(); iterator != end; ++iterator) {
+		ASSERT_TEST((*iterator).getId() == i);
+		i++;
+	}
+	
+	ASSERT_TEST(factory.stealProducts(600, 7) == 600);
+	ASSERT_TEST(factory.tryBuyOne() == 901);
+	
+	list<Product> avProds=factory.listAvailableProducts();
+	ASSERT_TEST(avProds.size() == 99);
+	ASSERT_TEST(avProds.front().getId() == 902 && avProds.back().getId() == 1000);
+	
+	list<pair<Product, int>> stolProds=factory.listStolenProducts();
+	ASSERT_TEST(stolProds.size() == 600);
+	ASSERT_TEST(stolProds.front().first.getId() == 301 && stolProds.back().first.getId() == 900);
+	return true;
+}
+
+
+bool testThreadPool() {
+	FactoryOptions options;
+	options.pool_threads = 2;
+	Factory factory(options);
+	
+	Product products[3];
+	products[0]=Product(1,3);
+	products[1]=Product(2,5);
+	products[2]=Product(3,7);
+	
+	// both companies block until all the products are made, more actors than workers are running
+	factory.startCompanyBuyer(2, 4, 1);
+	factory.startCompanyBuyer(1, 1, 2);
+	factory.startProduction(1, products, 3);
+	factory.startProduction(1, products+1, 4);
+	factory.startProduction(1, products+2, 5);
+	factory.finishProduction(3);
+	factory.finishProduction(4);
+	factory.finishProduction(5);
+	
+	int returned = factory.finishCompanyBuyer(1) + factory.finishCompanyBuyer(2);
+	ASSERT_TEST((int)factory.listAvailableProducts().size() == returned);
+	
+	// ids can be reused once the actor is finished
+	factory.startThief(17, 1);
+	ASSERT_TEST(factory.finishThief(1) == returned);
+	ASSERT_TEST(factory.listAvailableProducts().empty());
+	return true;
+}
+
+
+bool testLockFreeBuy() {
+	const int num_products = 600;
+	Product products[num_products];
+	for(int i=0; i<num_products; i++){
+		products[i]=Product(i+1,i);
+	}
+	
+	FactoryOptions options;
+	options.lock_free_buy = true;
+	Factory factory(options);
+	
+	ASSERT_TEST(factory.tryBuyOne() == -1);
+	factory.produce(num_products, products);
+	ASSERT_TEST(factory.tryBuyOne() == 1);
+	
+	factory.closeFactory();
+	ASSERT_TEST(factory.tryBuyOne() == -1);
+	factory.openFactory();
+	
+	// the oldest products go to the company, then the thief, then the simple buyers
+	list<Product> bought_products = factory.buyProducts(254);
+	ASSERT_TEST(bought_products.front().getId() == 2 && bought_products.back().getId() == 255);
+	ASSERT_TEST(factory.stealProducts(2, 5) == 2);
+	ASSERT_TEST(factory.tryBuyOne() == 258);
+	
+	bool seen[num_products+1] = {false};
+	for(unsigned int i=0; i<400; i++){
+		factory.startSimpleBuyer(i);
+	}
+	int num_bought = 0;
+	for(unsigned int i=0; i<400; i++){
+		int id = factory.finishSimpleBuyer(i);
+		if(id != -1){
+			ASSERT_TEST(!seen[id]);
+			seen[id] = true;
+			num_bought++;
+		}
+	}
+	ASSERT_TEST((int)factory.listAvailableProducts().size() == num_products - 258 - num_bought);
+	return true;
+}
+
+
+bool testProduceBatch() {
+	Factory factory=Factory();
+	Product products[3];
+	products[0]=Product(1,3);
+	products[1]=Product(2,5);
+	products[2]=Product(3,7);
+	factory.produce(2, products);
+	
+	ProductQueue batch;
+	for(int i=0; i<1000; i++){
+		batch.pushBack(Product(100+i, i));
+	}
+	factory.produce(batch);
+	ASSERT_TEST(batch.empty());
+	factory.produce(1, products+2);
+	
+	list<Product> avProds=factory.listAvailableProducts();
+	ASSERT_TEST(avProds.size() == 1003);
+	ASSERT_TEST(avProds.front().getId() == 1 && avProds.back().getId() == 3);
+	
+	list<Product> bought_products = factory.buyProducts(502);
+	ASSERT_TEST(bought_products.back().getId() == 599);
+	ASSERT_TEST(factory.stealProducts(500, 3) == 500);
+	ASSERT_TEST(factory.tryBuyOne() == 3);
+	return true;
+}
+
+
+bool testShardedInventory() {
+	FactoryOptions options;
+	options.inventory_shards = 4;
+	Factory factory(options);
+	
+	Product products[600];
+	for(int i=0; i<600; i++){
+		products[i]=Product(i+1,i%10);
+	}
+	for(unsigned int i=0; i<6; i++){
+		factory.startProduction(100, products+100*i, i);
+	}
+	for(unsigned int i=0; i<6; i++){
+		factory.finishProduction(i);
+	}
+	ASSERT_TEST(factory.listAvailableProducts().size() == 600);
+	
+	// companies and thieves always get the globally oldest products, whatever shard they are in
+	ProductQueue batch;
+	batch.pushBack(Product(1000,1));
+	factory.produce(batch);
+	list<Product> bought_products = factory.buyProducts(600);
+	ASSERT_TEST(bought_products.size() == 600);
+	ASSERT_TEST(factory.stealProducts(5, 8) == 1);
+	ASSERT_TEST(factory.listStolenProducts().front().first.getId() == 1000);
+	
+	// products left after companies return them are not lost or duplicated
+	factory.produce(300, products);
+	for(unsigned int i=0; i<10; i++){
+		factory.startCompanyBuyer(20, 5, i);
+		factory.startSimpleBuyer(100+i);
+		factory.startThief(3, 200+i);
+	}
+	int num_left = 300;
+	for(unsigned int i=0; i<10; i++){
+		num_left -= 20 - factory.finishCompanyBuyer(i);
+		num_left -= (factory.finishSimpleBuyer(100+i) == -1) ? 0 : 1;
+		num_left -= factory.finishThief(200+i);
+	}
+	ASSERT_TEST((int)factory.listAvailableProducts().size() == num_left);
+	
+	factory.closeFactory();
+	ASSERT_TEST(factory.tryBuyOne() == -1);
+	return true;
+}
+
+
+bool testFilteredPurchase() {
+	Product products[6];
+	products[0]=Product(1,3);
+	products[1]=Product(2,8);
+	products[2]=Product(3,1);
+	products[3]=Product(4,9);
+	products[4]=Product(5,2);
+	products[5]=Product(6,7);
+	
+	Factory factory=Factory();
+	factory.produce(6, products);
+	
+	// the cheap products never leave, and keep their place at the front
+	int num_rejected = -1;
+	list<Product> bought_products = factory.buyProducts(4, 5, &num_rejected);
+	ASSERT_TEST(num_rejected == 2);
+	ASSERT_TEST(bought_products.size() == 2);
+	ASSERT_TEST(bought_products.front().getId() == 2 && bought_products.back().getId() == 4);
+	list<Product> avProds=factory.listAvailableProducts();
+	int temp_ids[4] = {1,3,5,6};
+	int i=0;
+	for (list<Product>::iterator iterator = avProds.begin(), end = avProds.end(); iterator != end; ++iterator) {
+		ASSERT_TEST((*iterator).getId() == temp_ids[i]);
+		i++;
+	}
+	
+	// a company of a filtering factory doesn't need the returning service
+	FactoryOptions options;
+	options.filter_company_purchases = true;
+	options.inventory_shards = 2;
+	Factory filtering_factory(options);
+	filtering_factory.produce(6, products);
+	filtering_factory.closeReturningService();
+	filtering_factory.startCompanyBuyer(3, 5, 1);
+	ASSERT_TEST(filtering_factory.finishCompanyBuyer(1) == 2);
+	ASSERT_TEST(filtering_factory.tryBuyOne() == 1);
+	ASSERT_TEST(filtering_factory.listAvailableProducts().size() == 4);
+	return true;
+}
+
+
+bool testSnapshot() {
+	const int num_products = 600;
+	Product products[num_products];
+	for (int i = 0; i < num_products; ++i) {
+		products[i]=Product(i+1,i%10);
+	}
+	
+	FactoryOptions options;
+	options.lock_free_buy = true;
+	Factory factory(options);
+	factory.produce(num_products, products);
+	InventorySnapshot snapshot = factory.snapshotAvailableProducts();
+	ASSERT_TEST(snapshot.size() == num_products);
+	
+	// the snapshot doesn't change while whole chunks are bought, single products are bought and more are made
+	ASSERT_TEST(factory.buyProducts(300).size() == 300);
+	ASSERT_TEST(factory.tryBuyOne() == 301);
+	factory.produce(num_products, products);
+	list<Product> snapProds = snapshot.toList();
+	ASSERT_TEST((int)snapProds.size() == num_products);
+	int expected_id = 1;
+	for (list<Product>::iterator iterator = snapProds.begin(), end = snapProds.end(); iterator != end; ++iterator) {
+		ASSERT_TEST((*iterator).getId() == expected_id);
+		expected_id++;
+	}
+	ASSERT_TEST(factory.listAvailableProducts().size() == 2 * num_products - 301);
+	
+	// a sharded snapshot is merged in global order
+	options.lock_free_buy = false;
+	options.inventory_shards = 2;
+	Factory sharded_factory(options);
+	sharded_factory.produce(3, products);
+	sharded_factory.produce(3, products + 3);
+	InventorySnapshot sharded_snapshot = sharded_factory.snapshotAvailableProducts();
+	ASSERT_TEST(sharded_factory.buyProducts(6).size() == 6);
+	ASSERT_TEST(sharded_snapshot.size() == 6);
+	expected_id = 1;
+	sharded_snapshot.forEach([&expected_id](const Product& product){
+		if (product.getId() == expected_id) {
+			expected_id++;
+		}
+	});
+	ASSERT_TEST(expected_id == 7);
+	return true;
+}
+
+bool testTheftLog() {
+	// enough thefts for several segments and a bigger directory
+	const int num_products = 20000;
+	Product* products = new Product[num_products];
+	for (int i = 0; i < num_products; ++i) {
+		products[i]=Product(i+1,1);
+	}
+	
+	Factory factory=Factory();
+	factory.produce(num_products, products);
+	delete[] products;
+	
+	size_t cursor = 0;
+	factory.startThief(5, 1);
+	ASSERT_TEST(factory.finishThief(1) == 5);
+	list<pair<Product, int>> stolenProds = factory.listStolenProductsSince(cursor);
+	ASSERT_TEST(stolenProds.size() == 5 && cursor == 5);
+	ASSERT_TEST(factory.listStolenProductsSince(cursor).empty() && cursor == 5);
+	
+	// only the new thefts are read, in the order they happened
+	factory.startThief(num_products - 1000, 2);
+	ASSERT_TEST(factory.finishThief(2) == num_products - 1000);
+	factory.startThief(2000, 3);
+	ASSERT_TEST(factory.finishThief(3) == 995);
+	stolenProds = factory.listStolenProductsSince(cursor);
+	ASSERT_TEST((int)stolenProds.size() == num_products - 5 && (int)cursor == num_products);
+	int expected_id = 6;
+	for (list<pair<Product, int>>::iterator iterator = stolenProds.begin(), end = stolenProds.end(); iterator != end; ++iterator) {
+		ASSERT_TEST((*iterator).first.getId() == expected_id);
+		ASSERT_TEST((*iterator).second == (expected_id <= num_products - 995 ? 2 : 3));
+		expected_id++;
+	}
+	ASSERT_TEST((int)factory.listStolenProducts().size() == num_products);
+	return true;
+}
+
+bool testTargetedWakeups() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i+1);
+	}
+	
+	Factory factory=Factory();
+	factory.startCompanyBuyer(5, 0, 1);
+	factory.startCompanyBuyer(2, 0, 2);
+	factory.startCompanyBuyer(3, 0, 3);
+	sleep(1); // let the companies start waiting
+	
+	// only the company that the new products can satisfy is woken
+	factory.produce(2, products);
+	ASSERT_TEST(factory.finishCompanyBuyer(2) == 0);
+	ASSERT_TEST(factory.numCompanyWakeups() == 1);
+	factory.produce(4, products + 2);
+	ASSERT_TEST(factory.finishCompanyBuyer(3) == 0);
+	ASSERT_TEST(factory.numCompanyWakeups() == 2);
+	factory.produce(4, products + 6);
+	ASSERT_TEST(factory.finishCompanyBuyer(1) == 0);
+	ASSERT_TEST(factory.numCompanyWakeups() == 3);
+	ASSERT_TEST(factory.listAvailableProducts().empty());
+	return true;
+}
+
+bool testLatencyHistogram() {
+	LatencyHistogram first;
+	LatencyHistogram second;
+	ASSERT_TEST(first.count() == 0 && first.percentile(50) == 0);
+	for (unsigned long long value = 1; value <= 1000; ++value) {
+		first.record(value);
+		second.record(value * 1000);
+	}
+	ASSERT_TEST(first.count() == 1000 && first.min() == 1 && first.max() == 1000);
+	
+	// percentiles are within the error of a bucket, and never above the max
+	unsigned long long p50 = first.percentile(50);
+	ASSERT_TEST(p50 >= 500 && p50 <= 500 + 500 / LATENCY_SUB_BUCKETS);
+	ASSERT_TEST(first.percentile(100) == 1000);
+	
+	// merging keeps both sets of values
+	first.merge(second);
+	ASSERT_TEST(first.count() == 2000 && first.min() == 1 && first.max() == 1000000);
+	unsigned long long p75 = first.percentile(75);
+	ASSERT_TEST(p75 >= 500000 && p75 <= 500000 + 500000 / LATENCY_SUB_BUCKETS);
+	first.reset();
+	ASSERT_TEST(first.count() == 0 && first.max() == 0);
+	return true;
+}
+
+bool testLockStats() {
+	Product products[4];
+	for (int i = 0; i < 4; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	
+	// without profiling there are no statistics
+	Factory factory=Factory();
+	factory.produce(4, products);
+	ASSERT_TEST(factory.lockStats().empty());
+	
+	FactoryOptions options;
+	options.profile_locks = true;
+	Factory profiled_factory(options);
+	profiled_factory.produce(4, products);
+	profiled_factory.produce(4, products);
+	ASSERT_TEST(profiled_factory.buyProducts(3).size() == 3);
+	ASSERT_TEST(profiled_factory.tryBuyOne() == 4);
+	profiled_factory.startThief(2, 7);
+	ASSERT_TEST(profiled_factory.finishThief(7) == 2);
+	
+	vector<MutexStats> stats = profiled_factory.lockStats();
+	ASSERT_TEST(stats.size() == 3);
+	MutexStats& factory_lock_stats = stats[0];
+	ASSERT_TEST(string(factory_lock_stats.name) == "factory_lock");
+	ASSERT_TEST(factory_lock_stats.operations[OP_PRODUCE].acquisitions == 2);
+	ASSERT_TEST(factory_lock_stats.operations[OP_BUY_PRODUCTS].acquisitions == 1);
+	ASSERT_TEST(factory_lock_stats.operations[OP_TRY_BUY_ONE].acquisitions == 1);
+	ASSERT_TEST(factory_lock_stats.operations[OP_STEAL_PRODUCTS].acquisitions == 1);
+	ASSERT_TEST(factory_lock_stats.total().acquisitions == 5 && factory_lock_stats.total().contended == 0);
+	ASSERT_TEST(factory_lock_stats.hold_time.count() == 5 && factory_lock_stats.wait_time.count() == 5);
+	ASSERT_TEST(stats[1].operations[OP_START_THIEF].acquisitions == 1);
+	return true;
+}
+
+void* recordProfileSamples(void* arg) {
+	// a full buffer is merged, the rest is left for the exit
+	for (int i = 0; i < OPERATION_BUFFER_SIZE + 3; ++i) {
+		static_cast<OperationProfile*>(arg)->record(OP_TRY_BUY_ONE, 0, 1);
+	}
+	return NULL;
+}
+
+bool testOperationStats() {
+	Product products[4];
+	for (int i = 0; i < 4; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	
+	// without profiling there are no statistics
+	Factory factory=Factory();
+	factory.produce(4, products);
+	ASSERT_TEST(factory.operationStats().empty());
+	
+	FactoryOptions options;
+	options.profile_operations = true;
+	Factory profiled_factory(options);
+	profiled_factory.produce(4, products);
+	profiled_factory.produce(4, products);
+	ASSERT_TEST(profiled_factory.buyProducts(3).size() == 3);
+	ASSERT_TEST(profiled_factory.tryBuyOne() == 4);
+	profiled_factory.returnProducts(list<Product>(1, products[0]), 5);
+	
+	// a thief that waits for the factory to open
+	profiled_factory.closeFactory();
+	profiled_factory.startThief(2, 7);
+	usleep(50000);
+	profiled_factory.openFactory();
+	ASSERT_TEST(profiled_factory.finishThief(7) == 2);
+	
+	vector<OperationStats> stats = profiled_factory.operationStats();
+	ASSERT_TEST(stats.size() == NUM_FACTORY_OPERATIONS);
+	ASSERT_TEST(stats[OP_PRODUCE].operation == OP_PRODUCE && stats[OP_PRODUCE].total_time.count() == 2);
+	ASSERT_TEST(stats[OP_BUY_PRODUCTS].total_time.count() == 1);
+	ASSERT_TEST(stats[OP_TRY_BUY_ONE].total_time.count() == 1);
+	ASSERT_TEST(stats[OP_RETURN_PRODUCTS].total_time.count() == 1);
+	ASSERT_TEST(stats[OP_STEAL_PRODUCTS].total_time.count() == 1);
+	// nothing had to wait except the thief
+	ASSERT_TEST(stats[OP_BUY_PRODUCTS].wait_time.max() == 0);
+	ASSERT_TEST(stats[OP_STEAL_PRODUCTS].wait_time.min() >= 25000000);
+	ASSERT_TEST(stats[OP_STEAL_PRODUCTS].work_time.max() < stats[OP_STEAL_PRODUCTS].total_time.max());
+	
+	// every thread's samples are merged when reading
+	profiled_factory.startProduction(4, products, 1);
+	profiled_factory.finishProduction(1);
+	ASSERT_TEST(profiled_factory.operationStats()[OP_PRODUCE].total_time.count() == 3);
+	
+	// a thread that exits leaves its samples and frees its buffer
+	OperationProfile profile;
+	profile.record(OP_PRODUCE, 0, 1);
+	for (int i = 0; i < 10; ++i) {
+		pthread_t thread;
+		pthread_create(&thread, NULL, recordProfileSamples, &profile);
+		pthread_join(thread, NULL);
+	}
+	ASSERT_TEST(profile.numThreadBuffers() == 1);
+	ASSERT_TEST(profile.read()[OP_TRY_BUY_ONE].total_time.count() == 10 * (OPERATION_BUFFER_SIZE + 3));
+	ASSERT_TEST(profile.read()[OP_PRODUCE].total_time.count() == 1);
+	return true;
+}
+
+void countContinuation(int result, void* arg) {
+	__atomic_add_fetch(static_cast<int*>(arg), result, __ATOMIC_SEQ_CST);
+}
+
+bool testActorFutures() {
+	Product products[TEST_SYNC_SIZE];
+	for (int i = 0; i < TEST_SYNC_SIZE; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	
+	Factory factory=Factory();
+	
+	// a company that waits for products is not done until they are produced
+	ActorFuture company = factory.launchCompanyBuyer(3, 1);
+	usleep(50000);
+	ASSERT_TEST(company.valid() && !company.poll());
+	int continued = 0;
+	company.then(countContinuation, &continued);
+	factory.launchProduction(3, products).wait();
+	// the product worth 0 was returned
+	ASSERT_TEST(company.wait() == 1);
+	ASSERT_TEST(company.poll() && company.wait() == 1);
+	ASSERT_TEST(__atomic_load_n(&continued, __ATOMIC_SEQ_CST) == 1);
+	
+	// a continuation of a finished actor runs right away
+	ActorFuture copy = company;
+	copy.then(countContinuation, &continued);
+	ASSERT_TEST(continued == 2);
+	ASSERT_TEST(factory.launchSimpleBuyer().wait() == 1);
+	
+	// the id API still works
+	factory.startThief(5, 7);
+	ASSERT_TEST(factory.finishThief(7) == 0);
+	
+	// wait for many actors at once
+	FactoryOptions options;
+	options.pool_threads = 4;
+	Factory pooled_factory(options);
+	ActorGroup group;
+	for (int i = 0; i < TEST_SYNC_SIZE; ++i) {
+		group.add(pooled_factory.launchCompanyBuyer(1, 0));
+	}
+	ASSERT_TEST(group.numPending() > 0);
+	for (int i = 0; i < TEST_SYNC_SIZE; ++i) {
+		group.add(pooled_factory.launchProduction(1, products + i));
+	}
+	int num_finished = 0;
+	while (group.waitAny().valid()) {
+		++num_finished;
+	}
+	ASSERT_TEST(num_finished == 2*TEST_SYNC_SIZE);
+	ASSERT_TEST(group.numPending() == 0 && pooled_factory.listAvailableProducts().empty());
+	return true;
+}
+
+#define CONTROLLERS 4
+#define CONTROLLER_ROUNDS 50
+
+struct ControllerArgs {
+	Factory* factory;
+	int controller;
+	int num_failed;
+};
+
+void* controllerMain(void* arg) {
+	ControllerArgs* args = static_cast<ControllerArgs*>(arg);
+	for (int round = 0; round < CONTROLLER_ROUNDS; ++round) {
+		// every controller reuses its ids in every round, and the ids of the controllers are far apart
+		for (int i = 0; i < TEST_SYNC_SIZE; ++i) {
+			args->factory->startThief(1, args->controller * 100000 + i);
+		}
+		for (int i = 0; i < TEST_SYNC_SIZE; ++i) {
+			if (args->factory->finishThief(args->controller * 100000 + i) != 0) {
+				++args->num_failed;
+			}
+		}
+	}
+	return NULL;
+}
+
+bool testConcurrentLaunch() {
+	Factory factory=Factory();
+	
+	// a few controllers start and finish actors at the same time, nothing is produced so every theft is empty
+	pthread_t controllers[CONTROLLERS];
+	ControllerArgs args[CONTROLLERS];
+	for (int i = 0; i < CONTROLLERS; ++i) {
+		args[i].factory = &factory;
+		args[i].controller = i;
+		args[i].num_failed = 0;
+		pthread_create(&controllers[i], NULL, controllerMain, &args[i]);
+	}
+	for (int i = 0; i < CONTROLLERS; ++i) {
+		pthread_join(controllers[i], NULL);
+		ASSERT_TEST(args[i].num_failed == 0);
+	}
+	
+	// any id can be used, and an id that was never started has no result
+	Product products[2];
+	products[0]=Product(1,1);
+	products[1]=Product(2,2);
+	factory.startProduction(2, products, UINT_MAX);
+	factory.finishProduction(UINT_MAX);
+	factory.startSimpleBuyer(0);
+	ASSERT_TEST(factory.finishSimpleBuyer(0) == 1);
+	ASSERT_TEST(factory.finishSimpleBuyer(12345) == 0);
+	ASSERT_TEST(factory.listAvailableProducts().size() == 1);
+	return true;
+}
+
+bool testTryBuyMany() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	
+	Factory factory=Factory();
+	ASSERT_TEST(factory.tryBuyMany(3).empty());
+	factory.produce(10, products);
+	
+	// the oldest products, in order
+	list<Product> bought = factory.tryBuyMany(3);
+	ASSERT_TEST(bought.size() == 3 && bought.front().getId() == 1 && bought.back().getId() == 3);
+	// less than asked for is fine
+	ASSERT_TEST(factory.tryBuyMany(0).empty());
+	factory.startBulkBuyer(5, 1);
+	ASSERT_TEST(factory.finishBulkBuyer(1) == 5);
+	ASSERT_TEST(factory.tryBuyMany(5).size() == 2);
+	
+	// a closed factory sells nothing
+	factory.produce(2, products);
+	factory.closeFactory();
+	ASSERT_TEST(factory.tryBuyMany(2).empty());
+	factory.openFactory();
+	ASSERT_TEST(factory.launchBulkBuyer(4).wait() == 2);
+	
+	// a sharded inventory gives the local shard's products first, then the other shards'
+	FactoryOptions options;
+	options.inventory_shards = 4;
+	Factory sharded_factory(options);
+	sharded_factory.produce(10, products);
+	ASSERT_TEST(sharded_factory.tryBuyMany(4).size() == 4);
+	ASSERT_TEST(sharded_factory.tryBuyMany(10).size() == 6);
+	return true;
+}
+
+static void countWake(void* arg) {
+	++*static_cast<int*>(arg);
+}
+
+bool testAsyncCalls() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	
+	Factory factory=Factory();
+	int wakes = 0;
+	int num_rejected = 0;
+	list<Product> bought;
+	
+	// a company without enough products registers and is woken by produce
+	AsyncWait company_wait(countWake, &wakes);
+	ASSERT_TEST(!factory.buyProductsAsync(4, NO_MIN_VALUE, &num_rejected, bought, company_wait));
+	ASSERT_TEST(wakes == 0);
+	factory.produce(3, products);
+	ASSERT_TEST(wakes == 0);
+	factory.produce(3, products + 3);
+	ASSERT_TEST(wakes == 1);
+	ASSERT_TEST(factory.buyProductsAsync(4, NO_MIN_VALUE, &num_rejected, bought, company_wait));
+	ASSERT_TEST(bought.size() == 4 && bought.front().getId() == 1);
+	
+	// a thief waits for the factory to open
+	int num_stolen = 0;
+	AsyncWait thief_wait(countWake, &wakes);
+	factory.closeFactory();
+	ASSERT_TEST(!factory.stealProductsAsync(5, 7, &num_stolen, thief_wait));
+	factory.openFactory();
+	ASSERT_TEST(wakes == 2);
+	ASSERT_TEST(factory.stealProductsAsync(5, 7, &num_stolen, thief_wait));
+	ASSERT_TEST(num_stolen == 2);
+	
+	// returns wait for the returning service
+	AsyncWait return_wait(countWake, &wakes);
+	factory.closeReturningService();
+	ASSERT_TEST(!factory.returnProductsAsync(bought, return_wait));
+	factory.openReturningService();
+	ASSERT_TEST(wakes == 3);
+	ASSERT_TEST(factory.returnProductsAsync(bought, return_wait));
+	ASSERT_TEST(factory.listAvailableProducts().size() == 4);
+	return true;
+}
+
+bool testOperationTrace() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	const char* path = "/tmp/os_hw3_test.trace";
+	
+	{
+		FactoryOptions options;
+		options.trace_path = path;
+		Factory factory(options);
+		factory.produce(10, products);
+		ASSERT_TEST(factory.tryBuyOne() == 1);
+		list<Product> bought = factory.buyProducts(3);
+		factory.closeFactory();
+		factory.openFactory();
+		factory.returnProducts(bought, 0);
+		factory.startThief(2, 7);
+		ASSERT_TEST(factory.finishThief(7) == 2);
+	}
+	
+	// every call with its arguments, results and products, in the order of the calling thread
+	vector<TracedCall> calls;
+	ASSERT_TEST(OperationTrace::read(path, calls));
+	remove(path);
+	ASSERT_TEST(calls.size() == 8);
+	vector<TracedCall> main_calls;
+	for (auto& call : calls) {
+		if (call.record.operation != OP_STEAL_PRODUCTS) {
+			main_calls.push_back(call);
+		} else {
+			ASSERT_TEST(call.record.argument == 7 && call.record.result == 2);
+		}
+	}
+	ASSERT_TEST(main_calls.size() == 7);
+	ASSERT_TEST(main_calls[0].record.operation == OP_PRODUCE && main_calls[0].products.size() == 10);
+	ASSERT_TEST(main_calls[0].products[9].getId() == 10 && main_calls[0].products[9].getValue() == 9);
+	ASSERT_TEST(main_calls[1].record.operation == OP_TRY_BUY_ONE && main_calls[1].record.result == 1);
+	ASSERT_TEST(main_calls[2].record.operation == OP_BUY_PRODUCTS && main_calls[2].record.num_products == 3);
+	ASSERT_TEST(main_calls[2].record.argument == NO_MIN_VALUE && main_calls[2].record.result == 3);
+	ASSERT_TEST(main_calls[3].record.operation == OP_CLOSE_FACTORY);
+	ASSERT_TEST(main_calls[4].record.operation == OP_OPEN_FACTORY);
+	ASSERT_TEST(main_calls[5].record.operation == OP_RETURN_PRODUCTS && main_calls[5].products.size() == 3);
+	ASSERT_TEST(main_calls[5].products.front().getId() == 2);
+	ASSERT_TEST(main_calls[6].record.operation == OP_START_THIEF && main_calls[6].record.argument == 7);
+	for (size_t i = 1; i < main_calls.size(); ++i) {
+		ASSERT_TEST(main_calls[i].record.thread == main_calls[0].record.thread);
+		ASSERT_TEST(main_calls[i].record.start_ns >= main_calls[i-1].record.start_ns);
+	}
+	
+	// a theft on the calling thread (a cluster's) is recorded as a started thief too, so a replay steals as well
+	{
+		FactoryOptions options;
+		options.trace_path = path;
+		Factory factory(options);
+		factory.produce(3, products);
+		ASSERT_TEST(factory.stealAsThief(2, 9) == 2);
+	}
+	vector<TracedCall> theft_calls;
+	ASSERT_TEST(OperationTrace::read(path, theft_calls));
+	remove(path);
+	ASSERT_TEST(theft_calls.size() == 3);
+	int num_started = 0;
+	for (auto& call : theft_calls) {
+		if (call.record.operation == OP_START_THIEF) {
+			ASSERT_TEST(call.record.argument == 9 && call.record.num_products == 2);
+			++num_started;
+		}
+	}
+	ASSERT_TEST(num_started == 1);
+	return true;
+}
+
+bool testPersistentStore() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	const char* path = "/tmp/os_hw3_test.store";
+	remove(path);
+	
+	{
+		FactoryOptions options;
+		options.store_path = path;
+		Factory factory(options);
+		factory.produce(10, products);
+		ASSERT_TEST(factory.tryBuyOne() == 1);
+		// products 2 and 3 are worth less than 3, they stay in their place
+		int num_rejected = 0;
+		ASSERT_TEST(factory.buyProducts(3, 3, &num_rejected).size() == 1 && num_rejected == 2);
+		factory.startThief(2, 7);
+		ASSERT_TEST(factory.finishThief(7) == 2);
+		factory.returnProducts(list<Product>(1, Product(11, 5)), 0);
+	}
+	
+	// a restarted factory has the same products and thefts
+	{
+		FactoryOptions options;
+		options.store_path = path;
+		Factory factory(options);
+		list<Product> available = factory.listAvailableProducts();
+		ASSERT_TEST(available.size() == 7);
+		ASSERT_TEST(available.front().getId() == 5 && available.back().getId() == 11);
+		list<pair<Product, int>> stolen = factory.listStolenProducts();
+		ASSERT_TEST(stolen.size() == 2 && stolen.front().first.getId() == 2 && stolen.back().second == 7);
+		
+		// grows past the first capacity
+		for (int i = 0; i < 1000; ++i) {
+			factory.produce(10, products);
+		}
+		ASSERT_TEST(factory.buyProducts(10000).size() == 10000);
+	}
+	{
+		FactoryOptions options;
+		options.store_path = path;
+		Factory factory(options);
+		ASSERT_TEST(factory.listAvailableProducts().size() == 7);
+		ASSERT_TEST(factory.listStolenProducts().size() == 2);
+	}
+	remove(path);
+	
+	// a process that is killed in the middle of buying and stealing leaves whole operations behind
+	pid_t child = fork();
+	if (child == 0) {
+		FactoryOptions options;
+		options.store_path = path;
+		Factory factory(options);
+		for (int id = 1; ; id += 10) {
+			for (int i = 0; i < 10; ++i) {
+				products[i]=Product(id+i,i);
+			}
+			factory.produce(10, products);
+			int num_rejected = 0;
+			factory.buyProducts(4, 5, &num_rejected);
+			factory.startThief(3, id);
+			factory.finishThief(id);
+		}
+	}
+	usleep(200000);
+	kill(child, SIGKILL);
+	waitpid(child, NULL, 0);
+	{
+		FactoryOptions options;
+		options.store_path = path;
+		Factory factory(options);
+		// every product is either available or stolen, once, and the available ones are still in order
+		list<Product> available = factory.listAvailableProducts();
+		list<pair<Product, int>> stolen = factory.listStolenProducts();
+		ASSERT_TEST(!stolen.empty());
+		set<int> ids;
+		int last_id = 0;
+		for (auto& product : available) {
+			ASSERT_TEST(product.getId() > last_id && ids.insert(product.getId()).second);
+			last_id = product.getId();
+		}
+		for (auto& theft : stolen) {
+			ASSERT_TEST(ids.insert(theft.first.getId()).second);
+		}
+	}
+	remove(path);
+	return true;
+}
+
 bool testSync() {
 	Factory factory=Factory();
 	Product allProducts[TEST_SYNC_SIZE][TEST_SYNC_SIZE];
@@ -369,6 +1189,466 @@ bool testSync() {
 	return true;
 }
 
+static void countLogWake(void* arg) {
+	__atomic_add_fetch(static_cast<int*>(arg), 1, __ATOMIC_SEQ_CST);
+}
+
+bool testWriteAheadLog() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	const char* path = "/tmp/os_hw3_test.wal";
+	remove(path);
+	
+	{
+		FactoryOptions options;
+		options.wal_path = path;
+		options.wal_wait_durable = true;
+		Factory factory(options);
+		factory.produce(10, products);
+		ASSERT_TEST(factory.tryBuyOne() == 1);
+		ASSERT_TEST(factory.buyProducts(3).size() == 3);
+		factory.startThief(2, 7);
+		ASSERT_TEST(factory.finishThief(7) == 2);
+		factory.returnProducts(list<Product>(1, Product(11, 5)), 0);
+		ASSERT_TEST(factory.tryBuyMany(2).size() == 2);
+		// nothing to buy, nothing is logged
+		factory.closeFactory();
+		ASSERT_TEST(factory.tryBuyOne() == -1);
+	}
+	
+	// the records are in the order of the operations
+	vector<WalEntry> entries;
+	ASSERT_TEST(WriteAheadLog::read(path, entries));
+	ASSERT_TEST(entries.size() == 5);
+	ASSERT_TEST(entries[0].type == WAL_SALE && entries[0].products.size() == 1 && entries[0].products[0].getId() == 1);
+	ASSERT_TEST(entries[1].type == WAL_SALE && entries[1].num_products == 3 && entries[1].products[2].getId() == 4);
+	ASSERT_TEST(entries[2].type == WAL_THEFT && entries[2].fake_id == 7 && entries[2].products[0].getId() == 5);
+	ASSERT_TEST(entries[3].type == WAL_RETURN && entries[3].products[0].getId() == 11 && entries[3].products[0].getValue() == 5);
+	ASSERT_TEST(entries[4].type == WAL_SALE && entries[4].products[0].getId() == 7 && entries[4].products[1].getId() == 8);
+	
+	// a reopened log appends after the old records
+	{
+		FactoryOptions options;
+		options.wal_path = path;
+		Factory factory(options);
+		factory.produce(10, products);
+		ASSERT_TEST(factory.tryBuyOne() == 1);
+		factory.waitDurable();
+	}
+	entries.clear();
+	ASSERT_TEST(WriteAheadLog::read(path, entries));
+	ASSERT_TEST(entries.size() == 6 && entries[5].type == WAL_SALE && entries[5].products[0].getId() == 1);
+	remove(path);
+	
+	// tryReserve fails without reserving anything when the buffer is full, until the flusher made room
+	size_t half = WAL_BUFFER_SIZE / 2 / sizeof(WalProduct) - 2;
+	{
+		WriteAheadLog* wal = WriteAheadLog::open(path, false);
+		ASSERT_TEST(wal != NULL);
+		list<Product> half_products(half, Product(1, 1));
+		WriteAheadLog::Reservation first;
+		WriteAheadLog::Reservation second;
+		WriteAheadLog::Reservation third;
+		// the first record is not written yet, so nothing after it can be flushed
+		ASSERT_TEST(wal->tryReserve(1, first));
+		ASSERT_TEST(wal->tryReserve(half, second) && second.num_products == static_cast<int>(half));
+		unsigned long long reserved = wal->reservedPosition();
+		ASSERT_TEST(!wal->tryReserve(half, third));
+		ASSERT_TEST(wal->reservedPosition() == reserved);
+		// a caller that must not wait leaves a wake, the flusher calls it once it wrote the first record
+		int log_wakes = 0;
+		wal->wakeOnRoom(half, countLogWake, &log_wakes);
+		usleep(50000);
+		ASSERT_TEST(__atomic_load_n(&log_wakes, __ATOMIC_SEQ_CST) == 0);
+		wal->write(first, WAL_SALE, 0, products[0]);
+		for (int i = 0; i < 5000 && __atomic_load_n(&log_wakes, __ATOMIC_SEQ_CST) == 0; ++i) {
+			usleep(1000);
+		}
+		ASSERT_TEST(__atomic_load_n(&log_wakes, __ATOMIC_SEQ_CST) == 1);
+		// with room in the buffer the wake is called at once
+		wal->wakeOnRoom(half, countLogWake, &log_wakes);
+		ASSERT_TEST(__atomic_load_n(&log_wakes, __ATOMIC_SEQ_CST) == 2);
+		wal->waitForRoom(half);
+		ASSERT_TEST(wal->tryReserve(half, third) && third.position == reserved);
+		wal->write(second, WAL_RETURN, 0, half_products);
+		wal->write(third, WAL_SALE, 0, half_products);
+		delete wal;
+	}
+	entries.clear();
+	ASSERT_TEST(WriteAheadLog::read(path, entries));
+	ASSERT_TEST(entries.size() == 3 && entries[0].products[0].getId() == 1);
+	ASSERT_TEST(entries[1].type == WAL_RETURN && entries[1].products.size() == half);
+	ASSERT_TEST(entries[2].type == WAL_SALE && entries[2].products.size() == half);
+	remove(path);
+	return true;
+}
+
+struct PooledTestObject : public PooledObject<PooledTestObject> {
+	long long values[3];
+};
+
+void* freePooledObjects(void* arg) {
+	vector<PooledTestObject*>* objects = static_cast<vector<PooledTestObject*>*>(arg);
+	for (auto object : *objects) {
+		delete object;
+	}
+	return NULL;
+}
+
+bool testObjectPools() {
+	// objects freed by another thread are reused after it exits
+	vector<PooledTestObject*> objects;
+	for (int i = 0; i < 100; ++i) {
+		objects.push_back(new PooledTestObject());
+	}
+	set<PooledTestObject*> addresses(objects.begin(), objects.end());
+	pthread_t thread;
+	pthread_create(&thread, NULL, freePooledObjects, &objects);
+	pthread_join(thread, NULL);
+	PoolCounters before = PoolStats::read();
+	int num_reused = 0;
+	for (int i = 0; i < 100; ++i) {
+		objects[i] = new PooledTestObject();
+		num_reused += addresses.count(objects[i]);
+	}
+	ASSERT_TEST(num_reused == 100 && PoolStats::read().heap_allocations == before.heap_allocations);
+	freePooledObjects(&objects);
+	
+	// once warm, the factory's operations and actors stop allocating from the heap
+	Product products[10];
+	Factory factory;
+	vector<pair<Product, int>> stolen;
+	size_t cursor = 0;
+	for (int round = 0; round < 2; ++round) {
+		before = PoolStats::read();
+		for (int i = 0; i < 200; ++i) {
+			for (int j = 0; j < 10; ++j) {
+				products[j]=Product(i*10+j,j);
+			}
+			factory.produce(10, products);
+			ASSERT_TEST(factory.buyProducts(4).size() == 4);
+			ASSERT_TEST(factory.tryBuyOne() != -1);
+			factory.startSimpleBuyer(1);
+			factory.startThief(2, 2);
+			ASSERT_TEST(factory.finishThief(2) == 2);
+			factory.finishSimpleBuyer(1);
+			cursor = factory.copyStolenProductsSince(cursor, stolen);
+			ASSERT_TEST(stolen.size() == 2);
+		}
+	}
+	ASSERT_TEST(PoolStats::read().heap_allocations - before.heap_allocations < 10);
+	return true;
+}
+
+bool testFifoCompanyOrders() {
+	FactoryOptions options;
+	options.fifo_company_orders = true;
+	Factory factory(options);
+	Product products[5];
+	for (int i = 0; i < 5; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	
+	// the big order arrived first, so the small one does not buy before it
+	factory.startCompanyBuyer(5, 0, 1);
+	usleep(100000);
+	factory.startCompanyBuyer(1, 0, 2);
+	usleep(100000);
+	factory.produce(1, products);
+	usleep(100000);
+	ASSERT_TEST(factory.listAvailableProducts().size() == 1);
+	factory.produce(4, products + 1);
+	ASSERT_TEST(factory.finishCompanyBuyer(1) == 0);
+	ASSERT_TEST(factory.listAvailableProducts().size() == 0);
+	
+	// then the small order is next in line
+	factory.produce(1, products);
+	ASSERT_TEST(factory.finishCompanyBuyer(2) == 0);
+	ASSERT_TEST(factory.listAvailableProducts().size() == 0);
+	
+	// a company that arrives when nobody waits buys at once
+	factory.produce(2, products);
+	ASSERT_TEST(factory.buyProducts(2).size() == 2);
+	return true;
+}
+
+bool testCompanyHandoff() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	FactoryOptions handoff_options;
+	handoff_options.company_handoff = true;
+	Factory factory(handoff_options);
+	factory.startCompanyBuyer(3, 0, 1);
+	factory.startCompanyBuyer(5, 0, 2);
+	usleep(100000);
+	
+	// the producer hands the products to the companies they satisfy, oldest products first
+	factory.produce(4, products);
+	ASSERT_TEST(factory.finishCompanyBuyer(1) == 0);
+	ASSERT_TEST(factory.numCompanyHandoffs() == 1);
+	list<Product> available = factory.listAvailableProducts();
+	ASSERT_TEST(available.size() == 1 && available.front().getId() == 4);
+	factory.produce(4, products + 4);
+	ASSERT_TEST(factory.finishCompanyBuyer(2) == 0);
+	ASSERT_TEST(factory.numCompanyHandoffs() == 2 && factory.listAvailableProducts().empty());
+	
+	// companies that wait for the thieves to leave are handed their products by the last thief
+	factory.produce(2, products + 8);
+	factory.startThief(2, 3);
+	factory.startCompanyBuyer(1, 0, 4);
+	ASSERT_TEST(factory.finishThief(3) == 2);
+	factory.produce(1, products);
+	ASSERT_TEST(factory.finishCompanyBuyer(4) == 0);
+	ASSERT_TEST(factory.listAvailableProducts().empty());
+	
+	// without handoff (the default) the companies are only woken, and take the products themselves
+	Factory looking_factory;
+	looking_factory.startCompanyBuyer(3, 0, 1);
+	usleep(100000);
+	looking_factory.produce(3, products);
+	ASSERT_TEST(looking_factory.finishCompanyBuyer(1) == 0);
+	ASSERT_TEST(looking_factory.numCompanyHandoffs() == 0 && looking_factory.listAvailableProducts().empty());
+	return true;
+}
+
+static size_t routeToArg(FactoryCluster& /*cluster*/, FactoryOperation /*operation*/, int /*num_products*/, void* arg) {
+	return static_cast<std::atomic<size_t>*>(arg)->load();
+}
+
+static void* clusterCompany(void* arg) {
+	FactoryCluster* cluster = static_cast<FactoryCluster*>(arg);
+	return reinterpret_cast<void*>(cluster->buyProducts(4).size());
+}
+
+struct SplitOrder {
+	FactoryCluster* cluster;
+	std::atomic<int>* num_done;
+	int num_products;
+};
+
+static void* clusterSplitCompany(void* arg) {
+	SplitOrder* order = static_cast<SplitOrder*>(arg);
+	size_t num_bought = order->cluster->buyProducts(order->num_products).size();
+	order->num_done->fetch_add(1);
+	return reinterpret_cast<void*>(num_bought);
+}
+
+bool testFactoryCluster() {
+	Product products[10];
+	for (int i = 0; i < 10; ++i) {
+		products[i]=Product(i+1,i);
+	}
+	FactoryCluster cluster(2, FactoryOptions());
+	ASSERT_TEST(cluster.numInstances() == 2);
+	
+	// round robin spreads the batches over the instances, a batch stays together
+	cluster.produce(3, products);
+	cluster.produce(3, products + 3);
+	ASSERT_TEST(cluster.stock(0) == 3 && cluster.stock(1) == 3);
+	ASSERT_TEST(cluster.instance(1).listAvailableProducts().front().getId() == 4);
+	ASSERT_TEST(cluster.numAvailableProducts() == 6 && cluster.listAvailableProducts().size() == 6);
+	
+	// an order bigger than any instance's stock is filled across the instances
+	list<Product> bought = cluster.buyProducts(5);
+	ASSERT_TEST(bought.size() == 5 && cluster.numAvailableProducts() == 1);
+	
+	// simple buyers and thieves go on to the next instance when theirs is empty
+	ASSERT_TEST(cluster.tryBuyOne() != -1 && cluster.tryBuyOne() == -1);
+	cluster.produce(2, products + 6);
+	ASSERT_TEST(cluster.stealProducts(4, 7) == 2);
+	list<pair<Product,int>> thefts = cluster.listStolenProducts();
+	ASSERT_TEST(thefts.size() == 2 && thefts.front().second == 7);
+	cluster.returnProducts(bought, 1);
+	ASSERT_TEST(cluster.numAvailableProducts() == 5);
+	
+	// a custom policy, products go to the instance the companies wait at whatever it says
+	std::atomic<size_t> target(0);
+	FactoryCluster routed(3, FactoryOptions(), routeToArg, &target);
+	pthread_t company;
+	pthread_create(&company, NULL, clusterCompany, &routed);
+	usleep(100000);
+	target = 2;
+	routed.produce(4, products);
+	void* num_bought;
+	pthread_join(company, &num_bought);
+	ASSERT_TEST(reinterpret_cast<size_t>(num_bought) == 4 && routed.numAvailableProducts() == 0);
+	routed.produce(4, products + 4);
+	ASSERT_TEST(routed.stock(2) == 4);
+	
+	// two split orders that wait, and then exactly the stock for one: it is served, and the other waited
+	// holding nothing
+	FactoryCluster split(2, FactoryOptions());
+	split.produce(5, products);
+	std::atomic<int> num_done(0);
+	SplitOrder order = {&split, &num_done, 10};
+	pthread_t split_companies[2];
+	for (int i = 0; i < 2; ++i) {
+		pthread_create(&split_companies[i], NULL, clusterSplitCompany, &order);
+		usleep(100000);
+	}
+	ASSERT_TEST(num_done.load() == 0);
+	split.produce(5, products + 5);
+	usleep(200000);
+	ASSERT_TEST(num_done.load() == 1 && split.numAvailableProducts() == 0);
+	split.produce(5, products);
+	split.produce(5, products + 5);
+	for (int i = 0; i < 2; ++i) {
+		pthread_join(split_companies[i], &num_bought);
+		ASSERT_TEST(reinterpret_cast<size_t>(num_bought) == 10);
+	}
+	ASSERT_TEST(split.numAvailableProducts() == 0);
+	
+	// a split order waits (without spinning) for stock it can't buy, here in a closed instance. it takes
+	// nothing until it can take everything, so it never waits for a closed returning service
+	target = 0;
+	FactoryCluster blocked(2, FactoryOptions(), routeToArg, &target);
+	blocked.instance(0).produce(3, products);
+	blocked.instance(1).produce(3, products + 3);
+	blocked.instance(1).closeFactory();
+	blocked.instance(0).closeReturningService();
+	std::atomic<int> num_blocked_done(0);
+	SplitOrder blocked_order = {&blocked, &num_blocked_done, 6};
+	struct timespec cpu_start, cpu_end;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
+	pthread_create(&company, NULL, clusterSplitCompany, &blocked_order);
+	usleep(200000);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+	long long cpu_ns = (cpu_end.tv_sec - cpu_start.tv_sec) * 1000000000LL + (cpu_end.tv_nsec - cpu_start.tv_nsec);
+	ASSERT_TEST(num_blocked_done.load() == 0 && cpu_ns < 50000000);
+	ASSERT_TEST(blocked.stock(0) == 3 && blocked.instance(0).listAvailableProducts().front().getId() == 1);
+	blocked.instance(1).openFactory();
+	pthread_join(company, &num_bought);
+	ASSERT_TEST(reinterpret_cast<size_t>(num_bought) == 6 && blocked.numAvailableProducts() == 0);
+	return true;
+}
+
+bool testProductColumns() {
+	// every kernel the cpu has gives the scalar results, on the vector blocks and on the tails after them
+	int values[37] = {5, -3, 7, 0, 2147483647, -2147483647 - 1, 5, 4, 6, 9, 1, 5, 3, 8, 2, 7, 0, 5, 5, 6,
+	                  -1, 10, 4, 5, 6, 2, 3, 9, 5, 5, 1, 0, 7, 8, 4, 5, 6};
+	int min_values[4] = {5, -2147483647 - 1, 2147483647, 0};
+	unsigned int expected[37];
+	unsigned int indices[37];
+	for (int min_value : min_values) {
+		for (size_t num_values = 0; num_values <= 37; ++num_values) {
+			size_t num_expected = 0;
+			for (size_t i = 0; i < num_values; ++i) {
+				if (values[i] >= min_value) {
+					expected[num_expected++] = i;
+				}
+			}
+			for (int kernel = 0; kernel < NUM_FILTER_KERNELS; ++kernel) {
+				FilterKernel filter_kernel = static_cast<FilterKernel>(kernel);
+				ASSERT_TEST(countAtLeast(values, num_values, min_value, filter_kernel) == num_expected);
+				ASSERT_TEST(selectAtLeast(values, num_values, min_value, indices, filter_kernel) == num_expected);
+				ASSERT_TEST(equal(expected, expected + num_expected, indices));
+				ASSERT_TEST(selectBelow(values, num_values, min_value, indices, filter_kernel) ==
+				            num_values - num_expected);
+			}
+		}
+	}
+	ASSERT_TEST(filterKernelSupported(FILTER_SCALAR) && filterKernelSupported(bestFilterKernel()));
+	
+	// the columns filter like remove_if on a list, over more than one block
+	Factory factory;
+	Product products[1000];
+	for (int i = 0; i < 10; ++i) {
+		for (int j = 0; j < 1000; ++j) {
+			products[j] = Product(i * 1000 + j, (i * 7 + j * 13) % 10);
+		}
+		factory.produce(1000, products);
+	}
+	ProductColumns columns;
+	columns.pushBack(factory.snapshotAvailableProducts());
+	list<Product> available = factory.listAvailableProducts();
+	ASSERT_TEST(columns.size() == 10000 && columns.at(1234).getId() == 1234);
+	ProductColumns selected;
+	ASSERT_TEST(columns.selectAtLeast(6, selected) == columns.countAtLeast(6));
+	ASSERT_TEST(selected.countAtLeast(6) == selected.size() && selected.size() == 4000);
+	available.remove_if([](const Product& product) { return product.getValue() >= 6; });
+	ASSERT_TEST(columns.removeAtLeast(6) == 4000);
+	list<Product> remaining = columns.toList();
+	ASSERT_TEST(remaining.size() == available.size());
+	ASSERT_TEST(equal(remaining.begin(), remaining.end(), available.begin(), [](const Product& a, const Product& b) {
+		return a.getId() == b.getId() && a.getValue() == b.getValue();
+	}));
+	ASSERT_TEST(columns.removeAtLeast(-2147483647 - 1, FILTER_SCALAR) == 6000 && columns.empty());
+	return true;
+}
+
+bool testInventoryAnalytics() {
+	// the sharded factory's analytics run on its pool
+	FactoryOptions sharded_options;
+	sharded_options.inventory_shards = 4;
+	sharded_options.pool_threads = 2;
+	Factory plain_factory;
+	Factory sharded_factory(sharded_options);
+	Factory* factories[2] = {&plain_factory, &sharded_factory};
+	
+	// an empty inventory
+	ValueSummary empty = plain_factory.summarizeAvailableProducts(1);
+	ASSERT_TEST(empty.count == 0 && empty.sum == 0 && empty.min == 0 && empty.max == 0);
+	ASSERT_TEST(plain_factory.countAvailableProductsInRange(0, 10, 2) == 0);
+	
+	// several chunks, extreme values, and a first chunk that starts in the middle
+	ThreadPool pool(1);
+	Product products[1000];
+	for (int i = 0; i < 1000; ++i) {
+		products[i] = Product(i, (i * 37) % 201 - 100);
+	}
+	products[500] = Product(500, 2147483647);
+	products[501] = Product(501, -2147483647 - 1);
+	for (Factory* factory : factories) {
+		factory->produce(1000, products);
+		factory->produce(999, products);
+		ASSERT_TEST(factory->tryBuyMany(3).size() == 3);
+		
+		list<Product> available = factory->listAvailableProducts();
+		long long sum = 0;
+		int min = 2147483647, max = -2147483647 - 1;
+		size_t in_range = 0, below = 0, above = 0;
+		size_t buckets[4] = {0, 0, 0, 0};
+		for (const Product& product : available) {
+			int value = product.getValue();
+			sum += value;
+			min = std::min(min, value);
+			max = std::max(max, value);
+			in_range += (value >= -10 && value <= 25);
+			if (value < -50) {
+				++below;
+			} else if (value >= 50) {
+				++above;
+			} else {
+				++buckets[(value + 50) / 25];
+			}
+		}
+		
+		InventorySnapshot snapshot = factory->snapshotAvailableProducts();
+		for (int kernel = 0; kernel < NUM_FILTER_KERNELS; ++kernel) {
+			for (int num_threads = 1; num_threads <= 3; ++num_threads) {
+				FilterKernel filter_kernel = static_cast<FilterKernel>(kernel);
+				ValueSummary summary = summarizeValues(snapshot, num_threads, filter_kernel);
+				ASSERT_TEST(summary.count == available.size() && summary.sum == sum);
+				ASSERT_TEST(summary.min == min && summary.max == max);
+				ASSERT_TEST(countValuesInRange(snapshot, -10, 25, num_threads, filter_kernel) == in_range);
+				ValueSummary pooled = summarizeValues(snapshot, num_threads, filter_kernel, &pool);
+				ASSERT_TEST(pooled.sum == sum && pooled.min == min && pooled.max == max);
+				ASSERT_TEST(countValuesInRange(snapshot, -10, 25, num_threads, filter_kernel, &pool) == in_range);
+			}
+		}
+		ValueHistogram histogram = factory->histogramAvailableProducts(-50, 25, 4, 2);
+		ASSERT_TEST(histogram.below == below && histogram.above == above);
+		ASSERT_TEST(equal(histogram.counts.begin(), histogram.counts.end(), buckets));
+		ASSERT_TEST(factory->summarizeAvailableProducts(2).sum == sum);
+		ASSERT_TEST(factory->countAvailableProductsInRange(-2147483647 - 1, 2147483647, 1) == available.size());
+	}
+	return true;
+}
+
 bool testStressTestSync() {
 	for(int i=0; i<STRESS_TEST_SIZE; i++){
 		if(!testSync()){
@@ -393,6 +1673,31 @@ int main (){
 	RUN_TEST(testOpenAndClose);
 	RUN_TEST(testCloseReturning);
 	RUN_TEST(testReusingIds);
+	RUN_TEST(testManyChunks);
+	RUN_TEST(testThreadPool);
+	RUN_TEST(testLockFreeBuy);
+	RUN_TEST(testProduceBatch);
+	RUN_TEST(testShardedInventory);
+	RUN_TEST(testFilteredPurchase);
+	RUN_TEST(testSnapshot);
+	RUN_TEST(testTheftLog);
+	RUN_TEST(testTargetedWakeups);
+	RUN_TEST(testLatencyHistogram);
+	RUN_TEST(testLockStats);
+	RUN_TEST(testOperationStats);
+	RUN_TEST(testActorFutures);
+	RUN_TEST(testConcurrentLaunch);
+	RUN_TEST(testTryBuyMany);
+	RUN_TEST(testAsyncCalls);
+	RUN_TEST(testOperationTrace);
+	RUN_TEST(testPersistentStore);
+	RUN_TEST(testWriteAheadLog);
+	RUN_TEST(testObjectPools);
+	RUN_TEST(testFifoCompanyOrders);
+	RUN_TEST(testCompanyHandoff);
+	RUN_TEST(testFactoryCluster);
+	RUN_TEST(testProductColumns);
+	RUN_TEST(testInventoryAnalytics);
 	RUN_TEST(testStressTestSync); // if it freezes, that's probably mean you have a deadlock or someting
 	std::cout << "Fin :)\n";
 	return 0;